@@ -9,8 +9,11 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <map>
 #include <memory>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include <common/cbasetypes.hpp>
 #include <common/cli.hpp>
@@ -173,10 +176,16 @@ void char_set_char_offline(uint32 char_id, uint32 account_id){
 		if (cp)
 			char_get_chardb().erase( char_id );
 
+		char_memitemdata_release(TABLE_INVENTORY, char_id);
+		char_memitemdata_release(TABLE_CART, char_id);
+
 		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `online`='0' WHERE `char_id`='%d' LIMIT 1", schema_config.char_db, char_id) )
 			Sql_ShowDebug(sql_handle);
 	}
 
+	// Storages are saved before the character goes offline
+	char_memitemdata_release(TABLE_STORAGE, account_id);
+
 	std::shared_ptr<struct online_char_data> character = util::umap_find( char_get_onlinedb(), account_id );
 
 	// We don't free yet to avoid aCalloc/aFree spamming during char change. [Skotlex]
@@ -529,77 +538,101 @@ int32 char_mmo_char_tosql(uint32 char_id, struct mmo_charstatus* p){
 	return 0;
 }
 
-/// Saves an array of 'item' entries into the specified table.
-int32 char_memitemdata_to_sql(const struct item items[], int32 max, int32 id, enum storage_type tableswitch, uint8 stor_id) {
-	StringBuf buf;
-	SqlStmt stmt{ *sql_handle };
-	int32 i, j, offset = 0, errors = 0;
-	const char *tablename, *selectoption, *printname;
-	struct item item; // temp storage variable
-	bool* flag; // bit array for inventory matching
-	bool found;
+/// Key of an item shadow: owner id, table and storage id
+typedef std::tuple<int32, enum storage_type, uint8> t_item_shadow_key;
 
+/// In-memory copy of the item rows of an owner as they are stored in the database.
+/// Saves are compared against it instead of selecting the rows again.
+/// The copy is replaced whenever the items are loaded, but changes made to the tables
+/// by anything else than the char-server while the owner is loaded are not noticed
+/// and can be overwritten by the next save.
+static std::map<t_item_shadow_key, std::vector<struct item>> item_shadows;
+
+/**
+ * Gets the table information of an item table.
+ * @param tableswitch: Table type
+ * @param stor_id: Storage ID
+ * @param tablename: Name of the table
+ * @param selectoption: Owner column of the table
+ * @param printname: Name for messages
+ * @return True on success, false if the table is invalid
+ */
+static bool char_memitemdata_table( enum storage_type tableswitch, uint8 stor_id, const char** tablename, const char** selectoption, const char** printname ){
 	switch (tableswitch) {
 		case TABLE_INVENTORY:
-			printname = "Inventory";
-			tablename = schema_config.inventory_db;
-			selectoption = "char_id";
+			*printname = "Inventory";
+			*tablename = schema_config.inventory_db;
+			*selectoption = "char_id";
 			break;
 		case TABLE_CART:
-			printname = "Cart";
-			tablename = schema_config.cart_db;
-			selectoption = "char_id";
+			*printname = "Cart";
+			*tablename = schema_config.cart_db;
+			*selectoption = "char_id";
 			break;
 		case TABLE_STORAGE: {
 			std::shared_ptr<s_storage_table> storage_info = interServerDb.find( stor_id );
 
 			if( storage_info == nullptr ){
-				ShowError( "Invalid storage with id %d\n", id );
-				return 1;
+				ShowError( "Invalid storage with id %d\n", stor_id );
+				return false;
 			}
 
-			printname = storage_info->name;
-			tablename = storage_info->table;
-			selectoption = "account_id";
+			*printname = storage_info->name;
+			*tablename = storage_info->table;
+			*selectoption = "account_id";
 			} break;
 		case TABLE_GUILD_STORAGE:
-			printname = "Guild Storage";
-			tablename = schema_config.guild_storage_db;
-			selectoption = "guild_id";
+			*printname = "Guild Storage";
+			*tablename = schema_config.guild_storage_db;
+			*selectoption = "guild_id";
 			break;
 		default:
 			ShowError("Invalid table name!\n");
-			return 1;
+			return false;
 	}
 
-	// The following code compares inventory with current database values
-	// and performs modification/deletion/insertion only on relevant rows.
-	// This approach is more complicated than a trivial delete&insert, but
-	// it significantly reduces cpu load on the database server.
+	return true;
+}
+
+/**
+ * Loads all item rows of an owner.
+ * @param rows: Loaded rows
+ * @param id: Owner ID
+ * @param tableswitch: Table type
+ * @param tablename: Name of the table
+ * @param selectoption: Owner column of the table
+ * @return True on success
+ */
+static bool char_memitemdata_select( std::vector<struct item>& rows, int32 id, enum storage_type tableswitch, const char* tablename, const char* selectoption ){
+	StringBuf buf;
+	SqlStmt stmt{ *sql_handle };
+	int32 i, j, offset = 0;
+	struct item item;
 
 	StringBuf_Init(&buf);
-	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`, `enchantgrade`");
+	StringBuf_AppendStr(&buf, "SELECT `id`,`nameid`,`amount`,`equip`,`identify`,`refine`,`attribute`,`expire_time`,`bound`,`unique_id`,`enchantgrade`");
 	if (tableswitch == TABLE_INVENTORY) {
 		StringBuf_Printf(&buf, ", `favorite`, `equip_switch`");
 		offset = 2;
 	}
-
-	for( i = 0; i < MAX_SLOTS; ++i )
-		StringBuf_Printf(&buf, ", `card%d`", i);
-	for( i = 0; i < MAX_ITEM_RDM_OPT; ++i ) {
-		StringBuf_Printf(&buf, ", `option_id%d`", i);
-		StringBuf_Printf(&buf, ", `option_val%d`", i);
-		StringBuf_Printf(&buf, ", `option_parm%d`", i);
+	for( j = 0; j < MAX_SLOTS; ++j )
+		StringBuf_Printf(&buf, ",`card%d`", j);
+	for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
+		StringBuf_Printf(&buf, ", `option_id%d`", j);
+		StringBuf_Printf(&buf, ", `option_val%d`", j);
+		StringBuf_Printf(&buf, ", `option_parm%d`", j);
 	}
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `%s`='%d'", tablename, selectoption, id);
+	StringBuf_Printf(&buf, " FROM `%s` WHERE `%s`=? ORDER BY `id`", tablename, selectoption );
 
-	if( SQL_ERROR == stmt.PrepareStr( StringBuf_Value(&buf))
-	||  SQL_ERROR == stmt.Execute() )
+	if( SQL_ERROR == stmt.PrepareStr(StringBuf_Value(&buf))
+		||	SQL_ERROR == stmt.BindParam(0, SQLDT_INT32, &id, 0)
+		||	SQL_ERROR == stmt.Execute() )
 	{
 		SqlStmt_ShowDebug(stmt);
-		return 1;
+		return false;
 	}
 
+	memset(&item, 0, sizeof(item));
 	stmt.BindColumn(0, SQLDT_INT32, &item.id);
 	stmt.BindColumn(1, SQLDT_UINT32, &item.nameid);
 	stmt.BindColumn(2, SQLDT_INT16, &item.amount);
@@ -608,8 +641,8 @@ int32 char_memitemdata_to_sql(const struct item items[], int32 max, int32 id, en
 	stmt.BindColumn(5, SQLDT_CHAR, &item.refine);
 	stmt.BindColumn(6, SQLDT_CHAR, &item.attribute);
 	stmt.BindColumn(7, SQLDT_UINT32, &item.expire_time);
-	stmt.BindColumn(8, SQLDT_UINT32, &item.bound);
-	stmt.BindColumn(9, SQLDT_UINT64, &item.unique_id);
+	stmt.BindColumn(8, SQLDT_CHAR, &item.bound);
+	stmt.BindColumn(9, SQLDT_ULONGLONG, &item.unique_id);
 	stmt.BindColumn(10, SQLDT_INT8, &item.enchantgrade);
 	if (tableswitch == TABLE_INVENTORY){
 		stmt.BindColumn(11, SQLDT_CHAR, &item.favorite);
@@ -622,17 +655,89 @@ int32 char_memitemdata_to_sql(const struct item items[], int32 max, int32 id, en
 		stmt.BindColumn(12+offset+MAX_SLOTS+i*3, SQLDT_INT16, &item.option[i].value);
 		stmt.BindColumn(13+offset+MAX_SLOTS+i*3, SQLDT_CHAR, &item.option[i].param);
 	}
-	// bit array indicating which inventory items have already been matched
-	flag = (bool*) aCalloc(max, sizeof(bool));
+
+	rows.clear();
+	rows.reserve( static_cast<size_t>( stmt.NumRows() ) );
 
 	while( SQL_SUCCESS == stmt.NextRow() )
+		rows.push_back( item );
+
+	return true;
+}
+
+/// Appends the column list of an item table.
+static void char_memitemdata_columns( StringBuf* buf, enum storage_type tableswitch, const char* selectoption ){
+	int32 j;
+
+	StringBuf_Printf(buf, "`%s`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`, `enchantgrade`", selectoption);
+	if (tableswitch == TABLE_INVENTORY)
+		StringBuf_Printf(buf, ", `favorite`, `equip_switch`");
+	for( j = 0; j < MAX_SLOTS; ++j )
+		StringBuf_Printf(buf, ", `card%d`", j);
+	for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
+		StringBuf_Printf(buf, ", `option_id%d`", j);
+		StringBuf_Printf(buf, ", `option_val%d`", j);
+		StringBuf_Printf(buf, ", `option_parm%d`", j);
+	}
+}
+
+/// Appends the values of an item, matching char_memitemdata_columns.
+static void char_memitemdata_values( StringBuf* buf, const struct item& item, int32 id, enum storage_type tableswitch ){
+	int32 j;
+
+	StringBuf_Printf(buf, "'%d', '%u', '%d', '%u', '%d', '%d', '%d', '%u', '%d', '%" PRIu64 "', '%d'",
+		id, item.nameid, item.amount, item.equip, item.identify, item.refine, item.attribute, item.expire_time, item.bound, item.unique_id, item.enchantgrade);
+	if (tableswitch == TABLE_INVENTORY)
+		StringBuf_Printf(buf, ", '%d', '%u'", item.favorite, item.equipSwitch);
+	for( j = 0; j < MAX_SLOTS; ++j )
+		StringBuf_Printf(buf, ", '%u'", item.card[j]);
+	for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
+		StringBuf_Printf(buf, ", '%d'", item.option[j].id);
+		StringBuf_Printf(buf, ", '%d'", item.option[j].value);
+		StringBuf_Printf(buf, ", '%d'", item.option[j].param);
+	}
+}
+
+/// Saves an array of 'item' entries into the specified table.
+int32 char_memitemdata_to_sql(const struct item items[], int32 max, int32 id, enum storage_type tableswitch, uint8 stor_id) {
+	StringBuf buf;
+	int32 i, j, errors = 0;
+	const char *tablename, *selectoption, *printname;
+	std::vector<int32> deleted, updated, inserted;
+
+	if( !char_memitemdata_table( tableswitch, stor_id, &tablename, &selectoption, &printname ) )
+		return 1;
+
+	// The following code compares the items with the rows in the database
+	// and performs modification/deletion/insertion only on relevant rows.
+	// The rows are kept in memory since they were loaded or last saved,
+	// only if they are unknown the database has to be queried.
+	t_item_shadow_key key = std::make_tuple( id, tableswitch, stor_id );
+	auto it = item_shadows.find( key );
+
+	if( it == item_shadows.end() ){
+		std::vector<struct item> rows;
+
+		if( !char_memitemdata_select( rows, id, tableswitch, tablename, selectoption ) )
+			return 1;
+
+		it = item_shadows.emplace( key, std::move( rows ) ).first;
+	}
+
+	std::vector<struct item>& rows = it->second;
+	// index of the row each item was matched with, -1 if it is new
+	std::vector<int32> matched( max, -1 );
+
+	for( size_t r = 0; r < rows.size(); ++r )
 	{
-		found = false;
+		const struct item& item = rows[r];
+		bool found = false;
+
 		// search for the presence of the item in the char's inventory
 		for( i = 0; i < max; ++i )
 		{
 			// skip empty and already matched entries
-			if( items[i].nameid == 0 || flag[i] )
+			if( items[i].nameid == 0 || matched[i] != -1 )
 				continue;
 
 			if( items[i].nameid == item.nameid
@@ -642,10 +747,10 @@ int32 char_memitemdata_to_sql(const struct item items[], int32 max, int32 id, en
 			&&  items[i].unique_id == item.unique_id
 			) {	//They are the same item.
 				int32 k;
-				
+
 				ARR_FIND( 0, MAX_SLOTS, j, items[i].card[j] != item.card[j] );
 				ARR_FIND( 0, MAX_ITEM_RDM_OPT, k, items[i].option[k].id != item.option[k].id || items[i].option[k].value != item.option[k].value || items[i].option[k].param != item.option[k].param );
-				
+
 				if( j == MAX_SLOTS &&
 					k == MAX_ITEM_RDM_OPT &&
 					items[i].amount == item.amount &&
@@ -659,141 +764,186 @@ int32 char_memitemdata_to_sql(const struct item items[], int32 max, int32 id, en
 					(tableswitch != TABLE_INVENTORY || (items[i].favorite == item.favorite && items[i].equipSwitch == item.equipSwitch)) )
 				;	//Do nothing.
 				else
-				{
-					// update all fields.
-					StringBuf_Clear(&buf);
-					StringBuf_Printf(&buf, "UPDATE `%s` SET `amount`='%d', `equip`='%u', `identify`='%d', `refine`='%d',`attribute`='%d', `expire_time`='%u', `bound`='%d', `unique_id`='%" PRIu64 "', `enchantgrade`='%d'",
-						tablename, items[i].amount, items[i].equip, items[i].identify, items[i].refine, items[i].attribute, items[i].expire_time, items[i].bound, items[i].unique_id, items[i].enchantgrade);
-					if (tableswitch == TABLE_INVENTORY)
-						StringBuf_Printf(&buf, ", `favorite`='%d', `equip_switch`='%u'", items[i].favorite, items[i].equipSwitch);
-					for( j = 0; j < MAX_SLOTS; ++j )
-						StringBuf_Printf(&buf, ", `card%d`=%u", j, items[i].card[j]);
-					for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
-						StringBuf_Printf(&buf, ", `option_id%d`=%d", j, items[i].option[j].id);
-						StringBuf_Printf(&buf, ", `option_val%d`=%d", j, items[i].option[j].value);
-						StringBuf_Printf(&buf, ", `option_parm%d`=%d", j, items[i].option[j].param);
-					}
-					StringBuf_Printf(&buf, " WHERE `id`='%d' LIMIT 1", item.id);
-
-					if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
-					{
-						Sql_ShowDebug(sql_handle);
-						errors++;
-					}
-				}
+					updated.push_back( i );
 
-				found = flag[i] = true; //Item dealt with,
+				matched[i] = static_cast<int32>( r ); //Item dealt with,
+				found = true;
 				break; //skip to next item in the db.
 			}
 		}
-		if( !found )
-		{// Item not present in inventory, remove it.
-			if( SQL_ERROR == Sql_Query(sql_handle, "DELETE from `%s` where `id`='%d' LIMIT 1", tablename, item.id) )
-			{
-				Sql_ShowDebug(sql_handle);
-				errors++;
-			}
-		}
-	}
 
-	StringBuf_Clear(&buf);
-	StringBuf_Printf(&buf, "INSERT INTO `%s`(`%s`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`, `enchantgrade`", tablename, selectoption);
-	if (tableswitch == TABLE_INVENTORY)
-		StringBuf_Printf(&buf, ", `favorite`, `equip_switch`");
-	for( j = 0; j < MAX_SLOTS; ++j )
-		StringBuf_Printf(&buf, ", `card%d`", j);
-	for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
-		StringBuf_Printf(&buf, ", `option_id%d`", j);
-		StringBuf_Printf(&buf, ", `option_val%d`", j);
-		StringBuf_Printf(&buf, ", `option_parm%d`", j);
+		if( !found ) // Item not present in inventory, remove it.
+			deleted.push_back( item.id );
 	}
-	StringBuf_AppendStr(&buf, ") VALUES ");
 
-	found = false;
-	// insert non-matched items into the db as new items
 	for( i = 0; i < max; ++i )
 	{
-		// skip empty and already matched entries
-		if( items[i].nameid == 0 || flag[i] )
-			continue;
+		if( items[i].nameid != 0 && matched[i] == -1 )
+			inserted.push_back( i );
+	}
 
-		if( found )
-			StringBuf_AppendStr(&buf, ",");
-		else
-			found = true;
+	if( deleted.empty() && updated.empty() && inserted.empty() ){
+		ShowInfo("Saved %s (%d) data to table %s for %s: %d (unchanged)\n", printname, stor_id, tablename, selectoption, id);
+		return 0;
+	}
+
+	// All changes are written with at most one statement each
+	StringBuf_Init(&buf);
+
+	if( !deleted.empty() ){
+		StringBuf_Printf(&buf, "DELETE FROM `%s` WHERE `id` IN (", tablename);
+		for( size_t d = 0; d < deleted.size(); ++d )
+			StringBuf_Printf(&buf, d == 0 ? "'%d'" : ",'%d'", deleted[d]);
+		StringBuf_AppendStr(&buf, ")");
+
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
+		{
+			Sql_ShowDebug(sql_handle);
+			errors++;
+		}
+	}
 
-		StringBuf_Printf(&buf, "('%d', '%u', '%d', '%u', '%d', '%d', '%d', '%u', '%d', '%" PRIu64 "', '%d'",
-			id, items[i].nameid, items[i].amount, items[i].equip, items[i].identify, items[i].refine, items[i].attribute, items[i].expire_time, items[i].bound, items[i].unique_id, items[i].enchantgrade);
+	if( !errors && !updated.empty() ){
+		// update all fields of the changed rows, identified by their id
+		StringBuf_Clear(&buf);
+		StringBuf_Printf(&buf, "INSERT INTO `%s` (`id`, ", tablename);
+		char_memitemdata_columns(&buf, tableswitch, selectoption);
+		StringBuf_AppendStr(&buf, ") VALUES ");
+		for( size_t u = 0; u < updated.size(); ++u ){
+			i = updated[u];
+			StringBuf_Printf(&buf, u == 0 ? "('%d', " : ",('%d', ", rows[matched[i]].id);
+			char_memitemdata_values(&buf, items[i], id, tableswitch);
+			StringBuf_AppendStr(&buf, ")");
+		}
+		StringBuf_AppendStr(&buf, " ON DUPLICATE KEY UPDATE `amount`=VALUES(`amount`), `equip`=VALUES(`equip`), `identify`=VALUES(`identify`), `refine`=VALUES(`refine`), `attribute`=VALUES(`attribute`), `expire_time`=VALUES(`expire_time`), `bound`=VALUES(`bound`), `unique_id`=VALUES(`unique_id`), `enchantgrade`=VALUES(`enchantgrade`)");
 		if (tableswitch == TABLE_INVENTORY)
-			StringBuf_Printf(&buf, ", '%d', '%u'", items[i].favorite, items[i].equipSwitch);
+			StringBuf_AppendStr(&buf, ", `favorite`=VALUES(`favorite`), `equip_switch`=VALUES(`equip_switch`)");
 		for( j = 0; j < MAX_SLOTS; ++j )
-			StringBuf_Printf(&buf, ", '%u'", items[i].card[j]);
+			StringBuf_Printf(&buf, ", `card%d`=VALUES(`card%d`)", j, j);
 		for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
-			StringBuf_Printf(&buf, ", '%d'", items[i].option[j].id);
-			StringBuf_Printf(&buf, ", '%d'", items[i].option[j].value);
-			StringBuf_Printf(&buf, ", '%d'", items[i].option[j].param);
+			StringBuf_Printf(&buf, ", `option_id%d`=VALUES(`option_id%d`)", j, j);
+			StringBuf_Printf(&buf, ", `option_val%d`=VALUES(`option_val%d`)", j, j);
+			StringBuf_Printf(&buf, ", `option_parm%d`=VALUES(`option_parm%d`)", j, j);
+		}
+
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
+		{
+			Sql_ShowDebug(sql_handle);
+			errors++;
 		}
-		StringBuf_AppendStr(&buf, ")");
 	}
 
-	if( found && SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
+	std::vector<int32> inserted_ids;
+
+	if( !errors && !inserted.empty() ){
+		// insert non-matched items into the db as new items
+		StringBuf_Clear(&buf);
+		StringBuf_Printf(&buf, "INSERT INTO `%s`(", tablename);
+		char_memitemdata_columns(&buf, tableswitch, selectoption);
+		StringBuf_AppendStr(&buf, ") VALUES ");
+		for( size_t n = 0; n < inserted.size(); ++n ){
+			StringBuf_AppendStr(&buf, n == 0 ? "(" : ",(");
+			char_memitemdata_values(&buf, items[inserted[n]], id, tableswitch);
+			StringBuf_AppendStr(&buf, ")");
+		}
+
+		// The new rows are the ones of the owner from the first generated id on
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf))
+		||  SQL_ERROR == Sql_Query(sql_handle, "SELECT `id` FROM `%s` WHERE `%s`='%d' AND `id` >= LAST_INSERT_ID() ORDER BY `id`", tablename, selectoption, id) )
+		{
+			Sql_ShowDebug(sql_handle);
+			errors++;
+		}
+		else
+		{
+			while( SQL_SUCCESS == Sql_NextRow(sql_handle) ){
+				char* data;
+
+				Sql_GetData(sql_handle, 0, &data, nullptr);
+				inserted_ids.push_back( atoi( data ) );
+			}
+
+			Sql_FreeResult(sql_handle);
+
+			if( inserted_ids.size() != inserted.size() ){
+				ShowError( "char_memitemdata_to_sql: Inserted %" PRIuPTR " rows into table %s for %s: %d, but found %" PRIuPTR ".\n", inserted.size(), tablename, selectoption, id, inserted_ids.size() );
+				errors++;
+			}
+		}
+	}
+
+	if( errors ){
+		// The item tables use MyISAM, so the statements before the failed one were applied.
+		// The state of the database is unknown, it is selected again on the next save
+		item_shadows.erase( it );
+		return errors;
+	}
+
+	// Remember the rows as they are now stored
+	std::vector<struct item> saved;
+
+	saved.reserve( max );
+
+	for( i = 0; i < max; ++i )
 	{
-		Sql_ShowDebug(sql_handle);
-		errors++;
+		if( items[i].nameid != 0 && matched[i] != -1 ){
+			saved.push_back( items[i] );
+			saved.back().id = rows[matched[i]].id;
+		}
+	}
+
+	for( size_t n = 0; n < inserted.size(); ++n ){
+		saved.push_back( items[inserted[n]] );
+		saved.back().id = inserted_ids[n];
 	}
 
+	rows.swap( saved );
+
 	ShowInfo("Saved %s (%d) data to table %s for %s: %d\n", printname, stor_id, tablename, selectoption, id);
-	aFree(flag);
 
 	return errors;
 }
 
+/**
+ * Forgets the item rows of an owner kept in memory.
+ * Has to be called whenever the rows are changed by other queries.
+ * @param tableswitch: Table type
+ * @param id: Owner ID
+ */
+void char_memitemdata_release( enum storage_type tableswitch, int32 id ){
+	auto it = item_shadows.lower_bound( std::make_tuple( id, tableswitch, (uint8)0 ) );
+
+	while( it != item_shadows.end() && std::get<0>( it->first ) == id && std::get<1>( it->first ) == tableswitch ){
+		it = item_shadows.erase( it );
+	}
+}
+
 bool char_memitemdata_from_sql(struct s_storage* p, int32 max, int32 id, enum storage_type tableswitch, uint8 stor_id) {
-	StringBuf buf;
-	SqlStmt stmt{ *sql_handle };
-	int32 i,j, offset = 0, max2;
-	struct item item, *storage;
+	int32 i, max2;
+	struct item *storage;
 	const char *tablename, *selectoption, *printname;
 
+	if( !char_memitemdata_table( tableswitch, stor_id, &tablename, &selectoption, &printname ) )
+		return false;
+
 	switch (tableswitch) {
 		case TABLE_INVENTORY:
-			printname = "Inventory";
-			tablename = schema_config.inventory_db;
-			selectoption = "char_id";
 			storage = p->u.items_inventory;
 			max2 = MAX_INVENTORY;
 			break;
 		case TABLE_CART:
-			printname = "Cart";
-			tablename = schema_config.cart_db;
-			selectoption = "char_id";
 			storage = p->u.items_cart;
 			max2 = MAX_CART;
 			break;
-		case TABLE_STORAGE: {
-			std::shared_ptr<s_storage_table> storage_info = interServerDb.find( stor_id );
-
-			if( storage_info == nullptr ){
-				ShowError( "Invalid storage with id %d\n", id );
-				return false;
-			}
-
-			printname = storage_info->name;
-			tablename = storage_info->table;
-			selectoption = "account_id";
+		case TABLE_STORAGE:
 			storage = p->u.items_storage;
-			max2 = storage_info->max_num;
-			} break;
+			max2 = interServerDb.find( stor_id )->max_num;
+			break;
 		case TABLE_GUILD_STORAGE:
-			printname = "Guild Storage";
-			tablename = schema_config.guild_storage_db;
-			selectoption = "guild_id";
+		default:
 			storage = p->u.items_guild;
 			max2 = inter_guild_storagemax(id);
 			break;
-		default:
-			ShowError("Invalid table name!\n");
-			return false;
 	}
 
 	memset(p, 0, sizeof(struct s_storage)); //clean up memory
@@ -802,59 +952,25 @@ bool char_memitemdata_from_sql(struct s_storage* p, int32 max, int32 id, enum st
 	p->stor_id = stor_id;
 	p->max_amount = max2;
 
+	t_item_shadow_key key = std::make_tuple( id, tableswitch, stor_id );
 
-	StringBuf_Init(&buf);
-	StringBuf_AppendStr(&buf, "SELECT `id`,`nameid`,`amount`,`equip`,`identify`,`refine`,`attribute`,`expire_time`,`bound`,`unique_id`,`enchantgrade`");
-	if (tableswitch == TABLE_INVENTORY) {
-		StringBuf_Printf(&buf, ", `favorite`, `equip_switch`");
-		offset = 2;
-	}
-	for( j = 0; j < MAX_SLOTS; ++j )
-		StringBuf_Printf(&buf, ",`card%d`", j);
-	for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
-		StringBuf_Printf(&buf, ", `option_id%d`", j);
-		StringBuf_Printf(&buf, ", `option_val%d`", j);
-		StringBuf_Printf(&buf, ", `option_parm%d`", j);
-	}
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `%s`=? ORDER BY `id`", tablename, selectoption );
+	// A full load always starts from the database, the rows might have been changed meanwhile
+	item_shadows.erase( key );
 
-	if( SQL_ERROR == stmt.PrepareStr(StringBuf_Value(&buf))
-		||	SQL_ERROR == stmt.BindParam(0, SQLDT_INT32, &id, 0)
-		||	SQL_ERROR == stmt.Execute() )
-	{
-		SqlStmt_ShowDebug(stmt);
-		return false;
-	}
+	std::vector<struct item> rows;
 
-	stmt.BindColumn(0, SQLDT_INT32, &item.id);
-	stmt.BindColumn(1, SQLDT_UINT32, &item.nameid);
-	stmt.BindColumn(2, SQLDT_INT16, &item.amount);
-	stmt.BindColumn(3, SQLDT_UINT32, &item.equip);
-	stmt.BindColumn(4, SQLDT_CHAR, &item.identify);
-	stmt.BindColumn(5, SQLDT_CHAR, &item.refine);
-	stmt.BindColumn(6, SQLDT_CHAR, &item.attribute);
-	stmt.BindColumn(7, SQLDT_UINT32, &item.expire_time);
-	stmt.BindColumn(8, SQLDT_CHAR, &item.bound);
-	stmt.BindColumn(9, SQLDT_ULONGLONG, &item.unique_id);
-	stmt.BindColumn(10, SQLDT_INT8, &item.enchantgrade);
-	if (tableswitch == TABLE_INVENTORY){
-		stmt.BindColumn(11, SQLDT_CHAR, &item.favorite);
-		stmt.BindColumn(12, SQLDT_UINT32, &item.equipSwitch);
-	}
-	for( i = 0; i < MAX_SLOTS; ++i )
-		stmt.BindColumn(11+offset+i, SQLDT_UINT32, &item.card[i]);
- 	for( i = 0; i < MAX_ITEM_RDM_OPT; ++i ) {
-		stmt.BindColumn(11+offset+MAX_SLOTS+i*3, SQLDT_INT16, &item.option[i].id);
-		stmt.BindColumn(12+offset+MAX_SLOTS+i*3, SQLDT_INT16, &item.option[i].value);
-		stmt.BindColumn(13+offset+MAX_SLOTS+i*3, SQLDT_CHAR, &item.option[i].param);
- 	}
+	if( !char_memitemdata_select( rows, id, tableswitch, tablename, selectoption ) )
+		return false;
 
-	for( i = 0; i < max && SQL_SUCCESS == stmt.NextRow(); ++i )
-		memcpy(&storage[i], &item, sizeof(item));
+	for( i = 0; i < max && i < static_cast<int32>( rows.size() ); ++i )
+		memcpy(&storage[i], &rows[i], sizeof(struct item));
 
 	p->amount = i;
 	ShowInfo("Loaded %s data from table %s for %s: %d (total: %d)\n", printname, tablename, selectoption, id, p->amount);
 
+	// Following saves are compared against the loaded rows
+	item_shadows[key] = std::move( rows );
+
 	return true;
 }
 
@@ -1532,6 +1648,8 @@ int32 char_divorce_char_sql(int32 partner_id1, int32 partner_id2){
 		Sql_ShowDebug(sql_handle);
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE (`nameid`='%u' OR `nameid`='%u') AND (`char_id`='%d' OR `char_id`='%d') LIMIT 2", schema_config.inventory_db, WEDDING_RING_M, WEDDING_RING_F, partner_id1, partner_id2) )
 		Sql_ShowDebug(sql_handle);
+	char_memitemdata_release(TABLE_INVENTORY, partner_id1);
+	char_memitemdata_release(TABLE_INVENTORY, partner_id2);
 	chmapif_send_ackdivorce(partner_id1, partner_id2);
 	return 0;
 }
@@ -1682,6 +1800,9 @@ enum e_char_del_response char_delete(struct char_session_data* sd, uint32 char_i
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `char_id`='%d'", schema_config.cart_db, char_id) )
 		Sql_ShowDebug(sql_handle);
 
+	char_memitemdata_release(TABLE_INVENTORY, char_id);
+	char_memitemdata_release(TABLE_CART, char_id);
+
 	/* delete memo areas */
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `char_id`='%d'", schema_config.memo_db, char_id) )
 		Sql_ShowDebug(sql_handle);
@@ -311,6 +311,7 @@ int32 char_rename_char_sql(struct char_session_data *sd, uint32 char_id);
 int32 char_divorce_char_sql(int32 partner_id1, int32 partner_id2);
 int32 char_memitemdata_to_sql(const struct item items[], int32 max, int32 id, enum storage_type tableswitch, uint8 stor_id);
 bool char_memitemdata_from_sql(struct s_storage* p, int32 max, int32 id, enum storage_type tableswitch, uint8 stor_id);
+void char_memitemdata_release( enum storage_type tableswitch, int32 id );
 
 int32 char_married(int32 pl1,int32 pl2);
 int32 char_child(int32 parent_id, int32 child_id);
@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <cstring> //memcpy
 #include <memory>
+#include <unordered_map>
 
 #include <common/malloc.hpp>
 #include <common/showmsg.hpp>
@@ -21,6 +22,15 @@
 
 using namespace rathena;
 
+/// Character status as last received from a map-server, base of delta saves
+struct s_char_save_base {
+	int32 server; ///< Map-server that sent the status
+	uint32 seq; ///< Sequence number of the save
+	struct mmo_charstatus status;
+};
+
+static std::unordered_map<uint32, std::unique_ptr<struct s_char_save_base>> char_save_bases;
+
 /**
  * Packet send to all map-servers, attach to ourself
  * @param buf: packet to send in form of an array buffer
@@ -398,6 +408,41 @@ int32 chmapif_parse_regmapuser(int32 fd, int32 id){
 	return 1;
 }
 
+/**
+ * Saves the character status received from a map-server
+ * @param fd: wich fd to parse from
+ * @param id: wich map_serv id
+ * @param aid: account id
+ * @param cid: char id
+ * @param quit: whether the character is quitting
+ * @param force: save even if the character is not online
+ * @param status: character status to save
+ */
+static void chmapif_save_character( int32 fd, int32 id, uint32 aid, uint32 cid, bool quit, bool force, const struct mmo_charstatus& status ){
+	std::shared_ptr<struct online_char_data> character = util::umap_find( char_get_onlinedb(), aid );
+
+	//Check account only if this ain't final save. Final-save goes through because of the char-map reconnect
+	if( quit || force || ( character != nullptr && character->char_id == cid ) ){
+		struct mmo_charstatus char_dat;
+		memcpy(&char_dat, &status, sizeof(struct mmo_charstatus));
+		char_mmo_char_tosql(cid, &char_dat);
+	} else {	//This may be valid on char-server reconnection, when re-sending characters that already logged off.
+		ShowError("parse_from_map (save-char): Received data for non-existant/offline character (%d:%d).\n", aid, cid);
+		char_set_char_online(id, cid, aid);
+	}
+
+	if (quit)
+	{	//Flag, set character offline after saving. [Skotlex]
+		char_save_bases.erase( cid );
+		char_set_char_offline(cid, aid);
+		WFIFOHEAD(fd,10);
+		WFIFOW(fd,0) = 0x2b21; //Save ack only needed on final save.
+		WFIFOL(fd,2) = aid;
+		WFIFOL(fd,6) = cid;
+		WFIFOSET(fd,10);
+	}
+}
+
 /**
  * Map-serv request to save mmo_char_status in sql
  * Receive character data from map-server for saving
@@ -411,40 +456,101 @@ int32 chmapif_parse_reqsavechar(int32 fd, int32 id){
 	else {
 		uint32 aid = RFIFOL( fd, 4 ), cid = RFIFOL( fd, 8 );
 		uint16 size = RFIFOW( fd, 2 );
+		bool quit = RFIFOB( fd, 12 ) != 0;
 
-		if (size - 13 != sizeof(struct mmo_charstatus))
+		if (size - 17 != sizeof(struct mmo_charstatus))
 		{
-			ShowError("parse_from_map (save-char): Size mismatch! %d != %" PRIuPTR "\n", size-13, sizeof(struct mmo_charstatus));
+			ShowError("parse_from_map (save-char): Size mismatch! %d != %" PRIuPTR "\n", size-17, sizeof(struct mmo_charstatus));
 			RFIFOSKIP(fd,size);
 			return 1;
 		}
 
-		std::shared_ptr<struct online_char_data> character = util::umap_find( char_get_onlinedb(), aid );
+		std::unique_ptr<struct s_char_save_base>& base = char_save_bases[cid];
 
-		//Check account only if this ain't final save. Final-save goes through because of the char-map reconnect
-		if( RFIFOB( fd, 12 ) || RFIFOB( fd, 13 ) || ( character != nullptr && character->char_id == cid ) ){
-			struct mmo_charstatus char_dat;
-			memcpy(&char_dat, RFIFOP(fd,13), sizeof(struct mmo_charstatus));
-			char_mmo_char_tosql(cid, &char_dat);
-		} else {	//This may be valid on char-server reconnection, when re-sending characters that already logged off.
-			ShowError("parse_from_map (save-char): Received data for non-existant/offline character (%d:%d).\n", aid, cid);
-			char_set_char_online(id, cid, aid);
+		// Following delta saves are based on this status
+		if( base == nullptr ){
+			base = std::make_unique<struct s_char_save_base>();
 		}
 
-		if (RFIFOB(fd,12))
-		{	//Flag, set character offline after saving. [Skotlex]
-			char_set_char_offline(cid, aid);
-			WFIFOHEAD(fd,10);
-			WFIFOW(fd,0) = 0x2b21; //Save ack only needed on final save.
-			WFIFOL(fd,2) = aid;
-			WFIFOL(fd,6) = cid;
-			WFIFOSET(fd,10);
-		}
+		base->server = id;
+		base->seq = RFIFOL( fd, 13 + sizeof( struct mmo_charstatus ) );
+		memcpy( &base->status, RFIFOP( fd, 13 ), sizeof( struct mmo_charstatus ) );
+
+		chmapif_save_character( fd, id, aid, cid, quit, RFIFOB( fd, 13 ) != 0, base->status );
+
 		RFIFOSKIP(fd,size);
 	}
 	return 1;
 }
 
+/**
+ * Map-serv request to save the changes of mmo_char_status since its last save
+ * The changes are applied to the last received status, if it is not the status the changes are based on,
+ * the map-server is asked to send the complete status instead.
+ * @param fd: wich fd to parse from
+ * @param id: wich map_serv id
+ * @return : 0 not enough data received, 1 success
+ */
+int32 chmapif_parse_reqsavechar_delta( int32 fd, int32 id ){
+	if( RFIFOREST( fd ) < 4 || RFIFOREST( fd ) < RFIFOW( fd, 2 ) ){
+		return 0;
+	}
+
+	uint32 aid = RFIFOL( fd, 4 ), cid = RFIFOL( fd, 8 );
+	uint16 size = RFIFOW( fd, 2 );
+	bool quit = RFIFOB( fd, 12 ) != 0;
+	uint32 base_seq = RFIFOL( fd, 13 );
+	std::unique_ptr<struct s_char_save_base>* base = util::umap_find( char_save_bases, cid );
+	bool applied = false;
+
+	if( size >= 21 && base != nullptr && ( *base )->server == id && ( *base )->seq == base_seq ){
+		uint8* data = reinterpret_cast<uint8*>( &( *base )->status );
+		uint16 offset;
+
+		applied = true;
+
+		for( offset = 21; offset + 4 <= size; ){
+			uint16 start = RFIFOW( fd, offset );
+			uint16 length = RFIFOW( fd, offset + 2 );
+
+			if( offset + 4 + length > size || start + length > sizeof( struct mmo_charstatus ) ){
+				applied = false;
+				break;
+			}
+
+			memcpy( data + start, RFIFOP( fd, offset + 4 ), length );
+			offset += 4 + length;
+		}
+
+		if( offset != size ){
+			applied = false;
+		}
+
+		if( !applied ){
+			// The status might be partially updated now
+			ShowError( "parse_from_map (save-char delta): Malformed data for character (%d:%d).\n", aid, cid );
+			char_save_bases.erase( cid );
+		}
+	}
+
+	if( applied ){
+		( *base )->seq = RFIFOL( fd, 17 );
+		// Same flag as a complete save, which takes the first byte of the status
+		chmapif_save_character( fd, id, aid, cid, quit, reinterpret_cast<const uint8*>( &( *base )->status )[0] != 0, ( *base )->status );
+	}else{
+		// Request the complete status
+		WFIFOHEAD( fd, 10 );
+		WFIFOW( fd, 0 ) = 0x2b2c;
+		WFIFOL( fd, 2 ) = aid;
+		WFIFOL( fd, 6 ) = cid;
+		WFIFOSET( fd, 10 );
+	}
+
+	RFIFOSKIP( fd, size );
+
+	return 1;
+}
+
 /**
  * Inform mapserv of a new character selection request
  * @param fd : FD link tomapserv
@@ -1421,6 +1527,7 @@ int32 chmapif_parse(int32 fd){
 			case 0x2afe: next=chmapif_parse_getusercount(fd,id); break; //get nb user
 			case 0x2aff: next=chmapif_parse_regmapuser(fd,id); break; //register users
 			case 0x2b01: next=chmapif_parse_reqsavechar(fd,id); break;
+			case 0x2b29: next=chmapif_parse_reqsavechar_delta(fd,id); break;
 			case 0x2b02: next=chmapif_parse_authok(fd); break;
 			case 0x2b05: next=chmapif_parse_reqchangemapserv(fd); break;
 			case 0x2b07: next=chmapif_parse_askrmfriend(fd); break;
@@ -1525,6 +1632,15 @@ void chmapif_server_reset(int32 id){
 		char_db_setoffline( pair.second, id );
 	}
 
+	// The map-server sends complete saves after reconnecting
+	for( auto it = char_save_bases.begin(); it != char_save_bases.end(); ){
+		if( it->second->server == id ){
+			it = char_save_bases.erase( it );
+		}else{
+			it++;
+		}
+	}
+
 	chmapif_server_destroy(id);
 	chmapif_server_init(id);
 }
@@ -17,6 +17,7 @@ int32 chmapif_parse_askscdata(int32 fd);
 int32 chmapif_parse_getusercount(int32 fd, int32 id);
 int32 chmapif_parse_regmapuser(int32 fd, int32 id);
 int32 chmapif_parse_reqsavechar(int32 fd, int32 id);
+int32 chmapif_parse_reqsavechar_delta( int32 fd, int32 id );
 int32 chmapif_parse_authok(int32 fd);
 int32 chmapif_parse_req_saveskillcooldown(int32 fd);
 int32 chmapif_parse_req_skillcooldown(int32 fd);
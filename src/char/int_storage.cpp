@@ -346,6 +346,7 @@ bool mapif_parse_itembound_retrieve(int32 fd)
 		mapif_itembound_ack(fd,account_id,guild_id);
 		return true;
 	}
+	char_memitemdata_release(TABLE_INVENTORY, char_id);
 
 	// Send the deleted items to map-server to store them in guild storage [Cydh]
 	mapif_itembound_store2gstorage(fd, guild_id, items, count);
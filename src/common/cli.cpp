@@ -113,6 +113,18 @@ int32 cli_get_options(int32 argc, char ** argv) {
 			}
 			else if (strcmp(arg, "run-once") == 0) { // close the map-server as soon as its done.. for testing [Celest]
 				global_core->set_run_once( true );
+			}
+			else if (strcmp(arg, "timer-backend") == 0) {
+				if (opt_has_next_value(arg, i, argc)) {
+					const char* backend = argv[++i];
+
+					if (strcmpi(backend, "heap") == 0)
+						timer_set_backend(TIMER_BACKEND_HEAP);
+					else if (strcmpi(backend, "wheel") == 0)
+						timer_set_backend(TIMER_BACKEND_WHEEL);
+					else
+						ShowWarning("Unknown timer backend '%s', using the default heap.\n", backend);
+				}
 			}else if( global_core->get_type() == e_core_type::LOGIN || global_core->get_type() == e_core_type::CHARACTER ){
 				if (strcmp(arg, "lan-config") == 0) {
 					if (opt_has_next_value(arg, i, argc))
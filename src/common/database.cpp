@@ -3,6 +3,8 @@
 
 #include "database.hpp"
 
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
@@ -12,6 +14,91 @@
 
 using namespace rathena;
 
+/// Magic number ("SNAP") and format version of database snapshots
+static const uint32 SNAPSHOT_MAGIC = 0x50414e53;
+static const uint16 SNAPSHOT_FORMAT = 1;
+
+std::string YamlDatabase::snapshotFolder;
+
+void DatabaseSnapshotWriter::writeBytes( const void* data, size_t length ){
+	const uint8* bytes = static_cast<const uint8*>( data );
+
+	this->buffer.insert( this->buffer.end(), bytes, bytes + length );
+}
+
+void DatabaseSnapshotWriter::writeString( const std::string& str ){
+	this->write<uint32>( static_cast<uint32>( str.length() ) );
+	this->writeBytes( str.data(), str.length() );
+}
+
+const std::vector<uint8>& DatabaseSnapshotWriter::getBuffer() const{
+	return this->buffer;
+}
+
+bool DatabaseSnapshotReader::readBytes( void* out, size_t length ){
+	if( this->failed || length > this->size - this->pos ){
+		// Prevent any further reads
+		this->failed = true;
+		return false;
+	}
+
+	memcpy( out, this->data + this->pos, length );
+	this->pos += length;
+
+	return true;
+}
+
+bool DatabaseSnapshotReader::readString( std::string& str ){
+	uint32 length;
+
+	if( !this->read( length ) || length > this->size - this->pos ){
+		this->failed = true;
+		return false;
+	}
+
+	str.assign( reinterpret_cast<const char*>( this->data + this->pos ), length );
+	this->pos += length;
+
+	return true;
+}
+
+/**
+ * Checks if the whole snapshot was read without any error.
+ */
+bool DatabaseSnapshotReader::finished() const{
+	return !this->failed && this->pos == this->size;
+}
+
+/**
+ * Reads a whole file into a buffer.
+ * @param path: file to read
+ * @param out: buffer for the content
+ * @param mode: mode for fopen, source files have to be read like YamlDatabase::load does
+ * @return true if the file could be read
+ */
+static bool database_read_file( const std::string& path, std::vector<uint8>& out, const char* mode ){
+	FILE* f = fopen( path.c_str(), mode );
+
+	if( f == nullptr ){
+		return false;
+	}
+
+	fseek( f, 0, SEEK_END );
+	long size = ftell( f );
+	rewind( f );
+
+	if( size < 0 ){
+		fclose( f );
+		return false;
+	}
+
+	out.resize( size );
+	out.resize( fread( out.data(), sizeof( uint8 ), out.size(), f ) );
+	fclose( f );
+
+	return true;
+}
+
 bool YamlDatabase::nodeExists( const ryml::NodeRef& node, const std::string& name ){
 	return (node.num_children() > 0 && node.has_child(c4::to_csubstr(name)));
 }
@@ -76,7 +163,17 @@ bool YamlDatabase::verifyCompatibility( const ryml::Tree& tree ){
 }
 
 bool YamlDatabase::load(){
-	bool ret = this->load( this->getDefaultLocation() );
+	bool ret;
+
+	if( this->loadSnapshot() ){
+		ret = true;
+	}else{
+		ret = this->load( this->getDefaultLocation() );
+
+		if( ret ){
+			this->saveSnapshot();
+		}
+	}
 
 	this->loadingFinished();
 
@@ -94,6 +191,12 @@ bool YamlDatabase::load(const std::string& path) {
 	FILE* f = fopen(path.c_str(), "r");
 	if (f == nullptr) {
 		ShowError("Failed to open %s database file from '" CL_WHITE "%s" CL_RESET "'.\n", this->type.c_str(), path.c_str());
+
+		// A missing import has to stay missing for the snapshot to be valid
+		if( !this->snapshotKey.empty() ){
+			this->snapshotSources.push_back( { path, false, 0 } );
+		}
+
 		return false;
 	}
 	fseek(f, 0, SEEK_END);
@@ -105,6 +208,10 @@ bool YamlDatabase::load(const std::string& path) {
 	buf[real_size] = '\0';
 	fclose(f);
 
+	if( !this->snapshotKey.empty() ){
+		this->snapshotSources.push_back( { path, true, database_hash( buf, real_size ) } );
+	}
+
 	parser = {};
 	ryml::Tree tree;
 
@@ -149,6 +256,172 @@ void YamlDatabase::loadingFinished(){
 	// Does nothing by default, just for hooking
 }
 
+std::string YamlDatabase::getSnapshotKey(){
+	// Snapshots are not supported by default
+	return "";
+}
+
+bool YamlDatabase::readSnapshot( DatabaseSnapshotReader& reader ){
+	return false;
+}
+
+bool YamlDatabase::writeSnapshot( DatabaseSnapshotWriter& writer ){
+	return false;
+}
+
+std::string YamlDatabase::getSnapshotFile(){
+	std::string file = this->type;
+
+	util::tolower( file );
+
+	return snapshotFolder + "/" + file + ".bin";
+}
+
+/**
+ * Restores the parsed state of the database from its snapshot.
+ * The snapshot is only used if it was written by the same build and none of the YAML files,
+ * that were read for it, changed since then.
+ * @return true if the database was loaded from the snapshot
+ */
+bool YamlDatabase::loadSnapshot(){
+	this->snapshotSources.clear();
+	this->snapshotKey = snapshotFolder.empty() ? "" : this->getSnapshotKey();
+
+	if( this->snapshotKey.empty() ){
+		return false;
+	}
+
+	std::string file = this->getSnapshotFile();
+	std::vector<uint8> buf;
+
+	// No snapshot was written yet
+	if( !database_read_file( file, buf, "rb" ) ){
+		return false;
+	}
+
+	uint64 checksum;
+
+	if( buf.size() < sizeof( checksum ) ){
+		ShowWarning( "Snapshot '" CL_WHITE "%s" CL_RESET "' is damaged, ignoring it.\n", file.c_str() );
+		return false;
+	}
+
+	size_t length = buf.size() - sizeof( checksum );
+
+	memcpy( &checksum, buf.data() + length, sizeof( checksum ) );
+
+	if( database_hash( buf.data(), length ) != checksum ){
+		ShowWarning( "Snapshot '" CL_WHITE "%s" CL_RESET "' is damaged, ignoring it.\n", file.c_str() );
+		return false;
+	}
+
+	DatabaseSnapshotReader reader( buf.data(), length );
+	uint32 magic;
+	uint16 format;
+	std::string tmpType;
+	uint16 tmpVersion;
+	std::string tmpKey;
+	uint32 count;
+
+	if( !reader.read( magic ) || magic != SNAPSHOT_MAGIC || !reader.read( format ) || format != SNAPSHOT_FORMAT
+		|| !reader.readString( tmpType ) || tmpType != this->type || !reader.read( tmpVersion ) || tmpVersion != this->version
+		|| !reader.readString( tmpKey ) || tmpKey != this->snapshotKey || !reader.read( count ) ){
+		ShowStatus( "Snapshot '" CL_WHITE "%s" CL_RESET "' belongs to a different build, reading the YAML files instead.\n", file.c_str() );
+		return false;
+	}
+
+	for( uint32 i = 0; i < count; i++ ){
+		s_snapshot_source source;
+		uint8 exists;
+
+		if( !reader.readString( source.path ) || !reader.read( exists ) || !reader.read( source.hash ) ){
+			ShowWarning( "Snapshot '" CL_WHITE "%s" CL_RESET "' is damaged, ignoring it.\n", file.c_str() );
+			return false;
+		}
+
+		std::vector<uint8> content;
+
+		source.exists = database_read_file( source.path, content, "r" );
+
+		if( source.exists != ( exists != 0 ) || ( source.exists && database_hash( content.data(), content.size() ) != source.hash ) ){
+			ShowStatus( "'" CL_WHITE "%s" CL_RESET "' changed since snapshot '" CL_WHITE "%s" CL_RESET "' was written, reading the YAML files instead.\n", source.path.c_str(), file.c_str() );
+			return false;
+		}
+
+		this->snapshotSources.push_back( source );
+	}
+
+	if( !this->readSnapshot( reader ) || !reader.finished() ){
+		ShowWarning( "Failed to read %s snapshot from '" CL_WHITE "%s" CL_RESET "', reading the YAML files instead.\n", this->type.c_str(), file.c_str() );
+		this->clear();
+		this->snapshotSources.clear();
+		return false;
+	}
+
+	ShowStatus( "Done reading %s snapshot '" CL_WHITE "%s" CL_RESET "' of '" CL_WHITE "%" PRIu32 CL_RESET "' files.\n", this->type.c_str(), file.c_str(), count );
+
+	return true;
+}
+
+/**
+ * Writes the parsed state of the database together with the YAML files it was read from
+ * into its snapshot.
+ */
+void YamlDatabase::saveSnapshot(){
+	if( this->snapshotKey.empty() ){
+		return;
+	}
+
+	DatabaseSnapshotWriter writer;
+
+	writer.write( SNAPSHOT_MAGIC );
+	writer.write( SNAPSHOT_FORMAT );
+	writer.writeString( this->type );
+	writer.write( this->version );
+	writer.writeString( this->snapshotKey );
+	writer.write<uint32>( static_cast<uint32>( this->snapshotSources.size() ) );
+
+	for( const s_snapshot_source& source : this->snapshotSources ){
+		writer.writeString( source.path );
+		writer.write<uint8>( source.exists );
+		writer.write( source.hash );
+	}
+
+	// The database can not represent its current state
+	if( !this->writeSnapshot( writer ) ){
+		return;
+	}
+
+	const std::vector<uint8>& buf = writer.getBuffer();
+	uint64 checksum = database_hash( buf.data(), buf.size() );
+	std::string file = this->getSnapshotFile();
+	std::string tmpFile = file + ".tmp";
+	FILE* f = fopen( tmpFile.c_str(), "wb" );
+
+	if( f == nullptr ){
+		ShowWarning( "Failed to write %s snapshot to '" CL_WHITE "%s" CL_RESET "'. Does the folder exist?\n", this->type.c_str(), file.c_str() );
+		return;
+	}
+
+	bool written = fwrite( buf.data(), sizeof( uint8 ), buf.size(), f ) == buf.size() && fwrite( &checksum, sizeof( checksum ), 1, f ) == 1;
+
+	written = fclose( f ) == 0 && written;
+
+	// Only replace the old snapshot with a complete one
+	if( written ){
+		remove( file.c_str() );
+		written = rename( tmpFile.c_str(), file.c_str() ) == 0;
+	}
+
+	if( !written ){
+		remove( tmpFile.c_str() );
+		ShowWarning( "Failed to write %s snapshot to '" CL_WHITE "%s" CL_RESET "'.\n", this->type.c_str(), file.c_str() );
+		return;
+	}
+
+	ShowStatus( "Wrote %s snapshot to '" CL_WHITE "%s" CL_RESET "'.\n", this->type.c_str(), file.c_str() );
+}
+
 void YamlDatabase::parse( const ryml::Tree& tree ){
 	uint64 count = 0;
 
@@ -383,6 +656,32 @@ void YamlDatabase::setGenerator(bool shouldLoad) {
 	shouldLoadGenerator = shouldLoad;
 }
 
+/**
+ * Sets the folder in which database snapshots are stored.
+ * @param folder: folder or an empty string to disable snapshots
+ */
+void YamlDatabase::setSnapshotFolder( const std::string& folder ){
+	snapshotFolder = folder;
+}
+
+/**
+ * 64 bit FNV-1a hash, used to detect changes for database snapshots.
+ * @param data: data to hash
+ * @param length: length of the data
+ * @param hash: hash of previous data to continue from
+ * @return hash of the data
+ */
+uint64 database_hash( const void* data, size_t length, uint64 hash ){
+	const uint8* bytes = static_cast<const uint8*>( data );
+
+	for( size_t i = 0; i < length; i++ ){
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 void on_yaml_error( const char* msg, size_t len, ryml::Location loc, void *user_data ){
 	throw std::runtime_error( msg );
 }
@@ -4,6 +4,8 @@
 #ifndef DATABASE_HPP
 #define DATABASE_HPP
 
+#include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -16,17 +18,74 @@
 #include "core.hpp"
 #include "utilities.hpp"
 
+/// Serializes the parsed state of a database into a binary snapshot
+class DatabaseSnapshotWriter{
+private:
+	std::vector<uint8> buffer;
+
+public:
+	template <typename T> void write( const T& value ){
+		static_assert( std::is_trivially_copyable<T>::value, "Only trivially copyable types can be written directly" );
+
+		this->writeBytes( &value, sizeof( value ) );
+	}
+
+	void writeBytes( const void* data, size_t length );
+	void writeString( const std::string& str );
+	const std::vector<uint8>& getBuffer() const;
+};
+
+/// Reads the parsed state of a database back from a binary snapshot
+class DatabaseSnapshotReader{
+private:
+	const uint8* data;
+	size_t size;
+	size_t pos;
+	bool failed;
+
+public:
+	DatabaseSnapshotReader( const uint8* data_, size_t size_ ){
+		this->data = data_;
+		this->size = size_;
+		this->pos = 0;
+		this->failed = false;
+	}
+
+	template <typename T> bool read( T& value ){
+		static_assert( std::is_trivially_copyable<T>::value, "Only trivially copyable types can be read directly" );
+
+		return this->readBytes( &value, sizeof( value ) );
+	}
+
+	bool readBytes( void* out, size_t length );
+	bool readString( std::string& str );
+	bool finished() const;
+};
+
 class YamlDatabase{
 // Internal stuff
 private:
+	struct s_snapshot_source{
+		std::string path;
+		bool exists;
+		uint64 hash;
+	};
+
+	static std::string snapshotFolder;
+
 	std::string type;
 	uint16 version;
 	uint16 minimumVersion;
 	std::string currentFile;
 	bool shouldLoadGenerator{false};
+	std::string snapshotKey;
+	std::vector<s_snapshot_source> snapshotSources;
 
 	bool verifyCompatibility( const ryml::Tree& rootNode );
 	bool load( const std::string& path );
+	std::string getSnapshotFile();
+	bool loadSnapshot();
+	void saveSnapshot();
 	void parse( const ryml::Tree& rootNode );
 	void parseImports( const ryml::Tree& rootNode );
 	template <typename R> bool asType( const ryml::NodeRef& node, const std::string& name, R& out );
@@ -61,6 +120,11 @@ protected:
 
 	virtual void loadingFinished();
 
+	// Binary snapshots, only used for databases that return a key
+	virtual std::string getSnapshotKey();
+	virtual bool readSnapshot( DatabaseSnapshotReader& reader );
+	virtual bool writeSnapshot( DatabaseSnapshotWriter& writer );
+
 public:
 	YamlDatabase( const std::string& type_, uint16 version_, uint16 minimumVersion_ ){
 		this->type = type_;
@@ -75,6 +139,8 @@ public:
 	bool load();
 	bool reload();
 
+	static void setSnapshotFolder( const std::string& folder );
+
 	// Functions that need to be implemented for each type
 	virtual void clear() = 0;
 	virtual const std::string getDefaultLocation() = 0;
@@ -250,6 +316,7 @@ public:
 	}
 };
 
+uint64 database_hash( const void* data, size_t length, uint64 hash = 0xcbf29ce484222325ULL );
 void do_init_database();
 
 #endif /* DATABASE_HPP */
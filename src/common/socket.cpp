@@ -3,6 +3,7 @@
 
 #include "socket.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 
 #ifdef WIN32
@@ -15,6 +16,7 @@
 	#include <sys/ioctl.h>
 	#include <sys/socket.h>
 	#include <sys/time.h>
+	#include <sys/uio.h>
 	#include <unistd.h>
 
 	#if defined(__linux__) || defined(__linux)
@@ -23,6 +25,21 @@
 		#ifdef SOCKET_EPOLL
 			#include <sys/epoll.h>
 		#endif
+
+		#if defined(__has_include)
+			#if __has_include(<linux/io_uring.h>)
+				#include <linux/io_uring.h>
+
+				// Multishot receives require the headers of 6.0 or newer
+				#ifdef IORING_RECV_MULTISHOT
+					#define SOCKET_IO_URING
+					#include <poll.h>
+					#include <signal.h>
+					#include <sys/mman.h>
+					#include <sys/syscall.h>
+				#endif
+			#endif
+		#endif
 	#else 
 		#include <netinet/in.h>
 		#include <netinet/tcp.h>
@@ -219,6 +236,55 @@ char* sErr(int32 code)
 	#define MSG_NOSIGNAL 0
 #endif
 
+// Scatter/gather send of several buffers in one call
+#ifdef WIN32
+typedef WSABUF t_send_buffer;
+
+static void send_buffer_set( t_send_buffer& buffer, const uint8* data, size_t len ){
+	buffer.buf = (char*)data;
+	buffer.len = (ULONG)len;
+}
+
+static int32 sSendv( int32 fd, t_send_buffer* buffers, int32 count ){
+	DWORD sent = 0;
+
+	if( WSASend( fd2sock( fd ), buffers, count, &sent, 0, nullptr, nullptr ) == SOCKET_ERROR ){
+		return SOCKET_ERROR;
+	}
+
+	return (int32)sent;
+}
+#else
+typedef struct iovec t_send_buffer;
+
+static void send_buffer_set( t_send_buffer& buffer, const uint8* data, size_t len ){
+	buffer.iov_base = (void*)data;
+	buffer.iov_len = len;
+}
+
+static int32 sSendv( int32 fd, t_send_buffer* buffers, int32 count ){
+	struct msghdr msg = {};
+
+	msg.msg_iov = buffers;
+	msg.msg_iovlen = count;
+
+	return (int32)sendmsg( fd, &msg, MSG_NOSIGNAL );
+}
+#endif
+
+/// Maximum number of buffers passed to a single sSendv call
+#define SEND_BUFFERS_MAX 64
+
+/// Shared packet in the write queue of a session
+struct s_wfifo_shared {
+	size_t offset; ///< Number of bytes in wdata that have to be sent before this packet
+	size_t pos; ///< Number of bytes of this packet that were already sent
+	t_shared_packet packet;
+};
+
+/// Shared packets of each session in the order they have to be sent
+static std::vector<s_wfifo_shared> session_shared[MAXCONN];
+
 #ifndef SOCKET_EPOLL
 	// Select based Event Dispatcher
 	fd_set readfds;
@@ -249,9 +315,15 @@ static size_t socket_max_client_packet = USHRT_MAX;
 // Data I/O statistics
 static size_t socket_data_i = 0, socket_data_ci = 0, socket_data_qi = 0;
 static size_t socket_data_o = 0, socket_data_co = 0, socket_data_qo = 0;
+static size_t socket_data_po = 0; // packets queued for clients
+static size_t socket_data_so = 0; // send calls
+static size_t socket_data_ticks = 0; // main loop iterations
 static time_t socket_data_last_tick = 0;
 #endif
 
+// Only send to clients once per main loop iteration, after the timers were executed
+static bool send_coalesce = false;
+
 // initial recv buffer size (this will also be the max. size)
 // biggest known packet: S 0153 <len>.w <emblem data>.?B -> 24x24 256 color .bmp (0153 + len.w + 1618/1654/1756 bytes)
 #define RFIFO_SIZE (2*1024)
@@ -405,41 +477,120 @@ int32 recv_to_fifo(int32 fd)
 	return 0;
 }
 
-int32 send_from_fifo(int32 fd)
+/**
+ * Collects the pending data of a session, the write fifo interleaved with its shared packets.
+ * @param fd: Session
+ * @param buffers: Array of at least SEND_BUFFERS_MAX buffers that are filled
+ * @return Number of buffers that were filled
+ */
+static int32 send_fifo_buffers( int32 fd, t_send_buffer* buffers )
 {
-	int32 len;
+	struct socket_data* s = session[fd];
+	std::vector<s_wfifo_shared>& shared = session_shared[fd];
+	int32 count = 0;
+	size_t cur = 0;
+	size_t i;
+
+	// An entry can take two buffers, the gap before it and the packet itself,
+	// and one more buffer has to be left for the rest of the write fifo
+	for( i = 0; i < shared.size() && count + 3 <= SEND_BUFFERS_MAX; i++ ){
+		s_wfifo_shared& entry = shared[i];
+
+		if( entry.offset > cur ){
+			send_buffer_set( buffers[count++], s->wdata + cur, entry.offset - cur );
+			cur = entry.offset;
+		}
 
-	if( !session_isValid(fd) )
-		return -1;
+		send_buffer_set( buffers[count++], entry.packet->data() + entry.pos, entry.packet->size() - entry.pos );
+	}
 
-	if( session[fd]->wdata_size == 0 )
-		return 0; // nothing to send
+	if( i == shared.size() && cur < s->wdata_size ){
+		send_buffer_set( buffers[count++], s->wdata + cur, s->wdata_size - cur );
+	}
+
+	return count;
+}
+
+/**
+ * Removes the data that was sent from the write fifo and the shared packets of a session.
+ * @param fd: Session
+ * @param len: Number of bytes that were sent
+ */
+static void send_fifo_consume( int32 fd, size_t len )
+{
+	struct socket_data* s = session[fd];
+	std::vector<s_wfifo_shared>& shared = session_shared[fd];
+
+	// Walk the queue in the same order to find out what was sent
+	size_t remaining = len;
+	size_t done = 0;
+	size_t cur = 0;
+
+	for( s_wfifo_shared& entry : shared ){
+		size_t take = std::min( entry.offset - cur, remaining );
+
+		cur += take;
+		remaining -= take;
+
+		if( cur < entry.offset ){
+			break;
+		}
+
+		take = std::min( entry.packet->size() - entry.pos, remaining );
+		entry.pos += take;
+		remaining -= take;
+		s->wshared_size -= take;
+
+		if( entry.pos < entry.packet->size() ){
+			break;
+		}
+
+		done++;
+	}
+
+	if( done == shared.size() ){
+		cur += remaining;
+	}
+
+	shared.erase( shared.begin(), shared.begin() + done );
+
+	for( s_wfifo_shared& entry : shared ){
+		entry.offset -= cur;
+	}
 
-	len = sSend(fd, (const char *) session[fd]->wdata, (int32)session[fd]->wdata_size, MSG_NOSIGNAL);
+	// shift unsent data to the beginning of the queue
+	if( cur < s->wdata_size )
+		memmove(s->wdata, s->wdata + cur, s->wdata_size - cur);
 
+	s->wdata_size -= cur;
+}
+
+/**
+ * Handles the result of a send operation of a session.
+ * @param fd: Session
+ * @param len: Number of bytes that were sent or SOCKET_ERROR
+ * @param error: Error code if the send failed
+ */
+static void send_fifo_done( int32 fd, int32 len, int32 error )
+{
 	if( len == SOCKET_ERROR )
 	{//An exception has occured
-		if( sErrno != S_EWOULDBLOCK ) {
+		if( error != S_EWOULDBLOCK ) {
 			//ShowDebug("send_from_fifo: %s, ending connection #%d\n", error_msg(), fd);
 #ifdef SHOW_SERVER_STATS
-			socket_data_qo -= session[fd]->wdata_size;
+			socket_data_qo -= session[fd]->wdata_size + session[fd]->wshared_size;
 #endif
 			session[fd]->wdata_size = 0; //Clear the send queue as we can't send anymore. [Skotlex]
+			session[fd]->wshared_size = 0;
+			session_shared[fd].clear();
 			set_eof(fd);
 		}
-		return 0;
+		return;
 	}
 
 	if( len > 0 )
 	{
 		session[fd]->wdata_tick = last_tick;
-
-		// some data could not be transferred?
-		// shift unsent data to the beginning of the queue
-		if( (size_t)len < session[fd]->wdata_size )
-			memmove(session[fd]->wdata, session[fd]->wdata + len, session[fd]->wdata_size - len);
-
-		session[fd]->wdata_size -= len;
 #ifdef SHOW_SERVER_STATS
 		socket_data_o += len;
 		socket_data_qo -= len;
@@ -449,6 +600,45 @@ int32 send_from_fifo(int32 fd)
 		}
 #endif
 	}
+}
+
+int32 send_from_fifo(int32 fd)
+{
+	int32 len;
+
+	if( !session_isValid(fd) )
+		return -1;
+
+	if( session[fd]->wdata_size == 0 && session[fd]->wshared_size == 0 )
+		return 0; // nothing to send
+
+	if( session[fd]->wshared_size > 0 ){
+		// Send the write fifo together with the shared packets in one call
+		t_send_buffer buffers[SEND_BUFFERS_MAX];
+		int32 count = send_fifo_buffers( fd, buffers );
+
+		len = sSendv( fd, buffers, count );
+
+		if( len > 0 ){
+			send_fifo_consume( fd, len );
+		}
+	}else{
+		len = sSend(fd, (const char *) session[fd]->wdata, (int32)session[fd]->wdata_size, MSG_NOSIGNAL);
+
+		// some data could not be transferred?
+		// shift unsent data to the beginning of the queue
+		if( len > 0 ){
+			if( (size_t)len < session[fd]->wdata_size )
+				memmove(session[fd]->wdata, session[fd]->wdata + len, session[fd]->wdata_size - len);
+
+			session[fd]->wdata_size -= len;
+		}
+	}
+#ifdef SHOW_SERVER_STATS
+	socket_data_so++;
+#endif
+
+	send_fifo_done( fd, len, len == SOCKET_ERROR ? sErrno : 0 );
 
 	return 0;
 }
@@ -467,6 +657,682 @@ void flush_fifos(void)
 		flush_fifo(i);
 }
 
+#ifdef SOCKET_IO_URING
+/*======================================
+ *	CORE : io_uring based Event Dispatcher
+ *--------------------------------------*/
+// Receives are multishot requests that read into a ring of kernel selected buffers
+// and are copied into the read fifo. The sends of a cycle are submitted together
+// and finished before returning, so the write fifos are never changed while the
+// kernel reads from them.
+
+/// Number of submission queue entries, the completion queue is four times as big
+#define URING_ENTRIES 4096
+/// Number of buffers the kernel can receive into, has to be a power of 2
+#define URING_BUFFER_COUNT 1024
+/// Size of a single receive buffer
+#define URING_BUFFER_SIZE (4*1024)
+/// Buffer group of the receive buffers
+#define URING_BUFFER_GROUP 0
+
+enum e_uring_op : uint8 {
+	URING_OP_RECV = 1,
+	URING_OP_POLL,
+	URING_OP_SEND,
+	URING_OP_CANCEL,
+};
+
+/// io_uring state of a session
+struct s_uring_session {
+	uint32 generation; ///< Increased when the socket is closed, completions of older requests are ignored
+	uint64 request; ///< User data of the active receive or poll request, 0 if there is none
+	bool paused; ///< Receiving was canceled, because the read fifo is full
+	std::vector<uint8> pending; ///< Received data that did not fit into the read fifo yet
+};
+
+/// Send request of the current batch
+struct s_uring_send {
+	int32 fd;
+	int32 result;
+	struct msghdr msg;
+	t_send_buffer buffers[SEND_BUFFERS_MAX];
+};
+
+static struct s_uring {
+	int32 fd;
+	// submission queue
+	uint32* sq_head;
+	uint32* sq_tail;
+	uint32 sq_mask;
+	uint32 sq_entries;
+	uint32* sq_array;
+	struct io_uring_sqe* sqes;
+	uint32 sq_queued; ///< Entries that were not submitted yet
+	// completion queue
+	uint32* cq_head;
+	uint32* cq_tail;
+	uint32 cq_mask;
+	struct io_uring_cqe* cqes;
+	// mappings
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	// receive buffers, the ring tail overlays the reserved field of the first entry
+	struct io_uring_buf* buf_ring;
+	uint8* buffers;
+	uint16 buf_tail;
+} uring = { SOCKET_ERROR };
+
+static bool uring_enabled = false; ///< io_uring was selected in the configuration
+static bool uring_active = false; ///< io_uring is used as event dispatcher
+static bool uring_filled = false; ///< pending data was moved into a read fifo and has to be parsed
+static std::vector<int32> uring_unarmed; ///< Sessions that could not start receiving, because the submission queue was full
+static s_uring_session uring_sessions[MAXCONN];
+static std::vector<s_uring_send> uring_sends;
+static size_t uring_sends_pending = 0;
+
+static int32 uring_enter( uint32 to_submit, uint32 min_complete, uint32 flags, t_tick timeout = -1 ){
+	struct io_uring_getevents_arg arg = {};
+	struct timespec ts;
+	int32 ret;
+
+	if( timeout >= 0 ){
+		ts.tv_sec = (time_t)( timeout / 1000 );
+		ts.tv_nsec = (long)( timeout % 1000 * 1000000 );
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (uint64)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	ret = (int32)syscall( __NR_io_uring_enter, uring.fd, to_submit, min_complete, flags, timeout >= 0 ? &arg : nullptr, timeout >= 0 ? sizeof( arg ) : 0 );
+
+	if( ret > 0 ){
+		uring.sq_queued -= std::min( (uint32)ret, uring.sq_queued );
+	}
+
+	return ret;
+}
+
+/// Submits all queued entries without waiting for completions
+static void uring_submit( void ){
+	while( uring.sq_queued > 0 ){
+		if( uring_enter( uring.sq_queued, 0, 0 ) < 0 && errno != EINTR ){
+			ShowError( "uring_submit: Failed to submit %u requests: %s\n", uring.sq_queued, error_msg() );
+			break;
+		}
+	}
+}
+
+/// Returns a free submission queue entry or nullptr, if the queue is full and could not be submitted
+static struct io_uring_sqe* uring_get_sqe( void ){
+	uint32 tail = *uring.sq_tail;
+
+	if( tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE ) >= uring.sq_entries ){
+		// queue is full
+		uring_submit();
+
+		// The queued entries are still owned by the kernel
+		if( tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE ) >= uring.sq_entries ){
+			return nullptr;
+		}
+	}
+
+	uint32 index = tail & uring.sq_mask;
+	struct io_uring_sqe* sqe = &uring.sqes[index];
+
+	memset( sqe, 0, sizeof( *sqe ) );
+	uring.sq_array[index] = index;
+	__atomic_store_n( uring.sq_tail, tail + 1, __ATOMIC_RELEASE );
+	uring.sq_queued++;
+
+	return sqe;
+}
+
+static uint64 uring_data( e_uring_op op, int32 fd ){
+	return ( (uint64)op << 56 ) | ( (uint64)( uring_sessions[fd].generation & 0xFFFFFF ) << 32 ) | (uint32)fd;
+}
+
+/// Gives a receive buffer back to the kernel
+static void uring_recycle( uint16 bid ){
+	// io_uring_buf_ring::bufs is not usable in C++, its offset differs from the kernel's
+	struct io_uring_buf* buf = &uring.buf_ring[uring.buf_tail & ( URING_BUFFER_COUNT - 1 )];
+
+	buf->addr = (uint64)(uintptr_t)( uring.buffers + (size_t)bid * URING_BUFFER_SIZE );
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = bid;
+	uring.buf_tail++;
+	__atomic_store_n( &reinterpret_cast<struct io_uring_buf_ring*>( uring.buf_ring )->tail, uring.buf_tail, __ATOMIC_RELEASE );
+}
+
+/// Starts receiving on a session
+static void uring_arm( int32 fd ){
+	s_uring_session& us = uring_sessions[fd];
+	struct io_uring_sqe* sqe = uring_get_sqe();
+
+	if( sqe == nullptr ){
+		// Retried before the next wait
+		uring_unarmed.push_back( fd );
+		return;
+	}
+
+	sqe->fd = fd;
+
+	if( session[fd]->func_recv == recv_to_fifo ){
+		sqe->opcode = IORING_OP_RECV;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BUFFER_GROUP;
+		us.request = uring_data( URING_OP_RECV, fd );
+	}else{
+		// Other receive functions (like accepting connections) read on their own, only wait for the socket to become readable
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+		us.request = uring_data( URING_OP_POLL, fd );
+	}
+
+	sqe->user_data = us.request;
+}
+
+/// Cancels the active request of a session
+static void uring_cancel( int32 fd ){
+	struct io_uring_sqe* sqe = uring_get_sqe();
+
+	// The request keeps running, its completions are ignored after removing the socket
+	if( sqe == nullptr ){
+		return;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = uring_sessions[fd].request;
+	sqe->user_data = (uint64)URING_OP_CANCEL << 56;
+}
+
+/// Removes a socket that is about to be closed
+static void uring_remove( int32 fd ){
+	s_uring_session& us = uring_sessions[fd];
+
+	// Queued requests refer to the socket number, which can be reused right after closing it
+	uring_submit();
+
+	if( us.request != 0 ){
+		uring_cancel( fd );
+		us.request = 0;
+	}
+
+	us.generation++;
+	us.paused = false;
+	us.pending.clear();
+	us.pending.shrink_to_fit();
+}
+
+/// Copies received data into the read fifo, data that does not fit is kept until the fifo was parsed
+static void uring_receive( int32 fd, const uint8* data, size_t len ){
+	struct socket_data* s = session[fd];
+	s_uring_session& us = uring_sessions[fd];
+	size_t space = us.pending.empty() ? RFIFOSPACE( fd ) : 0;
+	size_t copy = std::min( space, len );
+
+	if( copy > 0 ){
+		memcpy( s->rdata + s->rdata_size, data, copy );
+		s->rdata_size += copy;
+#ifdef SHOW_SERVER_STATS
+		socket_data_qi += copy;
+#endif
+	}
+
+	if( copy < len ){
+		us.pending.insert( us.pending.end(), data + copy, data + len );
+
+		// Stop receiving until the data was parsed, the same as if the socket was not read
+		if( !us.paused && us.request != 0 ){
+			us.paused = true;
+			uring_cancel( fd );
+		}
+	}
+
+	s->rdata_tick = last_tick;
+#ifdef SHOW_SERVER_STATS
+	socket_data_i += len;
+	if( !s->flag.server ){
+		socket_data_ci += len;
+	}
+#endif
+}
+
+/// Moves pending data into the read fifo and resumes receiving once all of it was moved
+static void uring_fill_fifo( int32 fd ){
+	s_uring_session& us = uring_sessions[fd];
+
+	if( us.pending.empty() || !session_isActive( fd ) ){
+		return;
+	}
+
+	struct socket_data* s = session[fd];
+	size_t copy = std::min( RFIFOSPACE( fd ), us.pending.size() );
+
+	if( copy == 0 ){
+		return;
+	}
+
+	memcpy( s->rdata + s->rdata_size, us.pending.data(), copy );
+	s->rdata_size += copy;
+	us.pending.erase( us.pending.begin(), us.pending.begin() + copy );
+	uring_filled = true;
+#ifdef SHOW_SERVER_STATS
+	socket_data_qi += copy;
+#endif
+
+	if( us.pending.empty() && us.paused ){
+		us.paused = false;
+
+		// otherwise it is armed again once the cancellation completed
+		if( us.request == 0 ){
+			uring_arm( fd );
+		}
+	}
+}
+
+static void uring_complete( const struct io_uring_cqe& cqe ){
+	e_uring_op op = (e_uring_op)( cqe.user_data >> 56 );
+	int32 fd = (int32)( cqe.user_data & 0xFFFFFFFF );
+
+	if( op == URING_OP_SEND ){
+		// fd is the index of the request in the batch
+		uring_sends[fd].result = cqe.res;
+		uring_sends_pending--;
+		return;
+	}
+
+	if( op != URING_OP_RECV && op != URING_OP_POLL ){
+		return;
+	}
+
+	bool more = ( cqe.flags & IORING_CQE_F_MORE ) != 0;
+	bool buffer = ( cqe.flags & IORING_CQE_F_BUFFER ) != 0;
+	uint16 bid = (uint16)( cqe.flags >> IORING_CQE_BUFFER_SHIFT );
+
+	if( fd <= 0 || fd >= MAXCONN || uring_sessions[fd].request != cqe.user_data || session[fd] == nullptr ){
+		// Completion of a request of an already closed socket
+		if( buffer ){
+			uring_recycle( bid );
+		}
+		return;
+	}
+
+	s_uring_session& us = uring_sessions[fd];
+
+	if( !more ){
+		us.request = 0;
+	}
+
+	if( op == URING_OP_RECV ){
+		if( cqe.res > 0 ){
+			if( session_isActive( fd ) ){
+				uring_receive( fd, uring.buffers + (size_t)bid * URING_BUFFER_SIZE, cqe.res );
+			}
+		}else if( cqe.res == 0 ){
+			//Normal connection end.
+			set_eof( fd );
+		}else if( cqe.res != -ENOBUFS && cqe.res != -ECANCELED ){
+			//ShowDebug("uring_complete: %s, closing connection #%d\n", strerror(-cqe.res), fd);
+			set_eof( fd );
+		}
+
+		if( buffer ){
+			uring_recycle( bid );
+		}
+	}else{
+		if( cqe.res < 0 ){
+			if( cqe.res != -ECANCELED ){
+				set_eof( fd );
+			}
+		}else if( ( cqe.res & ( POLLERR | POLLHUP ) ) || !( cqe.res & POLLIN ) ){
+			// Got Error on this connection
+			set_eof( fd );
+		}else{
+			// data waiting
+			session[fd]->func_recv( fd );
+		}
+	}
+
+	if( us.request == 0 && !us.paused && session_isActive( fd ) ){
+		uring_arm( fd );
+	}
+}
+
+/// Processes all available completions
+static void uring_process( void ){
+	uint32 head = *uring.cq_head;
+
+	while( head != __atomic_load_n( uring.cq_tail, __ATOMIC_ACQUIRE ) ){
+		struct io_uring_cqe cqe = uring.cqes[head & uring.cq_mask];
+
+		__atomic_store_n( uring.cq_head, ++head, __ATOMIC_RELEASE );
+		uring_complete( cqe );
+	}
+}
+
+/// Waits for completions until the next tick and processes them
+static int32 uring_dispatch( t_tick next ){
+	if( !uring_unarmed.empty() ){
+		std::vector<int32> unarmed;
+
+		unarmed.swap( uring_unarmed );
+
+		for( int32 fd : unarmed ){
+			s_uring_session& us = uring_sessions[fd];
+
+			if( us.request == 0 && !us.paused && session_isActive( fd ) ){
+				uring_arm( fd );
+			}
+		}
+	}
+
+	// Do not wait, if there is data left in a read fifo that was not parsed yet
+	int32 ret = uring_enter( uring.sq_queued, 1, IORING_ENTER_GETEVENTS, uring_filled ? 0 : next );
+
+	uring_filled = false;
+
+	if( ret < 0 && errno != ETIME && errno != EBUSY ){
+		if( errno != EINTR ){
+			ShowFatalError( "do_sockets: io_uring_enter() failed, %s!\n", error_msg() );
+			exit( EXIT_FAILURE );
+		}
+
+		return SOCKET_ERROR; // interrupted by a signal
+	}
+
+	last_tick = time(nullptr);
+
+	uring_process();
+
+	return 0;
+}
+
+#ifdef SEND_SHORTLIST
+/**
+ * Sends the write fifos of all sessions in the send shortlist with one submission.
+ * Sessions that still have data left afterwards are handled by their func_send.
+ * @param flush_clients: Whether client sessions should be sent
+ */
+static void uring_send_shortlist( bool flush_clients ){
+	uring_sends.clear();
+	uring_sends.reserve( send_shortlist_count );
+
+	for( size_t i = 0; i < send_shortlist_count; i++ ){
+		int32 fd = send_shortlist_array[i];
+		struct socket_data* s = session[fd];
+
+		if( fd <= 0 || fd >= MAXCONN || s == nullptr || s->func_send != send_from_fifo ){
+			continue;
+		}
+
+		if( ( s->wdata_size == 0 && s->wshared_size == 0 ) || !( flush_clients || s->flag.server || s->flag.eof ) ){
+			continue;
+		}
+
+		uring_sends.emplace_back();
+
+		s_uring_send& send = uring_sends.back();
+
+		send.fd = fd;
+		send.result = 0;
+		memset( &send.msg, 0, sizeof( send.msg ) );
+		send.msg.msg_iov = send.buffers;
+		send.msg.msg_iovlen = send_fifo_buffers( fd, send.buffers );
+	}
+
+	if( uring_sends.empty() ){
+		return;
+	}
+
+	for( size_t i = 0; i < uring_sends.size(); i++ ){
+		struct io_uring_sqe* sqe = uring_get_sqe();
+
+		if( sqe == nullptr ){
+			// The remaining sessions keep their data queued for their func_send
+			uring_sends.resize( i );
+			break;
+		}
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = uring_sends[i].fd;
+		sqe->addr = (uint64)(uintptr_t)&uring_sends[i].msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = ( (uint64)URING_OP_SEND << 56 ) | (uint32)i;
+	}
+
+	if( uring_sends.empty() ){
+		return;
+	}
+
+	uring_sends_pending = uring_sends.size();
+
+	// The sockets are non-blocking, so the sends complete right away
+	while( uring_sends_pending > 0 ){
+		if( uring_enter( uring.sq_queued, 1, IORING_ENTER_GETEVENTS ) < 0 && errno != EINTR && errno != EBUSY ){
+			ShowFatalError( "uring_send_shortlist: io_uring_enter() failed, %s!\n", error_msg() );
+			exit( EXIT_FAILURE );
+		}
+
+		uring_process();
+	}
+
+	for( s_uring_send& send : uring_sends ){
+		int32 fd = send.fd;
+		int32 len = send.result < 0 ? SOCKET_ERROR : send.result;
+
+		if( !session_isValid( fd ) ){
+			continue;
+		}
+
+		if( len > 0 ){
+			send_fifo_consume( fd, len );
+		}
+#ifdef SHOW_SERVER_STATS
+		socket_data_so++;
+#endif
+
+		send_fifo_done( fd, len, -send.result );
+	}
+}
+#endif
+
+/// Checks if the kernel supports multishot receives on non-blocking sockets
+static bool uring_probe( void ){
+	int32 pair[2];
+	bool supported = false;
+
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, pair ) != 0 ){
+		return false;
+	}
+
+	set_nonblocking( pair[0], 1 );
+	set_nonblocking( pair[1], 1 );
+
+	struct io_uring_sqe* sqe = uring_get_sqe();
+
+	if( sqe == nullptr ){
+		close( pair[0] );
+		close( pair[1] );
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->fd = pair[0];
+	sqe->user_data = 1;
+
+	uring_submit();
+
+	if( write( pair[1], "", 1 ) == 1 ){
+		shutdown( pair[0], SHUT_RDWR );
+
+		// Collect the data and the end of the stream
+		for( bool done = false; !done; ){
+			if( uring_enter( 0, 1, IORING_ENTER_GETEVENTS, 1000 ) < 0 && errno != EINTR ){
+				break;
+			}
+
+			uint32 head = *uring.cq_head;
+
+			while( head != __atomic_load_n( uring.cq_tail, __ATOMIC_ACQUIRE ) ){
+				struct io_uring_cqe* cqe = &uring.cqes[head & uring.cq_mask];
+
+				if( cqe->res == 1 && ( cqe->flags & IORING_CQE_F_MORE ) ){
+					supported = true;
+				}
+
+				if( cqe->flags & IORING_CQE_F_BUFFER ){
+					uring_recycle( (uint16)( cqe->flags >> IORING_CQE_BUFFER_SHIFT ) );
+				}
+
+				if( !( cqe->flags & IORING_CQE_F_MORE ) ){
+					done = true;
+				}
+
+				__atomic_store_n( uring.cq_head, ++head, __ATOMIC_RELEASE );
+			}
+		}
+	}
+
+	close( pair[0] );
+	close( pair[1] );
+
+	return supported;
+}
+
+static void uring_final( void ){
+	if( uring.buffers != nullptr ){
+		munmap( uring.buffers, (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE );
+	}
+
+	if( uring.buf_ring != nullptr ){
+		munmap( uring.buf_ring, URING_BUFFER_COUNT * sizeof( struct io_uring_buf ) );
+	}
+
+	if( uring.sqes != nullptr ){
+		munmap( uring.sqes, uring.sqes_size );
+	}
+
+	if( uring.cq_ring != nullptr && uring.cq_ring != uring.sq_ring ){
+		munmap( uring.cq_ring, uring.cq_ring_size );
+	}
+
+	if( uring.sq_ring != nullptr ){
+		munmap( uring.sq_ring, uring.sq_ring_size );
+	}
+
+	if( uring.fd != SOCKET_ERROR ){
+		close( uring.fd );
+	}
+
+	memset( &uring, 0, sizeof( uring ) );
+	uring.fd = SOCKET_ERROR;
+	uring_active = false;
+	uring_sends.clear();
+	uring_sends.shrink_to_fit();
+	uring_unarmed.clear();
+}
+
+/// Sets up the rings and the receive buffers
+static bool uring_init( void ){
+	struct io_uring_params params = {};
+
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_ENTRIES * 4;
+
+	uring.fd = (int32)syscall( __NR_io_uring_setup, URING_ENTRIES, &params );
+
+	if( uring.fd < 0 ){
+		uring.fd = SOCKET_ERROR;
+		ShowWarning( "uring_init: io_uring_setup failed: %s\n", error_msg() );
+		return false;
+	}
+
+	// 5.11 or newer
+	if( !( params.features & IORING_FEAT_SINGLE_MMAP ) || !( params.features & IORING_FEAT_NODROP ) || !( params.features & IORING_FEAT_EXT_ARG ) ){
+		ShowWarning( "uring_init: The kernel does not support the required io_uring features.\n" );
+		uring_final();
+		return false;
+	}
+
+	uring.sq_ring_size = std::max( params.sq_off.array + params.sq_entries * sizeof( uint32 ), params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe ) );
+	uring.sq_ring = mmap( nullptr, uring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING );
+	uring.sqes_size = params.sq_entries * sizeof( struct io_uring_sqe );
+	uring.sqes = (struct io_uring_sqe*)mmap( nullptr, uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES );
+
+	if( uring.sq_ring == MAP_FAILED || uring.sqes == MAP_FAILED ){
+		ShowWarning( "uring_init: Failed to map the rings: %s\n", error_msg() );
+		if( uring.sq_ring == MAP_FAILED ) uring.sq_ring = nullptr;
+		if( uring.sqes == MAP_FAILED ) uring.sqes = nullptr;
+		uring_final();
+		return false;
+	}
+
+	uint8* sq = (uint8*)uring.sq_ring;
+
+	uring.cq_ring = uring.sq_ring;
+	uring.cq_ring_size = uring.sq_ring_size;
+	uring.sq_head = (uint32*)( sq + params.sq_off.head );
+	uring.sq_tail = (uint32*)( sq + params.sq_off.tail );
+	uring.sq_mask = *(uint32*)( sq + params.sq_off.ring_mask );
+	uring.sq_entries = *(uint32*)( sq + params.sq_off.ring_entries );
+	uring.sq_array = (uint32*)( sq + params.sq_off.array );
+	uring.cq_head = (uint32*)( sq + params.cq_off.head );
+	uring.cq_tail = (uint32*)( sq + params.cq_off.tail );
+	uring.cq_mask = *(uint32*)( sq + params.cq_off.ring_mask );
+	uring.cqes = (struct io_uring_cqe*)( sq + params.cq_off.cqes );
+
+	// Receive buffers, 5.19 or newer
+	size_t ring_size = URING_BUFFER_COUNT * sizeof( struct io_uring_buf );
+	void* buf_ring = mmap( nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	void* buffers = mmap( nullptr, (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+	uring.buf_ring = buf_ring != MAP_FAILED ? (struct io_uring_buf*)buf_ring : nullptr;
+	uring.buffers = buffers != MAP_FAILED ? (uint8*)buffers : nullptr;
+
+	if( uring.buf_ring == nullptr || uring.buffers == nullptr ){
+		ShowWarning( "uring_init: Failed to allocate the receive buffers: %s\n", error_msg() );
+		uring_final();
+		return false;
+	}
+
+	struct io_uring_buf_reg reg = {};
+
+	reg.ring_addr = (uint64)(uintptr_t)uring.buf_ring;
+	reg.ring_entries = URING_BUFFER_COUNT;
+	reg.bgid = URING_BUFFER_GROUP;
+
+	if( syscall( __NR_io_uring_register, uring.fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) != 0 ){
+		ShowWarning( "uring_init: Failed to register the receive buffers: %s\n", error_msg() );
+		uring_final();
+		return false;
+	}
+
+	for( uint16 i = 0; i < URING_BUFFER_COUNT; i++ ){
+		uring_recycle( i );
+	}
+
+	// Multishot receives, 6.0 or newer
+	if( !uring_probe() ){
+		ShowWarning( "uring_init: The kernel does not support multishot receives.\n" );
+		uring_final();
+		return false;
+	}
+
+	uring_active = true;
+
+	return true;
+}
+#endif
+
 /*======================================
  *	CORE : Connection functions
  *--------------------------------------*/
@@ -526,6 +1392,11 @@ int32 connect_client(int32 listen_fd)
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(client_address.sin_addr.s_addr);
 
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_arm(fd);
+#endif
+
 	return fd;
 }
 
@@ -595,6 +1466,11 @@ int32 make_listen_bind(uint32 ip, uint16 port)
 	session[fd]->rdata_tick = 0; // disable timeouts on this socket
 	session[fd]->wdata_tick = 0;
 
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_arm(fd);
+#endif
+
 	return fd;
 }
 
@@ -720,6 +1596,11 @@ int32 make_connection(uint32 ip, uint16 port, bool silent,int32 timeout) {
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(remote_address.sin_addr.s_addr);
 
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_arm(fd);
+#endif
+
 	return fd;
 }
 
@@ -744,13 +1625,15 @@ static void delete_session(int32 fd)
 	{
 #ifdef SHOW_SERVER_STATS
 		socket_data_qi -= session[fd]->rdata_size - session[fd]->rdata_pos;
-		socket_data_qo -= session[fd]->wdata_size;
+		socket_data_qo -= session[fd]->wdata_size + session[fd]->wshared_size;
 #endif
 		aFree(session[fd]->rdata);
 		aFree(session[fd]->wdata);
 		aFree(session[fd]->session_data);
 		aFree(session[fd]);
 		session[fd] = nullptr;
+		session_shared[fd].clear();
+		session_shared[fd].shrink_to_fit();
 	}
 }
 
@@ -860,7 +1743,7 @@ int32 WFIFOSET(int32 fd, size_t len)
 			return 0;
 		}
 
-		if( s->wdata_size+len > WFIFO_MAX ) {// reached maximum write fifo size
+		if( s->wdata_size+s->wshared_size+len > WFIFO_MAX ) {// reached maximum write fifo size
 			ShowError("WFIFOSET: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%" PRIuPTR ", ip=%lu.%lu.%lu.%lu).\n", fd, WFIFOW(fd,0), len, CONVIP(s->client_addr));
 			set_eof(fd);
 			return 0;
@@ -870,6 +1753,8 @@ int32 WFIFOSET(int32 fd, size_t len)
 	s->wdata_size += len;
 #ifdef SHOW_SERVER_STATS
 	socket_data_qo += len;
+	if( !s->flag.server )
+		socket_data_po++;
 #endif
 	//If the interserver has 200% of its normal size full, flush the data.
 	if( s->flag.server && s->wdata_size >= 2*FIFOSIZE_SERVERLINK )
@@ -889,7 +1774,70 @@ int32 WFIFOSET(int32 fd, size_t len)
 	return 0;
 }
 
-int32 do_sockets(t_tick next)
+/**
+ * Creates a packet that can be queued for several sessions with WFIFOSHARE.
+ * @param buf: Packet data
+ * @param len: Length of the packet
+ * @return Shared packet
+ */
+t_shared_packet socket_shared_packet( const void* buf, size_t len ){
+	const uint8* data = static_cast<const uint8*>( buf );
+
+	return std::make_shared<const std::vector<uint8>>( data, data + len );
+}
+
+/**
+ * Queues a shared packet for a client session.
+ * Same as WFIFOHEAD, copying the packet and WFIFOSET, but the data is only referenced and
+ * gathered from all queued packets when the session is sent.
+ * @param fd: Session
+ * @param packet: Packet to send
+ * @return 0
+ */
+int32 WFIFOSHARE( int32 fd, const t_shared_packet& packet ){
+	struct socket_data* s = session[fd];
+
+	if( !session_isValid( fd ) || s->wdata == nullptr || packet == nullptr || packet->empty() ){
+		return 0;
+	}
+
+	size_t len = packet->size();
+
+	// Inter-server links do not send the same packet to many sessions
+	if( s->flag.server ){
+		WFIFOHEAD( fd, len );
+		memcpy( WFIFOP( fd, 0 ), packet->data(), len );
+		return WFIFOSET( fd, len );
+	}
+
+	if( len > socket_max_client_packet ){// see declaration of socket_max_client_packet for details
+		ShowError( "WFIFOSHARE: Dropped too large client packet 0x%04x (length=%" PRIuPTR ", max=%" PRIuPTR ").\n", *(uint16*)packet->data(), len, socket_max_client_packet );
+		return 0;
+	}
+
+	if( s->wdata_size + s->wshared_size + len > WFIFO_MAX ){// reached maximum write fifo size
+		ShowError( "WFIFOSHARE: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%" PRIuPTR ", ip=%lu.%lu.%lu.%lu).\n", fd, *(uint16*)packet->data(), len, CONVIP( s->client_addr ) );
+		set_eof( fd );
+		return 0;
+	}
+
+	session_shared[fd].push_back( { s->wdata_size, 0, packet } );
+	s->wshared_size += len;
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo += len;
+	socket_data_po++;
+#endif
+
+#ifdef SEND_SHORTLIST
+	send_shortlist_add_fd( fd );
+#endif
+
+	return 0;
+}
+
+/// Waits for the select or epoll based Event Dispatcher and calls the receive functions
+/// @return SOCKET_ERROR if interrupted by a signal
+static int32 socket_dispatch( t_tick next )
 {
 #ifndef SOCKET_EPOLL
 	fd_set rfd;
@@ -897,21 +1845,6 @@ int32 do_sockets(t_tick next)
 #endif
 	int32 ret,i;
 
-	// PRESEND Timers are executed before do_sendrecv and can send packets and/or set sessions to eof.
-	// Send remaining data and process client-side disconnects here.
-#ifdef SEND_SHORTLIST
-	send_shortlist_do_sends();
-#else
-	for (i = 1; i < fd_max; i++)
-	{
-		if(!session[i])
-			continue;
-
-		if(session[i]->wdata_size)
-			session[i]->func_send(i);
-	}
-#endif
-
 #ifndef SOCKET_EPOLL
 	// Select based Event Dispatcher
 
@@ -929,7 +1862,7 @@ int32 do_sockets(t_tick next)
 			ShowFatalError("do_sockets: select() failed, %s!\n", error_msg());
 			exit(EXIT_FAILURE);
 		}
-		return 0; // interrupted by a signal, just loop and try again
+		return SOCKET_ERROR; // interrupted by a signal
 	}
 #else
 	// Epoll based Event Dispatcher
@@ -942,7 +1875,7 @@ int32 do_sockets(t_tick next)
 			exit( EXIT_FAILURE );
 		}
 
-		return 0; // interrupted by a signal, just loop and try again
+		return SOCKET_ERROR; // interrupted by a signal
 	}
 #endif
 
@@ -988,16 +1921,52 @@ int32 do_sockets(t_tick next)
 	}
 #endif
 
+	return 0;
+}
+
+int32 do_sockets(t_tick next)
+{
+	int32 ret,i;
+
+	// PRESEND Timers are executed before do_sendrecv and can send packets and/or set sessions to eof.
+	// Send remaining data and process client-side disconnects here.
+	// With send_coalesce this is the only point where data is sent to clients.
+#ifdef SHOW_SERVER_STATS
+	socket_data_ticks++;
+#endif
+#ifdef SEND_SHORTLIST
+	send_shortlist_do_sends( true );
+#else
+	for (i = 1; i < fd_max; i++)
+	{
+		if(!session[i])
+			continue;
+
+		if(session[i]->wdata_size || session[i]->wshared_size)
+			session[i]->func_send(i);
+	}
+#endif
+
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		ret = uring_dispatch( next );
+	else
+#endif
+	ret = socket_dispatch( next );
+
+	if( ret == SOCKET_ERROR )
+		return 0; // interrupted by a signal, just loop and try again
+
 	// POSTSEND Send remaining data and handle eof sessions.
 #ifdef SEND_SHORTLIST
-	send_shortlist_do_sends();
+	send_shortlist_do_sends( !send_coalesce );
 #else
 	for (i = 1; i < fd_max; i++)
 	{
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if( ( session[i]->wdata_size || session[i]->wshared_size ) && ( !send_coalesce || session[i]->flag.server || session[i]->flag.eof ) )
 			session[i]->func_send(i);
 
 		if(session[i]->flag.eof) //func_send can't free a session, this is safe.
@@ -1023,6 +1992,11 @@ int32 do_sockets(t_tick next)
 			}
 		}
 
+#ifdef SOCKET_IO_URING
+		if( uring_active )
+			uring_fill_fifo(i);
+#endif
+
 		session[i]->func_parse(i);
 
 		if(!session[i])
@@ -1041,7 +2015,7 @@ int32 do_sockets(t_tick next)
 	{
 		char buf[1024];
 		
-		sprintf(buf, "In: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | Out: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | RAM: %.03f MB", socket_data_i/1024., socket_data_ci/1024., socket_data_qi/1024., socket_data_o/1024., socket_data_co/1024., socket_data_qo/1024., malloc_usage()/1024.);
+		sprintf(buf, "In: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | Out: %.03f kB/s (%.03f kB/s, Q: %.03f kB, %.01f pkt/tick, %.01f send/tick) | RAM: %.03f MB", socket_data_i/1024., socket_data_ci/1024., socket_data_qi/1024., socket_data_o/1024., socket_data_co/1024., socket_data_qo/1024., socket_data_po/(double)i64max(socket_data_ticks, 1), socket_data_so/(double)i64max(socket_data_ticks, 1), malloc_usage()/1024.);
 #ifdef _WIN32
 		SetConsoleTitle(buf);
 #else
@@ -1050,6 +2024,7 @@ int32 do_sockets(t_tick next)
 		socket_data_last_tick = last_tick;
 		socket_data_i = socket_data_ci = 0;
 		socket_data_o = socket_data_co = 0;
+		socket_data_po = socket_data_so = socket_data_ticks = 0;
 	}
 #endif
 
@@ -1316,6 +2291,16 @@ int32 socket_config_read(const char* cfgName)
 			if( stall_time < 3 )
 				stall_time = 3;/* a minimum is required to refrain it from killing itself */
 		}
+		else if (!strcmpi(w1, "send_coalesce"))
+			send_coalesce = config_switch(w2) != 0;
+		else if (!strcmpi(w1, "io_uring")) {
+#ifdef SOCKET_IO_URING
+			uring_enabled = config_switch(w2) != 0;
+#else
+			if( config_switch(w2) )
+				ShowWarning("socket_config_read: io_uring is not supported by this build, ignoring...\n");
+#endif
+		}
 #ifndef MINICORE
 		else if (!strcmpi(w1, "enable_ip_rules")) {
 			ip_rules = config_switch(w2);
@@ -1402,6 +2387,10 @@ void socket_final(void)
 	aFree(session[0]);
 	session[0] = nullptr;
 
+#ifdef SOCKET_IO_URING
+	uring_final();
+#endif
+
 #ifdef WIN32
 	// Shut down windows networking
 	if( WSACleanup() != 0 ){
@@ -1438,6 +2427,11 @@ void do_close(int32 fd)
 	epoll_ctl( epfd, EPOLL_CTL_DEL, fd, &epevent ); // removing the socket from epoll when it's being closed is not required but recommended
 #endif
 
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_remove(fd);
+#endif
+
 	sShutdown(fd, SHUT_RDWR); // Disallow further reads/writes
 	sClose(fd); // We don't really care if these closing functions return an error, we are just shutting down and not reusing this socket.
 	if (session[fd]) delete_session(fd);
@@ -1607,6 +2601,15 @@ void socket_init(void)
 
 	socket_config_read(SOCKET_CONF_FILENAME);
 
+#ifdef SOCKET_IO_URING
+	if( uring_enabled ){
+		if( uring_init() )
+			ShowInfo( "Server uses '" CL_WHITE "io_uring" CL_RESET "' as event dispatcher instead\n" );
+		else
+			ShowWarning( "socket_init: io_uring is not available, keeping the default event dispatcher.\n" );
+	}
+#endif
+
 	// initialise last send-receive tick
 	last_tick = time(nullptr);
 
@@ -1716,8 +2719,15 @@ void send_shortlist_add_fd(int32 fd)
 }
 
 // Do pending network sends and eof handling from the shortlist.
-void send_shortlist_do_sends()
+// If flush_clients is false, client sessions keep their data until the next call, unless they are eof.
+void send_shortlist_do_sends( bool flush_clients )
 {
+#ifdef SOCKET_IO_URING
+	// Send everything at once, func_send only handles what is left
+	if( uring_active )
+		uring_send_shortlist( flush_clients );
+#endif
+
 	for( int32 i = static_cast<int32>( send_shortlist_count - 1 ); i >= 0; --i ){
 		int32 fd = send_shortlist_array[i];
 		int32 idx = fd/32;
@@ -1744,7 +2754,7 @@ void send_shortlist_do_sends()
 		if( session[fd] )
 		{
 			// Send data
-			if( session[fd]->wdata_size )
+			if( ( session[fd]->wdata_size || session[fd]->wshared_size ) && ( flush_clients || session[fd]->flag.server || session[fd]->flag.eof ) )
 				session[fd]->func_send(fd);
 
 			// If it's been marked as eof, call the parse func on it so that
@@ -1754,7 +2764,7 @@ void send_shortlist_do_sends()
 
 			// If the session still exists, is not eof and has things left to
 			// be sent from it we'll re-add it to the shortlist.
-			if( session_isActive(fd) && session[fd]->wdata_size )
+			if( session_isActive(fd) && ( session[fd]->wdata_size || session[fd]->wshared_size ) )
 				send_shortlist_add_fd(fd);
 		}
 	}
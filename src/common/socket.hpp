@@ -5,6 +5,8 @@
 #define SOCKET_HPP
 
 #include <ctime>
+#include <memory>
+#include <vector>
 
 #include <config/core.hpp>
 
@@ -102,6 +104,7 @@ struct socket_data
 	uint8 *rdata, *wdata;
 	size_t max_rdata, max_wdata;
 	size_t rdata_size, wdata_size;
+	size_t wshared_size; // bytes of shared packets that are queued after or between wdata (see WFIFOSHARE)
 	size_t rdata_pos;
 	time_t rdata_tick; // time of last recv (for detecting timeouts); zero when timeout is disabled
 	time_t wdata_tick; // time of last send (for detecting timeouts);
@@ -138,6 +141,12 @@ int32 make_connection(uint32 ip, uint16 port, bool silent, int32 timeout);
 int32 _realloc_fifo( int32 fd, uint32 rfifo_size, uint32 wfifo_size, const char* file, int32 line, const char* func );
 int32 _realloc_writefifo( int32 fd, size_t addition, const char* file, int32 line, const char* func );
 int32 WFIFOSET(int32 fd, size_t len);
+
+/// Packet that is queued for several sessions without copying it into their write fifos
+typedef std::shared_ptr<const std::vector<uint8>> t_shared_packet;
+
+t_shared_packet socket_shared_packet( const void* buf, size_t len );
+int32 WFIFOSHARE( int32 fd, const t_shared_packet& packet );
 int32 RFIFOSKIP(int32 fd, size_t len);
 
 int32 do_sockets(t_tick next);
@@ -196,7 +205,7 @@ void set_eof(int32 fd);
 // sending done on it.
 void send_shortlist_add_fd(int32 fd);
 // Do pending network sends (and eof handling) from the shortlist.
-void send_shortlist_do_sends();
+void send_shortlist_do_sends( bool flush_clients );
 #endif
 
 // Reuseable global packet buffer to prevent too many allocations
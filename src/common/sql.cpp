@@ -11,13 +11,6 @@
 #include "showmsg.hpp"
 #include "timer.hpp"
 
-// MySQL 8.0 or later removed my_bool typedef.
-// Reintroduce it as a bandaid fix.
-// See https://bugs.mysql.com/?id=87337
-#if !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_VERSION_ID) && MYSQL_VERSION_ID >= 80001 && MYSQL_VERSION_ID != 80002
-#define my_bool bool
-#endif
-
 void ra_mysql_error_handler(uint32 ecode);
 
 int32 mysql_reconnect_type;
@@ -13,6 +13,13 @@
 
 #include <mysql.h>
 
+// MySQL 8.0 or later removed my_bool typedef.
+// Reintroduce it as a bandaid fix.
+// See https://bugs.mysql.com/?id=87337
+#if !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_VERSION_ID) && MYSQL_VERSION_ID >= 80001 && MYSQL_VERSION_ID != 80002
+#define my_bool bool
+#endif
+
 #include "cbasetypes.hpp"
 #include "strlib.hpp"
 
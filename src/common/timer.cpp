@@ -3,9 +3,13 @@
 
 #include "timer.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "cbasetypes.hpp"
 #include "db.hpp"
@@ -46,11 +50,76 @@ static int32 free_timer_list_pos = 0;
 // timer heap (binary heap of tid's)
 static BHEAP_VAR(int32, timer_heap);
 
+// active timer backend
+static e_timer_backend timer_backend = TIMER_BACKEND_HEAP;
+
+/*----------------------------
+ * 	Timing wheel
+ *----------------------------*/
+// Hierarchical timing wheel with a resolution of 1ms.
+// Level 0 holds the timers expiring within the next 256ms, every further level
+// covers 64 times the range of the previous one. Timers beyond the last level are
+// kept in an overflow list and redistributed whenever the last level wraps around.
+// Lists are intrusive doubly linked lists of tid's stored in timer_wheel_link.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL0_BITS 8
+#define TIMER_WHEELN_BITS 6
+#define TIMER_WHEEL0_SIZE (1 << TIMER_WHEEL0_BITS)
+#define TIMER_WHEELN_SIZE (1 << TIMER_WHEELN_BITS)
+#define TIMER_WHEEL0_MASK (TIMER_WHEEL0_SIZE - 1)
+#define TIMER_WHEELN_MASK (TIMER_WHEELN_SIZE - 1)
+/// Bit shift of the slot index for the given wheel level
+#define TIMER_WHEEL_SHIFT(level) (TIMER_WHEEL0_BITS + ((level) - 1) * TIMER_WHEELN_BITS)
+/// Index of the first list of the given wheel level
+#define TIMER_WHEEL_LIST(level) ((level) == 0 ? 0 : TIMER_WHEEL0_SIZE + ((level) - 1) * TIMER_WHEELN_SIZE)
+/// List of timers beyond the range of the last wheel level
+#define TIMER_WHEEL_OVERFLOW TIMER_WHEEL_LIST(TIMER_WHEEL_LEVELS)
+/// List of expired timers waiting to be executed
+#define TIMER_WHEEL_DUE (TIMER_WHEEL_OVERFLOW + 1)
+#define TIMER_WHEEL_LISTS (TIMER_WHEEL_DUE + 1)
+
+struct s_timer_wheel_link {
+	int32 prev;
+	int32 next;
+	int32 list; // -1 if not scheduled
+};
+
+struct s_timer_wheel_list {
+	int32 first;
+	int32 last;
+};
+
+static struct s_timer_wheel_link* timer_wheel_link = nullptr;
+static struct s_timer_wheel_list timer_wheel_lists[TIMER_WHEEL_LISTS];
+// occupied slots of level 0
+static uint64 timer_wheel_used[TIMER_WHEEL0_SIZE / 64];
+// all timers with a tick below this value were moved to the due list
+static t_tick timer_wheel_tick = 0;
+// number of timers stored in the wheel levels and the overflow list
+static int32 timer_wheel_count = 0;
+
 
 // server startup time
 time_t start_time;
 
 
+/*----------------------------
+ * 	Timer profiling
+ *----------------------------*/
+struct s_timer_profile {
+	uint64 calls;
+	uint64 total_time; // microseconds
+	uint64 max_time; // microseconds
+	uint64 total_lateness; // milliseconds
+	t_tick max_lateness; // milliseconds
+};
+
+static bool timer_profile_enabled = false;
+static std::unordered_map<TimerFunc, s_timer_profile> timer_profile_db;
+static t_tick timer_profile_since = 0;
+static int32 timer_profile_tid = INVALID_TIMER;
+
+
 /*----------------------------
  * 	Timer debugging
  *----------------------------*/
@@ -212,6 +281,264 @@ static void push_timer_heap(int32 tid)
 	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP);
 }
 
+/// Removes the top timer from the timer_heap if it expired.
+/// @param tick: current tick
+/// @param tid: expired timer
+/// @param diff: difference between the tick of the top timer and the current tick
+/// @return true if an expired timer was removed
+static bool pop_timer_heap(t_tick tick, int32& tid, t_tick& diff)
+{
+	if( BHEAP_LENGTH(timer_heap) == 0 )
+		return false;
+
+	tid = BHEAP_PEEK(timer_heap);// top element in heap (smallest tick)
+	diff = DIFF_TICK(timer_data[tid].tick, tick);
+	if( diff > 0 )
+		return false; // no more expired timers to process
+
+	BHEAP_POP(timer_heap, DIFFTICK_MINTOPCMP);
+	return true;
+}
+
+/*======================================
+ * 	CORE : Timing Wheel
+ *--------------------------------------*/
+
+/// Appends a timer to a list of the timing wheel
+static void link_timer_wheel(int32 tid, int32 list)
+{
+	struct s_timer_wheel_list* l = &timer_wheel_lists[list];
+	struct s_timer_wheel_link* link = &timer_wheel_link[tid];
+
+	link->list = list;
+	link->next = -1;
+	link->prev = l->last;
+	if( l->last != -1 )
+		timer_wheel_link[l->last].next = tid;
+	else
+		l->first = tid;
+	l->last = tid;
+
+	if( list < TIMER_WHEEL0_SIZE )
+		timer_wheel_used[list / 64] |= UINT64_C(1) << (list % 64);
+	if( list != TIMER_WHEEL_DUE )
+		timer_wheel_count++;
+}
+
+/// Removes a timer from its list of the timing wheel
+static void unlink_timer_wheel(int32 tid)
+{
+	struct s_timer_wheel_link* link = &timer_wheel_link[tid];
+	struct s_timer_wheel_list* l = &timer_wheel_lists[link->list];
+
+	if( link->prev != -1 )
+		timer_wheel_link[link->prev].next = link->next;
+	else
+		l->first = link->next;
+	if( link->next != -1 )
+		timer_wheel_link[link->next].prev = link->prev;
+	else
+		l->last = link->prev;
+
+	if( link->list < TIMER_WHEEL0_SIZE && l->first == -1 )
+		timer_wheel_used[link->list / 64] &= ~(UINT64_C(1) << (link->list % 64));
+	if( link->list != TIMER_WHEEL_DUE )
+		timer_wheel_count--;
+
+	link->list = -1;
+}
+
+/// Adds a timer to the slot of the timing wheel matching its tick
+static void push_timer_wheel(int32 tid)
+{
+	t_tick expires = timer_data[tid].tick;
+	t_tick delta = DIFF_TICK(expires, timer_wheel_tick);
+
+	if( delta < 0 ){
+		// already expired
+		link_timer_wheel(tid, TIMER_WHEEL_DUE);
+		return;
+	}
+
+	if( delta < TIMER_WHEEL0_SIZE ){
+		link_timer_wheel(tid, TIMER_WHEEL_LIST(0) + (int32)(expires & TIMER_WHEEL0_MASK));
+		return;
+	}
+
+	for( int32 level = 1; level < TIMER_WHEEL_LEVELS; level++ ){
+		if( delta < ((t_tick)1 << (TIMER_WHEEL_SHIFT(level) + TIMER_WHEELN_BITS)) ){
+			link_timer_wheel(tid, TIMER_WHEEL_LIST(level) + (int32)((expires >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEELN_MASK));
+			return;
+		}
+	}
+
+	link_timer_wheel(tid, TIMER_WHEEL_OVERFLOW);
+}
+
+/// Redistributes all timers of a list into the lower levels of the timing wheel
+static void cascade_timer_wheel(int32 list)
+{
+	// detach the list first, timers might be pushed back into the same list
+	int32 tid = timer_wheel_lists[list].first;
+
+	timer_wheel_lists[list].first = -1;
+	timer_wheel_lists[list].last = -1;
+
+	while( tid != -1 ){
+		int32 next = timer_wheel_link[tid].next;
+
+		timer_wheel_link[tid].list = -1;
+		timer_wheel_count--;
+		push_timer_wheel(tid);
+		tid = next;
+	}
+}
+
+/// Moves timer_wheel_tick forward, cascading the higher levels whenever level 0 wraps around
+static void advance_timer_wheel(t_tick tick)
+{
+	if( DIFF_TICK(tick, timer_wheel_tick) <= 0 )
+		return;
+
+	timer_wheel_tick = tick;
+
+	if( timer_wheel_tick & TIMER_WHEEL0_MASK )
+		return;
+
+	for( int32 level = 1; level < TIMER_WHEEL_LEVELS; level++ ){
+		int32 index = (int32)((timer_wheel_tick >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEELN_MASK);
+
+		cascade_timer_wheel(TIMER_WHEEL_LIST(level) + index);
+
+		if( index != 0 )
+			return;
+	}
+
+	cascade_timer_wheel(TIMER_WHEEL_OVERFLOW);
+}
+
+/// Returns the first occupied slot of level 0 in [from, TIMER_WHEEL0_SIZE) or -1 if there is none.
+static int32 find_timer_wheel_slot(int32 from)
+{
+	for( int32 i = from / 64; i < TIMER_WHEEL0_SIZE / 64; i++ ){
+		uint64 bits = timer_wheel_used[i];
+
+		if( i == from / 64 )
+			bits &= ~UINT64_C(0) << (from % 64);
+
+		for( int32 j = 0; bits != 0; j++, bits >>= 1 ){
+			if( bits & 1 )
+				return i * 64 + j;
+		}
+	}
+
+	return -1;
+}
+
+/// Removes the next expired timer from the timing wheel.
+/// @param tick: current tick
+/// @param tid: expired timer
+/// @param diff: difference between the tick of the next timer and the current tick
+/// @return true if an expired timer was removed
+static bool pop_timer_wheel(t_tick tick, int32& tid, t_tick& diff)
+{
+	for(;;){
+		if( timer_wheel_lists[TIMER_WHEEL_DUE].first != -1 ){
+			tid = timer_wheel_lists[TIMER_WHEEL_DUE].first;
+			unlink_timer_wheel(tid);
+			diff = DIFF_TICK(timer_data[tid].tick, tick);
+			return true;
+		}
+
+		if( timer_wheel_count == 0 ){
+			// nothing to cascade, jump straight to the current tick
+			if( DIFF_TICK(timer_wheel_tick, tick) <= 0 )
+				timer_wheel_tick = tick + 1;
+			diff = TIMER_MAX_INTERVAL;
+			return false;
+		}
+
+		int32 index = (int32)(timer_wheel_tick & TIMER_WHEEL0_MASK);
+		t_tick boundary = timer_wheel_tick - index + TIMER_WHEEL0_SIZE;
+		int32 slot = find_timer_wheel_slot(index);
+		// without an occupied slot in the current rotation of level 0 the next boundary is a lower bound
+		t_tick next = ( slot != -1 ) ? timer_wheel_tick + slot - index : boundary;
+
+		if( DIFF_TICK(next, tick) > 0 ){
+			// no more expired timers to process
+			diff = DIFF_TICK(next, tick);
+			advance_timer_wheel(tick + 1);
+			return false;
+		}
+
+		if( slot == -1 ){
+			advance_timer_wheel(boundary);
+			continue;
+		}
+
+		// move the whole slot to the due list
+		int32 list = TIMER_WHEEL_LIST(0) + slot;
+
+		while( timer_wheel_lists[list].first != -1 ){
+			int32 expired = timer_wheel_lists[list].first;
+
+			unlink_timer_wheel(expired);
+			link_timer_wheel(expired, TIMER_WHEEL_DUE);
+		}
+
+		advance_timer_wheel(next + 1);
+	}
+}
+
+/*======================================
+ * 	CORE : Timer Backend
+ *--------------------------------------*/
+
+/// Schedules a timer in the active backend
+static void push_timer(int32 tid)
+{
+	if( timer_backend == TIMER_BACKEND_WHEEL )
+		push_timer_wheel(tid);
+	else
+		push_timer_heap(tid);
+}
+
+/// Switches the backend that stores the pending timers.
+/// Already scheduled timers are moved to the new backend.
+void timer_set_backend(e_timer_backend backend)
+{
+	std::vector<int32> pending;
+
+	if( backend == timer_backend )
+		return;
+
+	if( timer_backend == TIMER_BACKEND_WHEEL ){
+		for( int32 list = 0; list < TIMER_WHEEL_LISTS; list++ ){
+			while( timer_wheel_lists[list].first != -1 ){
+				pending.push_back(timer_wheel_lists[list].first);
+				unlink_timer_wheel(timer_wheel_lists[list].first);
+			}
+		}
+	}else{
+		pending.assign(BHEAP_DATA(timer_heap), BHEAP_DATA(timer_heap) + BHEAP_LENGTH(timer_heap));
+		BHEAP_CLEAR(timer_heap);
+	}
+
+	timer_backend = backend;
+
+	if( timer_backend == TIMER_BACKEND_WHEEL )
+		timer_wheel_tick = gettick_nocache();
+
+	for( int32 tid : pending )
+		push_timer(tid);
+}
+
+/// Returns the backend that stores the pending timers
+e_timer_backend timer_get_backend(void)
+{
+	return timer_backend;
+}
+
 /*==========================
  * 	Timer Management
  *--------------------------*/
@@ -240,6 +567,12 @@ static int32 acquire_timer(void)
 		else
 			CREATE(timer_data, struct TimerData, timer_data_max);
 		memset(timer_data + (timer_data_max - 256), 0, sizeof(struct TimerData)*256);
+		if( timer_wheel_link )
+			RECREATE(timer_wheel_link, struct s_timer_wheel_link, timer_data_max);
+		else
+			CREATE(timer_wheel_link, struct s_timer_wheel_link, timer_data_max);
+		for( int32 i = timer_data_max - 256; i < timer_data_max; i++ )
+			timer_wheel_link[i].list = -1;
 	}
 
 	if( tid >= timer_data_num )
@@ -261,7 +594,7 @@ int32 add_timer(t_tick tick, TimerFunc func, int32 id, intptr_t data)
 	timer_data[tid].data     = data;
 	timer_data[tid].type     = TIMER_ONCE_AUTODEL;
 	timer_data[tid].interval = 1000;
-	push_timer_heap(tid);
+	push_timer(tid);
 
 	return tid;
 }
@@ -285,7 +618,7 @@ int32 add_timer_interval(t_tick tick, TimerFunc func, int32 id, intptr_t data, i
 	timer_data[tid].data     = data;
 	timer_data[tid].type     = TIMER_INTERVAL;
 	timer_data[tid].interval = interval;
-	push_timer_heap(tid);
+	push_timer(tid);
 
 	return tid;
 }
@@ -329,11 +662,17 @@ t_tick addtick_timer(int32 tid, t_tick tick)
 /// Returns the new tick value, or -1 if it fails.
 t_tick settick_timer(int32 tid, t_tick tick)
 {
-	size_t i;
+	size_t i = 0;
+	bool found;
 
 	// search timer position
-	ARR_FIND(0, BHEAP_LENGTH(timer_heap), i, BHEAP_DATA(timer_heap)[i] == tid);
-	if( i == BHEAP_LENGTH(timer_heap) )
+	if( timer_backend == TIMER_BACKEND_WHEEL )
+		found = ( tid >= 0 && tid < timer_data_num && timer_wheel_link[tid].list != -1 );
+	else{
+		ARR_FIND(0, BHEAP_LENGTH(timer_heap), i, BHEAP_DATA(timer_heap)[i] == tid);
+		found = ( i < BHEAP_LENGTH(timer_heap) );
+	}
+	if( !found )
 	{
 		ShowError("settick_timer: no such timer %d (%p(%s))\n", tid, timer_data[tid].func, search_timer_func_list(timer_data[tid].func));
 		return -1;
@@ -346,9 +685,15 @@ t_tick settick_timer(int32 tid, t_tick tick)
 		return tick;// nothing to do, already in propper position
 
 	// pop and push adjusted timer
-	BHEAP_POPINDEX(timer_heap, i, DIFFTICK_MINTOPCMP);
-	timer_data[tid].tick = tick;
-	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP);
+	if( timer_backend == TIMER_BACKEND_WHEEL ){
+		unlink_timer_wheel(tid);
+		timer_data[tid].tick = tick;
+		push_timer_wheel(tid);
+	}else{
+		BHEAP_POPINDEX(timer_heap, i, DIFFTICK_MINTOPCMP);
+		timer_data[tid].tick = tick;
+		BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP);
+	}
 	return tick;
 }
 
@@ -357,27 +702,38 @@ t_tick settick_timer(int32 tid, t_tick tick)
 t_tick do_timer(t_tick tick)
 {
 	t_tick diff = TIMER_MAX_INTERVAL; // return value
+	int32 tid;
 
 	// process all timers one by one
-	while( BHEAP_LENGTH(timer_heap) )
+	while( timer_backend == TIMER_BACKEND_WHEEL ? pop_timer_wheel(tick, tid, diff) : pop_timer_heap(tick, tid, diff) )
 	{
-		int32 tid = BHEAP_PEEK(timer_heap);// top element in heap (smallest tick)
-
-		diff = DIFF_TICK(timer_data[tid].tick, tick);
-		if( diff > 0 )
-			break; // no more expired timers to process
-
-		// remove timer
-		BHEAP_POP(timer_heap, DIFFTICK_MINTOPCMP);
 		timer_data[tid].type |= TIMER_REMOVE_HEAP;
 
 		if( timer_data[tid].func )
 		{
+			TimerFunc func = timer_data[tid].func;
+			std::chrono::steady_clock::time_point start;
+
+			if( timer_profile_enabled )
+				start = std::chrono::steady_clock::now();
+
 			if( diff < -1000 )
 				// timer was delayed for more than 1 second, use current tick instead
-				timer_data[tid].func(tid, tick, timer_data[tid].id, timer_data[tid].data);
+				func(tid, tick, timer_data[tid].id, timer_data[tid].data);
 			else
-				timer_data[tid].func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
+				func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
+
+			if( timer_profile_enabled ){
+				s_timer_profile& profile = timer_profile_db[func];
+				uint64 elapsed = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ).count();
+				t_tick lateness = i64max( -diff, 0 );
+
+				profile.calls++;
+				profile.total_time += elapsed;
+				profile.max_time = std::max( profile.max_time, elapsed );
+				profile.total_lateness += lateness;
+				profile.max_lateness = i64max( profile.max_lateness, lateness );
+			}
 		}
 
 		// in the case the function didn't change anything...
@@ -402,7 +758,7 @@ t_tick do_timer(t_tick tick)
 					timer_data[tid].tick = tick + timer_data[tid].interval;
 				else
 					timer_data[tid].tick += timer_data[tid].interval;
-				push_timer_heap(tid);
+				push_timer(tid);
 			break;
 			}
 		}
@@ -411,6 +767,83 @@ t_tick do_timer(t_tick tick)
 	return cap_value(diff, TIMER_MIN_INTERVAL, TIMER_MAX_INTERVAL);
 }
 
+/// Prints the collected timer statistics, ordered by total execution time.
+/// @param limit: maximum amount of timer functions to show (0 = all)
+/// @param reset: clear the statistics afterwards
+void timer_profile_report(size_t limit, bool reset)
+{
+	if( !timer_profile_enabled ){
+		ShowInfo("timer_profile_report: Timer profiling is disabled.\n");
+		return;
+	}
+
+	std::vector<std::pair<TimerFunc, s_timer_profile>> entries( timer_profile_db.begin(), timer_profile_db.end() );
+
+	std::sort( entries.begin(), entries.end(), []( const std::pair<TimerFunc, s_timer_profile>& a, const std::pair<TimerFunc, s_timer_profile>& b ) -> bool {
+		return a.second.total_time > b.second.total_time;
+	} );
+
+	t_tick elapsed = DIFF_TICK( gettick(), timer_profile_since );
+	uint64 total_time = 0;
+
+	for( const auto& entry : entries ){
+		total_time += entry.second.total_time;
+	}
+
+	ShowInfo("timer_profile_report: '" CL_WHITE "%" PRIuPTR CL_RESET "' timer functions used '" CL_WHITE "%.2f ms" CL_RESET "' in the last '" CL_WHITE "%.1f s" CL_RESET "'\n", entries.size(), total_time / 1000., elapsed / 1000.);
+
+	for( size_t i = 0; i < entries.size() && ( limit == 0 || i < limit ); i++ ){
+		const s_timer_profile& profile = entries[i].second;
+
+		ShowInfo("  %-32s calls: %8" PRIu64 " | total: %9.2f ms | avg: %7.3f ms | max: %7.3f ms | late avg: %6.1f ms | late max: %5" PRtf " ms\n",
+			search_timer_func_list( entries[i].first ), profile.calls,
+			profile.total_time / 1000., profile.total_time / 1000. / profile.calls, profile.max_time / 1000.,
+			(double)profile.total_lateness / profile.calls, profile.max_lateness);
+	}
+
+	if( reset ){
+		timer_profile_db.clear();
+		timer_profile_since = gettick();
+	}
+}
+
+/// Prints the statistics of the busiest timer functions periodically
+static TIMER_FUNC(timer_profile_report_timer){
+	timer_profile_report( 20, true );
+	return 0;
+}
+
+/// Starts collecting execution statistics for every timer function.
+/// @param interval: interval in milliseconds to report the statistics (0 = never)
+void timer_profile_start(t_tick interval)
+{
+	if( timer_profile_tid != INVALID_TIMER ){
+		delete_timer( timer_profile_tid, timer_profile_report_timer );
+		timer_profile_tid = INVALID_TIMER;
+	}
+
+	if( !timer_profile_enabled ){
+		timer_profile_enabled = true;
+		timer_profile_db.clear();
+		timer_profile_since = gettick();
+	}
+
+	if( interval > 0 )
+		timer_profile_tid = add_timer_interval( gettick() + interval, timer_profile_report_timer, 0, 0, (int32)interval );
+}
+
+/// Stops collecting execution statistics for timer functions and drops the collected data.
+void timer_profile_stop(void)
+{
+	if( timer_profile_tid != INVALID_TIMER ){
+		delete_timer( timer_profile_tid, timer_profile_report_timer );
+		timer_profile_tid = INVALID_TIMER;
+	}
+
+	timer_profile_enabled = false;
+	timer_profile_db.clear();
+}
+
 unsigned long get_uptime(void)
 {
 	return (unsigned long)difftime(time(nullptr), start_time);
@@ -521,6 +954,14 @@ void timer_init(void)
 #endif
 
 	time(&start_time);
+
+	add_timer_func_list(timer_profile_report_timer, "timer_profile_report_timer");
+
+	for( int32 list = 0; list < TIMER_WHEEL_LISTS; list++ ){
+		timer_wheel_lists[list].first = -1;
+		timer_wheel_lists[list].last = -1;
+	}
+	timer_wheel_tick = gettick_nocache();
 }
 
 void timer_final(void)
@@ -535,6 +976,8 @@ void timer_final(void)
 	}
 
 	if (timer_data) aFree(timer_data);
+	if (timer_wheel_link) aFree(timer_wheel_link);
+	timer_profile_db.clear();
 	BHEAP_CLEAR(timer_heap);
 	if (free_timer_list) aFree(free_timer_list);
 }
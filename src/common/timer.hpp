@@ -30,6 +30,12 @@ enum {
 	TIMER_REMOVE_HEAP = 0x10,
 };
 
+// timer backends
+enum e_timer_backend {
+	TIMER_BACKEND_HEAP = 0, // binary heap, O(log n) insert
+	TIMER_BACKEND_WHEEL, // hierarchical timing wheel, O(1) insert
+};
+
 #define TIMER_FUNC(x) int32 x ( int32 tid, t_tick tick, int32 id, intptr_t data )
 
 // Struct declaration
@@ -61,6 +67,13 @@ t_tick settick_timer(int32 tid, t_tick tick);
 
 int32 add_timer_func_list(TimerFunc func, const char* name);
 
+void timer_set_backend(e_timer_backend backend);
+e_timer_backend timer_get_backend(void);
+
+void timer_profile_start(t_tick interval);
+void timer_profile_stop(void);
+void timer_profile_report(size_t limit, bool reset);
+
 unsigned long get_uptime(void);
 
 //transform a timestamp to string
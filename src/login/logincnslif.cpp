@@ -27,6 +27,7 @@ void display_helpscreen(bool do_exit) {
 	ShowInfo("  -?, -h [--help]\t\tDisplays this help screen.\n");
 	ShowInfo("  -v [--version]\t\tDisplays the server's version.\n");
 	ShowInfo("  --run-once\t\t\tCloses server after loading (testing).\n");
+	ShowInfo("  --timer-backend <heap|wheel>\tStorage used for pending timers.\n");
 	ShowInfo("  --login-config <file>\t\tAlternative login-server configuration.\n");
 	ShowInfo("  --lan-config <file>\t\tAlternative lan configuration.\n");
 	ShowInfo("  --msg-config <file>\t\tAlternative message configuration.\n");
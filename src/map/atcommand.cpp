@@ -4718,6 +4718,11 @@ ACMD_FUNC(mapinfo) {
 
 	sprintf(atcmd_output, msg_txt(sd,1040), mapname, mapdata->users, mapdata->npc_num, chat_num, vend_num); // Map: %s | Players: %d | NPCs: %d | Chats: %d | Vendings: %d
 	clif_displaymessage(fd, atcmd_output);
+	if (mapdata->instance_id > 0) {
+		// Instance maps share the cells of their source map until they change them
+		sprintf(atcmd_output, " Instance %d | Copied cell pages: %d of %d | Own cell planes: %s", mapdata->instance_id, mapdata->cell_page_private, (int32)mapdata->cell_page.size(), map_getmapdata(mapdata->instance_src_map)->cell_planes == mapdata->cell_planes ? "No" : "Yes");
+		clif_displaymessage(fd, atcmd_output);
+	}
 	clif_displaymessage(fd, msg_txt(sd,1041)); // ------ Map Flags ------
 	if (map_getmapflag(m_id, MF_TOWN))
 		clif_displaymessage(fd, msg_txt(sd,1042)); // Town Map
@@ -11464,6 +11469,109 @@ ACMD_FUNC(macrochecker){
 	return 0;
 }
 
+/**
+ * Controls the script profiler and shows its results
+ * Usage: @scriptprofile <on|off|reset|npc|func|buildin|dump> {<count>|<name>}
+ */
+ACMD_FUNC(scriptprofile){
+	char action[16], param[256];
+	e_script_profile_type type;
+
+	memset( param, '\0', sizeof( param ) );
+
+	if( !message || !*message || sscanf( message, "%15s %255[^\n]", action, param ) < 1 ){
+		clif_displaymessage( fd, msg_txt( sd, 1541 ) ); // Usage: @scriptprofile <on|off|reset|npc|func|buildin|dump> {<count>|<name>}
+		return -1;
+	}
+
+	if( strcmpi( action, "on" ) == 0 ){
+		script_profile_start();
+		clif_displaymessage( fd, msg_txt( sd, 1542 ) ); // Script profiler has been started.
+		return 0;
+	}else if( strcmpi( action, "off" ) == 0 ){
+		script_profile_stop();
+		clif_displaymessage( fd, msg_txt( sd, 1543 ) ); // Script profiler has been stopped.
+		return 0;
+	}else if( strcmpi( action, "reset" ) == 0 ){
+		script_profile_reset();
+		clif_displaymessage( fd, msg_txt( sd, 1544 ) ); // Script profiler data has been cleared.
+		return 0;
+	}else if( strcmpi( action, "dump" ) == 0 ){
+		char filename[64];
+
+		// Only a name is accepted, the profile is always written to the log folder
+		if( param[0] == '\0' ){
+			safestrncpy( filename, "log/script_profile.txt", sizeof( filename ) );
+		}else{
+			size_t length = strlen( param );
+
+			if( length > 32 ){
+				clif_displaymessage( fd, msg_txt( sd, 1541 ) ); // Usage: @scriptprofile <on|off|reset|npc|func|buildin|dump> {<count>|<name>}
+				return -1;
+			}
+
+			for( size_t i = 0; i < length; i++ ){
+				if( !ISALNUM( param[i] ) && param[i] != '_' && param[i] != '-' ){
+					clif_displaymessage( fd, msg_txt( sd, 1541 ) ); // Usage: @scriptprofile <on|off|reset|npc|func|buildin|dump> {<count>|<name>}
+					return -1;
+				}
+			}
+
+			safesnprintf( filename, sizeof( filename ), "log/script_profile_%s.txt", param );
+		}
+
+		if( script_profile_duration() == 0 ){
+			clif_displaymessage( fd, msg_txt( sd, 1545 ) ); // No script profiler data has been recorded.
+			return -1;
+		}
+
+		if( !script_profile_dump( filename ) ){
+			safesnprintf( atcmd_output, sizeof( atcmd_output ), msg_txt( sd, 1548 ), filename ); // Failed to write the script profile to '%s'.
+			clif_displaymessage( fd, atcmd_output );
+			return -1;
+		}
+
+		safesnprintf( atcmd_output, sizeof( atcmd_output ), msg_txt( sd, 1547 ), filename ); // Script profile has been written to '%s'.
+		clif_displaymessage( fd, atcmd_output );
+		return 0;
+	}else if( strcmpi( action, "npc" ) == 0 ){
+		type = SCRIPT_PROFILE_NPC;
+	}else if( strcmpi( action, "func" ) == 0 ){
+		type = SCRIPT_PROFILE_FUNC;
+	}else if( strcmpi( action, "buildin" ) == 0 ){
+		type = SCRIPT_PROFILE_BUILDIN;
+	}else{
+		clif_displaymessage( fd, msg_txt( sd, 1541 ) ); // Usage: @scriptprofile <on|off|reset|npc|func|buildin|dump> {<count>|<name>}
+		return -1;
+	}
+
+	std::vector<s_script_profile_entry> entries;
+
+	script_profile_report( type, entries );
+
+	if( entries.empty() ){
+		clif_displaymessage( fd, msg_txt( sd, 1545 ) ); // No script profiler data has been recorded.
+		return -1;
+	}
+
+	int32 count = param[0] != '\0' ? cap_value( atoi( param ), 1, 100 ) : 10;
+
+	count = min( count, static_cast<int32>( entries.size() ) );
+
+	safesnprintf( atcmd_output, sizeof( atcmd_output ), msg_txt( sd, 1549 ), count, static_cast<int32>( entries.size() ), txt_time( script_profile_duration() / 1000 ) ); // Top %d of %d by total time, recorded for %s:
+	clif_displaymessage( fd, atcmd_output );
+
+	for( int32 i = 0; i < count; i++ ){
+		const s_script_profile_entry& entry = entries[i];
+
+		// %s: %llu calls, %llu instructions, %.3f ms total, %.3f ms self
+		safesnprintf( atcmd_output, sizeof( atcmd_output ), msg_txt( sd, 1546 ), entry.name.c_str(), static_cast<unsigned long long>( entry.calls ), static_cast<unsigned long long>( entry.instructions ), entry.total / 1000000.0, entry.self / 1000000.0 );
+		clif_displaymessage( fd, atcmd_output );
+	}
+
+	return 0;
+}
+
 #include <custom/atcommand.inc>
 
 /**
@@ -11794,6 +11902,7 @@ void atcommand_basecommands(void) {
 		ACMD_DEFR(roulette, ATCMD_NOCONSOLE|ATCMD_NOAUTOTRADE),
 		ACMD_DEF(setcard),
 		ACMD_DEF(macrochecker),
+		ACMD_DEF(scriptprofile),
 	};
 	AtCommandInfo* atcommand;
 	int32 i;
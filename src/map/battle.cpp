@@ -3,6 +3,8 @@
 
 #include "battle.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 
@@ -10681,6 +10683,8 @@ static const struct _battle_data {
 	{ "trade_count_stackable",              &battle_config.trade_count_stackable,           1,      0,      1,              },
 	{ "enable_bonus_map_drops",             &battle_config.enable_bonus_map_drops,          1,      0,      1,              },
 	{ "hide_cloaked_units",                 &battle_config.hide_cloaked_units,              0,      0,      BL_ALL,         },
+	{ "monster_ai_threads",                 &battle_config.mob_ai_threads,                  0,      0,      64,             },
+	{ "path_graph",                         &battle_config.path_graph,                      1,      0,      1,              },
 
 #include <custom/battle_config_init.inc>
 };
@@ -10984,6 +10988,194 @@ int32 battle_config_read(const char* cfgName)
 	return 0;
 }
 
+/**
+ * Offline benchmark of the damage calculation, run by the map generator with --battle-benchmark.
+ * A fixed matrix of player builds (job, equipment, status changes) attacks a sample of mob_db
+ * with normal attacks and skills, and the mobs attack the players back.
+ * The results are folded into a digest, which stays the same as long as the formulas give
+ * the same results, so optimizations can be verified against the digest of the previous build.
+ */
+void battle_benchmark(void)
+{
+#ifdef MAP_GENERATOR
+	struct s_benchmark_build {
+		uint16 job;
+		uint16 str, agi, vit, int_, dex, luk;
+		t_itemid equip[3];
+		uint16 skills[4];
+	};
+
+	static const s_benchmark_build builds[] = {
+		{ JOB_LORD_KNIGHT, 90, 50, 60, 1, 50, 1, { 1116, 2301, 0 }, { SM_BASH, KN_BOWLINGBASH, LK_SPIRALPIERCE, 0 } },
+		{ JOB_SNIPER, 40, 80, 1, 1, 99, 40, { 1705, 1750, 2301 }, { AC_DOUBLE, SN_SHARPSHOOTING, HT_BLASTMINE, 0 } },
+		{ JOB_HIGH_WIZARD, 1, 40, 30, 99, 90, 1, { 1601, 2301, 0 }, { MG_FIREBOLT, MG_SOULSTRIKE, WZ_JUPITEL, 0 } },
+		{ JOB_ASSASSIN_CROSS, 80, 99, 30, 1, 50, 20, { 1250, 2301, 0 }, { AS_SONICBLOW, AS_GRIMTOOTH, ASC_BREAKER, 0 } },
+		{ JOB_CHAMPION, 99, 60, 40, 40, 60, 1, { 1801, 2301, 0 }, { MO_FINGEROFFENSIVE, MO_INVESTIGATE, MO_TRIPLEATTACK, 0 } },
+		{ JOB_WHITESMITH, 90, 40, 60, 1, 60, 40, { 1301, 2101, 2301 }, { MC_MAMMONITE, WS_CARTTERMINATION, 0, 0 } },
+	};
+	static const sc_type buffs[] = { SC_BLESSING, SC_INCREASEAGI, SC_IMPOSITIO, SC_GLORIA };
+	const int32 rounds = 200;
+	const size_t max_targets = 64;
+
+	// Sample of mob_db, ordered by id so the matrix does not depend on the load order
+	std::vector<int32> mob_ids;
+
+	for( const auto& it : mob_db ){
+		mob_ids.push_back( it.first );
+	}
+
+	std::sort( mob_ids.begin(), mob_ids.end() );
+
+	size_t step = std::max<size_t>( 1, mob_ids.size() / max_targets );
+	std::vector<mob_data*> targets;
+
+	for( size_t i = 0; i < mob_ids.size() && targets.size() < max_targets; i += step ){
+		mob_data* md = mob_once_spawn_sub( nullptr, 0, -1, -1, "--ja--", mob_ids[i], "", SZ_SMALL, AI_NONE );
+
+		if( md == nullptr )
+			continue;
+
+		status_calc_mob( md, SCO_FIRST );
+		targets.push_back( md );
+	}
+
+	if( targets.empty() ){
+		ShowError( "battle_benchmark: No mob could be created.\n" );
+		return;
+	}
+
+	// Player builds, each with and without buffs
+	std::vector<map_session_data*> players;
+	std::vector<const s_benchmark_build*> player_builds;
+
+	for( const s_benchmark_build& build : builds ){
+		for( int32 buffed = 0; buffed < 2; buffed++ ){
+			map_session_data* sd;
+
+			CREATE( sd, map_session_data, 1 );
+			new( sd ) map_session_data();
+			pc_setnewpc( sd, START_ACCOUNT_NUM + (uint32)players.size(), 150000 + (uint32)players.size(), 0, 0, SEX_MALE, 0 );
+			snprintf( sd->status.name, sizeof( sd->status.name ), "Benchmark %d", (int32)players.size() );
+
+			sd->status.class_ = build.job;
+			sd->class_ = pc_jobid2mapid( build.job );
+			sd->status.base_level = 99;
+			sd->status.job_level = 70;
+			sd->status.str = build.str;
+			sd->status.agi = build.agi;
+			sd->status.vit = build.vit;
+			sd->status.int_ = build.int_;
+			sd->status.dex = build.dex;
+			sd->status.luk = build.luk;
+			sd->m = targets.front()->m;
+			sd->x = targets.front()->x;
+			sd->y = targets.front()->y;
+			memset( &sd->equip_index, -1, sizeof( sd->equip_index ) );
+			memset( &sd->equip_switch_index, -1, sizeof( sd->equip_switch_index ) );
+
+			for( uint16 skill_id : build.skills ){
+				uint16 idx = skill_get_index( skill_id );
+
+				if( skill_id == 0 || idx == 0 )
+					continue;
+
+				sd->status.skill[idx].id = skill_id;
+				sd->status.skill[idx].lv = skill_get_max( skill_id );
+				sd->status.skill[idx].flag = SKILL_FLAG_PERMANENT;
+			}
+
+			for( int32 i = 0; i < ARRAYLENGTH( build.equip ); i++ ){
+				sd->inventory.u.items_inventory[i].nameid = item_db.exists( build.equip[i] ) ? build.equip[i] : 0;
+				sd->inventory.u.items_inventory[i].amount = sd->inventory.u.items_inventory[i].nameid ? 1 : 0;
+				sd->inventory.u.items_inventory[i].identify = 1;
+			}
+
+			pc_setinventorydata( *sd );
+
+			for( int32 i = 0; i < ARRAYLENGTH( build.equip ); i++ ){
+				if( sd->inventory_data[i] != nullptr )
+					sd->inventory.u.items_inventory[i].equip = pc_equippoint( sd, i );
+			}
+
+			pc_setequipindex( sd );
+			// Status calculation looks the player up by id
+			map_addiddb( sd );
+			status_calc_pc( sd, SCO_FIRST );
+
+			if( buffed ){
+				for( sc_type type : buffs ){
+					sc_start( sd, sd, type, 100, 10, INFINITE_TICK );
+				}
+			}
+
+			players.push_back( sd );
+			player_builds.push_back( &build );
+		}
+	}
+
+	// A fixed seed makes the random parts (critical hits, variance) repeatable
+	generator.seed( 0 );
+
+	uint64 digest = 0xcbf29ce484222325ULL;
+	uint64 count = 0;
+	auto mix = [&digest]( int64 value ){
+		for( int32 i = 0; i < 8; i++ ){
+			digest ^= (uint8)( value >> ( i * 8 ) );
+			digest *= 0x100000001b3ULL;
+		}
+	};
+	auto start = std::chrono::steady_clock::now();
+
+	for( int32 round = 0; round < rounds; round++ ){
+		for( size_t p = 0; p < players.size(); p++ ){
+			map_session_data* sd = players[p];
+
+			for( mob_data* md : targets ){
+				for( int32 s = -1; s < (int32)ARRAYLENGTH( player_builds[p]->skills ); s++ ){
+					uint16 skill_id = s < 0 ? 0 : player_builds[p]->skills[s];
+
+					if( s >= 0 && skill_id == 0 )
+						continue;
+
+					int32 type = skill_id ? skill_get_type( skill_id ) : BF_WEAPON;
+					Damage d = battle_calc_attack( type, sd, md, skill_id, skill_id ? skill_get_max( skill_id ) : 0, 0 );
+
+					mix( d.damage );
+					mix( d.damage2 );
+					mix( ( (int64)d.div_ << 32 ) | (uint32)d.type );
+					mix( ( (int64)d.flag << 32 ) | (uint32)d.dmg_lv );
+					count++;
+				}
+
+				// And back
+				Damage d = battle_calc_attack( BF_WEAPON, md, sd, 0, 0, 0 );
+
+				mix( d.damage );
+				mix( ( (int64)d.flag << 32 ) | (uint32)d.dmg_lv );
+				count++;
+			}
+		}
+	}
+
+	int64 duration = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ).count();
+
+	ShowInfo( "Battle benchmark: %" PRIu64 " damage calculations (%d builds, %d mobs) in %" PRId64 " ms, %" PRId64 " per second.\n",
+		count, (int32)players.size(), (int32)targets.size(), duration / 1000, duration > 0 ? (int64)( count * 1000000 / duration ) : 0 );
+	ShowInfo( "Battle benchmark: Result digest '" CL_WHITE "%016" PRIx64 CL_RESET "'.\n", digest );
+
+	for( map_session_data* sd : players ){
+		status_change_clear( sd, 1 );
+		map_deliddb( sd );
+		sd->~map_session_data();
+		aFree( sd );
+	}
+
+	for( mob_data* md : targets ){
+		unit_free( md, CLR_OUTSIGHT );
+	}
+#endif
+}
+
 /*==========================
  * initialize battle timer
  *--------------------------*/
@@ -780,6 +780,8 @@ struct Battle_Config
 	int32 trade_count_stackable;
 	int32 enable_bonus_map_drops;
 	int32 hide_cloaked_units;
+	int32 mob_ai_threads;
+	int32 path_graph;
 
 #include <custom/battle_config_struct.inc>
 };
@@ -788,6 +790,7 @@ extern struct Battle_Config battle_config;
 
 void do_init_battle(void);
 void do_final_battle(void);
+void battle_benchmark(void);
 extern int32 battle_config_read(const char *cfgName);
 extern void battle_set_defaults(void);
 int32 battle_set_value(const char* w1, const char* w2);
@@ -20,6 +20,7 @@
 #include "log.hpp"  // log_pick_pc, log_zeny
 #include "npc.hpp"
 #include "pc.hpp"  // map_session_data
+#include "searchstore.hpp"  // searchstore_index_*
 
 //Autotrader
 static DBMap *buyingstore_autotrader_db; /// Holds autotrader info: char_id -> struct s_autotrader
@@ -250,6 +251,7 @@ int8 buyingstore_create( map_session_data* sd, int32 zenylimit, unsigned char re
 	clif_buyingstore_myitemlist( *sd );
 	clif_buyingstore_entry( *sd );
 	idb_put(buyingstore_db, sd->status.char_id, sd);
+	searchstore_index_update( *sd, SEARCHTYPE_BUYING_STORE );
 
 	return 0;
 }
@@ -273,6 +275,7 @@ void buyingstore_close(map_session_data* sd) {
 		sd->buyer_id = 0;
 		memset(&sd->buyingstore, 0, sizeof(sd->buyingstore));
 		idb_remove(buyingstore_db, sd->status.char_id);
+		searchstore_index_remove( *sd, SEARCHTYPE_BUYING_STORE );
 
 		// notify other players
 		clif_buyingstore_disappear_entry( *sd );
@@ -475,6 +478,8 @@ void buyingstore_trade( map_session_data* sd, uint32 account_id, uint32 buyer_id
 		chrif_save(pl_sd, CSAVE_NORMAL|CSAVE_INVENTORY);
 	}
 	
+	searchstore_index_update( *pl_sd, SEARCHTYPE_BUYING_STORE );
+
 	// check whether or not there is still something to buy
 	int32 i;
 	ARR_FIND( 0, pl_sd->buyingstore.slots, i, pl_sd->buyingstore.items[i].amount != 0 );
@@ -528,65 +533,41 @@ bool buyingstore_search( const map_session_data* sd, t_itemid nameid )
 }
 
 
-/// Searches for all items in a buyingstore, that match given ids, price and possible cards.
+/// Adds a buyingstore entry found by the search index to the results of a search.
 /// @return Whether or not the search should be continued.
-bool buyingstore_searchall( const map_session_data* sd, const struct s_search_store_search* s )
+bool buyingstore_searchentry( const map_session_data* sd, uint16 slot, const struct s_search_store_search* s )
 {
-	uint32 i, idx;
 	const s_buyingstore_item* it;
 
 	nullpo_ret(sd);
 
-	if( !sd->state.buyingstore )
-	{// not buying
-		return true;
-	}
-
-	for( idx = 0; idx < s->item_count; idx++ )
-	{
-		ARR_FIND( 0, sd->buyingstore.slots, i, sd->buyingstore.items[i].nameid == s->itemlist[idx].itemId && sd->buyingstore.items[i].amount );
-		if( i == sd->buyingstore.slots )
-		{// not found
-			continue;
-		}
-		it = &sd->buyingstore.items[i];
+	it = &sd->buyingstore.items[slot];
 
-		if( s->min_price && s->min_price > (uint32)it->price )
-		{// too low price
-			continue;
-		}
-
-		if( s->max_price && s->max_price < (uint32)it->price )
-		{// too high price
-			continue;
-		}
-
-		if( s->card_count )
-		{// ignore cards, as there cannot be any
-			;
-		}
-
-		// Check if the result set is full
-		if( s->search_sd->searchstore.items.size() >= (uint32)battle_config.searchstore_maxresults ){
-			return false;
-		}
+	if( s->card_count )
+	{// ignore cards, as there cannot be any
+		;
+	}
 
-		std::shared_ptr<s_search_store_info_item> ssitem = std::make_shared<s_search_store_info_item>();
+	// Check if the result set is full
+	if( s->search_sd->searchstore.items.size() >= (uint32)battle_config.searchstore_maxresults ){
+		return false;
+	}
 
-		ssitem->store_id = sd->buyer_id;
-		ssitem->account_id = sd->status.account_id;
-		safestrncpy( ssitem->store_name, sd->message, sizeof( ssitem->store_name ) );
-		ssitem->nameid = it->nameid;
-		ssitem->amount = it->amount;
-		ssitem->price = it->price;
-		for( int32 j = 0; j < MAX_SLOTS; j++ ){
-			ssitem->card[j] = 0;
-		}
-		ssitem->refine = 0;
-		ssitem->enchantgrade = 0;
+	std::shared_ptr<s_search_store_info_item> ssitem = std::make_shared<s_search_store_info_item>();
 
-		s->search_sd->searchstore.items.push_back( ssitem );
+	ssitem->store_id = sd->buyer_id;
+	ssitem->account_id = sd->status.account_id;
+	safestrncpy( ssitem->store_name, sd->message, sizeof( ssitem->store_name ) );
+	ssitem->nameid = it->nameid;
+	ssitem->amount = it->amount;
+	ssitem->price = it->price;
+	for( int32 j = 0; j < MAX_SLOTS; j++ ){
+		ssitem->card[j] = 0;
 	}
+	ssitem->refine = 0;
+	ssitem->enchantgrade = 0;
+
+	s->search_sd->searchstore.items.push_back( ssitem );
 
 	return true;
 }
@@ -46,7 +46,7 @@ static const int32 packet_len_table[0x3d] = { // U - used, F - free
 	11,10,10, 0,11, -1, 0,10,	// 2b10-2b17: U->2b10, U->2b11, U->2b12, F->2b13, U->2b14, U->2b15, F->2b16, U->2b17
 	 2,10, 2,-1,-1,-1, 2, 7,	// 2b18-2b1f: U->2b18, U->2b19, U->2b1a, U->2b1b, U->2b1c, U->2b1d, U->2b1e, U->2b1f
 	-1,10, 8, 2, 2,14,19,19,	// 2b20-2b27: U->2b20, U->2b21, U->2b22, U->2b23, U->2b24, U->2b25, U->2b26, U->2b27
-	-1, 0, 6,15, 0, 6,-1,-1,	// 2b28-2b2f: U->2b28, F->2b29, U->2b2a, U->2b2b, F->2b2c, U->2b2d, U->2b2e, U->2b2f
+	-1, 0, 6,15,10, 6,-1,-1,	// 2b28-2b2f: U->2b28, U->2b29, U->2b2a, U->2b2b, U->2b2c, U->2b2d, U->2b2e, U->2b2f
  };
 
 //Used Packets:
@@ -98,10 +98,10 @@ static const int32 packet_len_table[0x3d] = { // U - used, F - free
 //2b26: Outgoing, chrif_authreq -> 'client authentication request'
 //2b27: Incoming, chrif_authfail -> 'client authentication failed'
 //2b28: Outgoing, chrif_req_charban -> 'ban a specific char '
-//2b29: FREE
+//2b29: Outgoing, chrif_save -> 'charsave of char XY account XY (changes since the last save)'
 //2b2a: Outgoing, chrif_req_charunban -> 'unban a specific char '
 //2b2b: Incoming, chrif_parse_ack_vipActive -> vip info result
-//2b2c: FREE
+//2b2c: Incoming, chrif_save_delta_fail -> 'char-server could not apply a delta save, full save requested'
 //2b2d: Outgoing, chrif_bsdata_request -> request bonus_script for pc_authok'ed char.
 //2b2e: Outgoing, chrif_bsdata_save -> Send bonus_script of player for saving.
 //2b2f: Incoming, chrif_bsdata_received -> received bonus_script of player for loading.
@@ -114,6 +114,8 @@ static uint16 char_port = 6121;
 static char userid[NAME_LENGTH], passwd[NAME_LENGTH];
 static int32 chrif_state = 0;
 int32 other_mapserver_count=0; //Holds count of how many other map servers are online (apart of this instance) [Skotlex]
+static uint32 chrif_save_generation = 1; // Incremented on every disconnect, the save bases of the characters become invalid
+static struct s_chrif_save_stats chrif_save_stats;
 char charserver_name[NAME_LENGTH];
 
 //Interval at which map server updates online listing. [Valaris]
@@ -263,6 +265,145 @@ int32 chrif_isconnected(void) {
 	return (session_isValid(char_fd) && chrif_state == 2);
 }
 
+/**
+ * Appends the changed byte ranges of the character status to a delta save packet.
+ * Ranges that are only a few bytes apart are merged, because every range costs a header.
+ * @param base: Status the char-server already has
+ * @param status: Current status
+ * @param buf: Packet buffer, ranges are written from offset 21 on
+ * @param max_len: Maximum length of the packet
+ * @return Length of the packet or 0 if the delta would not be smaller than the complete status
+ */
+static uint16 chrif_save_delta( const struct mmo_charstatus& base, const struct mmo_charstatus& status, uint8* buf, size_t max_len ){
+	const uint8* old_data = reinterpret_cast<const uint8*>( &base );
+	const uint8* new_data = reinterpret_cast<const uint8*>( &status );
+	const size_t size = sizeof( struct mmo_charstatus );
+	// A range header is 4 bytes, so shorter gaps are cheaper to send along
+	const size_t merge_gap = 4;
+	size_t len = 21;
+	size_t i = 0;
+
+	while( i < size ){
+		// Skip unchanged data in word steps
+		if( i + sizeof( uint64 ) <= size && memcmp( old_data + i, new_data + i, sizeof( uint64 ) ) == 0 ){
+			i += sizeof( uint64 );
+			continue;
+		}
+
+		if( old_data[i] == new_data[i] ){
+			i++;
+			continue;
+		}
+
+		size_t start = i;
+		size_t end = i + 1;
+
+		// Extend the range until enough unchanged bytes follow
+		for( size_t j = end; j < size && j < end + merge_gap; j++ ){
+			if( old_data[j] != new_data[j] ){
+				end = j + 1;
+			}
+		}
+
+		if( len + 4 + ( end - start ) > max_len ){
+			return 0;
+		}
+
+		WBUFW( buf, len ) = static_cast<uint16>( start );
+		WBUFW( buf, len + 2 ) = static_cast<uint16>( end - start );
+		memcpy( WBUFP( buf, len + 4 ), new_data + start, end - start );
+		len += 4 + end - start;
+		i = end;
+	}
+
+	return static_cast<uint16>( len );
+}
+
+/**
+ * Sends the character status to the char-server.
+ * If the char-server has the last sent status, only the changes since then are sent.
+ * @param sd: Player
+ * @param quit: Whether the character is quitting
+ * @param full: Send the complete status
+ */
+static void chrif_save_status( map_session_data& sd, bool quit, bool full ){
+	uint16 full_len = sizeof( struct mmo_charstatus ) + 17;
+	uint16 len = 0;
+
+	if( sd.save_base == nullptr || sd.save_generation != chrif_save_generation ){
+		full = true;
+	}
+
+	WFIFOHEAD( char_fd, full_len );
+
+	if( !full ){
+		len = chrif_save_delta( *sd.save_base, sd.status, WFIFOP( char_fd, 0 ), full_len );
+	}
+
+	if( len > 0 ){
+		WFIFOW( char_fd, 0 ) = 0x2b29;
+		WFIFOW( char_fd, 2 ) = len;
+		WFIFOL( char_fd, 4 ) = sd.status.account_id;
+		WFIFOL( char_fd, 8 ) = sd.status.char_id;
+		WFIFOB( char_fd, 12 ) = quit ? 1 : 0;
+		WFIFOL( char_fd, 13 ) = sd.save_seq;
+		WFIFOL( char_fd, 17 ) = ++sd.save_seq;
+
+		chrif_save_stats.delta_saves++;
+		chrif_save_stats.delta_bytes += len;
+	}else{
+		len = full_len;
+
+		WFIFOW( char_fd, 0 ) = 0x2b01;
+		WFIFOW( char_fd, 2 ) = len;
+		WFIFOL( char_fd, 4 ) = sd.status.account_id;
+		WFIFOL( char_fd, 8 ) = sd.status.char_id;
+		WFIFOB( char_fd, 12 ) = quit ? 1 : 0; //Flag to tell char-server this character is quitting.
+
+		// Copy the whole status into the packet
+		memcpy( WFIFOP( char_fd, 13 ), &sd.status, sizeof( struct mmo_charstatus ) );
+		WFIFOL( char_fd, 13 + sizeof( struct mmo_charstatus ) ) = ++sd.save_seq;
+
+		chrif_save_stats.full_saves++;
+		chrif_save_stats.full_bytes += len;
+	}
+
+	WFIFOSET( char_fd, len );
+
+	if( sd.save_base == nullptr ){
+		sd.save_base = std::make_unique<struct mmo_charstatus>();
+	}
+
+	memcpy( sd.save_base.get(), &sd.status, sizeof( struct mmo_charstatus ) );
+	sd.save_generation = chrif_save_generation;
+}
+
+/**
+ * The char-server could not apply a delta save, because it does not have the status it was based on.
+ * The complete status is sent again.
+ * HZ 0x2b2c <account id>.L <char id>.L
+ */
+static void chrif_save_delta_fail( int32 fd ){
+	uint32 account_id = RFIFOL( fd, 2 );
+	uint32 char_id = RFIFOL( fd, 6 );
+	map_session_data* sd = map_charid2sd( char_id );
+
+	if( sd == nullptr || sd->status.account_id != account_id ){
+		return;
+	}
+
+	ShowInfo( "chrif_save_delta_fail: Resending the complete status of character %d:%d.\n", account_id, char_id );
+
+	chrif_save_status( *sd, false, true );
+}
+
+/**
+ * Returns the statistics of the character status saves.
+ */
+const struct s_chrif_save_stats& chrif_get_save_stats( void ){
+	return chrif_save_stats;
+}
+
 /**
  * Saves character data.
  * @param sd: Player data
@@ -275,8 +416,6 @@ int32 chrif_isconnected(void) {
  *  CSAVE_CART: Character changed cart data
  */
 int32 chrif_save(map_session_data *sd, int32 flag) {
-	uint16 mmo_charstatus_len = 0;
-
 	nullpo_retr(-1, sd);
 
 	pc_makesavestatus(sd);
@@ -314,18 +453,8 @@ int32 chrif_save(map_session_data *sd, int32 flag) {
 	if (sd->vars_dirty)
 		intif_saveregistry(sd);
 
-	mmo_charstatus_len = sizeof(sd->status) + 13;
-	WFIFOHEAD(char_fd, mmo_charstatus_len);
-	WFIFOW(char_fd,0) = 0x2b01;
-	WFIFOW(char_fd,2) = mmo_charstatus_len;
-	WFIFOL(char_fd,4) = sd->status.account_id;
-	WFIFOL(char_fd,8) = sd->status.char_id;
-	WFIFOB(char_fd,12) = (flag&CSAVE_QUIT) ? 1 : 0; //Flag to tell char-server this character is quitting.
-
-	// Copy the whole status into the packet
-	memcpy( WFIFOP( char_fd, 13 ), &sd->status, sizeof( struct mmo_charstatus ) );
-
-	WFIFOSET(char_fd, WFIFOW(char_fd,2));
+	// Characters leaving this map-server always send the complete status
+	chrif_save_status( *sd, ( flag&CSAVE_QUIT ) != 0, ( flag&CSAVE_QUITTING ) != 0 );
 
 	if( sd->status.pet_id > 0 && sd->pd )
 		intif_save_petdata(sd->status.account_id,&sd->pd->pet);
@@ -1499,6 +1628,7 @@ void chrif_on_disconnect(void) {
 	if( chrif_connected != 1 )
 		ShowWarning("Connection to Char Server lost.\n\n");
 	chrif_connected = 0;
+	chrif_save_generation++; // The char-server has to receive complete saves again
 
 	other_mapserver_count = 0; //Reset counter. We receive ALL maps from all map-servers on reconnect.
 	map_eraseallipport();
@@ -1791,6 +1921,7 @@ int32 chrif_parse(int32 fd) {
 			case 0x2b25: chrif_deadopt(RFIFOL(fd,2), RFIFOL(fd,6), RFIFOL(fd,10)); break;
 			case 0x2b27: chrif_authfail(fd); break;
 			case 0x2b2b: chrif_parse_ack_vipActive(fd); break;
+			case 0x2b2c: chrif_save_delta_fail(fd); break;
 			case 0x2b2f: chrif_bsdata_received(fd); break;
 			default:
 				ShowError("chrif_parse : unknown packet (session #%d): 0x%x. Disconnecting.\n", fd, cmd);
@@ -1924,6 +2055,11 @@ int32 auth_db_final(DBKey key, DBData *data, va_list ap) {
  *------------------------------------------*/
 void do_final_chrif(void) {
 
+	if( chrif_save_stats.full_saves > 0 || chrif_save_stats.delta_saves > 0 ){
+		ShowInfo( "Character saves: " CL_WHITE "%" PRIu64 CL_RESET " complete (%" PRIu64 " bytes), " CL_WHITE "%" PRIu64 CL_RESET " delta (%" PRIu64 " bytes).\n",
+			chrif_save_stats.full_saves, chrif_save_stats.full_bytes, chrif_save_stats.delta_saves, chrif_save_stats.delta_bytes );
+	}
+
 	if( char_fd != -1 ) {
 		do_close(char_fd);
 		char_fd = -1;
@@ -1938,7 +2074,7 @@ void do_final_chrif(void) {
  *
  *------------------------------------------*/
 void do_init_chrif(void) {
-	if(sizeof(struct mmo_charstatus) > 0xFFFF){
+	if(sizeof(struct mmo_charstatus) + 17 > 0xFFFF){
 		ShowError("mmo_charstatus size = %" PRIuPTR " is too big to be transmitted. (must be below 0xFFFF)\n",
 			sizeof(struct mmo_charstatus));
 		exit(EXIT_FAILURE);
@@ -36,6 +36,14 @@ struct auth_node {
 	enum sd_state state; //To track whether player was login in/out or changing maps.
 };
 
+/// Statistics of the character status saves
+struct s_chrif_save_stats {
+	uint64 full_saves; ///< Saves that sent the complete status
+	uint64 full_bytes;
+	uint64 delta_saves; ///< Saves that only sent the changes since the last save
+	uint64 delta_bytes;
+};
+
 void chrif_setuserid(char* id);
 void chrif_setpasswd(char* pwd);
 void chrif_checkdefaultlogin(void);
@@ -61,6 +69,7 @@ int32 chrif_skillcooldown_save( const map_session_data& sd );
 int32 chrif_skillcooldown_load(int32 fd);
 
 int32 chrif_save(map_session_data* sd, int32 flag);
+const struct s_chrif_save_stats& chrif_get_save_stats( void );
 int32 chrif_charselectreq(map_session_data* sd, uint32 s_ip);
 int32 chrif_changemapserver(map_session_data* sd, uint32 ip, uint16 port);
 
@@ -398,60 +398,50 @@ static bool clif_session_isValid(const map_session_data* sd) {
  * - AREA_WOS (AREA WITHOUT SELF) : Not run for self
  * - AREA_CHAT_WOC : Everyone in the area of your chat without a chat
  *------------------------------------------*/
-static int32 clif_send_sub(block_list *bl, va_list ap)
+static void clif_send_sub( map_session_data& sd, const void* buf, int32 len, const block_list* src_bl, int32 type, std::vector<int32>& recipients )
 {
-	block_list *src_bl;
-	map_session_data *sd;
-	unsigned char *buf;
-	int32 len, type, fd;
-
-	nullpo_ret(bl);
-	nullpo_ret(sd = (map_session_data *)bl);
+	const block_list* bl = &sd;
+	int32 fd;
 
 	// Don't send to disconnected clients.
-	if( !session_isActive( fd = sd->fd ) ){
-		return 0;
+	if( !session_isActive( fd = sd.fd ) ){
+		return;
 	}
 
-	buf = va_arg(ap,unsigned char*);
-	len = va_arg(ap,int32);
-	nullpo_ret(src_bl = va_arg(ap,block_list*));
-	type = va_arg(ap,int32);
-
 	switch(type) {
 	case AREA_WOS:
 		if (bl == src_bl)
-			return 0;
+			return;
 	break;
 	case AREA_WOC:
-		if (sd->chatID || bl == src_bl)
-			return 0;
+		if (sd.chatID || bl == src_bl)
+			return;
 	break;
 	case AREA_WOSC:
 	{
 		if(src_bl->type == BL_PC) {
-			map_session_data *ssd = (map_session_data *)src_bl;
-			if (ssd && sd->chatID && (sd->chatID == ssd->chatID))
-			return 0;
+			const map_session_data *ssd = (const map_session_data *)src_bl;
+			if (ssd && sd.chatID && (sd.chatID == ssd->chatID))
+			return;
 		}
 		else if(src_bl->type == BL_NPC) {
-			npc_data *nd = (npc_data *)src_bl;
-			if (nd && sd->chatID && (sd->chatID == nd->chat_id))
-			return 0;
+			const npc_data *nd = (const npc_data *)src_bl;
+			if (nd && sd.chatID && (sd.chatID == nd->chat_id))
+			return;
 		}
 	}
 	break;
 	}
 
-	if( src_bl->type == BL_NPC && npc_is_hidden_dynamicnpc( *( (npc_data*)src_bl ), *sd ) ){
+	if( src_bl->type == BL_NPC && npc_is_hidden_dynamicnpc( *( (const npc_data*)src_bl ), sd ) ){
 		// Do not send anything
-		return 0;
+		return;
 	}
 
 	/* unless visible, hold it here */
-	if (!battle_config.update_enemy_position && clif_ally_only && !sd->special_state.intravision &&
-		!sd->sc.getSCE(SC_INTRAVISION) && battle_check_target(src_bl,sd,BCT_ENEMY) > 0)
-		return 0;
+	if (!battle_config.update_enemy_position && clif_ally_only && !sd.special_state.intravision &&
+		!sd.sc.getSCE(SC_INTRAVISION) && battle_check_target(src_bl,&sd,BCT_ENEMY) > 0)
+		return;
 
 	WFIFOHEAD(fd, len);
 	if (WFIFOP(fd,0) == buf) {
@@ -461,13 +451,43 @@ static int32 clif_send_sub(block_list *bl, va_list ap)
 		// don't send to not move the pointer of the packet for next sessions in the loop
 		//WFIFOSET(fd,0);//## TODO is this ok?
 		//NO. It is not ok. There is the chance WFIFOSET actually sends the buffer data, and shifts elements around, which will corrupt the buffer.
-		return 0;
+		return;
 	}
 
-	memcpy(WFIFOP(fd,0), buf, len);
-	WFIFOSET(fd,len);
+	recipients.push_back(fd);
+}
 
-	return 0;
+/// Minimum length of an area packet to queue it as shared packet instead of copying it for every recipient
+#define CLIF_SHARED_PACKET_MIN_LEN 32
+
+/*==========================================
+ * Sends a packet to all players in an area, see clif_send_sub for the types
+ * The recipients are collected first, so larger packets are only copied once
+ * and queued as shared packet for all of them.
+ *------------------------------------------*/
+static void clif_send_area( const void* buf, int32 len, const block_list* bl, int16 range, int32 type )
+{
+	static std::vector<int32> recipients;
+
+	recipients.clear();
+
+	map_foreachinallarea(bl->m, bl->x-range, bl->y-range, bl->x+range, bl->y+range, BL_PC, [buf, len, bl, type]( block_list* tbl ){
+		clif_send_sub( *reinterpret_cast<map_session_data*>( tbl ), buf, len, bl, type, recipients );
+	});
+
+	if( recipients.size() > 1 && len >= CLIF_SHARED_PACKET_MIN_LEN ){
+		t_shared_packet packet = socket_shared_packet( buf, len );
+
+		for( int32 fd : recipients ){
+			WFIFOSHARE( fd, packet );
+		}
+	}else{
+		for( int32 fd : recipients ){
+			WFIFOHEAD( fd, len );
+			memcpy( WFIFOP( fd, 0 ), buf, len );
+			WFIFOSET( fd, len );
+		}
+	}
 }
 
 /*==========================================
@@ -521,12 +541,10 @@ int32 clif_send(const void* buf, int32 len, const block_list* bl, enum send_targ
 		[[fallthrough]];
 	case AREA_WOC:
 	case AREA_WOS:
-		map_foreachinallarea(clif_send_sub, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE,
-			BL_PC, buf, len, bl, type);
+		clif_send_area(buf, len, bl, AREA_SIZE, type);
 		break;
 	case AREA_CHAT_WOC:
-		map_foreachinallarea(clif_send_sub, bl->m, bl->x-(AREA_SIZE-5), bl->y-(AREA_SIZE-5),
-			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, bl, AREA_WOC);
+		clif_send_area(buf, len, bl, AREA_SIZE-5, AREA_WOC);
 		break;
 
 	case CHAT:
@@ -3503,22 +3521,6 @@ void clif_parse_guild_castle_teleport_request(int32 fd, map_session_data* sd){
 #endif
 }
 
-/*==========================================
- *
- *------------------------------------------*/
-static int32 clif_hpmeter_sub( block_list *bl, va_list ap ){
-	map_session_data* sd = va_arg( ap, map_session_data* );
-	map_session_data* tsd = BL_CAST( BL_PC, bl );
-
-	nullpo_ret(sd);
-	nullpo_ret(tsd);
-
-	if( pc_has_permission( tsd, PC_PERM_VIEW_HPMETER ) ){
-		 clif_hpmeter_single( *tsd, sd->status.account_id, sd->battle_status.hp, sd->battle_status.max_hp );
-	}
-	return 0;
-}
-
 /*==========================================
  * Server tells all players that are allowed to view HP bars
  * and are nearby 'sd' that 'sd' hp bar was updated.
@@ -3526,7 +3528,13 @@ static int32 clif_hpmeter_sub( block_list *bl, va_list ap ){
 static int32 clif_hpmeter( const map_session_data* sd )
 {
 	nullpo_ret(sd);
-	map_foreachinallarea(clif_hpmeter_sub, sd->m, sd->x-AREA_SIZE, sd->y-AREA_SIZE, sd->x+AREA_SIZE, sd->y+AREA_SIZE, BL_PC, sd);
+	map_foreachinallarea(sd->m, sd->x-AREA_SIZE, sd->y-AREA_SIZE, sd->x+AREA_SIZE, sd->y+AREA_SIZE, BL_PC, [sd]( block_list* bl ){
+		map_session_data* tsd = reinterpret_cast<map_session_data*>( bl );
+
+		if( pc_has_permission( tsd, PC_PERM_VIEW_HPMETER ) ){
+			clif_hpmeter_single( *tsd, sd->status.account_id, sd->battle_status.hp, sd->battle_status.max_hp );
+		}
+	});
 	return 0;
 }
 
@@ -5569,16 +5577,10 @@ void clif_skillunit_update( block_list& bl ){
 /*==========================================
  *
  *------------------------------------------*/
-static int32 clif_getareachar(block_list* bl,va_list ap)
+static void clif_getareachar( block_list* bl, map_session_data* sd )
 {
-	map_session_data *sd;
-
-	nullpo_ret(bl);
-
-	sd=va_arg(ap,map_session_data*);
-
 	if (!clif_session_isValid(sd))
-		return 0;
+		return;
 
 	switch(bl->type){
 	case BL_ITEM:
@@ -5593,7 +5595,6 @@ static int32 clif_getareachar(block_list* bl,va_list ap)
 		clif_getareachar_unit(sd,bl);
 		break;
 	}
-	return 0;
 }
 
 /*==========================================
@@ -9881,7 +9882,9 @@ void clif_refresh(map_session_data *sd)
 	}
 	if( sd->ed )
 		clif_elemental_info(sd);
-	map_foreachinallrange(clif_getareachar,sd,AREA_SIZE,BL_ALL,sd);
+	map_foreachinallrange(sd, AREA_SIZE, BL_ALL, [sd]( block_list* bl ){
+		clif_getareachar( bl, sd );
+	});
 	clif_weather_check(sd);
 	if( sd->chatID )
 		chat_leavechat(sd,0);
@@ -10839,7 +10842,9 @@ void clif_parse_LoadEndAck(int32 fd,map_session_data *sd)
 
 	// info about nearby objects
 	// must use foreachinarea (CIRCULAR_AREA interferes with foreachinrange)
-	map_foreachinallarea(clif_getareachar, sd->m, sd->x-AREA_SIZE, sd->y-AREA_SIZE, sd->x+AREA_SIZE, sd->y+AREA_SIZE, BL_ALL, sd);
+	map_foreachinallarea(sd->m, sd->x-AREA_SIZE, sd->y-AREA_SIZE, sd->x+AREA_SIZE, sd->y+AREA_SIZE, BL_ALL, [sd]( block_list* bl ){
+		clif_getareachar( bl, sd );
+	});
 
 	// pet
 	if( sd->pd ) {
@@ -1218,6 +1218,181 @@ void ItemDatabase::loadingFinished(){
 	hasPriceValue.clear();
 }
 
+std::string ItemDatabase::getSnapshotKey(){
+	// The snapshot contains the compiled item scripts
+	return std::string( __DATE__ " " __TIME__ "|" ) + std::to_string( sizeof( item_data ) ) + "|" + script_snapshot_key();
+}
+
+/**
+ * Writes all parsed items into the snapshot.
+ * This happens before loadingFinished, which is run again after reading the snapshot.
+ */
+bool ItemDatabase::writeSnapshot( DatabaseSnapshotWriter& writer ){
+	writer.write<uint32>( static_cast<uint32>( this->size() ) );
+
+	for( const auto& it : *this ){
+		const std::shared_ptr<item_data>& item = it.second;
+
+		// Filled by other databases after the item database was loaded
+		if( !item->combos.empty() ){
+			return false;
+		}
+
+		writer.write( item->nameid );
+		writer.writeString( item->name );
+		writer.writeString( item->ename );
+		writer.write( item->value_buy );
+		writer.write( item->value_sell );
+		writer.write( item->type );
+		writer.write( item->subtype );
+		writer.write( item->maxchance );
+		writer.write( item->sex );
+		writer.write( item->equip );
+		writer.write( item->weight );
+		writer.write( item->atk );
+		writer.write( item->def );
+		writer.write( item->range );
+		writer.write( item->slots );
+		writer.write( item->look );
+		writer.write( item->elv );
+		writer.write( item->weapon_level );
+		writer.write( item->armor_level );
+		writer.write( item->view_id );
+		writer.write( item->elvmax );
+#ifdef RENEWAL
+		writer.write( item->matk );
+#endif
+		writer.write( item->class_base );
+		writer.write( item->class_upper );
+		writer.write( item->mob );
+		writer.write( item->flag );
+		writer.write( item->stack );
+		writer.write( item->item_usage );
+		writer.write( item->gm_lv_trade_override );
+		writer.write( item->delay );
+
+		if( !script_snapshot_write( writer, item->script ) || !script_snapshot_write( writer, item->equip_script ) || !script_snapshot_write( writer, item->unequip_script ) ){
+			return false;
+		}
+	}
+
+	// The lookups keep the item, that was parsed last for a name
+	for( const auto* lookup : { &this->nameToItemDataMap, &this->aegisNameToItemDataMap } ){
+		writer.write<uint32>( static_cast<uint32>( lookup->size() ) );
+
+		for( const auto& it : *lookup ){
+			writer.writeString( it.first );
+			writer.write( it.second->nameid );
+		}
+	}
+
+	writer.write<uint32>( static_cast<uint32>( this->hasPriceValue.size() ) );
+
+	for( const auto& it : this->hasPriceValue ){
+		writer.write( it.first );
+		writer.write( it.second );
+	}
+
+	return true;
+}
+
+/**
+ * Reads all items from the snapshot, as if they were parsed from the YAML files.
+ */
+bool ItemDatabase::readSnapshot( DatabaseSnapshotReader& reader ){
+	uint32 count;
+
+	if( !reader.read( count ) ){
+		return false;
+	}
+
+	for( uint32 i = 0; i < count; i++ ){
+		std::shared_ptr<item_data> item = std::make_shared<item_data>();
+
+		bool valid = reader.read( item->nameid )
+			&& reader.readString( item->name )
+			&& reader.readString( item->ename )
+			&& reader.read( item->value_buy )
+			&& reader.read( item->value_sell )
+			&& reader.read( item->type )
+			&& reader.read( item->subtype )
+			&& reader.read( item->maxchance )
+			&& reader.read( item->sex )
+			&& reader.read( item->equip )
+			&& reader.read( item->weight )
+			&& reader.read( item->atk )
+			&& reader.read( item->def )
+			&& reader.read( item->range )
+			&& reader.read( item->slots )
+			&& reader.read( item->look )
+			&& reader.read( item->elv )
+			&& reader.read( item->weapon_level )
+			&& reader.read( item->armor_level )
+			&& reader.read( item->view_id )
+			&& reader.read( item->elvmax )
+#ifdef RENEWAL
+			&& reader.read( item->matk )
+#endif
+			&& reader.read( item->class_base )
+			&& reader.read( item->class_upper )
+			&& reader.read( item->mob )
+			&& reader.read( item->flag )
+			&& reader.read( item->stack )
+			&& reader.read( item->item_usage )
+			&& reader.read( item->gm_lv_trade_override )
+			&& reader.read( item->delay )
+			&& script_snapshot_read( reader, item->script )
+			&& script_snapshot_read( reader, item->equip_script )
+			&& script_snapshot_read( reader, item->unequip_script );
+
+		if( !valid ){
+			return false;
+		}
+
+		this->put( item->nameid, item );
+	}
+
+	for( auto* lookup : { &this->nameToItemDataMap, &this->aegisNameToItemDataMap } ){
+		if( !reader.read( count ) ){
+			return false;
+		}
+
+		for( uint32 i = 0; i < count; i++ ){
+			std::string name;
+			t_itemid nameid;
+
+			if( !reader.readString( name ) || !reader.read( nameid ) ){
+				return false;
+			}
+
+			std::shared_ptr<item_data> item = this->find( nameid );
+
+			if( item == nullptr ){
+				return false;
+			}
+
+			(*lookup)[name] = item;
+		}
+	}
+
+	if( !reader.read( count ) ){
+		return false;
+	}
+
+	for( uint32 i = 0; i < count; i++ ){
+		t_itemid nameid;
+		s_pricevalue value;
+
+		if( !reader.read( nameid ) || !reader.read( value ) ){
+			return false;
+		}
+
+		this->hasPriceValue[nameid] = value;
+	}
+
+	return true;
+}
+
 /**
  * Applies gender restrictions according to settings.
  * @param node: YAML node containing the entry.
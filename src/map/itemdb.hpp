@@ -3552,11 +3552,15 @@ public:
 	const std::string getDefaultLocation() override;
 	uint64 parseBodyNode(const ryml::NodeRef& node) override;
 	void loadingFinished() override;
+	std::string getSnapshotKey() override;
+	bool readSnapshot( DatabaseSnapshotReader& reader ) override;
+	bool writeSnapshot( DatabaseSnapshotWriter& writer ) override;
 	void clear() override{
 		TypesafeCachedYamlDatabase::clear();
 
 		this->nameToItemDataMap.clear();
 		this->aegisNameToItemDataMap.clear();
+		this->hasPriceValue.clear();
 	}
 
 	// Additional
@@ -3,13 +3,25 @@
 
 #include "log.hpp"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
 #include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include <common/cbasetypes.hpp>
 #include <common/nullpo.hpp>
 #include <common/showmsg.hpp>
 #include <common/sql.hpp> // SQL_INNODB
 #include <common/strlib.hpp>
+#include <common/timer.hpp>
 
 #include "battle.hpp"
 #include "homunculus.hpp"
@@ -19,6 +31,7 @@
 #include "npc.hpp"
 #include "pc.hpp"
 #include "pet.hpp"
+#include "sqlworker.hpp"
 
 static char log_timestamp_format[20];
 
@@ -54,6 +67,377 @@ struct Log_Config log_config;
 #define LOG_QUERY "INSERT DELAYED"
 #endif
 
+/*==========================================
+ * Asynchronous log writer [log_async]
+ * Log rows are queued by the main thread and written by a background thread,
+ * which combines the rows of a table into multi-row inserts and keeps the log
+ * files open. The thread uses its own database connection, because neither the
+ * Sql handles nor the memory manager may be used outside of the main thread.
+ *------------------------------------------*/
+
+/// Queued log row
+struct s_log_row {
+	bool sql; ///< Whether the target is a table or a file
+	std::string target; ///< Table or file name
+	std::string columns; ///< Column list of the table
+	std::string values; ///< Value tuple of the row or line of the file
+	std::chrono::steady_clock::time_point queued;
+};
+
+/// Statistics of the log writer since the last report
+struct s_log_writer_stats {
+	size_t rows; ///< Rows that were written
+	size_t writes; ///< Queries or file writes
+	size_t failed; ///< Rows that could not be written
+	size_t stalls; ///< Times the main thread had to wait for free space in the queue
+	size_t queue_max; ///< Highest queue depth
+	double latency_total; ///< Sum of the time the oldest row of each write was queued in milliseconds
+	double latency_max; ///< Longest time a row was queued in milliseconds
+};
+
+class LogWriter{
+private:
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable work; ///< Signaled when a batch is ready or the writer should stop
+	std::condition_variable space; ///< Signaled when the queue was taken by the writer
+	std::deque<s_log_row> queue;
+	std::vector<std::string> errors; ///< Errors of the writer thread, shown by the main thread
+	s_log_writer_stats stats{};
+	bool stopping = false;
+
+	size_t queue_size;
+	size_t batch_size;
+	std::chrono::milliseconds interval;
+
+	SqlThreadConnection connection; ///< Only used by the writer thread
+	std::unordered_map<std::string, FILE*> files;
+
+	void error( const std::string& message ){
+		std::lock_guard<std::mutex> lock( this->mutex );
+
+		this->errors.push_back( message );
+	}
+
+	/// Writes rows of the same table and columns with a single query
+	bool write_sql( const std::string& table, const std::string& columns, const std::vector<const s_log_row*>& rows ){
+		MYSQL* handle = this->connection.connect( [this]( const std::string& message ){ this->error( "log writer: " + message ); } );
+
+		if( handle == nullptr ){
+			return false;
+		}
+
+		std::string query = LOG_QUERY " INTO `" + table + "` (" + columns + ") VALUES ";
+
+		for( size_t i = 0; i < rows.size(); i++ ){
+			if( i > 0 ){
+				query += ',';
+			}
+
+			query += rows[i]->values;
+		}
+
+		if( mysql_real_query( handle, query.c_str(), static_cast<unsigned long>( query.length() ) ) != 0 ){
+			this->error( "log writer: failed to write " + std::to_string( rows.size() ) + " rows to '" + table + "': " + mysql_error( handle ) );
+			return false;
+		}
+
+		return true;
+	}
+
+	bool write_file( const std::string& file, const std::vector<const s_log_row*>& rows ){
+		FILE*& fp = this->files[file];
+
+		if( fp == nullptr && ( fp = fopen( file.c_str(), "a" ) ) == nullptr ){
+			this->error( "log writer: failed to open '" + file + "'" );
+			return false;
+		}
+
+		for( const s_log_row* row : rows ){
+			fputs( row->values.c_str(), fp );
+		}
+
+		return fflush( fp ) == 0;
+	}
+
+	/// Writes the rows taken from the queue, grouped by their target
+	void write( const std::deque<s_log_row>& rows ){
+		std::map<std::tuple<bool, std::string, std::string>, std::vector<const s_log_row*>> groups;
+		std::chrono::steady_clock::time_point now;
+		s_log_writer_stats done{};
+
+		for( const s_log_row& row : rows ){
+			groups[std::make_tuple( row.sql, row.target, row.columns )].push_back( &row );
+		}
+
+		for( const auto& group : groups ){
+			const std::vector<const s_log_row*>& group_rows = group.second;
+
+			for( size_t i = 0; i < group_rows.size(); i += this->batch_size ){
+				std::vector<const s_log_row*> batch( group_rows.begin() + i, group_rows.begin() + std::min( i + this->batch_size, group_rows.size() ) );
+				bool success;
+
+				if( std::get<0>( group.first ) ){
+					success = this->write_sql( std::get<1>( group.first ), std::get<2>( group.first ), batch );
+				}else{
+					success = this->write_file( std::get<1>( group.first ), batch );
+				}
+
+				if( !success ){
+					done.failed += batch.size();
+					continue;
+				}
+
+				// Rows are in queue order, so the first one waited the longest
+				now = std::chrono::steady_clock::now();
+				double latency = std::chrono::duration<double, std::milli>( now - batch.front()->queued ).count();
+
+				done.rows += batch.size();
+				done.writes++;
+				done.latency_total += latency;
+				done.latency_max = std::max( done.latency_max, latency );
+			}
+		}
+
+		std::lock_guard<std::mutex> lock( this->mutex );
+
+		this->stats.rows += done.rows;
+		this->stats.writes += done.writes;
+		this->stats.failed += done.failed;
+		this->stats.latency_total += done.latency_total;
+		this->stats.latency_max = std::max( this->stats.latency_max, done.latency_max );
+	}
+
+	void run(){
+		mysql_thread_init();
+
+		std::unique_lock<std::mutex> lock( this->mutex );
+
+		while( true ){
+			this->work.wait_for( lock, this->interval, [this]{ return this->stopping || this->queue.size() >= this->batch_size; } );
+
+			if( this->queue.empty() ){
+				if( this->stopping ){
+					break;
+				}
+
+				continue;
+			}
+
+			std::deque<s_log_row> rows;
+
+			rows.swap( this->queue );
+			this->space.notify_all();
+
+			lock.unlock();
+			this->write( rows );
+			lock.lock();
+		}
+
+		lock.unlock();
+
+		for( auto& file : this->files ){
+			if( file.second != nullptr ){
+				fclose( file.second );
+			}
+		}
+
+		this->files.clear();
+		this->connection.close();
+
+		mysql_thread_end();
+	}
+
+public:
+	~LogWriter(){
+		this->stop();
+	}
+
+	bool isRunning(){
+		return this->thread.joinable();
+	}
+
+	void start(){
+		if( this->isRunning() ){
+			return;
+		}
+
+		this->queue_size = static_cast<size_t>( std::max( log_config.async_queue, 1 ) );
+		this->batch_size = static_cast<size_t>( std::max( log_config.async_batch, 1 ) );
+		this->interval = std::chrono::milliseconds( std::max( log_config.async_interval, 1 ) );
+		this->connection.setup( log_db_ip, log_db_port, log_db_id, log_db_pw, log_db_db, default_codepage );
+		this->stopping = false;
+		this->thread = std::thread( &LogWriter::run, this );
+	}
+
+	/// Writes all queued rows and stops the writer thread
+	void stop(){
+		if( !this->isRunning() ){
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock( this->mutex );
+
+			this->stopping = true;
+		}
+
+		this->work.notify_one();
+		this->thread.join();
+	}
+
+	void push( s_log_row&& row ){
+		std::unique_lock<std::mutex> lock( this->mutex );
+
+		if( this->queue.size() >= this->queue_size ){
+			// The queue is full, wait for the writer instead of dropping the row
+			this->stats.stalls++;
+			this->work.notify_one();
+			this->space.wait( lock, [this]{ return this->queue.size() < this->queue_size; } );
+		}
+
+		row.queued = std::chrono::steady_clock::now();
+		this->queue.push_back( std::move( row ) );
+		this->stats.queue_max = std::max( this->stats.queue_max, this->queue.size() );
+
+		if( this->queue.size() == this->batch_size ){
+			this->work.notify_one();
+		}
+	}
+
+	/// Shows the errors of the writer thread and optionally the statistics since the last report
+	void report( bool show_stats ){
+		std::vector<std::string> messages;
+		s_log_writer_stats current;
+		size_t depth;
+
+		{
+			std::lock_guard<std::mutex> lock( this->mutex );
+
+			messages.swap( this->errors );
+			current = this->stats;
+			depth = this->queue.size();
+
+			if( show_stats ){
+				this->stats = {};
+			}
+		}
+
+		for( const std::string& message : messages ){
+			ShowError( "%s\n", message.c_str() );
+		}
+
+		if( show_stats ){
+			ShowInfo( "Log writer: " CL_WHITE "%" PRIuPTR CL_RESET " rows in %" PRIuPTR " writes, queue depth %" PRIuPTR " (max %" PRIuPTR "), flush latency %.1f ms (max %.1f ms), %" PRIuPTR " stalls, %" PRIuPTR " failed.\n",
+				current.rows, current.writes, depth, current.queue_max, current.writes > 0 ? current.latency_total / current.writes : 0., current.latency_max, current.stalls, current.failed );
+		}
+	}
+};
+
+static LogWriter log_writer;
+static bool log_writer_initialized = false;
+static t_tick log_writer_last_report = 0;
+
+/// Shows errors of the log writer and its statistics every log_async_report seconds
+static TIMER_FUNC(log_writer_timer){
+	bool show_stats = log_config.async_report > 0 && log_writer.isRunning() && DIFF_TICK( tick, log_writer_last_report ) >= log_config.async_report * 1000;
+
+	if( show_stats ){
+		log_writer_last_report = tick;
+	}
+
+	log_writer.report( show_stats );
+
+	return 0;
+}
+
+/// Starts or stops the log writer according to the configuration
+static void log_writer_apply( void ){
+	if( !log_writer_initialized ){
+		return;
+	}
+
+	// Settings might have changed, queued rows are written before
+	log_writer.stop();
+
+	if( log_config.async ){
+		log_writer.start();
+		log_writer_last_report = gettick();
+	}
+
+	log_writer.report( false );
+}
+
+/// Formats a string like sprintf
+static std::string log_format( const char* fmt, ... ){
+	va_list args;
+
+	va_start( args, fmt );
+	va_list copy;
+	va_copy( copy, args );
+	int32 len = vsnprintf( nullptr, 0, fmt, copy );
+	va_end( copy );
+
+	std::string str( std::max( len, 0 ), '\0' );
+
+	if( len > 0 ){
+		vsnprintf( &str[0], len + 1, fmt, args );
+	}
+
+	va_end( args );
+
+	return str;
+}
+
+/// Escapes a string for the log database
+static std::string log_escape( const char* str, size_t max_len ){
+	size_t len = safestrnlen( str, max_len );
+	std::string escaped( len * 2 + 1, '\0' );
+
+	escaped.resize( Sql_EscapeStringLen( logmysql_handle, &escaped[0], str, len ) );
+
+	return escaped;
+}
+
+/**
+ * Queues a row for a log table, only used while the log writer is running.
+ * Synchronous logs keep using prepared statements instead of escaped strings.
+ * @param table: Log table
+ * @param columns: Columns of the table, the first one receives the time of the event
+ * @param values: Escaped values of the other columns
+ */
+static void log_sql( const char* table, const std::string& columns, const std::string& values ){
+	// The time is taken now, rows of the log writer are inserted later
+	log_writer.push( { true, table, columns, "(FROM_UNIXTIME(" + std::to_string( time( nullptr ) ) + ")," + values + ")" } );
+}
+
+/**
+ * Writes a line to a log file, prefixed with the time of the event.
+ * @param file: Log file
+ * @param line: Line including the line break
+ */
+static void log_file( const char* file, const std::string& line ){
+	char timestring[255];
+	time_t curtime;
+
+	time( &curtime );
+	strftime( timestring, sizeof( timestring ), log_timestamp_format, localtime( &curtime ) );
+
+	std::string entry = std::string( timestring ) + " - " + line;
+
+	if( log_writer.isRunning() ){
+		log_writer.push( { false, file, "", std::move( entry ) } );
+		return;
+	}
+
+	FILE* logfp;
+
+	if( ( logfp = fopen( file, "a" ) ) == nullptr )
+		return;
+	fputs( entry.c_str(), logfp );
+	fclose( logfp );
+}
+
 
 /// obtain log type character for item/zeny logs
 static char log_picktype2char(e_log_pick_type type)
@@ -177,7 +561,11 @@ void log_branch( map_session_data* sd )
 	if( !log_config.branch )
 		return;
 
-	if( log_config.sql_logs ) {
+	if( log_config.sql_logs && log_writer.isRunning() ) {
+		log_sql( log_config.log_branch, "`branch_date`, `account_id`, `char_id`, `char_name`, `map`",
+			log_format( "'%d', '%d', '%s', '%s'", sd->status.account_id, sd->status.char_id, log_escape( sd->status.name, NAME_LENGTH ).c_str(), mapindex_id2name(sd->mapindex) ) );
+	}
+	else if( log_config.sql_logs ) {
 		SqlStmt stmt{ *logmysql_handle };
 
 		if( SQL_SUCCESS != stmt.Prepare(LOG_QUERY " INTO `%s` (`branch_date`, `account_id`, `char_id`, `char_name`, `map`) VALUES (NOW(), '%d', '%d', ?, '%s')", log_config.log_branch, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
@@ -190,16 +578,7 @@ void log_branch( map_session_data* sd )
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_branch, "a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp,"%s - %s[%d:%d]\t%s\n", timestring, sd->status.name, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex));
-		fclose(logfp);
+		log_file( log_config.log_branch, log_format( "%s[%d:%d]\t%s\n", sd->status.name, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) ) );
 	}
 }
 
@@ -215,7 +594,29 @@ void log_pick( int32 id, int16 m, e_log_pick_type type, int32 amount, const item
 	if( !should_log_item(itm->nameid, amount, itm->refine) )
 		return; //we skip logging this item set - it doesn't meet our logging conditions [Lupus]
 
-	if( log_config.sql_logs )
+	if( log_config.sql_logs && log_writer.isRunning() )
+	{
+		static std::string columns;
+
+		if( columns.empty() ){
+			columns = "`time`, `char_id`, `type`, `nameid`, `amount`, `refine`, `map`, `unique_id`, `bound`, `enchantgrade`";
+			for (int32 i = 0; i < MAX_SLOTS; ++i)
+				columns += log_format(", `card%d`", i);
+			for (int32 i = 0; i < MAX_ITEM_RDM_OPT; ++i)
+				columns += log_format(", `option_id%d`, `option_val%d`, `option_parm%d`", i, i, i);
+		}
+
+		std::string values = log_format("'%u','%c','%u','%d','%d','%s','%" PRIu64 "','%d','%d'",
+			id, log_picktype2char(type), itm->nameid, amount, itm->refine, map_getmapdata(m)->name[0] ? map_getmapdata(m)->name : "", itm->unique_id, itm->bound, itm->enchantgrade);
+
+		for (int32 i = 0; i < MAX_SLOTS; i++)
+			values += log_format(",'%u'", itm->card[i]);
+		for (int32 i = 0; i < MAX_ITEM_RDM_OPT; i++)
+			values += log_format(",'%d','%d','%d'", itm->option[i].id, itm->option[i].value, itm->option[i].param);
+
+		log_sql( log_config.log_pick, columns, values );
+	}
+	else if( log_config.sql_logs )
 	{
 		int32 i;
 		SqlStmt stmt{ *logmysql_handle };
@@ -244,16 +645,7 @@ void log_pick( int32 id, int16 m, e_log_pick_type type, int32 amount, const item
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_pick, "a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp,"%s - %d\t%c\t%u,%d,%d,%u,%u,%u,%u,%s,'%" PRIu64 "',%d,%d\n", timestring, id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], map_getmapdata(m)->name[0]?map_getmapdata(m)->name:"", itm->unique_id, itm->bound, itm->enchantgrade);
-		fclose(logfp);
+		log_file( log_config.log_pick, log_format( "%d\t%c\t%u,%d,%d,%u,%u,%u,%u,%s,'%" PRIu64 "',%d,%d\n", id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], map_getmapdata(m)->name[0]?map_getmapdata(m)->name:"", itm->unique_id, itm->bound, itm->enchantgrade ) );
 	}
 }
 
@@ -279,7 +671,12 @@ void log_zeny( const map_session_data &target_sd, e_log_pick_type type, uint32 s
 	if( !log_config.zeny || ( log_config.zeny != 1 && abs(amount) < log_config.zeny ) )
 		return;
 
-	if( log_config.sql_logs )
+	if( log_config.sql_logs && log_writer.isRunning() )
+	{
+		log_sql( log_config.log_zeny, "`time`, `char_id`, `src_id`, `type`, `amount`, `map`",
+			log_format( "'%d', '%d', '%c', '%d', '%s'", target_sd.status.char_id, src_id, log_picktype2char(type), amount, mapindex_id2name(target_sd.mapindex) ) );
+	}
+	else if( log_config.sql_logs )
 	{
 		if (SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `src_id`, `type`, `amount`, `map`) VALUES (NOW(), '%d', '%d', '%c', '%d', '%s')",
 			log_config.log_zeny, target_sd.status.char_id, src_id, log_picktype2char(type), amount, mapindex_id2name(target_sd.mapindex)))
@@ -290,16 +687,7 @@ void log_zeny( const map_session_data &target_sd, e_log_pick_type type, uint32 s
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_zeny, "a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp, "%s - [%d] ->\t%s[%d]\t%d\t\n", timestring, src_id, target_sd.status.name, target_sd.status.char_id, amount);
-		fclose(logfp);
+		log_file( log_config.log_zeny, log_format( "[%d] ->\t%s[%d]\t%d\t\n", src_id, target_sd.status.name, target_sd.status.char_id, amount ) );
 	}
 }
 
@@ -312,7 +700,12 @@ void log_mvpdrop( const map_session_data* sd, int32 monster_id, t_itemid nameid,
 	if( !log_config.mvpdrop )
 		return;
 
-	if( log_config.sql_logs )
+	if( log_config.sql_logs && log_writer.isRunning() )
+	{
+		log_sql( log_config.log_mvpdrop, "`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`",
+			log_format( "'%d', '%d', '%u', '%" PRIu64 "', '%s'", sd->status.char_id, monster_id, nameid, exp, mapindex_id2name(sd->mapindex) ) );
+	}
+	else if( log_config.sql_logs )
 	{
 		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`) VALUES (NOW(), '%d', '%d', '%u', '%" PRIu64 "', '%s') ",
 			log_config.log_mvpdrop, sd->status.char_id, monster_id, nameid, exp, mapindex_id2name(sd->mapindex)) )
@@ -323,16 +716,7 @@ void log_mvpdrop( const map_session_data* sd, int32 monster_id, t_itemid nameid,
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_mvpdrop,"a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp,"%s - %s[%d:%d]\t%d\t%u,%" PRIu64 "\n", timestring, sd->status.name, sd->status.account_id, sd->status.char_id, monster_id, nameid, exp);
-		fclose(logfp);
+		log_file( log_config.log_mvpdrop, log_format( "%s[%d:%d]\t%d\t%u,%" PRIu64 "\n", sd->status.name, sd->status.account_id, sd->status.char_id, monster_id, nameid, exp ) );
 	}
 }
 
@@ -346,7 +730,12 @@ void log_atcommand( map_session_data* sd, const char* message )
 	    !pc_should_log_commands(sd) )
 		return;
 
-	if( log_config.sql_logs )
+	if( log_config.sql_logs && log_writer.isRunning() )
+	{
+		log_sql( log_config.log_gm, "`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`",
+			log_format( "'%d', '%d', '%s', '%s', '%s'", sd->status.account_id, sd->status.char_id, log_escape( sd->status.name, NAME_LENGTH ).c_str(), sd->mapindex == 0 ? "" : mapindex_id2name(sd->mapindex), log_escape( message, 255 ).c_str() ) );
+	}
+	else if( log_config.sql_logs )
 	{
 		SqlStmt stmt{ *logmysql_handle };
 
@@ -361,16 +750,7 @@ void log_atcommand( map_session_data* sd, const char* message )
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_gm, "a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp, "%s - %s[%d]: %s\n", timestring, sd->status.name, sd->status.account_id, message);
-		fclose(logfp);
+		log_file( log_config.log_gm, log_format( "%s[%d]: %s\n", sd->status.name, sd->status.account_id, message ) );
 	}
 }
 
@@ -381,7 +761,12 @@ void log_npc( npc_data* nd, const char* message ){
 	if( !log_config.npc )
 		return;
 
-	if( log_config.sql_logs )
+	if( log_config.sql_logs && log_writer.isRunning() )
+	{
+		log_sql( log_config.log_npc, "`npc_date`, `char_name`, `map`, `mes`",
+			log_format( "'%s', '%s', '%s'", log_escape( nd->name, NAME_LENGTH ).c_str(), map_mapid2mapname(nd->m), log_escape( message, 255 ).c_str() ) );
+	}
+	else if( log_config.sql_logs )
 	{
 		SqlStmt stmt{ *logmysql_handle };
 
@@ -396,16 +781,7 @@ void log_npc( npc_data* nd, const char* message ){
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_npc, "a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp, "%s - %s: %s\n", timestring, nd->name, message);
-		fclose(logfp);
+		log_file( log_config.log_npc, log_format( "%s: %s\n", nd->name, message ) );
 	}
 }
 
@@ -417,7 +793,12 @@ void log_npc( map_session_data* sd, const char* message )
 	if( !log_config.npc )
 		return;
 
-	if( log_config.sql_logs )
+	if( log_config.sql_logs && log_writer.isRunning() )
+	{
+		log_sql( log_config.log_npc, "`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`",
+			log_format( "'%d', '%d', '%s', '%s', '%s'", sd->status.account_id, sd->status.char_id, log_escape( sd->status.name, NAME_LENGTH ).c_str(), mapindex_id2name(sd->mapindex), log_escape( message, 255 ).c_str() ) );
+	}
+	else if( log_config.sql_logs )
 	{
 		SqlStmt stmt{ *logmysql_handle };
 
@@ -432,16 +813,7 @@ void log_npc( map_session_data* sd, const char* message )
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_npc, "a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp, "%s - %s[%d]: %s\n", timestring, sd->status.name, sd->status.account_id, message);
-		fclose(logfp);
+		log_file( log_config.log_npc, log_format( "%s[%d]: %s\n", sd->status.name, sd->status.account_id, message ) );
 	}
 }
 
@@ -463,7 +835,11 @@ void log_chat( e_log_chat_type type, int32 type_id, int32 src_charid, int32 src_
 		dst_charname = "";
 	}
 
-	if( log_config.sql_logs ) {
+	if( log_config.sql_logs && log_writer.isRunning() ) {
+		log_sql( log_config.log_chat, "`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`",
+			log_format( "'%c', '%d', '%d', '%d', '%s', '%d', '%d', '%s', '%s'", log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, log_escape( dst_charname, NAME_LENGTH ).c_str(), log_escape( message, CHAT_SIZE_MAX ).c_str() ) );
+	}
+	else if( log_config.sql_logs ) {
 		SqlStmt stmt{ *logmysql_handle };
 
 		if( SQL_SUCCESS != stmt.Prepare(LOG_QUERY " INTO `%s` (`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`) VALUES (NOW(), '%c', '%d', '%d', '%d', '%s', '%d', '%d', ?, ?)", log_config.log_chat, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y)
@@ -477,16 +853,7 @@ void log_chat( e_log_chat_type type, int32 type_id, int32 src_charid, int32 src_
 	}
 	else
 	{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen(log_config.log_chat, "a") ) == nullptr )
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp, "%s - %c,%d,%d,%d,%s,%d,%d,%s,%s\n", timestring, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, dst_charname, message);
-		fclose(logfp);
+		log_file( log_config.log_chat, log_format( "%c,%d,%d,%d,%s,%d,%d,%s,%s\n", log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, dst_charname, message ) );
 	}
 }
 
@@ -497,7 +864,10 @@ void log_cash( const map_session_data* sd, e_log_pick_type type, e_log_cash_type
 	if( !log_config.cash )
 		return;
 
-	if( log_config.sql_logs ){
+	if( log_config.sql_logs && log_writer.isRunning() ){
+		log_sql( log_config.log_cash, "`time`, `char_id`, `type`, `cash_type`, `amount`, `map`",
+			log_format( "'%d', '%c', '%c', '%d', '%s'", sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) ) );
+	}else if( log_config.sql_logs ){
 		if( SQL_ERROR == Sql_Query( logmysql_handle, LOG_QUERY " INTO `%s` ( `time`, `char_id`, `type`, `cash_type`, `amount`, `map` ) VALUES ( NOW(), '%d', '%c', '%c', '%d', '%s' )",
 			log_config.log_cash, sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) ) )
 		{
@@ -505,16 +875,7 @@ void log_cash( const map_session_data* sd, e_log_pick_type type, e_log_cash_type
 			return;
 		}
 	}else{
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if( ( logfp = fopen( log_config.log_cash, "a" ) ) == nullptr )
-			return;
-		time( &curtime );
-		strftime( timestring, sizeof( timestring ), log_timestamp_format, localtime( &curtime ) );
-		fprintf( logfp, "%s - %s[%d]\t%d(%c)\t\n", timestring, sd->status.name, sd->status.account_id, amount, log_cashtype2char( cash_type ) );
-		fclose( logfp );
+		log_file( log_config.log_cash, log_format( "%s[%d]\t%d(%c)\t\n", sd->status.name, sd->status.account_id, amount, log_cashtype2char( cash_type ) ) );
 	}
 }
 
@@ -550,7 +911,10 @@ void log_feeding( const map_session_data* sd, e_log_feeding_type type, t_itemid
 			break;
 	}
 
-	if (log_config.sql_logs) {
+	if (log_config.sql_logs && log_writer.isRunning()) {
+		log_sql(log_config.log_feeding, "`time`, `char_id`, `target_id`, `target_class`, `type`, `intimacy`, `item_id`, `map`, `x`, `y`",
+			log_format("'%" PRIu32 "', '%" PRIu32 "', '%hu', '%c', '%" PRIu32 "', '%u', '%s', '%hu', '%hu'", sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->x, sd->y));
+	} else if (log_config.sql_logs) {
 		if (SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `target_id`, `target_class`, `type`, `intimacy`, `item_id`, `map`, `x`, `y`) VALUES ( NOW(), '%" PRIu32 "', '%" PRIu32 "', '%hu', '%c', '%" PRIu32 "', '%u', '%s', '%hu', '%hu' )",
 			log_config.log_feeding, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->x, sd->y))
 		{
@@ -558,16 +922,7 @@ void log_feeding( const map_session_data* sd, e_log_feeding_type type, t_itemid
 			return;
 		}
 	} else {
-		char timestring[255];
-		time_t curtime;
-		FILE* logfp;
-
-		if ((logfp = fopen(log_config.log_feeding, "a")) == nullptr)
-			return;
-		time(&curtime);
-		strftime(timestring, sizeof(timestring), log_timestamp_format, localtime(&curtime));
-		fprintf(logfp, "%s - %s[%d]\t%d\t%d(%c)\t%d\t%u\t%s\t%hu,%hu\n", timestring, sd->status.name, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->x, sd->y);
-		fclose(logfp);
+		log_file(log_config.log_feeding, log_format("%s[%d]\t%d\t%d(%c)\t%d\t%u\t%s\t%hu,%hu\n", sd->status.name, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->x, sd->y));
 	}
 }
 
@@ -581,6 +936,11 @@ void log_set_defaults(void)
 	log_config.price_items_log  = 1000; // 1000z
 	log_config.amount_items_log = 100;
 
+	// Asynchronous log writer
+	log_config.async_queue    = 10000;
+	log_config.async_batch    = 100;
+	log_config.async_interval = 100;  // 100ms
+
 	safestrncpy(log_timestamp_format, "%m/%d/%Y %H:%M:%S", sizeof(log_timestamp_format));
 }
 
@@ -659,6 +1019,16 @@ int32 log_config_read( const char* cfgName )
 				safestrncpy( log_config.log_cash, w2, sizeof( log_config.log_cash ) );
 			else if( strcmpi( w1, "log_feeding_db" ) == 0 )
 				safestrncpy( log_config.log_feeding, w2, sizeof( log_config.log_feeding ) );
+			else if( strcmpi( w1, "log_async" ) == 0 )
+				log_config.async = config_switch( w2 ) > 0;
+			else if( strcmpi( w1, "log_async_queue" ) == 0 )
+				log_config.async_queue = atoi( w2 );
+			else if( strcmpi( w1, "log_async_batch" ) == 0 )
+				log_config.async_batch = atoi( w2 );
+			else if( strcmpi( w1, "log_async_interval" ) == 0 )
+				log_config.async_interval = atoi( w2 );
+			else if( strcmpi( w1, "log_async_report" ) == 0 )
+				log_config.async_report = atoi( w2 );
 			// log file timestamp format
 			else if( strcmpi( w1, "log_timestamp_format" ) == 0 )
 				safestrncpy(log_timestamp_format, w2, sizeof(log_timestamp_format));
@@ -710,7 +1080,36 @@ int32 log_config_read( const char* cfgName )
 		if( log_config.feeding ){
 			ShowInfo( "Logging Feeding items to %s '%s'.\n", target, log_config.log_feeding );
 		}
+		if( log_config.async ){
+			ShowInfo( "Logs are written asynchronously in batches of up to %d rows.\n", log_config.async_batch );
+		}
+
+		log_writer_apply();
 	}
 
 	return 0;
 }
+
+void do_init_log( void ){
+	log_writer_initialized = true;
+
+	add_timer_func_list( log_writer_timer, "log_writer_timer" );
+	add_timer_interval( gettick() + 1000, log_writer_timer, 0, 0, 1000 );
+
+	log_writer_apply();
+}
+
+/// Writes all queued rows immediately, used when the server crashed
+void log_flush( void ){
+	log_writer.stop();
+	log_writer.report( false );
+}
+
+void do_final_log( void ){
+	bool running = log_writer.isRunning();
+
+	// Write everything that is still queued
+	log_writer.stop();
+	log_writer.report( running );
+	log_writer_initialized = false;
+}
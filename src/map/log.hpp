@@ -92,6 +92,9 @@ void log_branch( map_session_data* sd );
 void log_mvpdrop( const map_session_data* sd, int32 monster_id, t_itemid nameid, t_exp exp );
 
 int32 log_config_read( const char* cfgName );
+void do_init_log( void );
+void log_flush( void );
+void do_final_log( void );
 
 extern struct Log_Config
 {
@@ -105,6 +108,8 @@ extern struct Log_Config
 	unsigned feeding : 2;
 	char log_branch[64], log_pick[64], log_zeny[64], log_mvpdrop[64], log_gm[64], log_npc[64], log_chat[64], log_cash[64];
 	char log_feeding[64];
+	bool async;
+	int32 async_queue, async_batch, async_interval, async_report;
 } log_config;
 
 #endif /* LOG_HPP */
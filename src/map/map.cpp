@@ -3,8 +3,11 @@
 
 #include "map.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cmath>
+#include <deque>
+#include <map>
 
 #include <config/core.hpp>
 
@@ -50,6 +53,7 @@
 #include "pc.hpp"
 #include "pet.hpp"
 #include "quest.hpp"
+#include "searchstore.hpp"
 #include "storage.hpp"
 #include "trade.hpp"
 
@@ -113,11 +117,135 @@ static DBMap* map_db=nullptr; /// uint32 mapindex -> struct map_data*
 static DBMap* nick_db=nullptr; /// uint32 char_id -> struct charid2nick* (requested names of offline characters)
 static DBMap* charid_db=nullptr; /// uint32 char_id -> map_session_data*
 static DBMap* regen_db=nullptr; /// int32 id -> block_list* (status_natural_heal processing)
+static std::multimap<std::string, map_session_data*> name_index; /// lowercase name -> map_session_data* (sorted for map_nick2sd)
 static DBMap* map_msg_db=nullptr;
 
+/// Direct indexed lookup of the objects in id_db.
+/// Ids are split into the ranges of the floor objects, the players and the npcs/mobs,
+/// each range is indexed by pages that are allocated while they hold an object.
+/// The table is kept in sync with id_db by map_addiddb, map_deliddb and map_addnpc, this
+/// includes floor items, skill units and chat rooms. Ids stay plain ids, because they are
+/// sent to the client and kept by other objects (e.g. npc chat_id, targets) across ticks.
+#define MAP_ID_PAGE_SHIFT 8
+#define MAP_ID_PAGE_SIZE (1 << MAP_ID_PAGE_SHIFT)
+#define MAP_ID_FREE_PAGES 32 // Empty pages kept per range for reuse
+
+struct s_map_id_entry {
+	block_list* bl;
+	bool boss; // Mob is in bossid_db
+};
+
+struct s_map_id_page {
+	struct s_map_id_entry entries[MAP_ID_PAGE_SIZE];
+	int32 count;
+};
+
+struct s_map_id_table {
+	int32 base; // First id of the range
+	std::vector<struct s_map_id_page*> pages;
+	std::vector<struct s_map_id_page*> free_pages;
+};
+
+static struct s_map_id_table map_id_tables[] = {
+	{ 0 }, // Floor items, skill units and chat rooms
+	{ START_ACCOUNT_NUM }, // Players
+	{ START_NPC_NUM }, // NPCs, mobs, pets, homunculus, mercenaries and elementals
+};
+
+static inline struct s_map_id_table& map_idtable(int32 id){
+	if( id >= START_NPC_NUM )
+		return map_id_tables[2];
+	else if( id >= START_ACCOUNT_NUM )
+		return map_id_tables[1];
+	else
+		return map_id_tables[0];
+}
+
+/// Returns the entry of an id or nullptr if no object uses it
+static inline struct s_map_id_entry* map_idtable_find(int32 id){
+	if( id <= 0 )
+		return nullptr;
+
+	struct s_map_id_table& table = map_idtable( id );
+	size_t index = id - table.base;
+	size_t page = index >> MAP_ID_PAGE_SHIFT;
+
+	if( page >= table.pages.size() || table.pages[page] == nullptr )
+		return nullptr;
+
+	struct s_map_id_entry* entry = &table.pages[page]->entries[index & ( MAP_ID_PAGE_SIZE - 1 )];
+
+	return entry->bl != nullptr ? entry : nullptr;
+}
+
+static void map_idtable_put(block_list* bl, bool boss){
+	if( bl->id <= 0 )
+		return;
+
+	struct s_map_id_table& table = map_idtable( bl->id );
+	size_t index = bl->id - table.base;
+	size_t page = index >> MAP_ID_PAGE_SHIFT;
+
+	if( page >= table.pages.size() )
+		table.pages.resize( page + 1, nullptr );
+
+	if( table.pages[page] == nullptr ){
+		if( table.free_pages.empty() ){
+			CREATE( table.pages[page], struct s_map_id_page, 1 );
+		}else{
+			table.pages[page] = table.free_pages.back();
+			table.free_pages.pop_back();
+		}
+	}
+
+	struct s_map_id_entry& entry = table.pages[page]->entries[index & ( MAP_ID_PAGE_SIZE - 1 )];
+
+	if( entry.bl == nullptr )
+		table.pages[page]->count++;
+
+	entry.bl = bl;
+	entry.boss = boss;
+}
+
+static void map_idtable_remove(int32 id){
+	struct s_map_id_entry* entry = map_idtable_find( id );
+
+	if( entry == nullptr )
+		return;
+
+	entry->bl = nullptr;
+	entry->boss = false;
+
+	struct s_map_id_table& table = map_idtable( id );
+	size_t page = ( id - table.base ) >> MAP_ID_PAGE_SHIFT;
+
+	if( --table.pages[page]->count == 0 ){
+		if( table.free_pages.size() < MAP_ID_FREE_PAGES )
+			table.free_pages.push_back( table.pages[page] );
+		else
+			aFree( table.pages[page] );
+
+		table.pages[page] = nullptr;
+	}
+}
+
+static void map_idtable_final(void){
+	for( struct s_map_id_table& table : map_id_tables ){
+		for( struct s_map_id_page* page : table.pages ){
+			if( page != nullptr )
+				aFree( page );
+		}
+
+		for( struct s_map_id_page* page : table.free_pages )
+			aFree( page );
+
+		table.pages.clear();
+		table.free_pages.clear();
+	}
+}
+
 static int32 map_users=0;
 
-#define BLOCK_SIZE 8
 #define block_free_max 1048576
 block_list *block_free[block_free_max];
 static int32 block_free_count = 0, block_free_lock = 0;
@@ -183,6 +311,8 @@ const char *MSG_CONF_NAME_THA;
 char wisp_server_name[NAME_LENGTH] = "Server"; // can be modified in char-server configuration file
 
 int32 console = 0;
+static bool timer_profile = false; // collect timer function statistics
+static int32 timer_profile_interval = 0; // seconds between timer statistic reports
 int32 enable_spy = 0; //To enable/disable @spy commands, which consume too much cpu time when sending packets. [Skotlex]
 int32 enable_grf = 0;	//To enable/disable reading maps from GRF files, bypassing mapcache [blackhole89]
 
@@ -191,6 +321,7 @@ struct s_generator_options {
 	bool navi;
 	bool itemmoveinfo;
 	bool reputation;
+	bool battle_benchmark;
 } gen_options;
 #endif
 
@@ -386,7 +517,7 @@ static void map_addblcell(block_list *bl)
 
 	if( bl->m<0 || bl->x<0 || bl->x>=mapdata->xs || bl->y<0 || bl->y>=mapdata->ys || !(bl->type&BL_CHAR) )
 		return;
-	mapdata->cell[bl->x+bl->y*mapdata->xs].cell_bl++;
+	map_cell_write(mapdata, bl->x+bl->y*mapdata->xs).cell_bl++;
 	return;
 }
 
@@ -396,10 +527,150 @@ static void map_delblcell(block_list *bl)
 
 	if( bl->m <0 || bl->x<0 || bl->x>=mapdata->xs || bl->y<0 || bl->y>=mapdata->ys || !(bl->type&BL_CHAR) )
 		return;
-	mapdata->cell[bl->x+bl->y*mapdata->xs].cell_bl--;
+	map_cell_write(mapdata, bl->x+bl->y*mapdata->xs).cell_bl--;
 }
 #endif
 
+/*==========================================
+ * Structure of arrays block index
+ * Keeps the coordinates and types of the objects of a block next to each other,
+ * so range queries only need to dereference the objects that match.
+ * Most blocks of a map never hold an object, so a block only gets its index
+ * when the first object enters it and keeps it afterwards.
+ *------------------------------------------*/
+static void map_blockindex_init( struct map_data* mapdata ){
+	size_t size = mapdata->bxs * mapdata->bys;
+
+	mapdata->block_index.clear();
+	mapdata->block_index.resize( size );
+	mapdata->block_mob_index.clear();
+	mapdata->block_mob_index.resize( size );
+}
+
+static void map_blockindex_final( struct map_data* mapdata ){
+	mapdata->block_index.clear();
+	mapdata->block_index.shrink_to_fit();
+	mapdata->block_mob_index.clear();
+	mapdata->block_mob_index.shrink_to_fit();
+}
+
+static s_map_block_index* map_blockindex_get( struct map_data* mapdata, block_list* bl, int32 pos, bool create = false ){
+	std::vector<std::unique_ptr<s_map_block_index>>& blocks = bl->type == BL_MOB ? mapdata->block_mob_index : mapdata->block_index;
+
+	if( pos < 0 || static_cast<size_t>( pos ) >= blocks.size() ){
+		return nullptr;
+	}
+
+	if( blocks[pos] == nullptr && create ){
+		blocks[pos] = std::make_unique<s_map_block_index>();
+	}
+
+	return blocks[pos].get();
+}
+
+static void map_blockindex_add( struct map_data* mapdata, block_list* bl, int32 pos ){
+	s_map_block_index* index = map_blockindex_get( mapdata, bl, pos, true );
+
+	if( index == nullptr ){
+		return;
+	}
+
+	index->objects.push_back( bl );
+	index->x.push_back( bl->x );
+	index->y.push_back( bl->y );
+	index->type.push_back( bl->type );
+}
+
+static size_t map_blockindex_find( const s_map_block_index& index, const block_list* bl ){
+	// Recently added objects are at the end
+	for( size_t i = index.objects.size(); i-- > 0; ){
+		if( index.objects[i] == bl ){
+			return i;
+		}
+	}
+
+	return SIZE_MAX;
+}
+
+static void map_blockindex_remove( struct map_data* mapdata, block_list* bl, int32 pos ){
+	s_map_block_index* index = map_blockindex_get( mapdata, bl, pos );
+
+	if( index == nullptr ){
+		return;
+	}
+
+	size_t i = map_blockindex_find( *index, bl );
+
+	if( i == SIZE_MAX ){
+		ShowError( "map_blockindex_remove: Object %d not found in block %d of map %s.\n", bl->id, pos, mapdata->name );
+		return;
+	}
+
+	// Keep the order, blocks only hold a few objects
+	index->objects.erase( index->objects.begin() + i );
+	index->x.erase( index->x.begin() + i );
+	index->y.erase( index->y.begin() + i );
+	index->type.erase( index->type.begin() + i );
+}
+
+static void map_blockindex_move( struct map_data* mapdata, block_list* bl ){
+	s_map_block_index* index = map_blockindex_get( mapdata, bl, bl->x / BLOCK_SIZE + ( bl->y / BLOCK_SIZE ) * mapdata->bxs );
+
+	if( index == nullptr ){
+		return;
+	}
+
+	size_t i = map_blockindex_find( *index, bl );
+
+	if( i == SIZE_MAX ){
+		ShowError( "map_blockindex_move: Object %d not found on map %s.\n", bl->id, mapdata->name );
+		return;
+	}
+
+	index->x[i] = bl->x;
+	index->y[i] = bl->y;
+}
+
+/**
+ * Adds all objects of a block index that match the type and are inside (x0,y0)-(x1,y1) to list.
+ * The coordinates and types are filtered in branchless passes over chunks of the block first, which the compiler can vectorize.
+ * @param index: Block index or nullptr if the block never held an object
+ * @param type: Type of bl to search for
+ * @param x0: West end of area
+ * @param y0: South end of area
+ * @param x1: East end of area
+ * @param y1: North end of area
+ * @param list: Found objects are added here in block list order
+ * @param filter: Additional check for the matching objects
+ */
+template <typename Filter> static void map_blockindex_collect( const s_map_block_index* index, int32 type, int16 x0, int16 y0, int16 x1, int16 y1, std::vector<block_list*>& list, Filter&& filter ){
+	if( index == nullptr ){
+		return;
+	}
+
+	const int16* xs = index->x.data();
+	const int16* ys = index->y.data();
+	const int32* types = index->type.data();
+	uint8 match[64];
+
+	// Chunks are taken from the end, the objects are visited backwards like the block list
+	for( size_t end = index->objects.size(); end > 0; ){
+		size_t start = end > ARRAYLENGTH( match ) ? end - ARRAYLENGTH( match ) : 0;
+
+		for( size_t i = start; i < end; i++ ){
+			match[i - start] = ( xs[i] >= x0 ) & ( xs[i] <= x1 ) & ( ys[i] >= y0 ) & ( ys[i] <= y1 ) & ( ( types[i] & type ) != 0 );
+		}
+
+		for( size_t i = end; i-- > start; ){
+			if( match[i - start] && filter( index->objects[i] ) ){
+				list.push_back( index->objects[i] );
+			}
+		}
+
+		end = start;
+	}
+}
+
 /*==========================================
  * Adds a block to the map.
  * Returns 0 on success, 1 on failure (illegal coordinates).
@@ -438,6 +709,7 @@ int32 map_addblock(block_list* bl)
 	}
 
 	pos = x/BLOCK_SIZE+(y/BLOCK_SIZE)*mapdata->bxs;
+	mapdata->block_version++;
 
 	if (bl->type == BL_MOB) {
 		bl->next = mapdata->block_mob[pos];
@@ -450,6 +722,7 @@ int32 map_addblock(block_list* bl)
 		if (bl->next) bl->next->prev = bl;
 		mapdata->block[pos] = bl;
 	}
+	map_blockindex_add(mapdata, bl, pos);
 
 #ifdef CELL_NOSTACK
 	map_addblcell(bl);
@@ -484,6 +757,7 @@ int32 map_delblock(block_list* bl)
 	nullpo_ret(mapdata);
 
 	pos = bl->x/BLOCK_SIZE+(bl->y/BLOCK_SIZE)*mapdata->bxs;
+	mapdata->block_version++;
 
 	if (bl->next)
 		bl->next->prev = bl->prev;
@@ -501,6 +775,7 @@ int32 map_delblock(block_list* bl)
 	}
 	bl->next = nullptr;
 	bl->prev = nullptr;
+	map_blockindex_remove(mapdata, bl, pos);
 
 	return 0;
 }
@@ -559,13 +834,16 @@ int32 map_moveblock(block_list *bl, int32 x1, int32 y1, t_tick tick)
 #endif
 	bl->x = x1;
 	bl->y = y1;
+	map_getmapdata(bl->m)->block_version++;
 	if (moveblock) {
 		if(map_addblock(bl))
 			return 1;
-	}
+	} else {
+		map_blockindex_move(map_getmapdata(bl->m), bl);
 #ifdef CELL_NOSTACK
-	else map_addblcell(bl);
+		map_addblcell(bl);
 #endif
+	}
 
 	if (bl->type&BL_CHAR) {
 
@@ -713,26 +991,101 @@ skill_unit* map_find_skill_unit_oncell(block_list* target,int16 x,int16 y,uint16
 	return nullptr;
 }
 
+static std::deque<std::vector<block_list*>> map_blocklist_pool;
+static size_t map_blocklist_depth = 0;
+
+/**
+ * Returns an empty buffer for the results of a spatial query.
+ * Buffers are pooled per nesting level and keep their capacity, so nested queries
+ * from inside the callbacks get their own buffer and no allocation happens once the pool is warm.
+ * @return Buffer that stays valid until map_blocklist_release is called
+ */
+std::vector<block_list*>& map_blocklist_acquire(){
+	if( map_blocklist_depth == map_blocklist_pool.size() ){
+		map_blocklist_pool.emplace_back();
+	}
+
+	std::vector<block_list*>& list = map_blocklist_pool[map_blocklist_depth++];
+
+	list.clear();
+
+	return list;
+}
+
+/**
+ * Releases the last buffer returned by map_blocklist_acquire.
+ */
+void map_blocklist_release(){
+	if( map_blocklist_depth == 0 ){
+		ShowError( "map_blocklist_release: No buffer acquired.\n" );
+		return;
+	}
+
+	map_blocklist_depth--;
+}
+
+/**
+ * Resolves the line of sight check of a spatial query.
+ * @param check: Check
+ * @return True if the objects have to be shootable
+ */
+static bool map_query_wallcheck( e_map_query_check check ){
+	switch( check ){
+		case MAPQUERY_SHOOT:
+			return true;
+		case MAPQUERY_SKILL:
+			return battle_config.skill_wall_check > 0;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Calls a va_list callback for all objects of a spatial query, which were not removed in the meantime.
+ * @param list: Objects
+ * @param func: Function to call
+ * @param ap: Arguments for func
+ * @return Sum of the return values of func
+ */
+static int32 map_blocklist_callV( const std::vector<block_list*>& list, int32 (*func)(block_list*, va_list), va_list ap ){
+	int32 returnCount = 0;
+	va_list ap_copy;
+
+	FreeBlockLock freeLock;
+
+	for( block_list* bl : list ){
+		if( bl->prev ){ //func() may delete this bl, checking for prev ensures it wasn't queued for deletion.
+			va_copy( ap_copy, ap );
+			returnCount += func( bl, ap_copy );
+			va_end( ap_copy );
+		}
+	}
+
+	return returnCount;
+}
+
 /*==========================================
- * Adapted from foreachinarea for an easier invocation. [Skotlex]
+ * Collects all objects of a type in range of center. [Skotlex]
+ * Non-monster objects come first, both in block order.
+ * @param list: Found objects are added here
+ * @param center: Center of the range
+ * @param range: Range
+ * @param type: Type of bl to search for
+ * @param check: Line of sight check
  *------------------------------------------*/
-int32 map_foreachinrangeV(int32 (*func)(block_list*,va_list),const block_list* center, int16 range, int32 type, va_list ap, bool wall_check)
-{
+void map_getblocks_inrange( std::vector<block_list*>& list, const block_list* center, int16 range, int32 type, e_map_query_check check ){
 	int32 bx, by, m;
-	int32 returnCount = 0;	//total sum of returned values of func() [Skotlex]
-	block_list *bl;
-	int32 blockcount = bl_list_count, i;
 	int32 x0, x1, y0, y1;
-	va_list ap_copy;
+	bool wall_check = map_query_wallcheck( check );
 
 	m = center->m;
 	if( m < 0 )
-		return 0;
+		return;
 
 	struct map_data *mapdata = map_getmapdata(m);
 
 	if( mapdata == nullptr || mapdata->block == nullptr ){
-		return 0;
+		return;
 	}
 
 	x0 = i16max(center->x - range, 0);
@@ -740,19 +1093,18 @@ int32 map_foreachinrangeV(int32 (*func)(block_list*,va_list),const block_list* c
 	x1 = i16min(center->x + range, mapdata->xs - 1);
 	y1 = i16min(center->y + range, mapdata->ys - 1);
 
+	auto filter = [&]( block_list* bl ){
+		return true
+#ifdef CIRCULAR_AREA
+			&& check_distance_bl(center, bl, range)
+#endif
+			&& ( !wall_check || path_search_long(nullptr, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL) );
+	};
+
 	if ( type&~BL_MOB ) {
 		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
 			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for(bl = mapdata->block[ bx + by * mapdata->bxs ]; bl != nullptr; bl = bl->next ) {
-					if( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& ( !wall_check || path_search_long(nullptr, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL) )
-					  	&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
+				map_blockindex_collect( mapdata->block_index[bx + by * mapdata->bxs].get(), type&~BL_MOB, x0, y0, x1, y1, list, filter );
 			}
 		}
 	}
@@ -760,34 +1112,22 @@ int32 map_foreachinrangeV(int32 (*func)(block_list*,va_list),const block_list* c
 	if ( type&BL_MOB ) {
 		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
 			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for(bl = mapdata->block_mob[ bx + by * mapdata->bxs ]; bl != nullptr; bl = bl->next ) {
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& ( !wall_check || path_search_long(nullptr, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL) )
-					  	&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
+				map_blockindex_collect( mapdata->block_mob_index[bx + by * mapdata->bxs].get(), BL_MOB, x0, y0, x1, y1, list, filter );
 			}
 		}
 	}
+}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinrange: block count too many!\n");
-
-	FreeBlockLock freeLock;
+/*==========================================
+ * Adapted from foreachinarea for an easier invocation. [Skotlex]
+ *------------------------------------------*/
+int32 map_foreachinrangeV(int32 (*func)(block_list*,va_list),const block_list* center, int16 range, int32 type, va_list ap, bool wall_check)
+{
+	MapBlockList list;
 
-	for( i = blockcount; i < bl_list_count; i++ ) {
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_copy(ap_copy, ap);
-			returnCount += func(bl_list[i], ap_copy);
-			va_end(ap_copy);
-		}
-	}
+	map_getblocks_inrange( list, center, range, type, wall_check ? MAPQUERY_SHOOT : MAPQUERY_ALL );
 
-	bl_list_count = blockcount;
-	return returnCount;	//[Skotlex]
+	return map_blocklist_callV( list, func, ap );
 }
 
 int32 map_foreachinrange(int32 (*func)(block_list*,va_list), const block_list* center, int16 range, int32 type, ...)
@@ -825,25 +1165,23 @@ int32 map_foreachinshootrange(int32 (*func)(block_list*,va_list), const block_li
 
 
 /*========================================== [Playtester]
- * range = map m (x0,y0)-(x1,y1)
- * Apply *func with ... arguments for the range.
+ * Collects all objects of a type in the area map m (x0,y0)-(x1,y1).
+ * Non-monster objects come first, both in block order.
+ * @param list: Found objects are added here
  * @param m: ID of map
  * @param x0: West end of area
  * @param y0: South end of area
  * @param x1: East end of area
  * @param y1: North end of area
  * @param type: Type of bl to search for
+ * @param check: Line of sight check from the center of the area
 *------------------------------------------*/
-int32 map_foreachinareaV(int32 (*func)(block_list*, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, va_list ap, bool wall_check)
-{
+void map_getblocks_inarea( std::vector<block_list*>& list, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, e_map_query_check check ){
 	int32 bx, by, cx, cy;
-	int32 returnCount = 0;	//total sum of returned values of func()
-	block_list *bl;
-	int32 blockcount = bl_list_count, i;
-	va_list ap_copy;
+	bool wall_check = map_query_wallcheck( check );
 
 	if (m < 0)
-		return 0;
+		return;
 
 	if (x1 < x0)
 		std::swap(x0, x1);
@@ -853,7 +1191,7 @@ int32 map_foreachinareaV(int32 (*func)(block_list*, va_list), int16 m, int16 x0,
 	struct map_data *mapdata = map_getmapdata(m);
 
 	if( mapdata == nullptr || mapdata->block == nullptr ){
-		return 0;
+		return;
 	}
 
 	x0 = i16max(x0, 0);
@@ -861,21 +1199,17 @@ int32 map_foreachinareaV(int32 (*func)(block_list*, va_list), int16 m, int16 x0,
 	x1 = i16min(x1, mapdata->xs - 1);
 	y1 = i16min(y1, mapdata->ys - 1);
 
-	if( wall_check ) {
-		cx = x0 + (x1 - x0) / 2;
-		cy = y0 + (y1 - y0) / 2;
-	}
+	cx = x0 + (x1 - x0) / 2;
+	cy = y0 + (y1 - y0) / 2;
+
+	auto filter = [m, cx, cy, wall_check]( block_list* bl ){
+		return !wall_check || path_search_long(nullptr, m, cx, cy, bl->x, bl->y, CELL_CHKWALL);
+	};
 
 	if( type&~BL_MOB ) {
 		for (by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
 			for (bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
-				for(bl = mapdata->block[bx + by * mapdata->bxs]; bl != nullptr; bl = bl->next) {
-					if ( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-						&& ( !wall_check || path_search_long(nullptr, m, cx, cy, bl->x, bl->y, CELL_CHKWALL) )
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-				}
+				map_blockindex_collect( mapdata->block_index[bx + by * mapdata->bxs].get(), type&~BL_MOB, x0, y0, x1, y1, list, filter );
 			}
 		}
 	}
@@ -883,31 +1217,29 @@ int32 map_foreachinareaV(int32 (*func)(block_list*, va_list), int16 m, int16 x0,
 	if( type&BL_MOB ) {
 		for (by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
 			for (bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
-				for(bl = mapdata->block_mob[bx + by * mapdata->bxs]; bl != nullptr; bl = bl->next) {
-					if ( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-						&& ( !wall_check || path_search_long(nullptr, m, cx, cy, bl->x, bl->y, CELL_CHKWALL) )
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-				}
+				map_blockindex_collect( mapdata->block_mob_index[bx + by * mapdata->bxs].get(), BL_MOB, x0, y0, x1, y1, list, filter );
 			}
 		}
 	}
+}
 
-	if (bl_list_count >= BL_LIST_MAX)
-		ShowWarning("map_foreachinarea: block count too many!\n");
-
-	FreeBlockLock freeLock;
+/*========================================== [Playtester]
+ * range = map m (x0,y0)-(x1,y1)
+ * Apply *func with ... arguments for the range.
+ * @param m: ID of map
+ * @param x0: West end of area
+ * @param y0: South end of area
+ * @param x1: East end of area
+ * @param y1: North end of area
+ * @param type: Type of bl to search for
+*------------------------------------------*/
+int32 map_foreachinareaV(int32 (*func)(block_list*, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, va_list ap, bool wall_check)
+{
+	MapBlockList list;
 
-	for (i = blockcount; i < bl_list_count; i++) {
-		if (bl_list[i]->prev) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_copy(ap_copy, ap);
-			returnCount += func(bl_list[i], ap_copy);
-			va_end(ap_copy);
-		}
-	}
+	map_getblocks_inarea( list, m, x0, y0, x1, y1, type, wall_check ? MAPQUERY_SHOOT : MAPQUERY_ALL );
 
-	bl_list_count = blockcount;
-	return returnCount;
+	return map_blocklist_callV( list, func, ap );
 }
 
 int32 map_foreachinallarea(int32 (*func)(block_list*,va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, ...)
@@ -1203,56 +1535,48 @@ int32 map_foreachinmovearea(int32 (*func)(block_list*,va_list), const block_list
 //			 which only checks the exact single x/y passed to it rather than an
 //			 area radius - may be more useful in some instances)
 //
-int32 map_foreachincell(int32 (*func)(block_list*,va_list), int16 m, int16 x, int16 y, int32 type, ...)
-{
+void map_getblocks_incell( std::vector<block_list*>& list, int16 m, int16 x, int16 y, int32 type ){
 	int32 bx, by;
-	int32 returnCount = 0;  //total sum of returned values of func() [Skotlex]
-	block_list *bl;
-	int32 blockcount = bl_list_count, i;
 	struct map_data *mapdata = map_getmapdata(m);
-	va_list ap;
 
 	if( mapdata == nullptr || mapdata->block == nullptr ){
-		return 0;
+		return;
 	}
 
-	if ( x < 0 || y < 0 || x >= mapdata->xs || y >= mapdata->ys ) return 0;
+	if ( x < 0 || y < 0 || x >= mapdata->xs || y >= mapdata->ys ) return;
 
 	by = y / BLOCK_SIZE;
 	bx = x / BLOCK_SIZE;
 
+	auto filter = []( block_list* bl ){
+		return true;
+	};
+
 	if( type&~BL_MOB )
-		for( bl = mapdata->block[ bx + by * mapdata->bxs ]; bl != nullptr; bl = bl->next )
-			if( bl->type&type && bl->x == x && bl->y == y && bl_list_count < BL_LIST_MAX )
-				bl_list[ bl_list_count++ ] = bl;
+		map_blockindex_collect( mapdata->block_index[bx + by * mapdata->bxs].get(), type&~BL_MOB, x, y, x, y, list, filter );
 	if( type&BL_MOB )
-		for( bl = mapdata->block_mob[ bx + by * mapdata->bxs]; bl != nullptr; bl = bl->next )
-			if( bl->x == x && bl->y == y && bl_list_count < BL_LIST_MAX)
-				bl_list[ bl_list_count++ ] = bl;
+		map_blockindex_collect( mapdata->block_mob_index[bx + by * mapdata->bxs].get(), BL_MOB, x, y, x, y, list, filter );
+}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachincell: block count too many!\n");
-	
-	FreeBlockLock freeLock;
+int32 map_foreachincell(int32 (*func)(block_list*,va_list), int16 m, int16 x, int16 y, int32 type, ...)
+{
+	int32 returnCount = 0;  //total sum of returned values of func() [Skotlex]
+	MapBlockList list;
+	va_list ap;
 
-	for( i = blockcount; i < bl_list_count; i++ ) {
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
-	}
+	map_getblocks_incell( list, m, x, y, type );
+
+	va_start(ap, type);
+	returnCount = map_blocklist_callV( list, func, ap );
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;
 }
 
 /*============================================================
-* For checking a path between two points (x0, y0) and (x1, y1)
+* Collects all objects of a type in range of the path between two points (x0, y0) and (x1, y1)
 *------------------------------------------------------------*/
-int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int16 y0,int16 x1,int16 y1,int16 range,int32 length, int32 type,...)
-{
-	int32 returnCount = 0;  //total sum of returned values of func() [Skotlex]
+void map_getblocks_inpath( std::vector<block_list*>& list, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int32 length, int32 type ){
 //////////////////////////////////////////////////////////////
 //
 // sharp shooting 3 [Skotlex]
@@ -1287,24 +1611,22 @@ int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int1
 // kRO.
 
 	//Generic map_foreach* variables.
-	int32 i, blockcount = bl_list_count;
 	block_list *bl;
 	int32 bx, by;
 	//method specific variables
 	int32 magnitude2, len_limit; //The square of the magnitude
 	int32 k, xi, yi, xu, yu;
 	int32 mx0 = x0, mx1 = x1, my0 = y0, my1 = y1;
-	va_list ap;
 
 	//Avoid needless calculations by not getting the sqrt right away.
 	#define MAGNITUDE2(x0, y0, x1, y1) ( ( ( x1 ) - ( x0 ) ) * ( ( x1 ) - ( x0 ) ) + ( ( y1 ) - ( y0 ) ) * ( ( y1 ) - ( y0 ) ) )
 
 	if ( m < 0 )
-		return 0;
+		return;
 
 	len_limit = magnitude2 = MAGNITUDE2(x0, y0, x1, y1);
 	if ( magnitude2 < 1 ) //Same begin and ending point, can't trace path.
-		return 0;
+		return;
 
 	if ( length ) { //Adjust final position to fit in the given area.
 		//TODO: Find an alternate method which does not requires a square root calculation.
@@ -1338,7 +1660,7 @@ int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int1
 	struct map_data *mapdata = map_getmapdata(m);
 
 	if( mapdata == nullptr || mapdata->block == nullptr ){
-		return 0;
+		return;
 	}
 
 	mx0 = max(mx0, 0);
@@ -1352,7 +1674,7 @@ int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int1
 		for ( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
 			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
 				for( bl = mapdata->block[ bx + by * mapdata->bxs ]; bl != nullptr; bl = bl->next ) {
-					if( bl->prev && bl->type&type && bl_list_count < BL_LIST_MAX ) {
+					if( bl->prev && bl->type&type ) {
 						xi = bl->x;
 						yi = bl->y;
 
@@ -1377,7 +1699,7 @@ int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int1
 						if ( k > range )
 							continue;
 
-						bl_list[ bl_list_count++ ] = bl;
+						list.push_back( bl );
 					}
 				}
 			}
@@ -1386,7 +1708,7 @@ int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int1
 		for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
 			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
 				for( bl = mapdata->block_mob[ bx + by * mapdata->bxs ]; bl != nullptr; bl = bl->next ) {
-					if( bl->prev && bl_list_count < BL_LIST_MAX ) {
+					if( bl->prev ) {
 						xi = bl->x;
 						yi = bl->y;
 						k = ( xi - x0 ) * ( x1 - x0 ) + ( yi - y0 ) * ( y1 - y0 );
@@ -1408,28 +1730,27 @@ int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int1
 						if ( k > range )
 							continue;
 
-						bl_list[ bl_list_count++ ] = bl;
+						list.push_back( bl );
 					}
 				}
 			}
 		}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinpath: block count too many!\n");
+}
 
-	FreeBlockLock freeLock;
+int32 map_foreachinpath(int32 (*func)(block_list*,va_list),int16 m,int16 x0,int16 y0,int16 x1,int16 y1,int16 range,int32 length, int32 type,...)
+{
+	int32 returnCount = 0;  //total sum of returned values of func() [Skotlex]
+	MapBlockList list;
+	va_list ap;
 
-	for( i = blockcount; i < bl_list_count; i++ ) {
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
-	}
+	map_getblocks_inpath( list, m, x0, y0, x1, y1, range, length, type );
 
-	bl_list_count = blockcount;
-	return returnCount;	//[Skotlex]
+	va_start(ap, type);
+	returnCount = map_blocklist_callV( list, func, ap );
+	va_end(ap);
 
+	return returnCount;	//[Skotlex]
 }
 
 /*========================================== [Playtester]
@@ -1657,7 +1978,7 @@ int32 map_get_new_object_id(void)
 		if( i == MAX_FLOORITEM )
 			i = MIN_FLOORITEM;
 
-		if( !idb_exists(id_db, i) )
+		if( map_idtable_find(i) == nullptr )
 			break;
 
 		++i;
@@ -1679,7 +2000,7 @@ int32 map_get_new_object_id(void)
  * Called each flooritem_lifetime ms
  *------------------------------------------*/
 TIMER_FUNC(map_clearflooritem_timer){
-	flooritem_data* fitem = (flooritem_data*)idb_get(id_db, id);
+	flooritem_data* fitem = (flooritem_data*)map_id2bl(id);
 
 	if (fitem == nullptr || fitem->type != BL_ITEM || (fitem->cleartimer != tid)) {
 		ShowError("map_clearflooritem_timer : error\n");
@@ -2162,6 +2483,41 @@ void map_reqnickdb(map_session_data * sd, int32 charid)
 	chrif_searchcharid(charid);
 }
 
+/// Returns the key of a name in name_index
+static std::string map_namekey(const char* name)
+{
+	std::string key( name );
+
+	util::tolower( key );
+
+	return key;
+}
+
+static void map_addnameindex(map_session_data* sd)
+{
+	std::string key = map_namekey( sd->status.name );
+	auto range = name_index.equal_range( key );
+
+	for( auto it = range.first; it != range.second; ++it ){
+		if( it->second == sd )
+			return;
+	}
+
+	name_index.emplace( key, sd );
+}
+
+static void map_delnameindex(map_session_data* sd)
+{
+	auto range = name_index.equal_range( map_namekey( sd->status.name ) );
+
+	for( auto it = range.first; it != range.second; ++it ){
+		if( it->second == sd ){
+			name_index.erase( it );
+			return;
+		}
+	}
+}
+
 /*==========================================
  * add bl to id_db
  *------------------------------------------*/
@@ -2169,25 +2525,31 @@ void map_addiddb(block_list *bl)
 {
 	nullpo_retv(bl);
 
+	bool boss = false;
+
 	if( bl->type == BL_PC )
 	{
 		TBL_PC* sd = (TBL_PC*)bl;
 		idb_put(pc_db,sd->id,sd);
 		uidb_put(charid_db,sd->status.char_id,sd);
+		map_addnameindex(sd);
 	}
 	else if( bl->type == BL_MOB )
 	{
 		TBL_MOB* md = (TBL_MOB*)bl;
 		idb_put(mobid_db,bl->id,bl);
 
-		if( md->state.boss )
+		if( md->state.boss ){
 			idb_put(bossid_db, bl->id, bl);
+			boss = true;
+		}
 	}
 
 	if( bl->type & BL_REGEN )
 		idb_put(regen_db, bl->id, bl);
 
 	idb_put(id_db,bl->id,bl);
+	map_idtable_put(bl, boss);
 }
 
 /*==========================================
@@ -2202,6 +2564,7 @@ void map_deliddb(block_list *bl)
 		TBL_PC* sd = (TBL_PC*)bl;
 		idb_remove(pc_db,sd->id);
 		uidb_remove(charid_db,sd->status.char_id);
+		map_delnameindex(sd);
 	}
 	else if( bl->type == BL_MOB )
 	{
@@ -2213,6 +2576,7 @@ void map_deliddb(block_list *bl)
 		idb_remove(regen_db,bl->id);
 
 	idb_remove(id_db,bl->id);
+	map_idtable_remove(bl->id);
 }
 
 /*==========================================
@@ -2315,11 +2679,15 @@ int32 map_quit(map_session_data *sd) {
 
 	unit_remove_map_pc(sd,CLR_RESPAWN);
 
-	if (sd->state.vending)
+	if (sd->state.vending) {
 		idb_remove(vending_getdb(), sd->status.char_id);
+		searchstore_index_remove(*sd, SEARCHTYPE_VENDING);
+	}
 
-	if (sd->state.buyingstore)
+	if (sd->state.buyingstore) {
 		idb_remove(buyingstore_getdb(), sd->status.char_id);
+		searchstore_index_remove(*sd, SEARCHTYPE_BUYING_STORE);
+	}
 
 	party_booking_delete(sd); // Party Booking [Spiria]
 	pc_makesavestatus(sd);
@@ -2335,13 +2703,17 @@ int32 map_quit(map_session_data *sd) {
  * Lookup, id to session (player,mob,npc,homon,merc..)
  *------------------------------------------*/
 map_session_data * map_id2sd(int32 id){
-	if (id <= 0) return nullptr;
-	return (map_session_data*)idb_get(pc_db,id);
+	struct s_map_id_entry* entry = map_idtable_find(id);
+
+	if (entry == nullptr || entry->bl->type != BL_PC) return nullptr;
+	return (map_session_data*)entry->bl;
 }
 
 mob_data * map_id2md(int32 id){
-	if (id <= 0) return nullptr;
-	return (mob_data*)idb_get(mobid_db,id);
+	struct s_map_id_entry* entry = map_idtable_find(id);
+
+	if (entry == nullptr || entry->bl->type != BL_MOB) return nullptr;
+	return (mob_data*)entry->bl;
 }
 
 npc_data * map_id2nd(int32 id){
@@ -2405,63 +2777,54 @@ map_session_data* map_charid2sd(int32 charid)
  *------------------------------------------*/
 map_session_data * map_nick2sd(const char *nick, bool allow_partial)
 {
-	map_session_data* sd;
-	map_session_data* found_sd;
-	struct s_mapiterator* iter;
-	size_t nicklen;
-	int32 qty = 0;
-
 	if( nick == nullptr )
 		return nullptr;
 
-	nicklen = strlen(nick);
-	iter = mapit_getallusers();
+	std::string key = map_namekey( nick );
+	auto range = name_index.equal_range( key );
 
-	found_sd = nullptr;
-	for( sd = (TBL_PC*)mapit_first(iter); mapit_exists(iter); sd = (TBL_PC*)mapit_next(iter) )
-	{
-		if( allow_partial && battle_config.partial_name_scan )
-		{// partial name search
-			if( strnicmp(sd->status.name, nick, nicklen) == 0 )
-			{
-				found_sd = sd;
+	// A case sensitive match is preferred over other players with the same name in a different case
+	for( auto it = range.first; it != range.second; ++it ){
+		if( strcmp( it->second->status.name, nick ) == 0 )
+			return it->second;
+	}
 
-				if( strcmp(sd->status.name, nick) == 0 )
-				{// Perfect Match
-					qty = 1;
-					break;
-				}
+	if( allow_partial && battle_config.partial_name_scan )
+	{// partial name search, the name has to be unique
+		auto it = name_index.lower_bound( key );
 
-				qty++;
-			}
-		}
-		else if( strcasecmp(sd->status.name, nick) == 0 )
-		{// exact search only
-			found_sd = sd;
-			qty = 1;
-			break;
-		}
+		if( it == name_index.end() || it->first.compare( 0, key.length(), key ) != 0 )
+			return nullptr;
+
+		map_session_data* found_sd = it->second;
+
+		if( ++it != name_index.end() && it->first.compare( 0, key.length(), key ) == 0 )
+			return nullptr;
+
+		return found_sd;
 	}
-	mapit_free(iter);
 
-	if( battle_config.partial_name_scan && qty != 1 )
-		found_sd = nullptr;
+	// exact search only
+	if( range.first == range.second )
+		return nullptr;
 
-	return found_sd;
+	return range.first->second;
 }
 
 /*==========================================
  * Looksup id_db DBMap and returns BL pointer of 'id' or nullptr if not found
  *------------------------------------------*/
 block_list * map_id2bl(int32 id) {
-	return (block_list*)idb_get(id_db,id);
+	struct s_map_id_entry* entry = map_idtable_find(id);
+
+	return entry != nullptr ? entry->bl : nullptr;
 }
 
 /**
  * Same as map_id2bl except it only checks for its existence
  **/
 bool map_blid_exists( int32 id ) {
-	return (idb_exists(id_db,id));
+	return map_idtable_find(id) != nullptr;
 }
 
 /*==========================================
@@ -2489,8 +2852,10 @@ mob_data * map_getmob_boss(int16 m)
 
 mob_data * map_id2boss(int32 id)
 {
-	if (id <= 0) return nullptr;
-	return (mob_data*)idb_get(bossid_db,id);
+	struct s_map_id_entry* entry = map_idtable_find(id);
+
+	if (entry == nullptr || !entry->boss) return nullptr;
+	return (mob_data*)entry->bl;
 }
 
 /// Applies func to all the players in the db.
@@ -2810,6 +3175,7 @@ bool map_addnpc(int16 m,npc_data *nd)
 	}
 	mapdata->npc_num++;
 	idb_put(id_db,nd->id,nd);
+	map_idtable_put(nd, false);
 	return true;
 }
 
@@ -2867,16 +3233,19 @@ int32 map_addinstancemap(int32 src_m, int32 instance_id, bool no_mapflag)
 	dst_map->npc_num_area = 0;
 	dst_map->npc_num_warp = 0;
 
-	// Reallocate cells
-	size_t num_cell = dst_map->xs * dst_map->ys;
-
-	CREATE( dst_map->cell, struct mapcell, num_cell );
-	memcpy( dst_map->cell, src_map->cell, num_cell * sizeof(struct mapcell) );
+	// Share the cells, pages are copied on their first write
+	dst_map->cell = src_map->cell;
+	dst_map->cell_page = src_map->cell_page;
+	dst_map->cell_page_private = 0;
+	src_map->cell_sharers.push_back(dst_m);
+	// The cells are still the same as the ones of the source map, so are the planes
+	dst_map->cell_planes = src_map->cell_planes;
 
 	size_t size = dst_map->bxs * dst_map->bys * sizeof(block_list*);
 
 	dst_map->block = (block_list **)aCalloc(1,size);
 	dst_map->block_mob = (block_list **)aCalloc(1,size);
+	map_blockindex_init(dst_map);
 
 	dst_map->index = mapindex_addmap(-1, dst_map->name);
 	dst_map->channel = nullptr;
@@ -2936,6 +3305,7 @@ static int32 map_instancemap_clean(block_list *bl, va_list ap)
 }
 
 static void map_free_questinfo(struct map_data *mapdata);
+static void map_freecells(struct map_data* mapdata);
 
 /*==========================================
  * Deleting an instance map
@@ -2957,16 +3327,20 @@ int32 map_delinstancemap(int32 m)
 		delete_timer(mapdata->mob_delete_timer, map_removemobs_timer);
 	mapdata->mob_delete_timer = INVALID_TIMER;
 
+	if (battle_config.etc_log)
+		ShowDebug("[Instance] Map '%s' (%d) copied %d of %d cell pages.\n", mapdata->name, m, mapdata->cell_page_private, (int32)mapdata->cell_page.size());
+
 	// Free memory
-	if (mapdata->cell)
-		aFree(mapdata->cell);
-	mapdata->cell = nullptr;
+	map_freecells(mapdata);
+	path_graph_free(mapdata);
+	map_freecellplanes(mapdata);
 	if (mapdata->block)
 		aFree(mapdata->block);
 	mapdata->block = nullptr;
 	if (mapdata->block_mob)
 		aFree(mapdata->block_mob);
 	mapdata->block_mob = nullptr;
+	map_blockindex_final(mapdata);
 
 	map_free_questinfo(mapdata);
 	mapdata->damage_adjust = {};
@@ -3330,7 +3704,7 @@ int32 map_getcellp(struct map_data* m,int16 x,int16 y,cell_chk cellchk)
 	if(x<0 || x>=m->xs-1 || y<0 || y>=m->ys-1)
 		return( cellchk == CELL_CHKNOPASS );
 
-	cell = m->cell[x + y*m->xs];
+	cell = map_cell(m, x + y*m->xs);
 
 	switch(cellchk)
 	{
@@ -3394,6 +3768,148 @@ int32 map_getcellp(struct map_data* m,int16 x,int16 y,cell_chk cellchk)
 	}
 }
 
+/// Updates the bitplanes of a cell after its terrain flags changed
+static void map_updatecellplanes(struct map_data* mapdata, int16 x, int16 y)
+{
+	if( mapdata->cell_planes == nullptr )
+		return;
+
+	// Other maps still share the planes, the cell only changed for this one
+	if( mapdata->cell_planes.use_count() > 1 )
+		mapdata->cell_planes = std::make_shared<s_cell_planes>( *mapdata->cell_planes );
+
+	struct s_cell_planes* planes = mapdata->cell_planes.get();
+
+	size_t word = ( x >> 6 ) + (size_t)y * planes->words;
+	uint64 bit = 1ULL << ( x & 63 );
+
+	for( int32 i = 0; i < CELL_PLANE_MAX; i++ ){
+		// Like map_getcellp the last row and column are never blocked
+		if( x < mapdata->xs - 1 && y < mapdata->ys - 1 && map_getcellp( mapdata, x, y, i == CELL_PLANE_WALL ? CELL_CHKWALL : CELL_CHKNOREACH ) )
+			planes->plane[i][word] |= bit;
+		else
+			planes->plane[i][word] &= ~bit;
+	}
+}
+
+/**
+ * Builds the bitplanes of a map from its cells.
+ * This is done when the map is loaded, because the mob AI workers read the planes concurrently.
+ * @param mapdata: Map
+ */
+static void map_initcellplanes(struct map_data* mapdata)
+{
+	mapdata->cell_planes = std::make_shared<s_cell_planes>();
+
+	struct s_cell_planes* planes = mapdata->cell_planes.get();
+
+	planes->words = ( mapdata->xs + 63 ) >> 6;
+
+	for( int32 i = 0; i < CELL_PLANE_MAX; i++ )
+		planes->plane[i].assign( (size_t)planes->words * mapdata->ys, 0 );
+
+	for( int16 y = 0; y < mapdata->ys; y++ )
+		for( int16 x = 0; x < mapdata->xs; x++ )
+			map_updatecellplanes( mapdata, x, y );
+}
+
+/**
+ * Returns the bitplanes of a map.
+ * A set bit means the cell check returns true, e.g. the cell is a wall for CELL_PLANE_WALL.
+ * @param mapdata: Map
+ * @return Bitplanes or nullptr if the map has no cells
+ */
+const struct s_cell_planes* map_getcellplanes(struct map_data* mapdata)
+{
+	return mapdata->cell_planes.get();
+}
+
+void map_freecellplanes(struct map_data* mapdata)
+{
+	mapdata->cell_planes.reset();
+}
+
+/// Builds the cell pages of a map that owns its cells
+static void map_initcellpages(struct map_data* mapdata)
+{
+	size_t num_cell = (size_t)mapdata->xs * mapdata->ys;
+
+	mapdata->cell_page.resize( ( num_cell + MAP_CELL_PAGE_SIZE - 1 ) >> MAP_CELL_PAGE_SHIFT );
+
+	for( size_t i = 0; i < mapdata->cell_page.size(); i++ )
+		mapdata->cell_page[i] = mapdata->cell + ( i << MAP_CELL_PAGE_SHIFT );
+
+	mapdata->cell_sharers.clear();
+	mapdata->cell_page_private = 0;
+}
+
+/// Whether an instance map still shares a cell page with its source map
+static bool map_cellpage_shared(struct map_data* mapdata, size_t page)
+{
+	return mapdata->instance_id > 0 && mapdata->cell_page[page] == mapdata->cell + ( page << MAP_CELL_PAGE_SHIFT );
+}
+
+/// Gives an instance map its own copy of a shared cell page
+static void map_copycellpage(struct map_data* mapdata, size_t page)
+{
+	size_t num_cell = (size_t)mapdata->xs * mapdata->ys;
+	size_t start = page << MAP_CELL_PAGE_SHIFT;
+	struct mapcell* copy;
+
+	CREATE( copy, struct mapcell, MAP_CELL_PAGE_SIZE );
+	memcpy( copy, mapdata->cell_page[page], std::min<size_t>( MAP_CELL_PAGE_SIZE, num_cell - start ) * sizeof( struct mapcell ) );
+	mapdata->cell_page[page] = copy;
+	mapdata->cell_page_private++;
+}
+
+/**
+ * Returns a cell of a map for writing.
+ * Instance maps copy a shared page before the first write, source maps hand out copies
+ * of the page to the instance maps still sharing it, so no map sees the writes of another.
+ * @param mapdata: Map
+ * @param index: Cell index (x + y * xs)
+ * @return Writable cell
+ */
+struct mapcell& map_cell_write(struct map_data* mapdata, int32 index)
+{
+	size_t page = index >> MAP_CELL_PAGE_SHIFT;
+
+	if( map_cellpage_shared( mapdata, page ) ){
+		map_copycellpage( mapdata, page );
+	}else{
+		for( int16 m : mapdata->cell_sharers ){
+			struct map_data* sharer = map_getmapdata( m );
+
+			if( sharer->cell_page[page] == mapdata->cell_page[page] )
+				map_copycellpage( sharer, page );
+		}
+	}
+
+	return mapdata->cell_page[page][index & ( MAP_CELL_PAGE_SIZE - 1 )];
+}
+
+/// Frees the cells of a map, instance maps only free the pages they copied
+static void map_freecells(struct map_data* mapdata)
+{
+	if( mapdata->instance_id > 0 ){
+		for( size_t i = 0; i < mapdata->cell_page.size(); i++ ){
+			if( !map_cellpage_shared( mapdata, i ) )
+				aFree( mapdata->cell_page[i] );
+		}
+
+		std::vector<int16>& sharers = map_getmapdata( mapdata->instance_src_map )->cell_sharers;
+
+		sharers.erase( std::remove( sharers.begin(), sharers.end(), mapdata->m ), sharers.end() );
+	}else if( mapdata->cell != nullptr ){
+		aFree( mapdata->cell );
+	}
+
+	mapdata->cell = nullptr;
+	mapdata->cell_page.clear();
+	mapdata->cell_sharers.clear();
+	mapdata->cell_page_private = 0;
+}
+
 /*==========================================
  * Change the type/flags of a map cell
  * 'cell' - which flag to modify
@@ -3409,21 +3925,49 @@ void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag)
 
 	j = x + y*mapdata->xs;
 
+	const struct mapcell& cell_read = map_cell(mapdata, j);
+	bool current;
+
 	switch( cell ) {
-		case CELL_WALKABLE:      mapdata->cell[j].walkable = flag;      break;
-		case CELL_SHOOTABLE:     mapdata->cell[j].shootable = flag;     break;
-		case CELL_WATER:         mapdata->cell[j].water = flag;         break;
-
-		case CELL_NPC:           mapdata->cell[j].npc = flag;           break;
-		case CELL_BASILICA:      mapdata->cell[j].basilica = flag;      break;
-		case CELL_LANDPROTECTOR: mapdata->cell[j].landprotector = flag; break;
-		case CELL_NOVENDING:     mapdata->cell[j].novending = flag;     break;
-		case CELL_NOCHAT:        mapdata->cell[j].nochat = flag;        break;
-		case CELL_MAELSTROM:	 mapdata->cell[j].maelstrom = flag;	  break;
-		case CELL_ICEWALL:		 mapdata->cell[j].icewall = flag;		  break;
-		case CELL_NOBUYINGSTORE: mapdata->cell[j].nobuyingstore = flag; break;
+		case CELL_WALKABLE:      current = cell_read.walkable;      break;
+		case CELL_SHOOTABLE:     current = cell_read.shootable;     break;
+		case CELL_WATER:         current = cell_read.water;         break;
+
+		case CELL_NPC:           current = cell_read.npc;           break;
+		case CELL_BASILICA:      current = cell_read.basilica;      break;
+		case CELL_LANDPROTECTOR: current = cell_read.landprotector; break;
+		case CELL_NOVENDING:     current = cell_read.novending;     break;
+		case CELL_NOCHAT:        current = cell_read.nochat;        break;
+		case CELL_MAELSTROM:	 current = cell_read.maelstrom;	    break;
+		case CELL_ICEWALL:		 current = cell_read.icewall;		break;
+		case CELL_NOBUYINGSTORE: current = cell_read.nobuyingstore; break;
 		default:
 			ShowWarning("map_setcell: invalid cell type '%d'\n", (int32)cell);
+			return;
+	}
+
+	// Keep sharing the page of the source map if nothing changes
+	if( current == flag )
+		return;
+
+	mapdata->block_version++;
+
+	struct mapcell& cell_write = map_cell_write(mapdata, j);
+
+	switch( cell ) {
+		case CELL_WALKABLE:      cell_write.walkable = flag;      path_graph_update(mapdata, x, y); map_updatecellplanes(mapdata, x, y); break;
+		case CELL_SHOOTABLE:     cell_write.shootable = flag;     map_updatecellplanes(mapdata, x, y); break;
+		case CELL_WATER:         cell_write.water = flag;         break;
+
+		case CELL_NPC:           cell_write.npc = flag;           break;
+		case CELL_BASILICA:      cell_write.basilica = flag;      break;
+		case CELL_LANDPROTECTOR: cell_write.landprotector = flag; break;
+		case CELL_NOVENDING:     cell_write.novending = flag;     break;
+		case CELL_NOCHAT:        cell_write.nochat = flag;        break;
+		case CELL_MAELSTROM:	 cell_write.maelstrom = flag;	  break;
+		case CELL_ICEWALL:		 cell_write.icewall = flag;		  break;
+		case CELL_NOBUYINGSTORE: cell_write.nobuyingstore = flag; break;
+		default:
 			break;
 	}
 }
@@ -3440,9 +3984,21 @@ void map_setgatcell(int16 m, int16 x, int16 y, int32 gat)
 	j = x + y*mapdata->xs;
 
 	cell = map_gat2cell(gat);
-	mapdata->cell[j].walkable = cell.walkable;
-	mapdata->cell[j].shootable = cell.shootable;
-	mapdata->cell[j].water = cell.water;
+
+	const struct mapcell& cell_read = map_cell(mapdata, j);
+
+	if( cell_read.walkable == cell.walkable && cell_read.shootable == cell.shootable && cell_read.water == cell.water )
+		return;
+
+	mapdata->block_version++;
+
+	struct mapcell& cell_write = map_cell_write(mapdata, j);
+
+	cell_write.walkable = cell.walkable;
+	cell_write.shootable = cell.shootable;
+	cell_write.water = cell.water;
+	path_graph_update(mapdata, x, y);
+	map_updatecellplanes(mapdata, x, y);
 }
 
 /*==========================================
@@ -3739,7 +4295,7 @@ static void map_delmapid(int32 id)
 {
 	ShowNotice("Removing map [ %s ] from maplist" CL_CLL "\n",map[id].name);
 	for (int32 i = id; i < map_num - 1; i++)
-		map[i] = map[i + 1];
+		map[i] = std::move(map[i + 1]);
 	map_num--;
 }
 
@@ -3983,10 +4539,7 @@ int32 map_readallmaps (void)
 
 		if (uidb_get(map_db,(uint32)mapdata->index) != nullptr) {
 			ShowWarning("Map %s already loaded!" CL_CLL "\n", mapdata->name);
-			if (mapdata->cell) {
-				aFree(mapdata->cell);
-				mapdata->cell = nullptr;
-			}
+			map_freecells(mapdata);
 			map_delmapid(i);
 			maps_removed++;
 			i--;
@@ -3996,6 +4549,8 @@ int32 map_readallmaps (void)
 		map_addmap2db(mapdata);
 
 		mapdata->m = i;
+		map_initcellpages(mapdata);
+		map_initcellplanes(mapdata);
 		memset(mapdata->moblist, 0, sizeof(mapdata->moblist));	//Initialize moblist [Skotlex]
 		mapdata->mob_delete_timer = INVALID_TIMER;	//Initialize timer [Skotlex]
 
@@ -4005,6 +4560,7 @@ int32 map_readallmaps (void)
 		size = mapdata->bxs * mapdata->bys * sizeof(block_list*);
 		mapdata->block = (block_list**)aCalloc(size, 1);
 		mapdata->block_mob = (block_list**)aCalloc(size, 1);
+		map_blockindex_init(mapdata);
 
 		memset(&mapdata->save, 0, sizeof(struct point));
 		mapdata->damage_adjust = {};
@@ -4097,12 +4653,26 @@ int32 parse_console(const char* buf){
 	else if( strcmpi("ers_report", type) == 0 ){
 		ers_report();
 	}
+	else if( strcmpi("timer_report", type) == 0 ){
+		timer_profile_report(0, n == 2 && strcmpi("reset", command) == 0);
+	}
+	else if( n == 2 && strcmpi("timer_profile", type) == 0 ){
+		if( config_switch(command) ){
+			timer_profile_start(timer_profile_interval * 1000);
+			ShowInfo("Console: Timer profiling enabled.\n");
+		}else{
+			timer_profile_stop();
+			ShowInfo("Console: Timer profiling disabled.\n");
+		}
+	}
 	else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t admin:@<atcommand> => Uses an atcommand. Do NOT use commands requiring an attached player.\n");
 		ShowInfo("\t admin:map:<map> <x> <y> => Changes the map from which console commands are executed.\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t timer_report{:reset} => Displays (and resets) the timer function statistics.\n");
+		ShowInfo("\t timer_profile:<on|off> => Starts or stops collecting timer function statistics.\n");
 	}
 
 	return 0;
@@ -4191,6 +4761,8 @@ int32 map_config_read(const char *cfgName)
 			safestrncpy(channel_conf, w2, sizeof(channel_conf));
 		else if(strcmpi(w1,"db_path") == 0)
 			safestrncpy(db_path,w2,ARRAYLENGTH(db_path));
+		else if (strcmpi(w1, "db_snapshot_path") == 0)
+			YamlDatabase::setSnapshotFolder(strcmpi(w2, "off") == 0 ? "" : w2);
 		else if (strcmpi(w1, "console") == 0) {
 			console = config_switch(w2);
 			if (console)
@@ -4203,6 +4775,10 @@ int32 map_config_read(const char *cfgName)
 			console_msg_log = atoi(w2);//[Ind]
 		else if (strcmpi(w1, "console_log_filepath") == 0)
 			safestrncpy(console_log_filepath, w2, sizeof(console_log_filepath));
+		else if (strcmpi(w1, "timer_profile") == 0)
+			timer_profile = config_switch(w2);
+		else if (strcmpi(w1, "timer_profile_interval") == 0)
+			timer_profile_interval = max(atoi(w2), 0);
 		else if (strcmpi(w1, "import") == 0)
 			map_config_read(w2);
 		else
@@ -5078,9 +5654,12 @@ void MapServer::finalize(){
 	for (int32 i = 0; i < map_num; i++) {
 		struct map_data *mapdata = map_getmapdata(i);
 
-		if(mapdata->cell) aFree(mapdata->cell);
+		map_freecells(mapdata);
+		path_graph_free(mapdata);
+		map_freecellplanes(mapdata);
 		if(mapdata->block) aFree(mapdata->block);
 		if(mapdata->block_mob) aFree(mapdata->block_mob);
+		map_blockindex_final(mapdata);
 		if(battle_config.dynamic_mobs) { //Dynamic mobs flag by [random]
 			if(mapdata->mob_delete_timer != INVALID_TIMER)
 				delete_timer(mapdata->mob_delete_timer, map_removemobs_timer);
@@ -5098,11 +5677,13 @@ void MapServer::finalize(){
 	pc_db->destroy(pc_db, nullptr);
 	mobid_db->destroy(mobid_db, nullptr);
 	bossid_db->destroy(bossid_db, nullptr);
+	map_idtable_final();
 	nick_db->destroy(nick_db, nick_db_final);
 	charid_db->destroy(charid_db, nullptr);
 	iwall_db->destroy(iwall_db, nullptr);
 	regen_db->destroy(regen_db, nullptr);
 
+	do_final_log();
 	map_sql_close();
 
 	ShowStatus("Finished.\n");
@@ -5127,6 +5708,8 @@ void MapServer::handle_crash(){
 		return;
 	}
 	run = 1;
+	// Queued logs do not depend on the char-server
+	log_flush();
 	if (!chrif_isconnected())
 	{
 		if (pc_db->size(pc_db))
@@ -5149,6 +5732,7 @@ void display_helpscreen(bool do_exit)
 	ShowInfo("  -?, -h [--help]\t\tDisplays this help screen.\n");
 	ShowInfo("  -v [--version]\t\tDisplays the server's version.\n");
 	ShowInfo("  --run-once\t\t\tCloses server after loading (testing).\n");
+	ShowInfo("  --timer-backend <heap|wheel>\tStorage used for pending timers.\n");
 	ShowInfo("  --map-config <file>\t\tAlternative map-server configuration.\n");
 	ShowInfo("  --battle-config <file>\tAlternative battle configuration.\n");
 	ShowInfo("  --atcommand-config <file>\tAlternative atcommand configuration.\n");
@@ -5263,6 +5847,8 @@ int32 mapgenerator_get_options(int32 argc, char** argv) {
 				gen_options.itemmoveinfo = true;
 			} else if (strcmp(arg, "generate-reputation") == 0) {
 				gen_options.reputation = true;
+			} else if (strcmp(arg, "battle-benchmark") == 0) {
+				gen_options.battle_benchmark = true;
 			} else {
 				// pass through to default get_options
 				continue;
@@ -5403,6 +5989,7 @@ bool MapServer::initialize( int32 argc, char *argv[] ){
 	map_sql_init();
 	if (log_config.sql_logs)
 		log_sql_init();
+	do_init_log();
 
 	mapindex_init();
 	if(enable_grf)
@@ -5462,6 +6049,8 @@ bool MapServer::initialize( int32 argc, char *argv[] ){
 		itemdb_gen_itemmoveinfo();
 	if (gen_options.reputation)
 		pc_reputation_generate();
+	if (gen_options.battle_benchmark)
+		battle_benchmark();
 	this->signal_shutdown();
 #endif
 
@@ -5470,6 +6059,9 @@ bool MapServer::initialize( int32 argc, char *argv[] ){
 		add_timer_interval(gettick()+1000, parse_console_timer, 0, 0, 1000); //start in 1s each 1sec
 	}
 
+	if( timer_profile )
+		timer_profile_start(timer_profile_interval * 1000);
+
 	return true;
 }
 
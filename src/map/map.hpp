@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <cstdarg>
+#include <memory>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
@@ -64,6 +65,7 @@ void map_msg_reload(void);
 
 #define MAX_NPC_PER_MAP 512
 #define AREA_SIZE battle_config.area_size
+#define BLOCK_SIZE 8
 #ifndef DAMAGELOG_SIZE 
 	#define DAMAGELOG_SIZE 20
 #endif
@@ -80,6 +82,8 @@ void map_msg_reload(void);
 #define MAX_IGNORE_LIST 20 	// official is 14
 #define MAX_VENDING 12
 #define MAX_MAP_SIZE 512*512 	// Wasn't there something like this already? Can't find it.. [Shinryo]
+#define MAP_CELL_PAGE_SHIFT 8 // Cells per page (1 << shift) that instance maps copy on write, see map_cell_write
+#define MAP_CELL_PAGE_SIZE (1 << MAP_CELL_PAGE_SHIFT)
 
 //The following system marks a different job ID system used by the map server,
 //which makes a lot more sense than the normal one. [Skotlex]
@@ -785,6 +789,20 @@ enum cell_chk : uint8 {
 
 };
 
+/// Bitplanes of the cell checks used by line checks, see map_getcellplanes
+enum e_cell_plane : uint8 {
+	CELL_PLANE_WALL = 0, ///< CELL_CHKWALL
+	CELL_PLANE_NOREACH, ///< CELL_CHKNOREACH
+	CELL_PLANE_MAX
+};
+
+/// Cell checks packed into one bit per cell, rows are padded to full words.
+/// The planes are built for every map when it is loaded, CELL_PLANE_MAX bits per cell.
+struct s_cell_planes {
+	int32 words; ///< Words per row
+	std::vector<uint64> plane[CELL_PLANE_MAX];
+};
+
 struct mapcell
 {
 	// terrain flags
@@ -816,10 +834,24 @@ struct iwall_data {
 	bool shootable;
 };
 
+/// Compact structure of arrays copy of the objects in a block
+/// Objects are appended, so iterating backwards yields the same order as the block list
+struct s_map_block_index {
+	std::vector<block_list*> objects;
+	std::vector<int16> x;
+	std::vector<int16> y;
+	std::vector<int32> type;
+};
+
 struct map_data {
 	char name[MAP_NAME_LENGTH];
 	uint16 index; // The map index used by the mapindex* functions.
 	struct mapcell* cell; // Holds the information of each map cell (nullptr if the map is not on this map-server).
+	struct s_path_graph* path_graph; // Connectivity of the walkable cells, built on first use (see path_graph_reachable)
+	std::shared_ptr<struct s_cell_planes> cell_planes; // Bitplanes of the cells, built when the map is loaded and shared with instance maps until a cell changes (see map_getcellplanes)
+	std::vector<struct mapcell*> cell_page; // Pages of the cells, instance maps share the pages of their source map until they write to them
+	std::vector<int16> cell_sharers; // Instance maps that share the cell pages of this map
+	int32 cell_page_private; // Number of cell pages an instance map copied on write
 	block_list **block;
 	block_list **block_mob;
 	int16 m;
@@ -857,6 +889,9 @@ struct map_data {
 
 	/* speeds up clif_updatestatus processing by causing hpmeter to run only when someone with the permission can view it */
 	uint16 hpmeter_visible;
+	uint32 block_version; // Changes whenever an object is added, removed or moved or a cell is modified
+	std::vector<std::unique_ptr<s_map_block_index>> block_index; // Same objects as block, allocated when the first object enters a block
+	std::vector<std::unique_ptr<s_map_block_index>> block_mob_index; // Same objects as block_mob, allocated when the first object enters a block
 #ifdef MAP_GENERATOR
 	struct {
 		std::vector<const npc_data *> npcs;
@@ -908,6 +943,14 @@ int32 map_getcell(int16 m,int16 x,int16 y,cell_chk cellchk);
 int32 map_getcellp(struct map_data* m,int16 x,int16 y,cell_chk cellchk);
 void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag);
 void map_setgatcell(int16 m, int16 x, int16 y, int32 gat);
+const struct s_cell_planes* map_getcellplanes(struct map_data* mapdata);
+void map_freecellplanes(struct map_data* mapdata);
+struct mapcell& map_cell_write(struct map_data* mapdata, int32 index);
+
+/// Returns a cell of a map for reading, use map_cell_write to modify it
+static inline const struct mapcell& map_cell(const struct map_data* mapdata, int32 index){
+	return mapdata->cell_page[index >> MAP_CELL_PAGE_SHIFT][index & ( MAP_CELL_PAGE_SIZE - 1 )];
+}
 
 extern struct map_data map[];
 extern int32 map_num;
@@ -1158,6 +1201,138 @@ int32 map_foreachincell(int32 (*func)(block_list*,va_list), int16 m, int16 x, in
 int32 map_foreachinpath(int32 (*func)(block_list*,va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int32 length, int32 type, ...);
 int32 map_foreachindir(int32 (*func)(block_list*,va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int32 length, int32 offset, int32 type, ...);
 int32 map_foreachinmap(int32 (*func)(block_list*,va_list), int16 m, int32 type, ...);
+
+/// Line of sight check of spatial queries
+enum e_map_query_check : uint8 {
+	MAPQUERY_ALL = 0, ///< No check
+	MAPQUERY_SHOOT, ///< Objects must be shootable from the center
+	MAPQUERY_SKILL, ///< Same as MAPQUERY_SHOOT if skill_wall_check is enabled
+};
+
+std::vector<block_list*>& map_blocklist_acquire();
+void map_blocklist_release();
+void map_getblocks_inrange( std::vector<block_list*>& list, const block_list* center, int16 range, int32 type, e_map_query_check check );
+void map_getblocks_inarea( std::vector<block_list*>& list, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, e_map_query_check check );
+void map_getblocks_incell( std::vector<block_list*>& list, int16 m, int16 x, int16 y, int32 type );
+void map_getblocks_inpath( std::vector<block_list*>& list, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int32 length, int32 type );
+
+/// Pooled result buffer of a spatial query, released when it goes out of scope
+class MapBlockList {
+public:
+	MapBlockList() : list( map_blocklist_acquire() ) {}
+	~MapBlockList() { map_blocklist_release(); }
+
+	operator std::vector<block_list*>&() { return this->list; }
+	std::vector<block_list*>::iterator begin() { return this->list.begin(); }
+	std::vector<block_list*>::iterator end() { return this->list.end(); }
+	size_t size() const { return this->list.size(); }
+
+	MapBlockList(const MapBlockList&) = delete;
+	MapBlockList& operator=(const MapBlockList&) = delete;
+private:
+	std::vector<block_list*>& list;
+};
+
+/**
+ * Calls func for all objects of a spatial query, which were not removed by a previous call.
+ * func takes a block_list* and either returns nothing or an int32, which is summed up.
+ * Block frees are deferred until all calls are done.
+ * @param list: Objects
+ * @param func: Function to call
+ * @return Sum of the return values of func
+ */
+template <typename Func> int32 map_blocklist_call( std::vector<block_list*>& list, Func&& func ){
+	int32 returnCount = 0;
+
+	FreeBlockLock freeLock;
+
+	for( block_list* bl : list ){
+		if( bl->prev == nullptr ){
+			continue;
+		}
+
+		if constexpr( std::is_void_v<std::invoke_result_t<Func, block_list*>> ){
+			func( bl );
+		}else{
+			returnCount += func( bl );
+		}
+	}
+
+	return returnCount;
+}
+
+/// Calls func for all objects of a type in range of center, with a wall check if skill_wall_check is enabled
+template <typename Func> int32 map_foreachinrange( const block_list* center, int16 range, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_inrange( list, center, range, type, MAPQUERY_SKILL );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
+/// Calls func for all objects of a type in range of center
+template <typename Func> int32 map_foreachinallrange( const block_list* center, int16 range, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_inrange( list, center, range, type, MAPQUERY_ALL );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
+/// Calls func for all objects of a type in range of center, that are shootable from center
+template <typename Func> int32 map_foreachinshootrange( const block_list* center, int16 range, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_inrange( list, center, range, type, MAPQUERY_SHOOT );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
+/// Calls func for all objects of a type in an area, with a wall check if skill_wall_check is enabled
+template <typename Func> int32 map_foreachinarea( int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_inarea( list, m, x0, y0, x1, y1, type, MAPQUERY_SKILL );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
+/// Calls func for all objects of a type in an area
+template <typename Func> int32 map_foreachinallarea( int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_inarea( list, m, x0, y0, x1, y1, type, MAPQUERY_ALL );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
+/// Calls func for all objects of a type in an area, that are shootable from the center of the area
+template <typename Func> int32 map_foreachinshootarea( int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_inarea( list, m, x0, y0, x1, y1, type, MAPQUERY_SHOOT );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
+/// Calls func for all objects of a type on a cell
+template <typename Func> int32 map_foreachincell( int16 m, int16 x, int16 y, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_incell( list, m, x, y, type );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
+/// Calls func for all objects of a type in range of the path between (x0,y0) and (x1,y1)
+template <typename Func> int32 map_foreachinpath( int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int32 length, int32 type, Func&& func ){
+	MapBlockList list;
+
+	map_getblocks_inpath( list, m, x0, y0, x1, y1, range, length, type );
+
+	return map_blocklist_call( list, std::forward<Func>( func ) );
+}
+
 //blocklist nb in one cell
 int32 map_count_oncell(int16 m,int16 x,int16 y,int32 type,int32 flag);
 skill_unit *map_find_skill_unit_oncell(block_list *,int16 x,int16 y,uint16 skill_id,skill_unit *, int32 flag);
@@ -1321,6 +1496,18 @@ extern int32 db_use_sqldbs;
 extern Sql* mmysql_handle;
 extern Sql* qsmysql_handle;
 extern Sql* logmysql_handle;
+
+extern std::string default_codepage;
+extern std::string map_server_ip;
+extern int32 map_server_port;
+extern std::string map_server_id;
+extern std::string map_server_pw;
+extern std::string map_server_db;
+extern std::string log_db_ip;
+extern uint16 log_db_port;
+extern std::string log_db_id;
+extern std::string log_db_pw;
+extern std::string log_db_db;
 #endif
 
 extern char barter_table[32];
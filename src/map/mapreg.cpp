@@ -4,6 +4,10 @@
 #include "mapreg.hpp"
 
 #include <cstdlib>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
 
 #include <common/cbasetypes.hpp>
 #include <common/db.hpp>
@@ -16,16 +20,41 @@
 
 #include "map.hpp" // mmysql_handle
 #include "script.hpp"
+#include "sqlworker.hpp"
 
 static struct eri *mapreg_ers;
 
 bool skip_insert = false;
 
 static char mapreg_table[32] = "mapreg";
-static bool mapreg_dirty = false; // Whether there are modified regs to be saved
+static int32 mapreg_flush_interval = 1000; // How often the journal is written [ms]
+static int32 mapreg_flush_timer = INVALID_TIMER;
 struct reg_db regs;
 
-#define MAPREG_AUTOSAVE_INTERVAL (300*1000)
+/// Journal of the permanent variables that were changed since the last flush.
+/// Only the uid is kept, so any number of changes to a variable result in a single write
+/// of its value at the time of the flush, or a delete if it does not exist anymore.
+static std::unordered_set<int64> mapreg_journal;
+
+/// Writes the journal with a second connection, so scripts do not wait for the database.
+static SqlWorker mapreg_worker( "mapreg" );
+
+// Maximum number of rows per statement
+#define MAPREG_FLUSH_BATCH 500
+
+/**
+ * Marks a variable to be written to the database.
+ * Temporary global variables ($@var) are not saved.
+ * @param uid: variable's unique identifier
+ * @param name: variable's name
+ */
+static void mapreg_journal_add( int64 uid, const char* name ){
+	if( name[1] == '@' || skip_insert ){
+		return;
+	}
+
+	mapreg_journal.insert( uid );
+}
 
 
 /**
@@ -69,10 +98,6 @@ bool mapreg_setreg(int64 uid, int64 val)
 	if (val != 0) {
 		if ((m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid)))) {
 			m->u.i = val;
-			if (name[1] != '@') {
-				m->save = true;
-				mapreg_dirty = true;
-			}
 		} else {
 			if (i)
 				script_array_update(&regs, uid, false);
@@ -81,15 +106,8 @@ bool mapreg_setreg(int64 uid, int64 val)
 
 			m->u.i = val;
 			m->uid = uid;
-			m->save = false;
 			m->is_string = false;
 
-			if (name[1] != '@' && !skip_insert) {// write new variable to database
-				char esc_name[32 * 2 + 1];
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-				if (SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%" PRIu32 "','%" PRId64 "')", mapreg_table, esc_name, i, val))
-					Sql_ShowDebug(mmysql_handle);
-			}
 			i64db_put(regs.vars, uid, m);
 		}
 	} else { // val == 0
@@ -99,15 +117,11 @@ bool mapreg_setreg(int64 uid, int64 val)
 			ers_free(mapreg_ers, m);
 		}
 		i64db_remove(regs.vars, uid);
-
-		if (name[1] != '@') {// Remove from database because it is unused.
-			char esc_name[32 * 2 + 1];
-			Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-			if (SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%" PRIu32 "'", mapreg_table, esc_name, i))
-				Sql_ShowDebug(mmysql_handle);
-		}
 	}
 
+	// Inserted, updated or removed with the next flush
+	mapreg_journal_add(uid, name);
+
 	return true;
 }
 
@@ -128,12 +142,6 @@ bool mapreg_setregstr(int64 uid, const char* str)
 	if (str == nullptr || *str == 0) {
 		if (i)
 			script_array_update(&regs, uid, true);
-		if (name[1] != '@') {
-			char esc_name[32 * 2 + 1];
-			Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-			if (SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%" PRIu32 "'", mapreg_table, esc_name, i))
-				Sql_ShowDebug(mmysql_handle);
-		}
 		if ((m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid)))) {
 			if (m->u.str != nullptr)
 				aFree(m->u.str);
@@ -145,10 +153,6 @@ bool mapreg_setregstr(int64 uid, const char* str)
 			if (m->u.str != nullptr)
 				aFree(m->u.str);
 			m->u.str = aStrdup(str);
-			if (name[1] != '@') {
-				mapreg_dirty = true;
-				m->save = true;
-			}
 		} else {
 			if (i)
 				script_array_update(&regs, uid, false);
@@ -157,21 +161,15 @@ bool mapreg_setregstr(int64 uid, const char* str)
 
 			m->uid = uid;
 			m->u.str = aStrdup(str);
-			m->save = false;
 			m->is_string = true;
 
-			if (name[1] != '@' && !skip_insert) { //put returned null, so we must insert.
-				char esc_name[32 * 2 + 1];
-				char esc_str[255 * 2 + 1];
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-				Sql_EscapeStringLen(mmysql_handle, esc_str, str, strnlen(str, 255));
-				if (SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%" PRIu32 "','%s')", mapreg_table, esc_name, i, esc_str))
-					Sql_ShowDebug(mmysql_handle);
-			}
 			i64db_put(regs.vars, uid, m);
 		}
 	}
 
+	// Inserted, updated or removed with the next flush
+	mapreg_journal_add(uid, name);
+
 	return true;
 }
 
@@ -221,51 +219,104 @@ static void script_load_mapreg(void)
 	}
 
 	skip_insert = false;
-	mapreg_dirty = false;
 }
 
 /**
- * Saves permanent variables to database.
+ * Writes the journal to the database.
+ * The statements are built on the main thread and executed by the mapreg worker in the order of the flushes.
+ * The mapreg table uses MyISAM, so a failed flush can be applied partially. Its variables are written again
+ * with their current values by the next flush, which makes the retry safe.
  */
 static void script_save_mapreg(void)
 {
-	if (mapreg_dirty) {
-		DBIterator *iter = db_iterator(regs.vars);
-		struct mapreg_save *m;
-		for (m = static_cast<mapreg_save *>(dbi_first(iter)); dbi_exists(iter); m = static_cast<mapreg_save *>(dbi_next(iter))) {
-			if (m->save) {
-				int32 num = script_getvarid(m->uid);
-				uint32 i = script_getvaridx(m->uid);
-				const char* name = get_str(num);
-				if (!m->is_string) {
-					char esc_name[32 * 2 + 1];
-					Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-					if (SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%" PRId64 "' WHERE `varname`='%s' AND `index`='%" PRIu32 "' LIMIT 1", mapreg_table, m->u.i, esc_name, i))
-						Sql_ShowDebug(mmysql_handle);
-				} else {
-					char esc_str[2 * 255 + 1];
-					char esc_name[32 * 2 + 1];
-					Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-					Sql_EscapeStringLen(mmysql_handle, esc_str, m->u.str, safestrnlen(m->u.str, 255));
-					if (SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%s' WHERE `varname`='%s' AND `index`='%" PRIu32 "' LIMIT 1", mapreg_table, esc_str, esc_name, i))
-						Sql_ShowDebug(mmysql_handle);
-				}
-				m->save = false;
+	if (mapreg_journal.empty())
+		return;
+
+	std::string upsert, remove;
+	std::vector<std::string> queries;
+	size_t upserts = 0, removes = 0;
+
+	for (int64 uid : mapreg_journal) {
+		struct mapreg_save *m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid));
+		const char* name = get_str(script_getvarid(uid));
+		uint32 i = script_getvaridx(uid);
+		char esc_name[32 * 2 + 1];
+
+		Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
+
+		if (m == nullptr) { // Remove from database because it is unused.
+			remove += (removes == 0 ? "DELETE FROM `" + std::string(mapreg_table) + "` WHERE (`varname`,`index`) IN (" : ",");
+			remove += "('" + std::string(esc_name) + "','" + std::to_string(i) + "')";
+
+			if (++removes == MAPREG_FLUSH_BATCH) {
+				queries.push_back(remove + ")");
+				remove.clear();
+				removes = 0;
 			}
+			continue;
+		}
+
+		std::string value;
+
+		if (m->is_string) {
+			char esc_str[2 * 255 + 1];
+
+			Sql_EscapeStringLen(mmysql_handle, esc_str, m->u.str, safestrnlen(m->u.str, 255));
+			value = esc_str;
+		} else
+			value = std::to_string(m->u.i);
+
+		upsert += (upserts == 0 ? "INSERT INTO `" + std::string(mapreg_table) + "`(`varname`,`index`,`value`) VALUES " : ",");
+		upsert += "('" + std::string(esc_name) + "','" + std::to_string(i) + "','" + value + "')";
+
+		if (++upserts == MAPREG_FLUSH_BATCH) {
+			queries.push_back(upsert + " ON DUPLICATE KEY UPDATE `value`=VALUES(`value`)");
+			upsert.clear();
+			upserts = 0;
 		}
-		dbi_destroy(iter);
-		mapreg_dirty = false;
 	}
+
+	if (removes > 0)
+		queries.push_back(remove + ")");
+	if (upserts > 0)
+		queries.push_back(upsert + " ON DUPLICATE KEY UPDATE `value`=VALUES(`value`)");
+
+	// The variables are written again with the next flush if the database could not be updated
+	std::vector<int64> uids(mapreg_journal.begin(), mapreg_journal.end());
+	std::shared_ptr<bool> success = std::make_shared<bool>(false);
+
+	mapreg_journal.clear();
+
+	mapreg_worker.push([queries = std::move(queries), success](MYSQL* handle) {
+		*success = true;
+
+		for (const std::string& query : queries)
+			*success = *success && mapreg_worker.query(handle, query);
+	}, [uids = std::move(uids), success]() {
+		if (!*success)
+			mapreg_journal.insert(uids.begin(), uids.end());
+	});
 }
 
 /**
- * Timer event to auto-save permanent variables.
+ * Timer event to write the journal and report errors of the worker.
  */
 static TIMER_FUNC(script_autosave_mapreg){
 	script_save_mapreg();
+	mapreg_worker.process();
 	return 0;
 }
 
+/**
+ * Writes the journal and waits until the database is up to date.
+ */
+static void mapreg_flush(void)
+{
+	script_save_mapreg();
+	mapreg_worker.wait();
+	mapreg_worker.process();
+}
+
 /**
  * Destroys a mapreg_save structure, freeing the contained string, if any.
  *
@@ -297,7 +348,7 @@ int32 mapreg_destroyreg(DBKey key, DBData *data, va_list ap)
  */
 void mapreg_reload(void)
 {
-	script_save_mapreg();
+	mapreg_flush();
 
 	regs.vars->clear(regs.vars, mapreg_destroyreg);
 
@@ -314,7 +365,14 @@ void mapreg_reload(void)
  */
 void mapreg_final(void)
 {
-	script_save_mapreg();
+	mapreg_flush();
+	mapreg_worker.stop();
+	mapreg_worker.process();
+
+	if (mapreg_flush_timer != INVALID_TIMER) {
+		delete_timer(mapreg_flush_timer, script_autosave_mapreg);
+		mapreg_flush_timer = INVALID_TIMER;
+	}
 
 	regs.vars->destroy(regs.vars, mapreg_destroyreg);
 
@@ -337,8 +395,10 @@ void mapreg_init(void)
 
 	script_load_mapreg();
 
+	mapreg_worker.start(map_server_ip, static_cast<uint16>(map_server_port), map_server_id, map_server_pw, map_server_db, default_codepage);
+
 	add_timer_func_list(script_autosave_mapreg, "script_autosave_mapreg");
-	add_timer_interval(gettick() + MAPREG_AUTOSAVE_INTERVAL, script_autosave_mapreg, 0, 0, MAPREG_AUTOSAVE_INTERVAL);
+	mapreg_flush_timer = add_timer_interval(gettick() + mapreg_flush_interval, script_autosave_mapreg, 0, 0, mapreg_flush_interval);
 }
 
 /**
@@ -348,6 +408,8 @@ bool mapreg_config_read(const char* w1, const char* w2)
 {
 	if(!strcmpi(w1, "mapreg_table"))
 		safestrncpy(mapreg_table, w2, sizeof(mapreg_table));
+	else if(!strcmpi(w1, "mapreg_flush_interval"))
+		mapreg_flush_interval = max(atoi(w2), 100);
 	else
 		return false;
 
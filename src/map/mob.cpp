@@ -4,9 +4,14 @@
 #include "mob.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -1308,20 +1313,248 @@ int32 mob_target(mob_data *md,block_list *bl,int32 dist)
 	return 0;
 }
 
+/*==========================================
+ * Parallel hard AI [monster_ai_threads]
+ * The spatial searches of the hard AI are evaluated by worker threads
+ * before the AI of the monsters is executed on the main thread.
+ *
+ * The workers read the map blocks, the positions and status of the units and
+ * the cells (through path_search_long and battle_check_range) without locks.
+ * This is safe, because all of this data is only changed by the main thread,
+ * and the main thread does not execute any game logic while the workers run:
+ * MobAiWorkers::run blocks until all intents are evaluated and the main thread
+ * only evaluates intents itself meanwhile. Data that the workers read must not
+ * be built on first use, e.g. the cell bitplanes are built when a map is loaded.
+ *------------------------------------------*/
+
+/// Search results of a monster, evaluated by a worker thread
+struct s_mob_ai_intent {
+	mob_data* md;
+	int16 m, x, y;
+	uint32 block_version; ///< Version of the map blocks the results are based on
+	int32 range; ///< Range the enemies were searched in (range2 of the monster)
+	int32 enemy_type; ///< Types the enemies were searched for
+	bool looter; ///< Whether items were searched for
+	std::vector<std::pair<block_list*, bool>> enemies; ///< Enemy candidates in search order and whether they are in range
+	std::vector<block_list*> items; ///< Items in loot range with a free line of sight in search order
+};
+
+/// Intent of the monster whose AI is currently executed by mob_ai_hard_active
+static s_mob_ai_intent* mob_ai_intent = nullptr;
+
+/// Worker threads for the parallel hard AI
+class MobAiWorkers {
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	const std::function<void(size_t)>* job = nullptr;
+	size_t job_count = 0;
+	std::atomic<size_t> job_next{ 0 };
+	size_t busy = 0;
+	uint64 generation = 0;
+	bool stopping = false;
+
+	void process(){
+		for( size_t i; ( i = this->job_next.fetch_add( 1 ) ) < this->job_count; ){
+			(*this->job)( i );
+		}
+	}
+
+	void work(){
+		uint64 handled = 0;
+
+		for(;;){
+			{
+				std::unique_lock<std::mutex> lock( this->mutex );
+
+				this->work_cv.wait( lock, [this, handled]() { return this->stopping || this->generation != handled; } );
+
+				if( this->stopping ){
+					return;
+				}
+
+				handled = this->generation;
+			}
+
+			this->process();
+
+			{
+				std::lock_guard<std::mutex> lock( this->mutex );
+
+				if( --this->busy == 0 ){
+					this->done_cv.notify_one();
+				}
+			}
+		}
+	}
+
+public:
+	~MobAiWorkers(){
+		this->stop();
+	}
+
+	size_t size() const{
+		return this->threads.size();
+	}
+
+	void start( size_t count ){
+		this->stop();
+		this->stopping = false;
+
+		for( size_t i = 0; i < count; i++ ){
+			this->threads.emplace_back( &MobAiWorkers::work, this );
+		}
+	}
+
+	void stop(){
+		{
+			std::lock_guard<std::mutex> lock( this->mutex );
+
+			this->stopping = true;
+		}
+
+		this->work_cv.notify_all();
+
+		for( std::thread& thread : this->threads ){
+			thread.join();
+		}
+
+		this->threads.clear();
+	}
+
+	/// Calls func for every index in [0, count) on the worker threads and the calling thread.
+	/// Returns once all calls are done, so the game data is not changed while func runs.
+	void run( size_t count, const std::function<void(size_t)>& func ){
+		{
+			std::lock_guard<std::mutex> lock( this->mutex );
+
+			this->job = &func;
+			this->job_count = count;
+			this->job_next = 0;
+			this->busy = this->threads.size();
+			this->generation++;
+		}
+
+		this->work_cv.notify_all();
+		this->process();
+
+		std::unique_lock<std::mutex> lock( this->mutex );
+
+		this->done_cv.wait( lock, [this]() { return this->busy == 0; } );
+		this->job = nullptr;
+	}
+};
+
+static MobAiWorkers mob_ai_workers;
+
+/**
+ * Evaluates the spatial searches of the hard AI of a monster.
+ * Runs on a worker thread while the main thread waits, so it must only read game data
+ * and only call functions that do not write any shared state, not even caches.
+ * @param intent: Intent of the monster
+ */
+static void mob_ai_evaluate_intent( s_mob_ai_intent& intent ){
+	mob_data* md = intent.md;
+	struct map_data* mapdata = map_getmapdata( md->m );
+
+	intent.m = md->m;
+	intent.x = md->x;
+	intent.y = md->y;
+	intent.block_version = mapdata->block_version;
+	intent.range = md->db->range2;
+	intent.enemy_type = DEFAULT_ENEMY_TYPE( md );
+	intent.looter = ( md->status.mode&MD_LOOTER ) && md->lootitems != nullptr;
+
+	if( mapdata->block == nullptr ){
+		return;
+	}
+
+	// Same search order as map_getblocks_inrange
+	auto search = [&intent, md, mapdata]( block_list** blocks, int32 type, int32 range, bool wall_check, const std::function<void(block_list*)>& func ){
+		int32 x0 = i16max( md->x - range, 0 );
+		int32 y0 = i16max( md->y - range, 0 );
+		int32 x1 = i16min( md->x + range, mapdata->xs - 1 );
+		int32 y1 = i16min( md->y + range, mapdata->ys - 1 );
+
+		for( int32 by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ){
+			for( int32 bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ){
+				for( block_list* bl = blocks[bx + by * mapdata->bxs]; bl != nullptr; bl = bl->next ){
+					if( bl->type&type
+						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+#ifdef CIRCULAR_AREA
+						&& check_distance_bl( md, bl, range )
+#endif
+						&& ( !wall_check || path_search_long( nullptr, md->m, md->x, md->y, bl->x, bl->y, CELL_CHKWALL ) ) ){
+						func( bl );
+					}
+				}
+			}
+		}
+	};
+
+	auto add_enemy = [&intent, md]( block_list* bl ){
+		intent.enemies.emplace_back( bl, battle_check_range( md, bl, md->db->range2 ) );
+	};
+
+	if( intent.enemy_type&~BL_MOB ){
+		search( mapdata->block, intent.enemy_type, intent.range, false, add_enemy );
+	}
+
+	if( intent.enemy_type&BL_MOB ){
+		search( mapdata->block_mob, BL_MOB, intent.range, false, add_enemy );
+	}
+
+	if( intent.looter ){
+		search( mapdata->block, BL_ITEM, battle_config.loot_range, true, [&intent]( block_list* bl ){
+			intent.items.push_back( bl );
+		} );
+	}
+}
+
+/**
+ * Returns the intent of the monster if its search results are still valid.
+ * @param md: Monster
+ * @return Intent or nullptr if the searches have to be executed again
+ */
+static s_mob_ai_intent* mob_ai_getintent( mob_data* md ){
+	s_mob_ai_intent* intent = mob_ai_intent;
+
+	if( intent == nullptr || intent->md != md ){
+		return nullptr;
+	}
+
+	// Anything moved on the map or the monster changed
+	if( intent->m != md->m || intent->x != md->x || intent->y != md->y || intent->block_version != map_getmapdata( md->m )->block_version ){
+		return nullptr;
+	}
+
+	if( intent->range != md->db->range2 || intent->enemy_type != DEFAULT_ENEMY_TYPE( md ) ){
+		return nullptr;
+	}
+
+	return intent;
+}
+
+/// Checks if a search result of an intent is part of a search with a smaller range
+static bool mob_ai_intent_inrange( mob_data* md, block_list* bl, int32 range ){
+	return bl->prev != nullptr && abs( bl->x - md->x ) <= range && abs( bl->y - md->y ) <= range
+#ifdef CIRCULAR_AREA
+		&& check_distance_bl( md, bl, range )
+#endif
+		;
+}
+
 /*==========================================
  * The ?? routine of an active monster
+ * in_range: precomputed range2 check of an intent or nullptr
  *------------------------------------------*/
-static int32 mob_ai_sub_hard_activesearch(block_list *bl,va_list ap)
+static int32 mob_ai_sub_hard_activesearch_sub(mob_data* md, block_list* bl, block_list** target, enum e_mode mode, const bool* in_range)
 {
-	mob_data *md;
-	block_list **target;
-	enum e_mode mode;
 	int32 dist;
 
 	nullpo_ret(bl);
-	md=va_arg(ap,mob_data *);
-	target= va_arg(ap,block_list**);
-	mode= static_cast<enum e_mode>(va_arg(ap, int32));
 
 	//If can't seek yet, not an enemy, or you can't attack it, skip.
 	if ((*target) == bl || !status_check_skilluse(md, bl, 0, 0))
@@ -1344,7 +1577,7 @@ static int32 mob_ai_sub_hard_activesearch(block_list *bl,va_list ap)
 	dist = distance_bl(md, bl);
 	if(
 		((*target) == nullptr || !check_distance_bl(md, *target, dist)) &&
-		battle_check_range(md,bl,md->db->range2)
+		(in_range != nullptr ? *in_range : battle_check_range(md,bl,md->db->range2))
 	) { //Pick closest target?
 #ifdef ACTIVEPATHSEARCH
 		struct walkpath_data wpd;
@@ -1366,14 +1599,9 @@ static int32 mob_ai_sub_hard_activesearch(block_list *bl,va_list ap)
 /*==========================================
  * chase target-change routine.
  *------------------------------------------*/
-static int32 mob_ai_sub_hard_changechase(block_list *bl,va_list ap)
+static int32 mob_ai_sub_hard_changechase_sub(mob_data* md, block_list* bl, block_list** target)
 {
-	mob_data *md;
-	block_list **target;
-
 	nullpo_ret(bl);
-	md=va_arg(ap,mob_data *);
-	target= va_arg(ap,block_list**);
 
 	//If can't seek yet, not an enemy, or you can't attack it, skip.
 	if ((*target) == bl ||
@@ -1409,15 +1637,10 @@ static int32 mob_ai_sub_hard_bg_ally(block_list *bl,va_list ap) {
 /*==========================================
  * loot monster item search
  *------------------------------------------*/
-static int32 mob_ai_sub_hard_lootsearch(block_list *bl,va_list ap)
+static int32 mob_ai_sub_hard_lootsearch_sub(mob_data* md, block_list* bl, block_list** target)
 {
-	mob_data* md;
-	block_list **target;
 	int32 dist;
 
-	md = va_arg(ap,mob_data *);
-	target = va_arg(ap,block_list**);
-
 	dist = distance_bl(md, bl);
 	if (mob_can_reach(md, bl, battle_config.loot_range) && (
 		(*target) == nullptr ||
@@ -2009,22 +2232,48 @@ static bool mob_ai_sub_hard(mob_data *md, t_tick tick)
 	if (can_move && mode&MD_LOOTER && md->lootitems && DIFF_TICK(tick, md->ud.canact_tick) > 0 &&
 		(md->lootitem_count < LOOTITEM_SIZE || battle_config.monster_loot_type != 1))
 	{
+		s_mob_ai_intent* intent = mob_ai_getintent(md);
+
+		if (intent != nullptr && !intent->looter)
+			intent = nullptr;
+
 		if (tbl == nullptr) {
 			// Search for items in loot range
-			map_foreachinshootrange(mob_ai_sub_hard_lootsearch, md, battle_config.loot_range, BL_ITEM, md, &tbl);
+			if (intent != nullptr) {
+				for (block_list* bl : intent->items) {
+					if (mob_ai_intent_inrange(md, bl, battle_config.loot_range))
+						mob_ai_sub_hard_lootsearch_sub(md, bl, &tbl);
+				}
+			} else
+				map_foreachinshootrange(md, battle_config.loot_range, BL_ITEM, [md, &tbl](block_list* bl) { return mob_ai_sub_hard_lootsearch_sub(md, bl, &tbl); });
 		}
 		else if (tbl->type == BL_ITEM && battle_config.monster_loot_search_type == 0) {
 			// Looter already has a target item, but we want to check if there is an item that's closer
 			int16 dist = distance_bl(md, tbl) - 1;
-			if (dist > 0)
-				map_foreachinshootrange(mob_ai_sub_hard_lootsearch, md, dist, BL_ITEM, md, &tbl);
+			if (dist > 0) {
+				if (intent != nullptr && dist <= battle_config.loot_range) {
+					for (block_list* bl : intent->items) {
+						if (mob_ai_intent_inrange(md, bl, dist))
+							mob_ai_sub_hard_lootsearch_sub(md, bl, &tbl);
+					}
+				} else
+					map_foreachinshootrange(md, dist, BL_ITEM, [md, &tbl](block_list* bl) { return mob_ai_sub_hard_lootsearch_sub(md, bl, &tbl); });
+			}
 		}
 	}
 
 	if ((mode&MD_AGGRESSIVE && (!tbl || slave_lost_target)) || md->state.skillstate == MSS_FOLLOW)
 	{
 		int32 prev_id = md->target_id;
-		map_foreachinallrange (mob_ai_sub_hard_activesearch, md, view_range, DEFAULT_ENEMY_TYPE(md), md, &tbl, mode);
+		s_mob_ai_intent* intent = mob_ai_getintent(md);
+
+		if (intent != nullptr && view_range <= intent->range) {
+			for (const auto& enemy : intent->enemies) {
+				if (mob_ai_intent_inrange(md, enemy.first, view_range))
+					mob_ai_sub_hard_activesearch_sub(md, enemy.first, &tbl, static_cast<enum e_mode>(mode), &enemy.second);
+			}
+		} else
+			map_foreachinallrange(md, view_range, DEFAULT_ENEMY_TYPE(md), [md, &tbl, mode](block_list* bl) { return mob_ai_sub_hard_activesearch_sub(md, bl, &tbl, static_cast<enum e_mode>(mode), nullptr); });
 		// If a monster finds a new target that is already in attack range it immediately switches to rush mode
 		// This behavior overrides even angry mode and other mode-specific behavior
 		if (tbl != nullptr && prev_id != md->target_id && battle_check_range(md, tbl, md->status.rhw.range)) {
@@ -2037,7 +2286,15 @@ static bool mob_ai_sub_hard(mob_data *md, t_tick tick)
 	{
 		int32 search_size;
 		search_size = view_range<md->status.rhw.range ? view_range:md->status.rhw.range;
-		map_foreachinallrange (mob_ai_sub_hard_changechase, md, search_size, DEFAULT_ENEMY_TYPE(md), md, &tbl);
+		s_mob_ai_intent* intent = mob_ai_getintent(md);
+
+		if (intent != nullptr && search_size <= intent->range) {
+			for (const auto& enemy : intent->enemies) {
+				if (mob_ai_intent_inrange(md, enemy.first, search_size))
+					mob_ai_sub_hard_changechase_sub(md, enemy.first, &tbl);
+			}
+		} else
+			map_foreachinallrange(md, search_size, DEFAULT_ENEMY_TYPE(md), [md, &tbl](block_list* bl) { return mob_ai_sub_hard_changechase_sub(md, bl, &tbl); });
 	}
 
 	if (!tbl) { //No targets available.
@@ -2329,28 +2586,195 @@ TIMER_FUNC(mob_norm_attacked) {
 	return 0;
 }
 
-static int32 mob_ai_sub_hard_timer(block_list *bl,va_list ap)
+/// Monster near players and the index of the first player that spotted it
+struct s_mob_ai_activation {
+	mob_data* md;
+	size_t player;
+};
+
+/// Players on a map and their global index in the order of map_foreachpc
+struct s_mob_ai_map_players {
+	std::vector<map_session_data*> players;
+	std::vector<size_t> indexes;
+};
+
+typedef std::map<int16, s_mob_ai_map_players> t_mob_ai_maps;
+
+static int32 mob_ai_sub_collect_players(map_session_data *sd,va_list ap)
 {
-	mob_data *md = (mob_data*)bl;
-	uint32 char_id = va_arg(ap, uint32);
-	t_tick tick = va_arg(ap, t_tick);
-	mob_add_spotted(md, char_id);
-	if (mob_ai_sub_hard(md, tick))
-	{	//Hard AI triggered.
-		md->last_pcneartime = tick;
+	t_mob_ai_maps* maps = va_arg(ap, t_mob_ai_maps*);
+	size_t* count = va_arg(ap, size_t*);
+
+	if (sd->m >= 0) {
+		s_mob_ai_map_players& map = (*maps)[sd->m];
+
+		map.players.push_back(sd);
+		map.indexes.push_back(*count);
 	}
+
+	(*count)++;
 	return 0;
 }
 
+/**
+ * Collects all monsters of a map that are within AREA_SIZE+ACTIVE_AI_RANGE of a player.
+ * The blocks around the players are marked once, so every monster is checked exactly once
+ * and added to the spotted log of all players near it in bulk.
+ * @param m: Map
+ * @param map: Players on the map
+ * @param activations: Found monsters are added here
+ */
+static void mob_ai_collect_map(int16 m, const s_mob_ai_map_players& map, std::vector<s_mob_ai_activation>& activations)
+{
+	static std::vector<bool> active_blocks;
+	static std::vector<int32> block_players; // First player index in a block
+	static std::vector<int32> next_players; // Next player index in the same block
+	static std::vector<int32> spotted;
+	struct map_data* mapdata = map_getmapdata(m);
+	int32 range = AREA_SIZE + ACTIVE_AI_RANGE;
+
+	if (mapdata == nullptr || mapdata->block_mob == nullptr)
+		return;
+
+	active_blocks.assign(mapdata->bxs * mapdata->bys, false);
+	block_players.assign(mapdata->bxs * mapdata->bys, -1);
+	next_players.assign(map.players.size(), -1);
+
+	// Walk backwards, so the players of a block are linked in ascending order
+	for (int32 i = static_cast<int32>(map.players.size()) - 1; i >= 0; i--) {
+		map_session_data* sd = map.players[i];
+
+		if (sd->x < 0 || sd->x >= mapdata->xs || sd->y < 0 || sd->y >= mapdata->ys)
+			continue;
+
+		int32 x0 = i16max(sd->x - range, 0) / BLOCK_SIZE;
+		int32 y0 = i16max(sd->y - range, 0) / BLOCK_SIZE;
+		int32 x1 = i16min(sd->x + range, mapdata->xs - 1) / BLOCK_SIZE;
+		int32 y1 = i16min(sd->y + range, mapdata->ys - 1) / BLOCK_SIZE;
+		int32 pos = sd->x / BLOCK_SIZE + (sd->y / BLOCK_SIZE) * mapdata->bxs;
+
+		next_players[i] = block_players[pos];
+		block_players[pos] = i;
+
+		for (int32 by = y0; by <= y1; by++) {
+			for (int32 bx = x0; bx <= x1; bx++)
+				active_blocks[bx + by * mapdata->bxs] = true;
+		}
+	}
+
+	for (int32 by = 0; by < mapdata->bys; by++) {
+		for (int32 bx = 0; bx < mapdata->bxs; bx++) {
+			if (!active_blocks[bx + by * mapdata->bxs])
+				continue;
+
+			for (block_list* bl = mapdata->block_mob[bx + by * mapdata->bxs]; bl != nullptr; bl = bl->next) {
+				int32 x0 = i16max(bl->x - range, 0) / BLOCK_SIZE;
+				int32 y0 = i16max(bl->y - range, 0) / BLOCK_SIZE;
+				int32 x1 = i16min(bl->x + range, mapdata->xs - 1) / BLOCK_SIZE;
+				int32 y1 = i16min(bl->y + range, mapdata->ys - 1) / BLOCK_SIZE;
+
+				spotted.clear();
+
+				for (int32 py = y0; py <= y1; py++) {
+					for (int32 px = x0; px <= x1; px++) {
+						for (int32 i = block_players[px + py * mapdata->bxs]; i != -1; i = next_players[i]) {
+							map_session_data* sd = map.players[i];
+
+							if (abs(sd->x - bl->x) <= range && abs(sd->y - bl->y) <= range
+#ifdef CIRCULAR_AREA
+								&& check_distance_bl(sd, bl, range)
+#endif
+								)
+								spotted.push_back(i);
+						}
+					}
+				}
+
+				if (spotted.empty())
+					continue;
+
+				mob_data* md = (mob_data*)bl;
+
+				// Same order in which the players would have spotted the monster one by one
+				std::sort(spotted.begin(), spotted.end());
+
+				for (int32 i : spotted)
+					mob_add_spotted(md, map.players[i]->status.char_id);
+
+				activations.push_back({ md, map.indexes[spotted.front()] });
+			}
+		}
+	}
+}
+
 /*==========================================
- * Serious processing for mob in PC field of view (foreachclient)
+ * Serious processing for mob in PC field of view
+ * Every monster near a player is processed once, in the order of the first player that spotted it.
+ * With monster_ai_threads the searches of the monsters are evaluated on the worker threads first.
  *------------------------------------------*/
-static int32 mob_ai_sub_foreachclient(map_session_data *sd,va_list ap)
+static void mob_ai_hard_active(t_tick tick)
 {
-	t_tick tick=va_arg(ap,t_tick);
-	map_foreachinallrange(mob_ai_sub_hard_timer,sd, AREA_SIZE+ACTIVE_AI_RANGE, BL_MOB, sd->status.char_id, tick);
+	t_mob_ai_maps maps;
+	std::vector<s_mob_ai_activation> activations;
+	std::vector<s_mob_ai_intent> intents;
+	std::vector<std::pair<size_t, size_t>> batches;
+	const size_t batch_size = 64;
+	size_t count = 0;
+
+	// Objects collected here must not be freed until all AI was executed
+	FreeBlockLock freeLock;
 
-	return 0;
+	map_foreachpc(mob_ai_sub_collect_players, &maps, &count);
+
+	// Monsters are collected grouped by map
+	for (const auto& map : maps)
+		mob_ai_collect_map(map.first, map.second, activations);
+
+	if (battle_config.mob_ai_threads > 0) {
+		if (mob_ai_workers.size() != static_cast<size_t>(battle_config.mob_ai_threads))
+			mob_ai_workers.start(battle_config.mob_ai_threads);
+
+		// Split the monsters into batches of the same map for the workers
+		intents.resize(activations.size());
+
+		for (size_t i = 0; i < activations.size(); i++) {
+			intents[i].md = activations[i].md;
+
+			if (batches.empty() || batches.back().second - batches.back().first >= batch_size || activations[batches.back().first].md->m != activations[i].md->m)
+				batches.emplace_back(i, i + 1);
+			else
+				batches.back().second = i + 1;
+		}
+
+		mob_ai_workers.run(batches.size(), [&intents, &batches](size_t batch) {
+			for (size_t i = batches[batch].first; i < batches[batch].second; i++)
+				mob_ai_evaluate_intent(intents[i]);
+		});
+	} else if (mob_ai_workers.size() > 0)
+		mob_ai_workers.stop();
+
+	std::vector<size_t> order(activations.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	std::stable_sort(order.begin(), order.end(), [&activations](size_t a, size_t b) -> bool {
+		return activations[a].player < activations[b].player;
+	});
+
+	for (size_t i : order) {
+		mob_data* md = activations[i].md;
+
+		if (md->prev == nullptr)
+			continue;
+
+		mob_ai_intent = intents.empty() ? nullptr : &intents[i];
+		if (mob_ai_sub_hard(md, tick))
+		{	//Hard AI triggered.
+			md->last_pcneartime = tick;
+		}
+		mob_ai_intent = nullptr;
+	}
 }
 
 /*==========================================
@@ -2470,7 +2894,7 @@ static TIMER_FUNC(mob_ai_hard){
 	if (battle_config.mob_ai&0x20)
 		map_foreachmob(mob_ai_sub_lazy,tick);
 	else
-		map_foreachpc(mob_ai_sub_foreachclient,tick);
+		mob_ai_hard_active(tick);
 
 	return 0;
 }
@@ -7376,5 +7800,6 @@ void do_final_mob(bool is_reload){
 	map_drop_db.clear();
 	if( !is_reload ) {
 		mob_delayed_drops.clear();
+		mob_ai_workers.stop();
 	}
 }
@@ -180,6 +180,11 @@ bool navi_path_search(struct navi_walkpath_data *wpd, const struct navi_pos *fro
 		return true;
 	}
 
+	// Skip the search for cells that are not connected at all, e.g. between segments of a map
+	// The graph only prunes, found paths are still the ones of the A* below
+	if (!path_graph_reachable(mapdata, from->x, from->y, dest->x, dest->y, cell))
+		return false;
+
 	struct path_node *current, *it;
 	int32 xs = mapdata->xs - 1;
 	int32 ys = mapdata->ys - 1;
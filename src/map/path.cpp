@@ -3,10 +3,12 @@
 
 #include "path.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include <common/cbasetypes.hpp>
 #include <common/db.hpp>
@@ -126,6 +128,102 @@ int32 path_blownpos(int16 m,int16 x0,int16 y0,int16 dx,int16 dy,int32 count)
 	return (x0<<16)|y0; //TODO: use 'struct point' here instead?
 }
 
+/// Checks if any cell from xa to xb (inclusive) of a bitplane row is set, 64 cells per word
+static inline bool path_plane_row(const uint64* row, int32 xa, int32 xb)
+{
+	int32 wa = xa >> 6, wb = xb >> 6;
+	uint64 first = ~0ULL << (xa & 63);
+	uint64 last = ~0ULL >> (63 - (xb & 63));
+
+	if (wa == wb)
+		return (row[wa] & first & last) != 0;
+
+	if (row[wa] & first)
+		return true;
+
+	for (int32 w = wa + 1; w < wb; w++) {
+		if (row[w])
+			return true;
+	}
+
+	return (row[wb] & last) != 0;
+}
+
+/// Same walk as path_search_long, but on a bitplane of the cell check.
+/// Lines that are closer to horizontal visit runs of cells in the same row,
+/// these runs are checked with word masks instead of cell by cell.
+static bool path_search_long_plane(const struct s_cell_planes* planes, const uint64* plane, int32 x0, int32 y0, int32 x1, int32 y1)
+{
+	if (x1 < x0) {
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
+
+	int32 dx = x1 - x0;
+	int32 dy = y1 - y0;
+	int32 x = x0, y = y0;
+
+#define plane_test(x, y) ((plane[((x) >> 6) + (size_t)(y) * planes->words] >> ((x) & 63)) & 1)
+	if (dx > abs(dy)) {
+		// x advances on every step, y only every few steps
+		int32 weight = dx;
+		int32 wy = 0;
+
+		for (;;) {
+			int32 left = x1 - x;
+			int32 steps; // Steps until y changes
+
+			if (dy > 0)
+				steps = (weight - wy + dy - 1) / dy;
+			else if (dy < 0)
+				steps = wy / -dy + 1;
+			else
+				steps = left + 1;
+
+			if (steps > left) // Last row, the destination itself is not checked
+				return left <= 1 || !path_plane_row(plane + (size_t)y * planes->words, x + 1, x1 - 1);
+
+			if (steps > 1 && path_plane_row(plane + (size_t)y * planes->words, x + 1, x + steps - 1))
+				return false;
+
+			x += steps;
+			wy += steps * dy;
+			if (dy > 0) {
+				wy -= weight;
+				y++;
+			} else {
+				wy += weight;
+				y--;
+			}
+
+			if (x == x1 && y == y1)
+				return true;
+			if (plane_test(x, y))
+				return false;
+		}
+	} else {
+		// y advances on every step
+		int32 weight = abs(dy);
+		int32 wx = 0;
+		int32 sy = (dy > 0) ? 1 : -1;
+
+		while (x != x1 || y != y1) {
+			wx += dx;
+			if (wx >= weight) {
+				wx -= weight;
+				x++;
+			}
+			y += sy;
+
+			if ((x != x1 || y != y1) && plane_test(x, y))
+				return false;
+		}
+	}
+#undef plane_test
+
+	return true;
+}
+
 /*==========================================
  * is ranged attack from (x0,y0) to (x1,y1) possible?
  *------------------------------------------*/
@@ -137,12 +235,22 @@ bool path_search_long(struct shootpath_data *spd,int16 m,int16 x0,int16 y0,int16
 	struct map_data *mapdata = map_getmapdata(m);
 	struct shootpath_data s_spd;
 
-	if( spd == nullptr )
-		spd = &s_spd; // use dummy output variable
-
 	if (!mapdata->cell)
 		return false;
 
+	// Without a path to return, the check can run on the bitplanes
+	if (spd == nullptr && (cell == CELL_CHKWALL || cell == CELL_CHKNOREACH)
+		&& x0 >= 0 && x0 < mapdata->xs && y0 >= 0 && y0 < mapdata->ys
+		&& x1 >= 0 && x1 < mapdata->xs && y1 >= 0 && y1 < mapdata->ys
+		&& mapdata->cell_planes != nullptr) {
+		const struct s_cell_planes* planes = map_getcellplanes(mapdata);
+
+		return path_search_long_plane(planes, planes->plane[cell == CELL_CHKWALL ? CELL_PLANE_WALL : CELL_PLANE_NOREACH].data(), x0, y0, x1, y1);
+	}
+
+	if( spd == nullptr )
+		spd = &s_spd; // use dummy output variable
+
 	dx = (x1 - x0);
 	if (dx < 0) {
 		std::swap(x0, x1);
@@ -192,6 +300,321 @@ bool path_search_long(struct shootpath_data *spd,int16 m,int16 x0,int16 y0,int16
 	return true;
 }
 
+/// @name Reachability pruning
+/// The map is split into clusters of PATH_CLUSTER_SIZE^2 cells. Inside each cluster the
+/// walkable cells are grouped into regions, regions of neighbouring clusters are linked
+/// where they touch and the linked regions form the components of the map.
+/// Changing a cell only requires to relabel its cluster and to link the regions again.
+/// The components only prune searches that can not succeed, the paths themselves are
+/// still searched cell by cell by path_search and navi_path_search.
+/// @{
+
+#define PATH_CLUSTER_SIZE 16
+#define PATH_REGION_NONE UINT8_MAX
+
+/// Component of the cells that are only passable for CELL_CHKNOREACH (last row and column)
+#define PATH_COMPONENT_EDGE -2
+
+struct s_path_graph {
+	int32 cxs, cys; ///< Map dimensions (in clusters)
+	std::vector<uint8> label; ///< Region of each cell inside its cluster or PATH_REGION_NONE
+	std::vector<uint8> regions; ///< Number of regions of each cluster
+	std::vector<bool> dirty; ///< Clusters that have to be labeled again
+	std::vector<int32> region_base; ///< First region of each cluster in component
+	std::vector<int32> component; ///< Component of each region
+	std::vector<bool> edge; ///< Components that touch the last row or column of the map
+	bool changed; ///< Components have to be linked again
+};
+
+/// Cells of the last row and column are never passable for CELL_CHKNOPASS, see map_getcellp
+static inline bool path_graph_passable( struct map_data* mapdata, int32 x, int32 y ){
+	return x < mapdata->xs - 1 && y < mapdata->ys - 1 && map_cell(mapdata, x + y * mapdata->xs).walkable;
+}
+
+/// Groups the passable cells of a cluster into 4-connected regions.
+/// Diagonal steps are only allowed by path_search if both orthogonal cells are passable,
+/// therefore 4-connectivity is the same as the connectivity of the search.
+static void path_graph_label( struct map_data* mapdata, struct s_path_graph* graph, int32 cx, int32 cy ){
+	int32 x0 = cx * PATH_CLUSTER_SIZE, y0 = cy * PATH_CLUSTER_SIZE;
+	int32 x1 = std::min<int32>( x0 + PATH_CLUSTER_SIZE, mapdata->xs ), y1 = std::min<int32>( y0 + PATH_CLUSTER_SIZE, mapdata->ys );
+	int32 stack[PATH_CLUSTER_SIZE * PATH_CLUSTER_SIZE];
+	uint8 regions = 0;
+
+	for( int32 y = y0; y < y1; y++ ){
+		for( int32 x = x0; x < x1; x++ ){
+			graph->label[x + y * mapdata->xs] = PATH_REGION_NONE;
+		}
+	}
+
+	for( int32 y = y0; y < y1; y++ ){
+		for( int32 x = x0; x < x1; x++ ){
+			if( graph->label[x + y * mapdata->xs] != PATH_REGION_NONE || !path_graph_passable( mapdata, x, y ) ){
+				continue;
+			}
+
+			int32 top = 0;
+
+			stack[top++] = x + y * mapdata->xs;
+			graph->label[x + y * mapdata->xs] = regions;
+
+			while( top > 0 ){
+				int32 index = stack[--top];
+				int32 px = index % mapdata->xs, py = index / mapdata->xs;
+				const int32 dirs[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+
+				for( const auto& dir : dirs ){
+					int32 nx = px + dir[0], ny = py + dir[1];
+
+					if( nx < x0 || nx >= x1 || ny < y0 || ny >= y1 ){
+						continue;
+					}
+
+					int32 next = nx + ny * mapdata->xs;
+
+					if( graph->label[next] == PATH_REGION_NONE && path_graph_passable( mapdata, nx, ny ) ){
+						graph->label[next] = regions;
+						stack[top++] = next;
+					}
+				}
+			}
+
+			regions++;
+		}
+	}
+
+	graph->regions[cx + cy * graph->cxs] = regions;
+	graph->dirty[cx + cy * graph->cxs] = false;
+}
+
+/// Finds the root of a region in the union-find forest
+static int32 path_graph_find( std::vector<int32>& parent, int32 i ){
+	while( parent[i] != i ){
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+/// Relabels changed clusters and links the regions of neighbouring clusters into components
+static void path_graph_link( struct map_data* mapdata, struct s_path_graph* graph ){
+	int32 clusters = graph->cxs * graph->cys;
+	int32 total = 0;
+
+	for( int32 i = 0; i < clusters; i++ ){
+		if( graph->dirty[i] ){
+			path_graph_label( mapdata, graph, i % graph->cxs, i / graph->cxs );
+		}
+
+		graph->region_base[i] = total;
+		total += graph->regions[i];
+	}
+
+	std::vector<int32> parent( total );
+
+	for( int32 i = 0; i < total; i++ ){
+		parent[i] = i;
+	}
+
+	auto region = [mapdata, graph]( int32 x, int32 y ){
+		return graph->region_base[x / PATH_CLUSTER_SIZE + ( y / PATH_CLUSTER_SIZE ) * graph->cxs] + graph->label[x + y * mapdata->xs];
+	};
+
+	auto unite = [mapdata, graph, &parent, &region]( int32 x, int32 y, int32 nx, int32 ny ){
+		if( graph->label[x + y * mapdata->xs] == PATH_REGION_NONE || graph->label[nx + ny * mapdata->xs] == PATH_REGION_NONE ){
+			return;
+		}
+
+		int32 a = path_graph_find( parent, region( x, y ) ), b = path_graph_find( parent, region( nx, ny ) );
+
+		if( a != b ){
+			parent[a] = b;
+		}
+	};
+
+	// Only the cells on the borders of the clusters have to be checked
+	for( int32 x = PATH_CLUSTER_SIZE; x < mapdata->xs; x += PATH_CLUSTER_SIZE ){
+		for( int32 y = 0; y < mapdata->ys; y++ ){
+			unite( x - 1, y, x, y );
+		}
+	}
+
+	for( int32 y = PATH_CLUSTER_SIZE; y < mapdata->ys; y += PATH_CLUSTER_SIZE ){
+		for( int32 x = 0; x < mapdata->xs; x++ ){
+			unite( x, y - 1, x, y );
+		}
+	}
+
+	graph->component.assign( total, -1 );
+	graph->edge.clear();
+
+	for( int32 i = 0; i < total; i++ ){
+		int32 root = path_graph_find( parent, i );
+
+		if( graph->component[root] < 0 ){
+			graph->component[root] = static_cast<int32>( graph->edge.size() );
+			graph->edge.push_back( false );
+		}
+
+		graph->component[i] = graph->component[root];
+	}
+
+	// Cells next to the last row or column can step onto it with CELL_CHKNOREACH
+	for( int32 y = 0; y < mapdata->ys - 1; y++ ){
+		if( mapdata->xs >= 2 && graph->label[mapdata->xs - 2 + y * mapdata->xs] != PATH_REGION_NONE ){
+			graph->edge[graph->component[region( mapdata->xs - 2, y )]] = true;
+		}
+	}
+
+	for( int32 x = 0; x < mapdata->xs - 1; x++ ){
+		if( mapdata->ys >= 2 && graph->label[x + ( mapdata->ys - 2 ) * mapdata->xs] != PATH_REGION_NONE ){
+			graph->edge[graph->component[region( x, mapdata->ys - 2 )]] = true;
+		}
+	}
+
+	graph->changed = false;
+}
+
+/// Returns the graph of a map, builds or updates it if required
+static struct s_path_graph* path_graph_get( struct map_data* mapdata ){
+	struct s_path_graph* graph = mapdata->path_graph;
+
+	if( graph == nullptr ){
+		graph = new s_path_graph();
+		graph->cxs = ( mapdata->xs + PATH_CLUSTER_SIZE - 1 ) / PATH_CLUSTER_SIZE;
+		graph->cys = ( mapdata->ys + PATH_CLUSTER_SIZE - 1 ) / PATH_CLUSTER_SIZE;
+		graph->label.resize( mapdata->xs * mapdata->ys );
+		graph->regions.resize( graph->cxs * graph->cys );
+		graph->dirty.assign( graph->cxs * graph->cys, true );
+		graph->region_base.resize( graph->cxs * graph->cys );
+		graph->changed = true;
+		mapdata->path_graph = graph;
+	}
+
+	if( graph->changed ){
+		path_graph_link( mapdata, graph );
+	}
+
+	return graph;
+}
+
+/// Returns the component of a cell, -1 if it is not passable
+static int32 path_graph_component( struct map_data* mapdata, struct s_path_graph* graph, int32 x, int32 y, cell_chk cell ){
+	if( x >= mapdata->xs - 1 || y >= mapdata->ys - 1 ){
+		return ( cell == CELL_CHKNOREACH ) ? PATH_COMPONENT_EDGE : -1;
+	}
+
+	uint8 label = graph->label[x + y * mapdata->xs];
+
+	if( label == PATH_REGION_NONE ){
+		return -1;
+	}
+
+	return graph->component[graph->region_base[x / PATH_CLUSTER_SIZE + ( y / PATH_CLUSTER_SIZE ) * graph->cxs] + label];
+}
+
+/// Checks if two components are connected for the given cell check
+static bool path_graph_connected( struct s_path_graph* graph, int32 a, int32 b, cell_chk cell ){
+	if( a < 0 && a != PATH_COMPONENT_EDGE ){
+		return false;
+	}
+
+	if( a == b ){
+		return true;
+	}
+
+	// All cells of the last row and column are passable and connected with CELL_CHKNOREACH
+	if( cell == CELL_CHKNOREACH ){
+		return ( a == PATH_COMPONENT_EDGE || graph->edge[a] ) && ( b == PATH_COMPONENT_EDGE || ( b >= 0 && graph->edge[b] ) );
+	}
+
+	return false;
+}
+
+/**
+ * Checks if a cell can possibly be reached by path_search.
+ * Only walkability checks are answered, for every other check true is returned.
+ * @param mapdata: Map
+ * @param x0, y0: Start cell, like path_search the start cell itself does not have to be passable
+ * @param x1, y1: Destination cell
+ * @param cell: Type of obstruction to check for
+ * @return false if there is definitely no path
+ */
+bool path_graph_reachable( struct map_data* mapdata, int16 x0, int16 y0, int16 x1, int16 y1, cell_chk cell ){
+#ifdef CELL_NOSTACK
+	// The stack limit makes CELL_CHKNOPASS depend on the units on the cells
+	if( cell != CELL_CHKNOREACH ){
+		return true;
+	}
+#else
+	if( cell != CELL_CHKNOPASS && cell != CELL_CHKNOREACH ){
+		return true;
+	}
+#endif
+
+	if( !battle_config.path_graph || mapdata->cell == nullptr ){
+		return true;
+	}
+
+	if( x0 < 0 || y0 < 0 || x1 < 0 || y1 < 0 || ( x0 == x1 && y0 == y1 ) ){
+		return true;
+	}
+
+	struct s_path_graph* graph = path_graph_get( mapdata );
+	int32 target = path_graph_component( mapdata, graph, x1, y1, cell );
+
+	if( target < 0 && target != PATH_COMPONENT_EDGE ){
+		return false;
+	}
+
+	int32 start = path_graph_component( mapdata, graph, x0, y0, cell );
+
+	if( start >= 0 || start == PATH_COMPONENT_EDGE ){
+		return path_graph_connected( graph, start, target, cell );
+	}
+
+	// Leaving a blocked start cell is possible in any orthogonal direction that is passable
+	const int32 dirs[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+
+	for( const auto& dir : dirs ){
+		int32 nx = x0 + dir[0], ny = y0 + dir[1];
+
+		if( nx < 0 || ny < 0 || nx >= mapdata->xs || ny >= mapdata->ys ){
+			continue;
+		}
+
+		if( path_graph_connected( graph, path_graph_component( mapdata, graph, nx, ny, cell ), target, cell ) ){
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Updates the graph after the walkability of a cell changed.
+ * The graph is updated lazily on its next use.
+ * @param mapdata: Map
+ * @param x, y: Changed cell
+ */
+void path_graph_update( struct map_data* mapdata, int16 x, int16 y ){
+	struct s_path_graph* graph = mapdata->path_graph;
+
+	if( graph == nullptr ){
+		return;
+	}
+
+	graph->dirty[x / PATH_CLUSTER_SIZE + ( y / PATH_CLUSTER_SIZE ) * graph->cxs] = true;
+	graph->changed = true;
+}
+
+/// Frees the graph of a map
+void path_graph_free( struct map_data* mapdata ){
+	delete mapdata->path_graph;
+	mapdata->path_graph = nullptr;
+}
+/// @}
+
 /// @name A* pathfinding related functions
 /// @{
 
@@ -289,6 +712,10 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 	if (x1 < 0 || x1 >= mapdata->xs || y1 < 0 || y1 >= mapdata->ys || map_getcellp(mapdata,x1,y1,cell))
 		return false;
 
+	// The easy path cuts corners, only A* is guaranteed to fail for unconnected cells
+	if (!(flag&1) && !path_graph_reachable(mapdata, x0, y0, x1, y1, cell))
+		return false;
+
 	if (flag&1) {
 		// Try finding direct path to target
 		// Direct path goes diagonally first, then in straight line.
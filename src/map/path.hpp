@@ -7,6 +7,7 @@
 #include <common/cbasetypes.hpp>
 
 enum cell_chk : uint8;
+struct map_data;
 
 #define MOVE_COST 10
 #define MOVE_DIAGONAL_COST 14
@@ -77,6 +78,10 @@ bool direction_diagonal( enum directions direction );
 bool direction_opposite( enum directions direction );
 
 //
+bool path_graph_reachable(struct map_data* mapdata, int16 x0, int16 y0, int16 x1, int16 y1, cell_chk cell);
+void path_graph_update(struct map_data* mapdata, int16 x, int16 y);
+void path_graph_free(struct map_data* mapdata);
+
 void do_init_path();
 void do_final_path();
 
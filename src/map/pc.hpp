@@ -483,6 +483,9 @@ public:
 
 	int32 langtype;
 	struct mmo_charstatus status;
+	std::unique_ptr<struct mmo_charstatus> save_base; ///< Status as last sent to the char-server, base of delta saves
+	uint32 save_seq; ///< Sequence number of the last sent status
+	uint32 save_generation; ///< Char-server connection the save base belongs to
 
 	// Item Storages
 	struct s_storage storage, premiumStorage;
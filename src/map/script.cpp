@@ -9,10 +9,17 @@
 
 #include "script.hpp"
 
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cmath>
 #include <csetjmp>
 #include <cstdlib> // atoi, strtol, strtoll, exit
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #ifdef PCRE_SUPPORT
 #include <pcre.h> // preg_match
@@ -61,6 +68,7 @@
 #include "pc_groups.hpp"
 #include "pet.hpp"
 #include "quest.hpp"
+#include "sqlworker.hpp"
 #include "storage.hpp"
 
 using namespace rathena;
@@ -76,6 +84,32 @@ struct eri *st_ers;
 struct eri *stack_ers;
 static map_session_data* dummy_sd;
 
+/// Interval in ms in which the results of asynchronous queries are processed
+#define SCRIPT_QUERY_ASYNC_INTERVAL 10
+
+/// Asynchronous query of query_sql_async/query_logsql_async
+struct s_script_query_async{
+	struct script_state* st;
+	bool done;
+	std::string sql;
+
+	// Guards the cancellation, so a timeout never kills the next query of the worker
+	std::mutex mutex;
+	bool cancelled; ///< Timed out, the worker skips or aborts the query
+	uint32 thread_id; ///< Connection id of the worker while it runs the query, 0 otherwise
+
+	// Written by the worker thread, only read by the main thread after done is set
+	std::string error;
+	uint32 columns;
+	uint64 rows;
+	std::vector<std::string> values; ///< Stored rows, columns * stored row count
+};
+
+/// Pending asynchronous queries by script state id
+static std::unordered_map<uint32, std::shared_ptr<s_script_query_async>> script_query_async_db;
+static std::vector<std::unique_ptr<SqlWorker>> script_query_workers[2]; ///< Workers for the main and the log database
+static TIMER_FUNC(script_query_async_timer);
+
 static bool script_rid2sd_( struct script_state *st, map_session_data** sd, const char *func );
 
 /**
@@ -249,6 +283,11 @@ static int32 buildin_set_ref = 0;
 static int32 buildin_callsub_ref = 0;
 static int32 buildin_callfunc_ref = 0;
 static int32 buildin_getelementofarray_ref = 0;
+static int32 buildin_goto_ref = 0;
+static int32 buildin_jump_zero_ref = 0;
+static int32 buildin_set2_ref = 0;
+static int32 buildin_getd_ref = 0;
+static int32 buildin_setd_ref = 0;
 
 // Caches compiled autoscript item code.
 // Note: This is not cleared when reloading itemdb.
@@ -258,6 +297,8 @@ struct Script_Config script_config = {
 	1, // warn_func_mismatch_argtypes
 	1, 65535, 2048, //warn_func_mismatch_paramnum/check_cmdcount/check_gotocount
 	0, INT_MAX, // input_min_value/input_max_value
+	2, // query_sql_async_workers
+	1, // predecode
 	// NOTE: None of these event labels should be longer than <EVENT_NAME_LENGTH> characters
 	// PC related
 	"OnPCDieEvent", //die_event_name
@@ -388,6 +429,7 @@ static struct linkdb_node *sleep_db; // int32 oid -> struct script_state *
  *------------------------------------------*/
 const char* parse_subexpr(const char* p,int32 limit);
 int32 run_func(struct script_state *st);
+static void script_decode(struct script_code* code);
 int32 script_instancegetid(struct script_state *st, e_instance_mode mode = IM_NONE);
 
 const char* script_op2name(int32 op)
@@ -2260,6 +2302,11 @@ static void add_buildin_func(void)
 			else if (!strcmp(buildin_func[i].name, "callsub")) buildin_callsub_ref = n;
 			else if (!strcmp(buildin_func[i].name, "callfunc")) buildin_callfunc_ref = n;
 			else if( !strcmp(buildin_func[i].name, "getelementofarray") ) buildin_getelementofarray_ref = n;
+			else if( !strcmp(buildin_func[i].name, "goto") ) buildin_goto_ref = n;
+			else if( !strcmp(buildin_func[i].name, "jump_zero") ) buildin_jump_zero_ref = n;
+			else if( !strcmp(buildin_func[i].name, "set") ) buildin_set2_ref = n;
+			else if( !strcmp(buildin_func[i].name, "getd") ) buildin_getd_ref = n;
+			else if( !strcmp(buildin_func[i].name, "setd") ) buildin_setd_ref = n;
 		}
 	}
 }
@@ -2657,9 +2704,223 @@ struct script_code* parse_script_( const char *src, const char *file, int32 line
 	code->script_size = script_size;
 	code->local.vars = nullptr;
 	code->local.arrays = nullptr;
+	script_decode(code);
 	return code;
 }
 
+/**
+ * Calls a function for the position of every name reference in a script buffer.
+ * @param buf: Script buffer
+ * @param size: Size of the script buffer
+ * @param func: Function that is called with the position of the 3 byte operand
+ * @return false if the buffer contains an unknown operation or the function failed
+ */
+template <typename F> static bool script_snapshot_names( unsigned char* buf, int32 size, F func ){
+	int32 pos = 0;
+
+	while( pos < size ){
+		c_op c = get_com( buf, &pos );
+
+		switch( c ){
+			case C_INT:
+				get_num( buf, &pos );
+				break;
+			case C_NAME:
+				if( !func( pos ) ){
+					return false;
+				}
+				pos += 3;
+				break;
+			case C_POS:
+			case C_USERFUNC_POS:
+				pos += 3;
+				break;
+			case C_STR:
+				while( pos < size && buf[pos++] );
+				break;
+			case C_NOP:
+			case C_ARG:
+			case C_EOL:
+			case C_FUNC:
+			case C_REF:
+				break;
+			default:
+				// Operators do not have any operand
+				if( c < C_OP3 || c > C_SUB_PRE ){
+					return false;
+				}
+				break;
+		}
+	}
+
+	return pos == size;
+}
+
+/**
+ * Key of the script engine for database snapshots, that contain compiled scripts.
+ * It changes with every build and whenever a constant, parameter or command is changed.
+ */
+std::string script_snapshot_key(){
+	uint64 hash = database_hash( nullptr, 0 );
+
+	for( int32 i = LABEL_START; i < str_num; i++ ){
+		if( str_data[i].type != C_INT && str_data[i].type != C_PARAM && str_data[i].type != C_FUNC ){
+			continue;
+		}
+
+		const char* name = get_str( i );
+
+		hash = database_hash( name, strlen( name ) + 1, hash );
+		hash = database_hash( &str_data[i].type, sizeof( str_data[i].type ), hash );
+		hash = database_hash( &str_data[i].val, sizeof( str_data[i].val ), hash );
+	}
+
+	char key[64];
+
+	safesnprintf( key, sizeof( key ), "%s %s|%016" PRIx64, __DATE__, __TIME__, hash );
+
+	return key;
+}
+
+/**
+ * Writes a compiled script into a database snapshot.
+ * Name references are stored by name, since their ids depend on the order of parsing.
+ * @param writer: Snapshot writer
+ * @param code: Script code or nullptr
+ * @return false if the script can not be written
+ */
+bool script_snapshot_write( DatabaseSnapshotWriter& writer, struct script_code* code ){
+	if( code == nullptr ){
+		writer.write<uint8>( 0 );
+		return true;
+	}
+
+	std::vector<unsigned char> buf( code->script_buf, code->script_buf + code->script_size );
+	std::vector<int32> names;
+	std::unordered_map<int32, int32> indexes;
+
+	bool valid = script_snapshot_names( buf.data(), code->script_size, [&]( int32 pos ){
+		int32 id = GETVALUE( buf.data(), pos );
+
+		if( id < LABEL_START || id >= str_num ){
+			return false;
+		}
+
+		auto it = indexes.find( id );
+
+		if( it == indexes.end() ){
+			it = indexes.emplace( id, static_cast<int32>( names.size() ) ).first;
+			names.push_back( id );
+		}
+
+		SETVALUE( buf.data(), pos, it->second );
+
+		return true;
+	} );
+
+	if( !valid ){
+		return false;
+	}
+
+	writer.write<uint8>( 1 );
+	writer.write<uint32>( static_cast<uint32>( names.size() ) );
+
+	for( int32 id : names ){
+		writer.writeString( get_str( id ) );
+	}
+
+	writer.write( code->script_size );
+	writer.writeBytes( buf.data(), buf.size() );
+
+	return true;
+}
+
+/**
+ * Reads a compiled script from a database snapshot.
+ * @param reader: Snapshot reader
+ * @param code: Script code or nullptr, if no script was written
+ * @return false if the script could not be read
+ */
+bool script_snapshot_read( DatabaseSnapshotReader& reader, struct script_code*& code ){
+	uint8 exists;
+
+	code = nullptr;
+
+	if( !reader.read( exists ) ){
+		return false;
+	}
+
+	if( !exists ){
+		return true;
+	}
+
+	uint32 count;
+
+	if( !reader.read( count ) ){
+		return false;
+	}
+
+	std::vector<int32> ids;
+
+	for( uint32 i = 0; i < count; i++ ){
+		std::string name;
+
+		if( !reader.readString( name ) ){
+			return false;
+		}
+
+		int32 id = add_str( name.c_str() );
+
+		// Same as for the unknown references at the end of parse_script
+		switch( str_data[id].type ){
+			case C_NOP:
+			case C_POS:
+			case C_USERFUNC:
+			case C_USERFUNC_POS:
+				str_data[id].type = C_NAME;
+				str_data[id].label = id;
+				str_data[id].backpatch = -1;
+				break;
+		}
+
+		ids.push_back( id );
+	}
+
+	int32 size;
+
+	if( !reader.read( size ) || size <= 0 ){
+		return false;
+	}
+
+	unsigned char* buf = (unsigned char*)aMalloc( size );
+
+	bool valid = reader.readBytes( buf, size ) && script_snapshot_names( buf, size, [&]( int32 pos ){
+		size_t index = GETVALUE( buf, pos );
+
+		if( index >= ids.size() ){
+			return false;
+		}
+
+		SETVALUE( buf, pos, ids[index] );
+
+		return true;
+	} );
+
+	if( !valid ){
+		aFree( buf );
+		return false;
+	}
+
+	CREATE( code, struct script_code, 1 );
+	code->script_buf = buf;
+	code->script_size = size;
+	code->local.vars = nullptr;
+	code->local.arrays = nullptr;
+	script_decode( code );
+
+	return true;
+}
+
 /// Returns the player attached to this script, identified by the rid.
 /// If there is no player attached, the script is terminated.
 static bool script_rid2sd_( struct script_state *st, map_session_data** sd, const char *func ){
@@ -3550,6 +3811,10 @@ void pop_stack(struct script_state* st, int32 start, int32 end)
 				ri->scope.arrays->destroy(ri->scope.arrays, script_free_array_db);
 				ri->scope.arrays = nullptr;
 			}
+			if (ri->scope.slots) {
+				aFree(ri->scope.slots);
+				ri->scope.slots = nullptr;
+			}
 			if( data->ref )
 				aFree(data->ref);
 			aFree(ri);
@@ -3612,6 +3877,8 @@ void script_free_code(struct script_code* code)
 	if (code->local.arrays)
 		code->local.arrays->destroy(code->local.arrays, script_free_array_db);
 	aFree(code->script_buf);
+	if (code->insn)
+		aFree(code->insn);
 	aFree(code);
 }
 
@@ -3634,6 +3901,7 @@ struct script_state* script_alloc_state(struct script_code* rootscript, int32 po
 	st->stack->defsp = st->stack->sp;
 	st->stack->scope.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
 	st->stack->scope.arrays = nullptr;
+	st->stack->scope.slots = nullptr;
 	st->state = RUN;
 	st->script = rootscript;
 	st->pos = pos;
@@ -3641,6 +3909,7 @@ struct script_state* script_alloc_state(struct script_code* rootscript, int32 po
 	st->oid = oid;
 	st->sleep.timer = INVALID_TIMER;
 	st->npc_item_flag = battle_config.item_enabled_npc;
+	st->profile_node = 0;
 	
 	if( st->script->instances != USHRT_MAX )
 		st->script->instances++;
@@ -3683,10 +3952,14 @@ void script_free_state(struct script_state* st)
 
 		if (st->sleep.timer != INVALID_TIMER)
 			delete_timer(st->sleep.timer, run_script_timer);
+		// The result of a pending query is dropped when it arrives
+		script_query_async_db.erase(st->id);
 		if (st->stack) {
 			script_free_vars(st->stack->scope.vars);
 			if (st->stack->scope.arrays)
 				st->stack->scope.arrays->destroy(st->stack->scope.arrays, script_free_array_db);
+			if (st->stack->scope.slots)
+				aFree(st->stack->scope.slots);
 			pop_stack(st, 0, st->stack->sp);
 			aFree(st->stack->stack_data);
 			ers_free(stack_ers, st->stack);
@@ -4085,8 +4358,285 @@ static void script_check_buildin_argtype(struct script_state* st, int32 func)
 }
 
 
+/*==========================================
+ * Script profiler
+ *------------------------------------------*/
+
+/// Maximum depth of the call tree, deeper calls are charged to the deepest node
+#define SCRIPT_PROFILE_MAX_DEPTH 32
+
+/// Node of the call tree (NPC -> function/label -> ... -> buildin)
+struct s_script_profile_node {
+	std::string name;
+	e_script_profile_type type;
+	int32 parent;
+	int32 depth;
+	uint64 calls;
+	uint64 instructions; ///< Instructions executed in this node only
+	uint64 time; ///< Nanoseconds spent in this node only
+	std::unordered_map<std::string, int32> children;
+};
+
+static std::vector<s_script_profile_node> script_profile_nodes; ///< [0] is the root, nodes are never removed
+static bool script_profile_active = false;
+static int32 script_profile_current = 0; ///< Node the current segment is charged to
+static std::chrono::steady_clock::time_point script_profile_segment; ///< Start of the current segment
+static uint64 script_profile_segment_instructions = 0;
+static uint64 script_profile_instructions = 0; ///< Instructions executed by the interpreter loops
+static t_tick script_profile_started = 0;
+
+/// Returns the child of a node with the given name, creates it if required
+static int32 script_profile_child( int32 parent, const char* name, e_script_profile_type type ){
+	if( script_profile_nodes[parent].depth >= SCRIPT_PROFILE_MAX_DEPTH ){
+		return parent;
+	}
+
+	auto it = script_profile_nodes[parent].children.find( name );
+
+	if( it != script_profile_nodes[parent].children.end() ){
+		return it->second;
+	}
+
+	int32 id = static_cast<int32>( script_profile_nodes.size() );
+	s_script_profile_node node = {};
+
+	node.name = name;
+	node.type = type;
+	node.parent = parent;
+	node.depth = script_profile_nodes[parent].depth + 1;
+
+	script_profile_nodes.push_back( std::move( node ) );
+	script_profile_nodes[parent].children[name] = id;
+
+	return id;
+}
+
+/**
+ * Charges the time and instructions since the last switch to the current node and continues with another node.
+ * @param node: Node to continue with
+ * @return Previous node
+ */
+static int32 script_profile_switch( int32 node ){
+	auto now = std::chrono::steady_clock::now();
+	s_script_profile_node& current = script_profile_nodes[script_profile_current];
+	int32 previous = script_profile_current;
+
+	current.time += std::chrono::duration_cast<std::chrono::nanoseconds>( now - script_profile_segment ).count();
+	current.instructions += script_profile_instructions - script_profile_segment_instructions;
+
+	script_profile_current = node;
+	script_profile_segment = now;
+	script_profile_segment_instructions = script_profile_instructions;
+
+	return previous;
+}
+
+/// Returns the node of the function or label a script is running in
+static int32 script_profile_node( struct script_state* st ){
+	if( st->profile_node == 0 ){
+		struct npc_data* nd = map_id2nd( st->oid );
+
+		st->profile_node = script_profile_child( 0, nd != nullptr ? nd->exname : "(unknown)", SCRIPT_PROFILE_NPC );
+	}
+
+	return st->profile_node;
+}
+
+/**
+ * Enters a function or label called by callfunc or callsub.
+ * The node of the caller is saved in the return info and restored on return.
+ * @param st: Script state
+ * @param ri: Return info of the call
+ * @param name: Name of the function or label
+ */
+static void script_profile_call( struct script_state* st, struct script_retinfo* ri, const char* name ){
+	ri->profile_node = st->profile_node;
+
+	if( !script_profile_active ){
+		return;
+	}
+
+	st->profile_node = script_profile_child( script_profile_node( st ), name, SCRIPT_PROFILE_FUNC );
+	script_profile_nodes[st->profile_node].calls++;
+}
+
+/// Returns the name of the label at the given position of the script's NPC
+static const char* script_profile_label( struct script_state* st, int32 pos ){
+	static char name[32];
+	struct npc_data* nd = map_id2nd( st->oid );
+
+	if( nd != nullptr && nd->subtype == NPCTYPE_SCRIPT && nd->u.scr.script == st->script ){
+		for( int32 i = 0; i < nd->u.scr.label_list_num; i++ ){
+			if( nd->u.scr.label_list[i].pos == pos ){
+				return nd->u.scr.label_list[i].name;
+			}
+		}
+	}
+
+	safesnprintf( name, sizeof( name ), "callsub@%d", pos );
+
+	return name;
+}
+
+void script_profile_start( void ){
+	if( script_profile_active ){
+		return;
+	}
+
+	if( script_profile_nodes.empty() ){
+		script_profile_nodes.emplace_back();
+		script_profile_started = gettick();
+	}
+
+	script_profile_active = true;
+	script_profile_current = 0;
+	script_profile_segment = std::chrono::steady_clock::now();
+	script_profile_segment_instructions = script_profile_instructions;
+}
+
+void script_profile_stop( void ){
+	if( !script_profile_active ){
+		return;
+	}
+
+	script_profile_switch( 0 );
+	script_profile_active = false;
+}
+
+bool script_profile_running( void ){
+	return script_profile_active;
+}
+
+/// Clears the recorded data, the call tree itself is kept because running scripts reference its nodes
+void script_profile_reset( void ){
+	for( s_script_profile_node& node : script_profile_nodes ){
+		node.calls = 0;
+		node.instructions = 0;
+		node.time = 0;
+	}
+
+	script_profile_started = gettick();
+}
+
+/// Milliseconds since the profile was started or reset, 0 if no profile was recorded
+t_tick script_profile_duration( void ){
+	if( script_profile_nodes.empty() ){
+		return 0;
+	}
+
+	return DIFF_TICK( gettick(), script_profile_started );
+}
+
+/**
+ * Summarizes the recorded profile, sorted by total time.
+ * Time of recursive calls is only counted once for the total.
+ * @param type: Which nodes to summarize
+ * @param entries: Summary
+ */
+void script_profile_report( e_script_profile_type type, std::vector<s_script_profile_entry>& entries ){
+	std::vector<uint64> time( script_profile_nodes.size() ), instructions( script_profile_nodes.size() );
+	std::unordered_map<std::string, size_t> index;
+
+	entries.clear();
+
+	if( script_profile_active ){
+		script_profile_switch( script_profile_current );
+	}
+
+	// Children are always created after their parent
+	for( size_t i = script_profile_nodes.size(); i-- > 1; ){
+		time[i] += script_profile_nodes[i].time;
+		instructions[i] += script_profile_nodes[i].instructions;
+		time[script_profile_nodes[i].parent] += time[i];
+		instructions[script_profile_nodes[i].parent] += instructions[i];
+	}
+
+	for( size_t i = 1; i < script_profile_nodes.size(); i++ ){
+		const s_script_profile_node& node = script_profile_nodes[i];
+
+		if( node.type != type ){
+			continue;
+		}
+
+		auto it = index.find( node.name );
+
+		if( it == index.end() ){
+			it = index.emplace( node.name, entries.size() ).first;
+			entries.emplace_back();
+			entries.back().name = node.name;
+		}
+
+		s_script_profile_entry& entry = entries[it->second];
+		bool recursive = false;
+
+		for( int32 parent = node.parent; parent > 0; parent = script_profile_nodes[parent].parent ){
+			if( script_profile_nodes[parent].type == type && script_profile_nodes[parent].name == node.name ){
+				recursive = true;
+				break;
+			}
+		}
+
+		entry.calls += node.calls;
+		entry.self += node.time;
+
+		if( !recursive ){
+			entry.instructions += instructions[i];
+			entry.total += time[i];
+		}
+	}
+
+	std::sort( entries.begin(), entries.end(), []( const s_script_profile_entry& a, const s_script_profile_entry& b ){
+		return a.total > b.total;
+	} );
+}
+
+/**
+ * Writes the recorded profile in the collapsed stack format of flamegraph.pl.
+ * Every line contains the call stack of a node and the microseconds spent in it.
+ * @param filename: File to write to
+ * @return true on success
+ */
+bool script_profile_dump( const char* filename ){
+	FILE* fp = fopen( filename, "w" );
+
+	if( fp == nullptr ){
+		return false;
+	}
+
+	if( script_profile_active ){
+		script_profile_switch( script_profile_current );
+	}
+
+	for( size_t i = 1; i < script_profile_nodes.size(); i++ ){
+		uint64 time = script_profile_nodes[i].time / 1000;
+
+		if( time == 0 ){
+			continue;
+		}
+
+		std::string stack;
+
+		for( int32 node = static_cast<int32>( i ); node > 0; node = script_profile_nodes[node].parent ){
+			std::string name = script_profile_nodes[node].name;
+
+			// Semicolons separate the frames
+			std::replace( name.begin(), name.end(), ';', ':' );
+
+			stack = stack.empty() ? name : name + ";" + stack;
+		}
+
+		fprintf( fp, "%s %" PRIu64 "\n", stack.c_str(), time );
+	}
+
+	fclose( fp );
+
+	return true;
+}
+
 /// Executes a buildin command.
 /// Stack: C_NAME(<command>) C_ARG <arg0> <arg1> ... <argN>
+static int32 run_func_sub(struct script_state *st, int32 start_sp, int32 end_sp, int32 func);
+
 int32 run_func(struct script_state *st)
 {
 	struct script_data* data;
@@ -4103,14 +4653,13 @@ int32 run_func(struct script_state *st)
 		return 1;
 	}
 	start_sp = i-1;// C_NAME of the command
-	st->start = start_sp;
-	st->end = end_sp;
 
-	data = &st->stack->stack_data[st->start];
+	data = &st->stack->stack_data[start_sp];
 	if( data->type == C_NAME && str_data[data->u.num].type == C_FUNC ) {
 		func = (int32)data->u.num;
-		st->funcname = reference_getname(data);
 	} else {
+		st->start = start_sp;
+		st->end = end_sp;
 		ShowError("script:run_func: not a buildin command.\n");
 		script_reportdata(data);
 		script_reportsrc(st);
@@ -4118,6 +4667,21 @@ int32 run_func(struct script_state *st)
 		return 1;
 	}
 
+	return run_func_sub(st, start_sp, end_sp, func);
+}
+
+/// Calls the buildin command with the arguments between start_sp and end_sp.
+///
+/// @param st Script state
+/// @param start_sp Stack position of the C_NAME of the command
+/// @param end_sp Stack position after the last argument
+/// @param func Id of the command
+static int32 run_func_sub(struct script_state *st, int32 start_sp, int32 end_sp, int32 func)
+{
+	st->start = start_sp;
+	st->end = end_sp;
+	st->funcname = str_buf + str_data[func].str;
+
 	if( script_config.warn_func_mismatch_argtypes ) {
 		script_check_buildin_argtype(st, func);
 	}
@@ -4131,7 +4695,20 @@ int32 run_func(struct script_state *st)
 		}
 #endif
 
-		if (str_data[func].func(st) == SCRIPT_CMD_FAILURE) {
+		int32 result;
+
+		if( script_profile_active ){
+			int32 node = script_profile_child( script_profile_node( st ), st->funcname, SCRIPT_PROFILE_BUILDIN );
+
+			script_profile_nodes[node].calls++;
+			script_profile_switch( node );
+			result = str_data[func].func( st );
+			// Calls and returns change the node of the script
+			script_profile_switch( script_profile_node( st ) );
+		}else
+			result = str_data[func].func( st );
+
+		if (result == SCRIPT_CMD_FAILURE) {
 			//Report error
 			ShowWarning("Script command '%s' returned failure.\n", get_str(func));
 			script_reportsrc(st);
@@ -4162,6 +4739,8 @@ int32 run_func(struct script_state *st)
 		}
 		script_free_vars(st->stack->scope.vars);
 		st->stack->scope.arrays->destroy(st->stack->scope.arrays, script_free_array_db);
+		if (st->stack->scope.slots)
+			aFree(st->stack->scope.slots);
 
 		ri = st->stack->stack_data[st->stack->defsp-1].u.ri;
 		nargs = ri->nargs;
@@ -4169,7 +4748,9 @@ int32 run_func(struct script_state *st)
 		st->script = ri->script;
 		st->stack->scope.vars = ri->scope.vars;
 		st->stack->scope.arrays = ri->scope.arrays;
+		st->stack->scope.slots = ri->scope.slots;
 		st->stack->defsp = ri->defsp;
+		st->profile_node = ri->profile_node;
 		memset(ri, 0, sizeof(struct script_retinfo));
 
 		pop_stack(st, olddefsp-nargs-1, olddefsp);// pop arguments and retinfo
@@ -4355,19 +4936,730 @@ void script_attach_state(struct script_state* st){
 			{// there is already a backup
 				ShowDebug("script_attach_state: Previous script state lost (rid=%d, oid=%d, state=%d, bk_npcid=%d).\n", st->bk_st->rid, st->bk_st->oid, st->bk_st->state, st->bk_npcid);
 			}
-			st->bk_st = sd->st;
-			st->bk_npcid = sd->npc_id;
+			st->bk_st = sd->st;
+			st->bk_npcid = sd->npc_id;
+		}
+		sd->st = st;
+		sd->npc_id = st->oid;
+		sd->npc_item_flag = st->npc_item_flag; // load default.
+		sd->state.disable_atcommand_on_npc = battle_config.atcommand_disable_npc && (!pc_has_permission(sd, PC_PERM_ENABLE_COMMAND));
+#ifdef SECURE_NPCTIMEOUT
+		if( sd->npc_idle_timer == INVALID_TIMER && !sd->state.ignoretimeout )
+			sd->npc_idle_timer = add_timer(gettick() + (SECURE_NPCTIMEOUT_INTERVAL*1000),npc_secure_timeout_timer,sd->id,0);
+		sd->npc_idle_tick = gettick();
+#endif
+	}
+}
+
+/*==========================================
+ * Pre-decoded instructions
+ *------------------------------------------*/
+
+/// Instructions of the pre-decoded script code
+enum e_script_insn : uint8 {
+	SCRIPT_INSN_EOL = 0,
+	SCRIPT_INSN_INT,
+	SCRIPT_INSN_NAME,
+	SCRIPT_INSN_POS,
+	SCRIPT_INSN_ARG,
+	SCRIPT_INSN_STR,
+	SCRIPT_INSN_FUNC,
+	SCRIPT_INSN_REF,
+	SCRIPT_INSN_OP1,
+	SCRIPT_INSN_OP2,
+	SCRIPT_INSN_OP3,
+	SCRIPT_INSN_NOP,
+	SCRIPT_INSN_UNKNOWN, ///< Left to the legacy loop
+	SCRIPT_INSN_SLOT, ///< Pushes the value of a scope variable slot
+	SCRIPT_INSN_SLOT_SET, ///< Call of set that writes a scope variable slot
+
+	// Superinstructions
+	SCRIPT_INSN_NAME_INT_OP2, ///< C_NAME C_INT <op>
+	SCRIPT_INSN_NAME_NAME_OP2, ///< C_NAME C_NAME <op>
+	SCRIPT_INSN_INT_OP2, ///< C_INT <op>
+	SCRIPT_INSN_GOTO, ///< C_NAME(goto) C_ARG C_POS C_FUNC
+	SCRIPT_INSN_JUMP_ZERO, ///< C_POS C_FUNC of a jump_zero call
+	SCRIPT_INSN_SLOT_INT_OP2, ///< <slot> C_INT <op>
+	SCRIPT_INSN_SLOT_SLOT_OP2, ///< <slot> <slot> <op>
+
+	SCRIPT_INSN_MAX
+};
+
+/// Pre-decoded instruction, there is one for every instruction in the script buffer
+struct script_insn {
+	union {
+		int64 num; ///< Number, name id or label position
+		const char* str; ///< String inside the script buffer
+	};
+	int32 pos; ///< Position of the instruction in the script buffer
+	int32 next; ///< Position after the instruction, superinstructions skip the fused instructions
+	int32 id; ///< Buildin id of C_FUNC (-1 if unknown), slot of SCRIPT_INSN_SLOT or the first name/slot of superinstructions
+	int32 target; ///< Index of the jump target of SCRIPT_INSN_GOTO and SCRIPT_INSN_JUMP_ZERO, -1 if unknown
+	uint8 op; ///< e_script_insn
+	uint8 count; ///< Number of instructions covered by this instruction
+	uint8 oper; ///< Operator of SCRIPT_INSN_OP* and the fused operators
+};
+
+/// Returns the index of the instruction at the given position or -1 if there is none
+static int32 script_insn_find( struct script_code* code, int32 pos ){
+	int32 min = 0, max = code->insn_count - 1;
+
+	while( min <= max ){
+		int32 mid = ( min + max ) / 2;
+
+		if( code->insn[mid].pos < pos ){
+			min = mid + 1;
+		}else if( code->insn[mid].pos > pos ){
+			max = mid - 1;
+		}else{
+			return mid;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Resolves scope variables (.@) to slots of the scope.
+ * The expressions of the code are simulated on a symbolic stack to find out how every
+ * variable is used. An integer variable gets a slot, if it is only read by operators,
+ * jump_zero and set, and only written by set as a statement. Everything else, like arrays,
+ * references passed to commands or dynamic names of getd/setd, keeps using the DBMap.
+ * @param code: Script code
+ * @param insns: Decoded instructions, reads of slot variables are changed to SCRIPT_INSN_SLOT
+ *               and the calls that write them to SCRIPT_INSN_SLOT_SET
+ */
+static void script_decode_slots( struct script_code* code, std::vector<struct script_insn>& insns ){
+	enum e_sym : uint8 {
+		SYM_VALUE = 0, ///< Any value
+		SYM_NAME, ///< Scope variable
+		SYM_ARG, ///< Start of an argument list
+		SYM_CALL, ///< Command of an argument list
+		SYM_SET, ///< Result of set
+	};
+
+	struct s_sym {
+		e_sym kind;
+		int32 insn; ///< Pushing instruction
+		int32 id; ///< Name id of SYM_NAME, SYM_CALL and SYM_SET
+	};
+
+	struct s_slot_var {
+		bool unsafe;
+		std::vector<int32> reads; ///< Instructions that push the variable to be read
+		std::vector<int32> writes; ///< Calls of set that write the variable
+	};
+
+	std::vector<s_sym> stack;
+	std::unordered_map<int32, s_slot_var> vars;
+
+	auto candidate = []( int32 id ){
+		if( str_data[id].type != C_NAME ){
+			return false;
+		}
+
+		const char* name = get_str( id );
+
+		return name[0] == '.' && name[1] == '@' && !is_string_variable( name ) && script_check_RegistryVariableLength( 0, name, nullptr );
+	};
+
+	// Returns false if the code could not be analyzed
+	auto consume = [&vars]( const s_sym& sym, bool read ){
+		switch( sym.kind ){
+			case SYM_NAME:
+				if( read ){
+					vars[sym.id].reads.push_back( sym.insn );
+				}else{
+					vars[sym.id].unsafe = true;
+				}
+				return true;
+			case SYM_SET:
+				// The result of set is only supported as a statement
+				vars[sym.id].unsafe = true;
+				return true;
+			case SYM_VALUE:
+				return true;
+			default:
+				return false;
+		}
+	};
+
+	for( size_t i = 0; i < insns.size(); i++ ){
+		struct script_insn& insn = insns[i];
+		size_t operands = 0;
+
+		switch( insn.op ){
+			case SCRIPT_INSN_INT:
+			case SCRIPT_INSN_STR:
+			case SCRIPT_INSN_POS:
+				stack.push_back( { SYM_VALUE, -1, -1 } );
+				continue;
+			case SCRIPT_INSN_NAME:
+				if( i + 1 < insns.size() && insns[i + 1].op == SCRIPT_INSN_ARG ){
+					stack.push_back( { SYM_CALL, static_cast<int32>( i ), static_cast<int32>( insn.num ) } );
+				}else if( candidate( static_cast<int32>( insn.num ) ) ){
+					stack.push_back( { SYM_NAME, static_cast<int32>( i ), static_cast<int32>( insn.num ) } );
+				}else{
+					stack.push_back( { SYM_VALUE, -1, -1 } );
+				}
+				continue;
+			case SCRIPT_INSN_ARG:
+				stack.push_back( { SYM_ARG, -1, -1 } );
+				continue;
+			case SCRIPT_INSN_OP1:
+				operands = 1;
+				break;
+			case SCRIPT_INSN_OP2:
+				operands = 2;
+				break;
+			case SCRIPT_INSN_OP3:
+				operands = 3;
+				break;
+			case SCRIPT_INSN_EOL:
+			case SCRIPT_INSN_NOP:
+				// Unused values are popped
+				for( const s_sym& sym : stack ){
+					if( sym.kind == SYM_NAME ){
+						vars[sym.id].reads.push_back( sym.insn );
+					}else if( sym.kind == SYM_ARG || sym.kind == SYM_CALL ){
+						return;
+					}
+				}
+				stack.clear();
+				continue;
+			case SCRIPT_INSN_FUNC: {
+				size_t arg = stack.size();
+
+				while( arg > 0 && stack[arg - 1].kind != SYM_ARG ){
+					arg--;
+				}
+
+				if( arg < 2 || stack[arg - 2].kind != SYM_CALL ){
+					return;
+				}
+
+				int32 func = stack[arg - 2].id;
+				size_t nargs = stack.size() - arg;
+				std::vector<s_sym> args( stack.begin() + arg, stack.end() );
+
+				stack.resize( arg - 2 );
+
+				// Dynamic variable names can access any variable
+				if( func == buildin_getd_ref || func == buildin_setd_ref ){
+					return;
+				}
+
+				if( ( func == buildin_set_ref && ( nargs == 2 || nargs == 3 ) ) || ( func == buildin_set2_ref && nargs == 2 ) ){
+					for( size_t j = 1; j < nargs; j++ ){
+						if( !consume( args[j], true ) ){
+							return;
+						}
+					}
+
+					if( args[0].kind == SYM_NAME ){
+						// A read of the variable is still pending in the surrounding expression
+						for( const s_sym& sym : stack ){
+							if( sym.kind == SYM_NAME && sym.id == args[0].id ){
+								vars[sym.id].unsafe = true;
+							}
+						}
+
+						vars[args[0].id].writes.push_back( static_cast<int32>( i ) );
+						stack.push_back( { SYM_SET, static_cast<int32>( i ), args[0].id } );
+					}else{
+						if( !consume( args[0], false ) ){
+							return;
+						}
+
+						stack.push_back( { SYM_VALUE, -1, -1 } );
+					}
+					continue;
+				}
+
+				// Only jump_zero is known to read its arguments, other commands might use them as references
+				for( const s_sym& sym : args ){
+					if( !consume( sym, func == buildin_jump_zero_ref ) ){
+						return;
+					}
+				}
+
+				stack.push_back( { SYM_VALUE, -1, -1 } );
+				continue;
+			}
+			default:
+				return;
+		}
+
+		// Operators read their operands
+		if( stack.size() < operands ){
+			return;
+		}
+
+		for( size_t j = stack.size() - operands; j < stack.size(); j++ ){
+			if( !consume( stack[j], true ) ){
+				return;
+			}
+		}
+
+		stack.resize( stack.size() - operands );
+		stack.push_back( { SYM_VALUE, -1, -1 } );
+	}
+
+	int32 slots = 0;
+
+	for( auto& pair : vars ){
+		s_slot_var& var = pair.second;
+
+		if( var.unsafe ){
+			continue;
+		}
+
+		for( int32 read : var.reads ){
+			insns[read].op = SCRIPT_INSN_SLOT;
+			insns[read].id = slots;
+		}
+
+		for( int32 write : var.writes ){
+			insns[write].op = SCRIPT_INSN_SLOT_SET;
+			insns[write].num = slots;
+		}
+
+		slots++;
+	}
+
+	code->slot_count = slots;
+}
+
+/**
+ * Translates the script buffer into pre-decoded instructions with fixed width operands.
+ * Every instruction of the buffer keeps its own entry, so labels and return positions
+ * can still point to any of them. Common sequences are fused into superinstructions
+ * on their first entry.
+ * @param code: Script code
+ */
+static void script_decode( struct script_code* code ){
+	std::vector<struct script_insn> insns;
+	std::vector<int32> calls; // Buildin ids of the calls that are open at the current position
+	unsigned char* buf = code->script_buf;
+	int32 pos = 0;
+
+	while( pos < code->script_size ){
+		struct script_insn insn = {};
+
+		insn.pos = pos;
+		insn.id = -1;
+		insn.target = -1;
+		insn.count = 1;
+
+		c_op c = get_com( buf, &pos );
+
+		switch( c ){
+			case C_EOL:
+				insn.op = SCRIPT_INSN_EOL;
+				break;
+			case C_INT:
+				insn.op = SCRIPT_INSN_INT;
+				insn.num = get_num( buf, &pos );
+				break;
+			case C_POS:
+			case C_NAME:
+				insn.op = ( c == C_POS ? SCRIPT_INSN_POS : SCRIPT_INSN_NAME );
+				insn.num = GETVALUE( buf, pos );
+				pos += 3;
+				break;
+			case C_USERFUNC_POS:
+				insn.op = SCRIPT_INSN_UNKNOWN;
+				pos += 3;
+				break;
+			case C_ARG:
+				insn.op = SCRIPT_INSN_ARG;
+
+				// The command is pushed right before the argument list
+				if( !insns.empty() && insns.back().op == SCRIPT_INSN_NAME && str_data[insns.back().num].type == C_FUNC ){
+					calls.push_back( static_cast<int32>( insns.back().num ) );
+				}else{
+					calls.push_back( -1 );
+				}
+				break;
+			case C_STR:
+				insn.op = SCRIPT_INSN_STR;
+				insn.str = reinterpret_cast<const char*>( buf + pos );
+				while( buf[pos++] );
+				break;
+			case C_FUNC:
+				insn.op = SCRIPT_INSN_FUNC;
+
+				if( !calls.empty() ){
+					insn.id = calls.back();
+					calls.pop_back();
+				}
+				break;
+			case C_REF:
+				insn.op = SCRIPT_INSN_REF;
+				break;
+			case C_NEG:
+			case C_NOT:
+			case C_LNOT:
+				insn.op = SCRIPT_INSN_OP1;
+				insn.oper = c;
+				break;
+			case C_ADD:
+			case C_SUB:
+			case C_MUL:
+			case C_DIV:
+			case C_MOD:
+			case C_EQ:
+			case C_NE:
+			case C_GT:
+			case C_GE:
+			case C_LT:
+			case C_LE:
+			case C_AND:
+			case C_OR:
+			case C_XOR:
+			case C_LAND:
+			case C_LOR:
+			case C_R_SHIFT:
+			case C_L_SHIFT:
+				insn.op = SCRIPT_INSN_OP2;
+				insn.oper = c;
+				break;
+			case C_OP3:
+				insn.op = SCRIPT_INSN_OP3;
+				insn.oper = c;
+				break;
+			case C_NOP:
+				insn.op = SCRIPT_INSN_NOP;
+				break;
+			default:
+				// The length is unknown, the rest of the buffer is left to the legacy loop
+				insn.op = SCRIPT_INSN_UNKNOWN;
+				pos = code->script_size;
+				break;
+		}
+
+		insn.next = pos;
+		insns.push_back( insn );
+	}
+
+	script_decode_slots( code, insns );
+
+	// Fuse common sequences
+	for( size_t i = 0; i < insns.size(); i++ ){
+		struct script_insn& insn = insns[i];
+		size_t left = insns.size() - i;
+
+		if( left >= 4 && insn.op == SCRIPT_INSN_NAME && insn.num == buildin_goto_ref && insns[i + 1].op == SCRIPT_INSN_ARG && insns[i + 2].op == SCRIPT_INSN_POS && insns[i + 3].op == SCRIPT_INSN_FUNC && insns[i + 3].id == buildin_goto_ref ){
+			insn.op = SCRIPT_INSN_GOTO;
+			insn.count = 4;
+			insn.num = insns[i + 2].num;
+			insn.target = -1;
+		}else if( left >= 2 && insn.op == SCRIPT_INSN_POS && insns[i + 1].op == SCRIPT_INSN_FUNC && insns[i + 1].id == buildin_jump_zero_ref ){
+			insn.op = SCRIPT_INSN_JUMP_ZERO;
+			insn.count = 2;
+		}else if( left >= 3 && insn.op == SCRIPT_INSN_NAME && insns[i + 1].op == SCRIPT_INSN_INT && insns[i + 2].op == SCRIPT_INSN_OP2 ){
+			insn.op = SCRIPT_INSN_NAME_INT_OP2;
+			insn.count = 3;
+			insn.id = static_cast<int32>( insn.num );
+			insn.num = insns[i + 1].num;
+			insn.oper = insns[i + 2].oper;
+		}else if( left >= 3 && insn.op == SCRIPT_INSN_NAME && insns[i + 1].op == SCRIPT_INSN_NAME && insns[i + 2].op == SCRIPT_INSN_OP2 ){
+			insn.op = SCRIPT_INSN_NAME_NAME_OP2;
+			insn.count = 3;
+			insn.id = static_cast<int32>( insn.num );
+			insn.num = insns[i + 1].num;
+			insn.oper = insns[i + 2].oper;
+		}else if( left >= 3 && insn.op == SCRIPT_INSN_SLOT && insns[i + 1].op == SCRIPT_INSN_INT && insns[i + 2].op == SCRIPT_INSN_OP2 ){
+			insn.op = SCRIPT_INSN_SLOT_INT_OP2;
+			insn.count = 3;
+			insn.num = insns[i + 1].num;
+			insn.oper = insns[i + 2].oper;
+		}else if( left >= 3 && insn.op == SCRIPT_INSN_SLOT && insns[i + 1].op == SCRIPT_INSN_SLOT && insns[i + 2].op == SCRIPT_INSN_OP2 ){
+			insn.op = SCRIPT_INSN_SLOT_SLOT_OP2;
+			insn.count = 3;
+			insn.num = insns[i + 1].id;
+			insn.oper = insns[i + 2].oper;
+		}else if( left >= 2 && insn.op == SCRIPT_INSN_INT && insns[i + 1].op == SCRIPT_INSN_OP2 ){
+			insn.op = SCRIPT_INSN_INT_OP2;
+			insn.count = 2;
+			insn.oper = insns[i + 1].oper;
+		}else{
+			continue;
+		}
+
+		insn.next = insns[i + insn.count - 1].next;
+	}
+
+	code->insn_count = static_cast<int32>( insns.size() );
+	CREATE( code->insn, struct script_insn, code->insn_count );
+	std::copy( insns.begin(), insns.end(), code->insn );
+
+	// Resolve the jump targets
+	for( int32 i = 0; i < code->insn_count; i++ ){
+		if( code->insn[i].op == SCRIPT_INSN_GOTO || code->insn[i].op == SCRIPT_INSN_JUMP_ZERO ){
+			code->insn[i].target = script_insn_find( code, static_cast<int32>( code->insn[i].num ) );
+		}
+	}
+}
+
+/**
+ * Runs the script with the pre-decoded instructions.
+ * If a position can not be found, the loop is left with the state RUN
+ * and st->pos pointing to it, so the legacy loop can continue there.
+ * @param st: Script state
+ * @param cmdcount: Remaining commands until an infinity loop is detected
+ * @param gotocount: Remaining jumps until an infinity loop is detected
+ */
+static void run_script_insn( struct script_state* st, int32& cmdcount, int32& gotocount ){
+	struct script_code* code = st->script;
+	struct script_stack* stack = st->stack;
+	int32 index;
+
+	if( code->insn == nullptr || ( index = script_insn_find( code, st->pos ) ) < 0 ){
+		return;
+	}
+
+#if defined(__GNUC__)
+	// Threaded dispatch, must be in the order of e_script_insn
+	static void* const dispatch[SCRIPT_INSN_MAX] = {
+		&&insn_SCRIPT_INSN_EOL,
+		&&insn_SCRIPT_INSN_INT,
+		&&insn_SCRIPT_INSN_NAME,
+		&&insn_SCRIPT_INSN_POS,
+		&&insn_SCRIPT_INSN_ARG,
+		&&insn_SCRIPT_INSN_STR,
+		&&insn_SCRIPT_INSN_FUNC,
+		&&insn_SCRIPT_INSN_REF,
+		&&insn_SCRIPT_INSN_OP1,
+		&&insn_SCRIPT_INSN_OP2,
+		&&insn_SCRIPT_INSN_OP3,
+		&&insn_SCRIPT_INSN_NOP,
+		&&insn_SCRIPT_INSN_UNKNOWN,
+		&&insn_SCRIPT_INSN_SLOT,
+		&&insn_SCRIPT_INSN_SLOT_SET,
+		&&insn_SCRIPT_INSN_NAME_INT_OP2,
+		&&insn_SCRIPT_INSN_NAME_NAME_OP2,
+		&&insn_SCRIPT_INSN_INT_OP2,
+		&&insn_SCRIPT_INSN_GOTO,
+		&&insn_SCRIPT_INSN_JUMP_ZERO,
+		&&insn_SCRIPT_INSN_SLOT_INT_OP2,
+		&&insn_SCRIPT_INSN_SLOT_SLOT_OP2,
+	};
+	#define SCRIPT_INSN_DISPATCH( op ) goto *dispatch[op];
+	#define SCRIPT_INSN_CASE( op ) insn_##op
+#else
+	#define SCRIPT_INSN_DISPATCH( op ) switch( op )
+	#define SCRIPT_INSN_CASE( op ) case op
+#endif
+
+	while( true ){
+		const struct script_insn* insn = &code->insn[index];
+		int32 next = index + insn->count; // -1 if the position has to be looked up
+		int32 count = insn->count;
+
+		st->pos = insn->next;
+
+		SCRIPT_INSN_DISPATCH( insn->op ){
+			SCRIPT_INSN_CASE( SCRIPT_INSN_EOL ):
+				if( stack->defsp > stack->sp )
+					ShowError("script:run_script_main: unexpected stack position (defsp=%d sp=%d). please report this!!!\n", stack->defsp, stack->sp);
+				else
+					pop_stack(st, stack->defsp, stack->sp);// pop unused stack data. (unused return value)
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_INT ):
+				push_val( stack, C_INT, insn->num );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_NAME ):
+				push_val( stack, C_NAME, insn->num );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_POS ):
+				push_val( stack, C_POS, insn->num );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_ARG ):
+				push_val( stack, C_ARG, 0 );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_STR ):
+				push_str( stack, C_CONSTSTR, const_cast<char*>( insn->str ) );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_FUNC ): {
+				int32 i = stack->sp - 1;
+
+				// Call the buildin directly, if it is the one the call was compiled for
+				while( i > 0 && stack->stack_data[i].type != C_ARG )
+					--i;
+
+				if( insn->id >= 0 && i > 0 && stack->stack_data[i - 1].type == C_NAME && stack->stack_data[i - 1].u.num == insn->id )
+					run_func_sub( st, i - 1, stack->sp, insn->id );
+				else
+					run_func( st );
+
+				if( st->state == GOTO ){
+					st->state = RUN;
+					if( !st->freeloop && gotocount>0 && (--gotocount)<=0 ){
+						ShowError("script:run_script_main: infinity loop !\n");
+						script_reportsrc(st);
+						st->state=END;
+					}
+				}
+
+				if( st->script != code || st->pos != insn->next )
+					next = -1;
+				goto insn_done;
+			}
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_REF ):
+				st->op2ref = 1;
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_OP1 ):
+				op_1( st, insn->oper );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_OP2 ):
+				op_2( st, insn->oper );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_OP3 ):
+				op_3( st, insn->oper );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_NOP ):
+				st->state = END;
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_UNKNOWN ):
+				// Let the legacy loop handle it
+				st->pos = insn->pos;
+				return;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_SLOT ):
+				push_val( stack, C_INT, stack->scope.slots ? stack->scope.slots[insn->id] : 0 );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_SLOT_SET ): {
+				int32 i = stack->sp - 1;
+
+				while( i > 0 && stack->stack_data[i].type != C_ARG )
+					--i;
+
+				// Stack: set, C_ARG, variable, value{, previous value}
+				if( i > 0 && stack->stack_data[i - 1].type == C_NAME && stack->stack_data[i - 1].u.num == insn->id ){
+					int32 start = i - 1;
+					int64 value = conv_num64( st, &stack->stack_data[start + 3] );
+					// Post-increment/decrement returns the previous value
+					int64 result = ( stack->sp - start > 4 ) ? conv_num64( st, &stack->stack_data[start + 4] ) : value;
+
+					if( stack->scope.slots == nullptr )
+						CREATE( stack->scope.slots, int64, code->slot_count );
+					stack->scope.slots[insn->num] = value;
+
+					pop_stack( st, start, stack->sp );
+					push_val( stack, C_INT, result );
+				}else
+					run_func( st );
+				goto insn_done;
+			}
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_SLOT_INT_OP2 ):
+				op_2num( st, insn->oper, stack->scope.slots ? stack->scope.slots[insn->id] : 0, insn->num );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_SLOT_SLOT_OP2 ):
+				op_2num( st, insn->oper, stack->scope.slots ? stack->scope.slots[insn->id] : 0, stack->scope.slots ? stack->scope.slots[insn->num] : 0 );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_NAME_INT_OP2 ):
+				push_val( stack, C_NAME, insn->id );
+				push_val( stack, C_INT, insn->num );
+				op_2( st, insn->oper );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_NAME_NAME_OP2 ):
+				push_val( stack, C_NAME, insn->id );
+				push_val( stack, C_NAME, insn->num );
+				op_2( st, insn->oper );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_INT_OP2 ):
+				push_val( stack, C_INT, insn->num );
+				op_2( st, insn->oper );
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_GOTO ):
+				st->pos = static_cast<int32>( insn->num );
+				next = insn->target;
+				if( !st->freeloop && gotocount>0 && (--gotocount)<=0 ){
+					ShowError("script:run_script_main: infinity loop !\n");
+					script_reportsrc(st);
+					st->state=END;
+				}
+				goto insn_done;
+
+			SCRIPT_INSN_CASE( SCRIPT_INSN_JUMP_ZERO ):
+				// Stack: jump_zero, C_ARG, condition
+				if( stack->sp >= 3 && stack->stack_data[stack->sp - 2].type == C_ARG && stack->stack_data[stack->sp - 3].type == C_NAME && stack->stack_data[stack->sp - 3].u.num == buildin_jump_zero_ref ){
+					struct script_data* data = script_getdatatop( st, -1 );
+
+					get_val( st, data );
+
+					if( data_isint( data ) ){
+						int64 sel = data->u.num;
+
+						script_removetop( st, -3, 0 );
+
+						if( !sel ){
+							st->pos = static_cast<int32>( insn->num );
+							next = insn->target;
+							if( !st->freeloop && gotocount>0 && (--gotocount)<=0 ){
+								ShowError("script:run_script_main: infinity loop !\n");
+								script_reportsrc(st);
+								st->state=END;
+							}
+						}
+						goto insn_done;
+					}
+				}
+
+				// Run the instructions one by one
+				push_val( stack, C_POS, insn->num );
+				st->pos = code->insn[index + 1].pos;
+				next = index + 1;
+				count = 1;
+				goto insn_done;
+		}
+
+insn_done:
+		script_profile_instructions += count;
+
+		if( !st->freeloop && cmdcount>0 && (cmdcount -= count)<=0 ){
+			ShowError("script:run_script_main: infinity loop !\n");
+			script_reportsrc(st);
+			st->state=END;
+		}
+
+		if( st->state != RUN ){
+			break;
+		}
+
+		if( next < 0 ){
+			code = st->script;
+
+			if( code->insn == nullptr || ( next = script_insn_find( code, st->pos ) ) < 0 ){
+				break;
+			}
 		}
-		sd->st = st;
-		sd->npc_id = st->oid;
-		sd->npc_item_flag = st->npc_item_flag; // load default.
-		sd->state.disable_atcommand_on_npc = battle_config.atcommand_disable_npc && (!pc_has_permission(sd, PC_PERM_ENABLE_COMMAND));
-#ifdef SECURE_NPCTIMEOUT
-		if( sd->npc_idle_timer == INVALID_TIMER && !sd->state.ignoretimeout )
-			sd->npc_idle_timer = add_timer(gettick() + (SECURE_NPCTIMEOUT_INTERVAL*1000),npc_secure_timeout_timer,sd->id,0);
-		sd->npc_idle_tick = gettick();
-#endif
+
+		index = next;
 	}
+
+	#undef SCRIPT_INSN_DISPATCH
+	#undef SCRIPT_INSN_CASE
 }
 
 /*==========================================
@@ -4379,9 +5671,20 @@ void run_script_main(struct script_state *st)
 	int32 gotocount = script_config.check_gotocount;
 	TBL_PC *sd;
 	struct script_stack *stack = st->stack;
+	int32 profile_previous = -1;
 
 	script_attach_state(st);
 
+	if( script_profile_active ){
+		// Resumed scripts are not counted as another run
+		bool started = st->profile_node == 0;
+		int32 node = script_profile_node(st);
+
+		if( started )
+			script_profile_nodes[node].calls++;
+		profile_previous = script_profile_switch(node);
+	}
+
 	if(st->state == RERUNLINE) {
 		run_func(st);
 		if(st->state == GOTO)
@@ -4389,6 +5692,10 @@ void run_script_main(struct script_state *st)
 	} else if(st->state != END)
 		st->state = RUN;
 
+	if(st->state == RUN && script_config.predecode)
+		run_script_insn(st, cmdcount, gotocount);
+
+	// Legacy loop, continues where the pre-decoded instructions could not
 	while(st->state == RUN) {
 		enum c_op c = get_com(st->script->script_buf,&st->pos);
 		switch(c){
@@ -4423,6 +5730,9 @@ void run_script_main(struct script_state *st)
 					st->state=END;
 				}
 			}
+			// Returned into pre-decoded code, slot variables are only handled there
+			if(st->state == RUN && script_config.predecode)
+				run_script_insn(st, cmdcount, gotocount);
 			break;
 
 		case C_REF:
@@ -4469,6 +5779,7 @@ void run_script_main(struct script_state *st)
 			st->state=END;
 			break;
 		}
+		script_profile_instructions++;
 		if( !st->freeloop && cmdcount>0 && (--cmdcount)<=0 ){
 			ShowError("script:run_script_main: infinity loop !\n");
 			script_reportsrc(st);
@@ -4476,6 +5787,9 @@ void run_script_main(struct script_state *st)
 		}
 	}
 
+	if( script_profile_active )
+		script_profile_switch(profile_previous >= 0 ? profile_previous : 0);
+
 	if(st->sleep.tick > 0) {
 		//Restore previous script
 		script_detach_state(st, false);
@@ -4561,6 +5875,12 @@ int32 script_config_read(const char *cfgName)
 		else if(strcmpi(w1,"warn_func_mismatch_argtypes")==0) {
 			script_config.warn_func_mismatch_argtypes = config_switch(w2);
 		}
+		else if(strcmpi(w1,"predecode")==0) {
+			script_config.predecode = config_switch(w2);
+		}
+		else if(strcmpi(w1,"query_sql_async_workers")==0) {
+			script_config.query_sql_async_workers = cap_value(atoi(w2), 1, 32);
+		}
 		else if(strcmpi(w1,"import")==0){
 			script_config_read(w2);
 		}
@@ -4807,6 +6127,15 @@ void do_final_script() {
 
 	mapreg_final();
 
+	// Finish the pending queries, their results are dropped with the script states
+	for( std::vector<std::unique_ptr<SqlWorker>>& workers : script_query_workers ){
+		for( std::unique_ptr<SqlWorker>& worker : workers ){
+			worker->stop();
+		}
+
+		workers.clear();
+	}
+
 	db_destroy(scriptlabel_db);
 	userfunc_db->destroy(userfunc_db, db_script_free_code_sub);
 	autobonus_db->destroy(autobonus_db, db_script_free_code_sub);
@@ -4856,6 +6185,8 @@ void do_init_script(void) {
 	array_ers = ers_new(sizeof(struct script_array), "script.cpp:array_ers", ERS_CLEAN_OPTIONS);
 
 	add_timer_func_list( run_script_timer, "run_script_timer" );
+	add_timer_func_list( script_query_async_timer, "script_query_async_timer" );
+	add_timer_interval( gettick() + SCRIPT_QUERY_ASYNC_INTERVAL, script_query_async_timer, 0, 0, SCRIPT_QUERY_ASYNC_INTERVAL );
 
 	ers_chunk_size(st_ers, 10);
 	ers_chunk_size(stack_ers, 10);
@@ -5441,10 +6772,12 @@ BUILDIN_FUNC(callfunc)
 	ri->script       = st->script;              // script code
 	ri->scope.vars   = st->stack->scope.vars;   // scope variables
 	ri->scope.arrays = st->stack->scope.arrays; // scope arrays
+	ri->scope.slots  = st->stack->scope.slots;  // scope variable slots
 	ri->pos          = st->pos;                 // script location
 	ri->nargs        = j;                       // argument count
 	ri->defsp        = st->stack->defsp;        // default stack pointer
 	push_retinfo(st->stack, ri, ref);
+	script_profile_call(st, ri, str);
 
 	st->pos = 0;
 	st->script = scr;
@@ -5452,6 +6785,7 @@ BUILDIN_FUNC(callfunc)
 	st->state = GOTO;
 	st->stack->scope.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
 	st->stack->scope.arrays = idb_alloc(DB_OPT_BASE);
+	st->stack->scope.slots = nullptr;
 
 	if (!st->script->local.vars)
 		st->script->local.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
@@ -5497,16 +6831,19 @@ BUILDIN_FUNC(callsub)
 	ri->script       = st->script;              // script code
 	ri->scope.vars   = st->stack->scope.vars;   // scope variables
 	ri->scope.arrays = st->stack->scope.arrays; // scope arrays
+	ri->scope.slots  = st->stack->scope.slots;  // scope variable slots
 	ri->pos          = st->pos;                 // script location
 	ri->nargs        = j;                       // argument count
 	ri->defsp        = st->stack->defsp;        // default stack pointer
 	push_retinfo(st->stack, ri, ref);
+	script_profile_call(st, ri, script_profile_label(st, pos));
 
 	st->pos = pos;
 	st->stack->defsp = st->stack->sp;
 	st->state = GOTO;
 	st->stack->scope.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
 	st->stack->scope.arrays = idb_alloc(DB_OPT_BASE);
+	st->stack->scope.slots = nullptr;
 
 	return SCRIPT_CMD_SUCCESS;
 }
@@ -18038,37 +19375,95 @@ BUILDIN_FUNC(setd)
 	return SCRIPT_CMD_SUCCESS;
 }
 
+/**
+ * Checks that all arguments from the given index on are variables.
+ * Attaches the player if one of the variables requires it.
+ * @param st: Script state
+ * @param start: Index of the first variable
+ * @param sd: Attached player, if any is required
+ * @return number of variables or -1 if an argument is not a variable or a required player is missing
+ */
+static int32 buildin_query_sql_vars( struct script_state* st, int32 start, map_session_data** sd ){
+	int32 i;
+
+	for( i = start; script_hasdata( st, i ); ++i ){
+		struct script_data* data = script_getdata( st, i );
+
+		if( !data_isreference( data ) ){
+			ShowError( "script:query_sql: not a variable\n" );
+			script_reportdata( data );
+			return -1;
+		}
+
+		const char* name = reference_getname( data );
+
+		// requires a player
+		if( not_server_variable( *name ) && *sd == nullptr && !script_rid2sd( *sd ) ){
+			// no player attached
+			script_reportdata( data );
+			return -1;
+		}
+	}
+
+	return i - start;
+}
+
+/**
+ * Stores the rows of a query result in the variables of query_sql and its variants.
+ * @param st: Script state
+ * @param sd: Attached player, if any is required
+ * @param start: Index of the first variable
+ * @param num_vars: Number of variables
+ * @param num_cols: Number of columns of the result
+ * @param num_rows: Number of rows of the result
+ * @param next_row: Moves to the next row, returns false if there is none
+ * @param get_column: Returns the value of a column of the current row or nullptr if it is NULL
+ * @return number of stored rows
+ */
+static uint32 buildin_query_sql_store( struct script_state* st, map_session_data* sd, int32 start, int32 num_vars, int32 num_cols, uint64 num_rows, const std::function<bool()>& next_row, const std::function<const char*( int32 column )>& get_column ){
+	uint32 i;
+
+	if( num_vars < num_cols ) {
+		ShowWarning("script:query_sql: Too many columns, discarding last %u columns.\n", (uint32)(num_cols-num_vars));
+		script_reportsrc(st);
+	} else if( num_vars > num_cols ) {
+		ShowWarning("script:query_sql: Too many variables (%u extra).\n", (uint32)(num_vars-num_cols));
+		script_reportsrc(st);
+	}
+
+	for( i = 0; i < SCRIPT_MAX_ARRAYSIZE && next_row(); ++i ) {
+		for( int32 j = 0; j < num_vars; ++j ) {
+			const char* str = j < num_cols ? get_column( j ) : nullptr;
+			struct script_data* data = script_getdata( st, j + start );
+			const char* name = reference_getname( data );
+
+			if( is_string_variable( name ) )
+				setd_sub_str( st, sd, name, i, str ? str : "", reference_getref( data ) );
+			else
+				setd_sub_num( st, sd, name, i, str ? strtoll( str, nullptr, 10 ) : 0, reference_getref( data ) );
+		}
+	}
+
+	if( i < num_rows ) {
+		ShowWarning("script:query_sql: Only %u/%" PRIu64 " rows have been stored.\n", i, num_rows);
+		script_reportsrc(st);
+	}
+
+	return i;
+}
+
 int32 buildin_query_sql_sub(struct script_state* st, Sql* handle)
 {
-	int32 i, j;
 	TBL_PC* sd = nullptr;
 	const char* query;
-	struct script_data* data;
-	const char* name;
-	uint32 max_rows = SCRIPT_MAX_ARRAYSIZE; // maximum number of rows
+	uint32 stored;
 	int32 num_vars;
-	int32 num_cols;
 
 	// check target variables
-	for( i = 3; script_hasdata(st,i); ++i ) {
-		data = script_getdata(st, i);
-		if( data_isreference(data) ) { // it's a variable
-			name = reference_getname(data);
-			if( not_server_variable(*name) && sd == nullptr ) { // requires a player
-				if( !script_rid2sd(sd) ) { // no player attached
-					script_reportdata(data);
-					st->state = END;
-					return SCRIPT_CMD_FAILURE;
-				}
-			}
-		} else {
-			ShowError("script:query_sql: not a variable\n");
-			script_reportdata(data);
-			st->state = END;
-			return SCRIPT_CMD_FAILURE;
-		}
+	if( ( num_vars = buildin_query_sql_vars( st, 3, &sd ) ) < 0 ){
+		st->state = END;
+		return SCRIPT_CMD_FAILURE;
 	}
-	num_vars = i - 3;
 
 	// Execute the query
 	query = script_getstr(st,2);
@@ -18085,41 +19480,19 @@ int32 buildin_query_sql_sub(struct script_state* st, Sql* handle)
 		return SCRIPT_CMD_SUCCESS;
 	}
 
-	// Count the number of columns to store
-	num_cols = Sql_NumColumns(handle);
-	if( num_vars < num_cols ) {
-		ShowWarning("script:query_sql: Too many columns, discarding last %u columns.\n", (uint32)(num_cols-num_vars));
-		script_reportsrc(st);
-	} else if( num_vars > num_cols ) {
-		ShowWarning("script:query_sql: Too many variables (%u extra).\n", (uint32)(num_vars-num_cols));
-		script_reportsrc(st);
-	}
-
 	// Store data
-	for( i = 0; i < max_rows && SQL_SUCCESS == Sql_NextRow(handle); ++i ) {
-		for( j = 0; j < num_vars; ++j ) {
+	stored = buildin_query_sql_store( st, sd, 3, num_vars, (int32)Sql_NumColumns(handle), Sql_NumRows(handle),
+		[handle]() { return SQL_SUCCESS == Sql_NextRow(handle); },
+		[handle]( int32 column ) {
 			char* str = nullptr;
 
-			if( j < num_cols )
-				Sql_GetData(handle, j, &str, nullptr);
-
-			data = script_getdata(st, j+3);
-			name = reference_getname(data);
-
-			if( is_string_variable(name) )
-				setd_sub_str( st, sd, name, i, str ? str : "", reference_getref( data ) );
-			else
-				setd_sub_num( st, sd, name, i, str ? strtoll( str, nullptr, 10 ) : 0, reference_getref( data ) );
-		}
-	}
-	if( i == max_rows && max_rows < Sql_NumRows(handle) ) {
-		ShowWarning("script:query_sql: Only %d/%u rows have been stored.\n", max_rows, (uint32)Sql_NumRows(handle));
-		script_reportsrc(st);
-	}
+			Sql_GetData(handle, column, &str, nullptr);
+			return (const char*)str;
+		} );
 
 	// Free data
 	Sql_FreeResult(handle);
-	script_pushint(st, i);
+	script_pushint(st, stored);
 	return SCRIPT_CMD_SUCCESS;
 }
 
@@ -18137,6 +19510,302 @@ BUILDIN_FUNC(query_logsql) {
 	return buildin_query_sql_sub(st, logmysql_handle);
 }
 
+/**
+ * Returns the worker with the fewest pending queries.
+ * The workers are started on the first use.
+ * @param log: true for the log database, false for the main database
+ */
+static SqlWorker* script_query_async_worker( bool log ){
+	std::vector<std::unique_ptr<SqlWorker>>& workers = script_query_workers[log ? 1 : 0];
+
+	if( workers.empty() ){
+		for( int32 i = 0; i < max( script_config.query_sql_async_workers, 1 ); i++ ){
+			std::unique_ptr<SqlWorker> worker = std::make_unique<SqlWorker>( log ? "query_logsql_async" : "query_sql_async" );
+
+			if( log ){
+				worker->start( log_db_ip, log_db_port, log_db_id, log_db_pw, log_db_db, default_codepage );
+			}else{
+				worker->start( map_server_ip, static_cast<uint16>( map_server_port ), map_server_id, map_server_pw, map_server_db, default_codepage );
+			}
+
+			workers.push_back( std::move( worker ) );
+		}
+	}
+
+	SqlWorker* best = workers[0].get();
+	size_t best_pending = best->pending();
+
+	for( size_t i = 1; i < workers.size() && best_pending > 0; i++ ){
+		size_t pending = workers[i]->pending();
+
+		if( pending < best_pending ){
+			best = workers[i].get();
+			best_pending = pending;
+		}
+	}
+
+	return best;
+}
+
+/// Resumes the scripts of finished asynchronous queries
+static TIMER_FUNC(script_query_async_timer){
+	for( std::vector<std::unique_ptr<SqlWorker>>& workers : script_query_workers ){
+		for( std::unique_ptr<SqlWorker>& worker : workers ){
+			worker->process();
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Cancels an asynchronous query that timed out.
+ * A query that did not start yet is skipped by the worker, a running one is aborted with
+ * KILL QUERY, so the worker is free for the next query.
+ * @param query: Query
+ * @param log: true for the log database, false for the main database
+ */
+static void script_query_async_cancel( struct s_script_query_async& query, bool log ){
+	std::lock_guard<std::mutex> lock( query.mutex );
+
+	query.cancelled = true;
+
+	if( query.thread_id == 0 ){
+		return;
+	}
+
+	Sql* handle = log ? logmysql_handle : qsmysql_handle;
+
+	if( SQL_ERROR == Sql_Query( handle, "KILL QUERY %" PRIu32, query.thread_id ) ){
+		Sql_ShowDebug( handle );
+	}
+}
+
+/**
+ * Runs the query on a worker and suspends the script until the result arrives or the timeout expires.
+ * The script is parked like it is done by sleep2, so the attached unit is kept.
+ * @param st: Script state
+ * @param log: true for the log database, false for the main database
+ */
+static int32 buildin_query_sql_async_sub( struct script_state* st, bool log ){
+	map_session_data* sd = nullptr;
+
+	// Second call (by the result or the timeout)
+	if( st->sleep.tick != 0 ){
+		st->state = RUN;
+		st->sleep.tick = 0;
+
+		auto it = script_query_async_db.find( st->id );
+
+		if( it == script_query_async_db.end() ){
+			script_pushint( st, -1 );
+			return SCRIPT_CMD_FAILURE;
+		}
+
+		std::shared_ptr<s_script_query_async> query = it->second;
+
+		script_query_async_db.erase( it );
+
+		if( !query->done ){
+			script_query_async_cancel( *query, log );
+			// The result is dropped when it arrives
+			ShowWarning( "script:%s: query did not finish within %d milliseconds and was cancelled: %s\n", log ? "query_logsql_async" : "query_sql_async", script_getnum( st, 3 ), query->sql.substr( 0, 100 ).c_str() );
+			script_reportsrc( st );
+			script_pushint( st, -1 );
+			return SCRIPT_CMD_FAILURE;
+		}
+
+		if( !query->error.empty() ){
+			ShowError( "script:%s: %s\n", log ? "query_logsql_async" : "query_sql_async", query->error.c_str() );
+			script_reportsrc( st );
+			script_pushint( st, -1 );
+			return SCRIPT_CMD_FAILURE;
+		}
+
+		// The variables are checked again, since the attached player might have changed
+		int32 num_vars = buildin_query_sql_vars( st, 4, &sd );
+
+		if( num_vars < 0 ){
+			st->state = END;
+			return SCRIPT_CMD_FAILURE;
+		}
+
+		if( query->rows == 0 ){
+			script_pushint( st, 0 );
+			return SCRIPT_CMD_SUCCESS;
+		}
+
+		int32 num_cols = query->columns;
+		size_t fetched = query->values.size() / num_cols;
+		size_t row = 0;
+
+		uint32 stored = buildin_query_sql_store( st, sd, 4, num_vars, num_cols, query->rows,
+			[&row, fetched]() { return row++ < fetched; },
+			[&query, &row, num_cols]( int32 column ) { return query->values[( row - 1 ) * num_cols + column].c_str(); } );
+
+		script_pushint( st, stored );
+		return SCRIPT_CMD_SUCCESS;
+	}
+
+	// First call
+	int32 timeout = script_getnum( st, 3 );
+
+	if( timeout < 0 ){
+		ShowError( "buildin_query_sql_async: negative timeout '%d' is not supported\n", timeout );
+		script_pushint( st, -1 );
+		return SCRIPT_CMD_FAILURE;
+	}
+
+	if( buildin_query_sql_vars( st, 4, &sd ) < 0 ){
+		st->state = END;
+		return SCRIPT_CMD_FAILURE;
+	}
+
+	std::shared_ptr<s_script_query_async> query = std::make_shared<s_script_query_async>();
+	std::string sql = script_getstr( st, 2 );
+	SqlWorker* worker = script_query_async_worker( log );
+	uint32 st_id = st->id;
+
+	query->st = st;
+	query->done = false;
+	query->sql = sql;
+	query->cancelled = false;
+	query->thread_id = 0;
+	query->columns = 0;
+	query->rows = 0;
+
+	script_query_async_db[st_id] = query;
+
+	worker->push(
+		[query, sql]( MYSQL* handle ){
+			if( handle == nullptr ){
+				query->error = "no connection to the database";
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock( query->mutex );
+
+				// Timed out while it was waiting for the worker
+				if( query->cancelled ){
+					return;
+				}
+
+				query->thread_id = static_cast<uint32>( mysql_thread_id( handle ) );
+			}
+
+			int32 failed = mysql_real_query( handle, sql.c_str(), static_cast<unsigned long>( sql.length() ) );
+
+			{
+				std::lock_guard<std::mutex> lock( query->mutex );
+
+				query->thread_id = 0;
+			}
+
+			if( failed != 0 ){
+				query->error = std::string( "query failed: " ) + mysql_error( handle ) + " - " + sql.substr( 0, 100 );
+				return;
+			}
+
+			MYSQL_RES* result = mysql_store_result( handle );
+
+			if( result == nullptr ){
+				if( mysql_field_count( handle ) != 0 ){
+					query->error = std::string( "failed to read the result: " ) + mysql_error( handle );
+				}
+
+				// No data received
+				return;
+			}
+
+			query->columns = mysql_num_fields( result );
+			query->rows = mysql_num_rows( result );
+
+			uint64 stored = std::min<uint64>( query->rows, SCRIPT_MAX_ARRAYSIZE );
+
+			query->values.reserve( static_cast<size_t>( stored * query->columns ) );
+
+			for( uint64 i = 0; i < stored; i++ ){
+				MYSQL_ROW row = mysql_fetch_row( result );
+
+				if( row == nullptr ){
+					break;
+				}
+
+				unsigned long* lengths = mysql_fetch_lengths( result );
+
+				for( uint32 j = 0; j < query->columns; j++ ){
+					if( row[j] != nullptr ){
+						query->values.emplace_back( row[j], lengths[j] );
+					}else{
+						query->values.emplace_back();
+					}
+				}
+			}
+
+			mysql_free_result( result );
+		},
+		[query, st_id](){
+			auto it = script_query_async_db.find( st_id );
+
+			// The script was terminated or the query timed out
+			if( it == script_query_async_db.end() || it->second != query ){
+				return;
+			}
+
+			struct script_state* st = query->st;
+
+			query->done = true;
+
+			// Not parked yet or already woken up
+			if( st->sleep.timer == INVALID_TIMER ){
+				return;
+			}
+
+			delete_timer( st->sleep.timer, run_script_timer );
+
+			// Trigger the timer function
+			run_script_timer( INVALID_TIMER, gettick(), st->sleep.charid, (intptr_t)st );
+		}
+	);
+
+	// Park the script until the query finished, a timeout of 0 waits for the result
+	st->state = RERUNLINE;
+	st->sleep.tick = timeout > 0 ? timeout : INT_MAX;
+
+	return SCRIPT_CMD_SUCCESS;
+}
+
+/// Executes an SQL query without blocking the server and pauses the script until the result is stored.
+/// Returns the number of rows or -1 on failure or timeout.
+///
+/// query_sql_async("<query>",<timeout>{,<variable>{,<variable>{,...}}})
+BUILDIN_FUNC(query_sql_async) {
+	return buildin_query_sql_async_sub(st, false);
+}
+
+/// Executes an SQL query on the log database without blocking the server and pauses the script until the result is stored.
+/// Returns the number of rows or -1 on failure or timeout.
+///
+/// query_logsql_async("<query>",<timeout>{,<variable>{,<variable>{,...}}})
+BUILDIN_FUNC(query_logsql_async) {
+	if( st->sleep.tick == 0 && !log_config.sql_logs ) {
+		ShowWarning("buildin_query_logsql_async: SQL logs are disabled, query '%s' will not be executed.\n", script_getstr(st,2));
+		script_pushint(st,-1);
+		return SCRIPT_CMD_FAILURE;
+	}
+
+	return buildin_query_sql_async_sub(st, true);
+}
+
+/// Returns the number of asynchronous queries that have not finished yet.
+///
+/// query_sql_pending()
+BUILDIN_FUNC(query_sql_pending) {
+	script_pushint(st, script_query_async_db.size());
+	return SCRIPT_CMD_SUCCESS;
+}
+
 //Allows escaping of a given string.
 BUILDIN_FUNC(escape_sql)
 {
@@ -28232,6 +29901,9 @@ struct script_function buildin_func[] = {
 	BUILDIN_DEF(axtoi,"s"),
 	BUILDIN_DEF(query_sql,"s*"),
 	BUILDIN_DEF(query_logsql,"s*"),
+	BUILDIN_DEF(query_sql_async,"si*"),
+	BUILDIN_DEF(query_logsql_async,"si*"),
+	BUILDIN_DEF(query_sql_pending,""),
 	BUILDIN_DEF(escape_sql,"v"),
 	BUILDIN_DEF(atoi,"s"),
 	BUILDIN_DEF(strtol,"si"),
@@ -4,6 +4,9 @@
 #ifndef SCRIPT_HPP
 #define SCRIPT_HPP
 
+#include <string>
+#include <vector>
+
 #include <ryml_std.hpp>
 #include <ryml.hpp>
 
@@ -157,6 +160,8 @@ struct Script_Config {
 	int32 check_gotocount;
 	int32 input_min_value;
 	int32 input_max_value;
+	int32 query_sql_async_workers;
+	unsigned predecode : 1;
 
 	// PC related
 	const char *die_event_name;
@@ -270,6 +275,7 @@ typedef enum c_op {
 struct reg_db {
 	struct DBMap *vars;
 	struct DBMap *arrays;
+	int64* slots; ///< Slot resolved scope variables, see script_code::slot_count
 };
 
 struct script_retinfo {
@@ -278,6 +284,7 @@ struct script_retinfo {
 	int32 pos;                    ///< script location
 	int32 nargs;                  ///< argument count
 	int32 defsp;                  ///< default stack pointer
+	int32 profile_node;           ///< node of the script profiler
 };
 
 struct script_data {
@@ -297,6 +304,9 @@ struct script_code {
 	unsigned char* script_buf;
 	struct reg_db local;
 	uint16 instances;
+	struct script_insn* insn; ///< Pre-decoded instructions, see script_decode
+	int32 insn_count;
+	int32 slot_count; ///< Number of scope variables resolved to slots
 };
 
 struct script_stack {
@@ -333,6 +343,7 @@ struct script_state {
 	unsigned clear_cutin : 1;
 	char* funcname; // Stores the current running function name
 	uint32 id;
+	int32 profile_node; ///< Node of the script profiler, 0 if not resolved yet
 };
 
 struct script_reg {
@@ -2305,6 +2316,9 @@ void script_warning(const char* src, const char* file, int32 start_line, const c
 bool is_number(const char *p);
 struct script_code* parse_script_( const char *src, const char *file, int32 line, int32 options, const char* src_file, int32 src_line, const char* src_func );
 #define parse_script( src, file, line, options ) parse_script_( ( src ), ( file ), ( line ), ( options ), ALC_MARK )
+std::string script_snapshot_key();
+bool script_snapshot_write( DatabaseSnapshotWriter& writer, struct script_code* code );
+bool script_snapshot_read( DatabaseSnapshotReader& reader, struct script_code*& code );
 void run_script(struct script_code *rootscript,int32 pos,int32 rid,int32 oid);
 
 bool set_reg_num(struct script_state* st, map_session_data* sd, int64 num, const char* name, const int64 value, struct reg_db *ref);
@@ -2328,6 +2342,31 @@ void script_free_vars(struct DBMap *storage);
 struct script_state* script_alloc_state(struct script_code* rootscript, int32 pos, int32 rid, int32 oid);
 void script_free_state(struct script_state* st);
 
+/**
+ * Script profiler
+ **/
+enum e_script_profile_type : uint8 {
+	SCRIPT_PROFILE_NPC = 0,
+	SCRIPT_PROFILE_FUNC, ///< callfunc and callsub
+	SCRIPT_PROFILE_BUILDIN,
+};
+
+struct s_script_profile_entry {
+	std::string name;
+	uint64 calls;
+	uint64 instructions; ///< Including called functions
+	uint64 total; ///< Nanoseconds including called functions and buildins
+	uint64 self; ///< Nanoseconds spent in the node itself
+};
+
+void script_profile_start( void );
+void script_profile_stop( void );
+bool script_profile_running( void );
+void script_profile_reset( void );
+t_tick script_profile_duration( void );
+void script_profile_report( e_script_profile_type type, std::vector<s_script_profile_entry>& entries );
+bool script_profile_dump( const char* filename );
+
 struct DBMap* script_get_label_db(void);
 struct DBMap* script_get_userfunc_db(void);
 void script_run_autobonus(const char *autobonus, map_session_data *sd, uint32 pos);
@@ -3,6 +3,10 @@
 
 #include "searchstore.hpp"  // struct s_search_store_info
 
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
 #include <common/cbasetypes.hpp>
 #include <common/malloc.hpp>  // aMalloc, aRealloc, aFree
 #include <common/showmsg.hpp>  // ShowError, ShowWarning
@@ -14,7 +18,18 @@
 
 /// Type for shop search function
 typedef bool (*searchstore_search_t)( const map_session_data* sd, t_itemid nameid );
-typedef bool (*searchstore_searchall_t)( const map_session_data* sd, const struct s_search_store_search* s );
+typedef bool (*searchstore_searchentry_t)( const map_session_data* sd, uint16 slot, const struct s_search_store_search* s );
+
+/// Store entry in the search index
+struct s_search_store_entry {
+	map_session_data* sd;
+	uint16 slot; // index in sd->vending or sd->buyingstore.items
+};
+
+/// item id -> store entries with the item, sorted by price
+static std::unordered_map<t_itemid, std::multimap<uint32, s_search_store_entry>> searchstore_index[SEARCHTYPE_BUYING_STORE + 1];
+/// char id -> item ids and prices of the store in searchstore_index
+static std::unordered_map<uint32, std::vector<std::pair<t_itemid, uint32>>> searchstore_index_stores[SEARCHTYPE_BUYING_STORE + 1];
 
 /**
  * Retrieves search function by type.
@@ -32,15 +47,15 @@ static searchstore_search_t searchstore_getsearchfunc(e_searchstore_searchtype t
 }
 
 /**
- * Retrieves search-all function by type.
+ * Retrieves search entry function by type.
  * @param type : type of search to conduct
  * @return : search type
  */
-static searchstore_searchall_t searchstore_getsearchallfunc(e_searchstore_searchtype type)
+static searchstore_searchentry_t searchstore_getsearchentryfunc(e_searchstore_searchtype type)
 {
 	switch( type ) {
-		case SEARCHTYPE_VENDING:      return &vending_searchall;
-		case SEARCHTYPE_BUYING_STORE: return &buyingstore_searchall;
+		case SEARCHTYPE_VENDING:      return &vending_searchentry;
+		case SEARCHTYPE_BUYING_STORE: return &buyingstore_searchentry;
 	}
 
 	return nullptr;
@@ -78,6 +93,79 @@ static int32 searchstore_getstoreid( const map_session_data& sd, e_searchstore_s
 	return 0;
 }
 
+/**
+ * Removes the items of a store from the search index.
+ * @param sd : store owner
+ * @param type : shop type
+ */
+void searchstore_index_remove(map_session_data& sd, e_searchstore_searchtype type)
+{
+	auto store = searchstore_index_stores[type].find( sd.status.char_id );
+
+	if( store == searchstore_index_stores[type].end() )
+		return;
+
+	for( const auto& item : store->second ) {
+		auto bucket = searchstore_index[type].find( item.first );
+
+		if( bucket == searchstore_index[type].end() )
+			continue;
+
+		auto range = bucket->second.equal_range( item.second );
+
+		for( auto it = range.first; it != range.second; ++it ) {
+			if( it->second.sd == &sd ) {
+				bucket->second.erase( it );
+				break;
+			}
+		}
+
+		if( bucket->second.empty() )
+			searchstore_index[type].erase( bucket );
+	}
+
+	searchstore_index_stores[type].erase( store );
+}
+
+/**
+ * Rebuilds the entries of a store in the search index after its items changed.
+ * Like vending_search and buyingstore_search only the first entry of an item is found.
+ * @param sd : store owner
+ * @param type : shop type
+ */
+void searchstore_index_update(map_session_data& sd, e_searchstore_searchtype type)
+{
+	searchstore_index_remove( sd, type );
+
+	if( !searchstore_hasstore( sd, type ) )
+		return;
+
+	std::vector<std::pair<t_itemid, uint32>>& items = searchstore_index_stores[type][sd.status.char_id];
+	uint16 slots = ( type == SEARCHTYPE_VENDING ) ? sd.vend_num : sd.buyingstore.slots;
+
+	for( uint16 slot = 0; slot < slots; slot++ ) {
+		t_itemid nameid;
+		uint32 price;
+
+		if( type == SEARCHTYPE_VENDING ) {
+			nameid = sd.cart.u.items_cart[sd.vending[slot].index].nameid;
+			price = sd.vending[slot].value;
+		} else {
+			if( sd.buyingstore.items[slot].amount == 0 )
+				continue;
+
+			nameid = sd.buyingstore.items[slot].nameid;
+			price = (uint32)sd.buyingstore.items[slot].price;
+		}
+
+		if( std::find_if( items.begin(), items.end(), [nameid]( const std::pair<t_itemid, uint32>& item ) { return item.first == nameid; } ) != items.end() )
+			continue;
+
+		items.emplace_back( nameid, price );
+		searchstore_index[type][nameid].emplace( price, s_search_store_entry{ &sd, slot } );
+	}
+}
+
 /**
  * Send request to open Search Store.
  * @param sd : player requesting
@@ -116,15 +204,14 @@ void searchstore_query(map_session_data& sd, e_searchstore_searchtype type, uint
 {
 	uint32 i;
 	map_session_data* pl_sd;
-	struct DBIterator *iter;
 	struct s_search_store_search s;
-	searchstore_searchall_t store_searchall;
+	searchstore_searchentry_t store_searchentry;
 	time_t querytime;
 
 	if( !sd.searchstore.open )
 		return;
 
-	if( ( store_searchall = searchstore_getsearchallfunc(type) ) == nullptr ) {
+	if( ( store_searchentry = searchstore_getsearchentryfunc(type) ) == nullptr ) {
 		ShowError("searchstore_query: Unknown search type %u (account_id=%d).\n", type, sd.id);
 		return;
 	}
@@ -182,25 +269,38 @@ void searchstore_query(map_session_data& sd, e_searchstore_searchtype type, uint
 	s.card_count = card_count;
 	s.min_price  = min_price;
 	s.max_price  = max_price;
-	iter         = db_iterator((type == SEARCHTYPE_VENDING) ? vending_getdb() : buyingstore_getdb());
 
-	for( pl_sd = (map_session_data*)dbi_first(iter); dbi_exists(iter);  pl_sd = (map_session_data*)dbi_next(iter) ) {
-		if( &sd == pl_sd ) // skip own shop, if any
-			continue;
+	// only the stores with the item in the price range are visited
+	for( i = 0; i < item_count; i++ ) {
+		auto bucket = searchstore_index[type].find( itemlist[i].itemId );
 
-		// Skip stores that are not in the map defined by the search
-		if (sd.searchstore.mapid != 0 && pl_sd->m != sd.searchstore.mapid) {
+		if( bucket == searchstore_index[type].end() )
 			continue;
+
+		auto it = min_price ? bucket->second.lower_bound( min_price ) : bucket->second.begin();
+		auto end = max_price ? bucket->second.upper_bound( max_price ) : bucket->second.end();
+
+		for( ; it != end; ++it ) {
+			pl_sd = it->second.sd;
+
+			if( &sd == pl_sd ) // skip own shop, if any
+				continue;
+
+			// Skip stores that are not in the map defined by the search
+			if (sd.searchstore.mapid != 0 && pl_sd->m != sd.searchstore.mapid) {
+				continue;
+			}
+
+			if( !store_searchentry(pl_sd, it->second.slot, &s) ) { // exceeded result size
+				clif_search_store_info_failed(sd, SSI_FAILED_OVER_MAXCOUNT);
+				break;
+			}
 		}
 
-		if( !store_searchall(pl_sd, &s) ) { // exceeded result size
-			clif_search_store_info_failed(sd, SSI_FAILED_OVER_MAXCOUNT);
+		if( it != end )
 			break;
-		}
 	}
 
-	dbi_destroy(iter);
-
 	if( !sd.searchstore.items.empty() ) {
 		// present results
 		clif_search_store_info_ack( sd );
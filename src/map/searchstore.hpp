@@ -100,5 +100,7 @@ void searchstore_close(map_session_data& sd);
 void searchstore_click(map_session_data& sd, uint32 account_id, int32 store_id, t_itemid nameid);
 bool searchstore_queryremote( const map_session_data& sd, uint32 account_id );
 void searchstore_clearremote(map_session_data& sd);
+void searchstore_index_update(map_session_data& sd, e_searchstore_searchtype type);
+void searchstore_index_remove(map_session_data& sd, e_searchstore_searchtype type);
 
 #endif /* SEARCHSTORE_HPP */
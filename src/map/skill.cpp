@@ -17179,11 +17179,8 @@ struct skill_unit_group_tickset *skill_unitgrouptickset_search(block_list *bl, s
  * Check for validity skill unit that triggered by skill_unit_timer_sub
  * And trigger skill_unit_onplace_timer for object that maybe stands there (catched object is *bl)
  *------------------------------------------*/
-int32 skill_unit_timer_sub_onplace(block_list* bl, va_list ap)
+static int32 skill_unit_timer_sub_onplace(block_list* bl, skill_unit* unit, t_tick tick)
 {
-	skill_unit* unit = va_arg(ap,skill_unit *);
-	t_tick tick = va_arg(ap,t_tick);
-
 	nullpo_ret(unit);
 
 	if( !unit->alive || bl->prev == nullptr )
@@ -17471,9 +17468,9 @@ static int32 skill_unit_timer_sub(DBKey key, DBData *data, va_list ap)
 	if( unit->range >= 0 && group->interval != -1 )
 	{
 		if (skill_get_unit_flag(group->skill_id, UF_PATHCHECK))
-			map_foreachinrange(skill_unit_timer_sub_onplace, bl, unit->range, group->bl_flag, bl, tick);
+			map_foreachinrange(bl, unit->range, group->bl_flag, [unit, tick](block_list* target) { return skill_unit_timer_sub_onplace(target, unit, tick); });
 		else
-			map_foreachinallrange(skill_unit_timer_sub_onplace, bl, unit->range, group->bl_flag, bl, tick);
+			map_foreachinallrange(bl, unit->range, group->bl_flag, [unit, tick](block_list* target) { return skill_unit_timer_sub_onplace(target, unit, tick); });
 
 		if(unit->range == -1) //Unit disabled, but it should not be deleted yet.
 			group->unit_id = UNT_USED_TRAPS;
@@ -17518,12 +17515,8 @@ static std::vector<int16> skill_unit_cell; // Temporary storage for tracking ski
  *	2 : clear that skill_unit
  *	4 : call_on_left
  *------------------------------------------*/
-int32 skill_unit_move_sub(block_list* bl, va_list ap)
+static int32 skill_unit_move_sub(skill_unit* unit, block_list* target, t_tick tick, int32 flag)
 {
-	skill_unit* unit = (skill_unit *)bl;
-	block_list* target = va_arg(ap,block_list*);
-	t_tick tick = va_arg(ap,t_tick);
-	int32 flag = va_arg(ap,int32);
 	bool dissonance;
 	uint16 skill_id;
 
@@ -17628,7 +17621,7 @@ int32 skill_unit_move(block_list *bl, t_tick tick, int32 flag)
 	if( flag&2 && !(flag&1) ) //Onout, clear data
 		skill_unit_cell.clear();
 
-	map_foreachincell(skill_unit_move_sub,bl->m,bl->x,bl->y,BL_SKILL,bl,tick,flag);
+	map_foreachincell(bl->m, bl->x, bl->y, BL_SKILL, [bl, tick, flag](block_list* unit) { return skill_unit_move_sub(reinterpret_cast<skill_unit*>(unit), bl, tick, flag); });
 
 	if( flag&2 && flag&1 ) { //Onplace, check any skill units you have left.
 		for (const auto &it : skill_unit_cell) {
@@ -0,0 +1,240 @@
+// Copyright (c) rAthena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#include "sqlworker.hpp"
+
+#include <common/showmsg.hpp>
+
+SqlThreadConnection::~SqlThreadConnection(){
+	this->close();
+}
+
+/// Sets the database to connect to, an existing connection is closed
+void SqlThreadConnection::setup( const std::string& host, uint16 port, const std::string& user, const std::string& password, const std::string& database, const std::string& codepage ){
+	this->close();
+	this->host = host;
+	this->port = port;
+	this->user = user;
+	this->password = password;
+	this->database = database;
+	this->codepage = codepage;
+}
+
+/**
+ * Connects to the database if there is no connection yet.
+ * Must be called by the thread that uses the connection.
+ * @param error: Handler for error messages
+ * @return MySQL handle or nullptr if the connection failed
+ */
+MYSQL* SqlThreadConnection::connect( const t_error& error ){
+	if( this->handle != nullptr ){
+		return this->handle;
+	}
+
+	this->handle = mysql_init( nullptr );
+
+	if( this->handle == nullptr ){
+		error( "mysql_init failed" );
+		return nullptr;
+	}
+
+	my_bool reconnect = 1;
+
+	mysql_options( this->handle, MYSQL_OPT_RECONNECT, &reconnect );
+
+	if( mysql_real_connect( this->handle, this->host.c_str(), this->user.c_str(), this->password.c_str(), this->database.c_str(), this->port, nullptr, 0 ) == nullptr ){
+		error( std::string( "connection to the database failed: " ) + mysql_error( this->handle ) );
+		mysql_close( this->handle );
+		this->handle = nullptr;
+		return nullptr;
+	}
+
+	if( !this->codepage.empty() && mysql_set_character_set( this->handle, this->codepage.c_str() ) != 0 ){
+		error( std::string( "failed to set the encoding: " ) + mysql_error( this->handle ) );
+	}
+
+	return this->handle;
+}
+
+void SqlThreadConnection::close(){
+	if( this->handle != nullptr ){
+		mysql_close( this->handle );
+		this->handle = nullptr;
+	}
+}
+
+SqlWorker::SqlWorker( const char* name ){
+	this->name = name;
+}
+
+SqlWorker::~SqlWorker(){
+	this->stop();
+}
+
+void SqlWorker::run(){
+	mysql_thread_init();
+
+	std::unique_lock<std::mutex> lock( this->mutex );
+
+	while( true ){
+		this->work.wait( lock, [this]{ return this->stopping || !this->jobs.empty(); } );
+
+		if( this->jobs.empty() ){
+			// Only stop after all jobs were done
+			break;
+		}
+
+		s_job job = std::move( this->jobs.front() );
+
+		this->jobs.pop_front();
+		this->busy = true;
+		lock.unlock();
+
+		job.job( this->connection.connect( [this]( const std::string& message ){ this->error( message ); } ) );
+
+		lock.lock();
+		this->busy = false;
+
+		if( job.callback ){
+			this->finished.push_back( std::move( job.callback ) );
+		}
+
+		if( this->jobs.empty() ){
+			this->idle.notify_all();
+		}
+	}
+
+	lock.unlock();
+
+	this->connection.close();
+
+	mysql_thread_end();
+}
+
+bool SqlWorker::isRunning(){
+	return this->thread.joinable();
+}
+
+/**
+ * Starts the worker thread.
+ * The connection is established by the thread before the first job.
+ */
+void SqlWorker::start( const std::string& host, uint16 port, const std::string& user, const std::string& password, const std::string& database, const std::string& codepage ){
+	if( this->isRunning() ){
+		return;
+	}
+
+	this->connection.setup( host, port, user, password, database, codepage );
+	this->stopping = false;
+	this->thread = std::thread( &SqlWorker::run, this );
+}
+
+/// Finishes all pushed jobs and stops the worker thread
+void SqlWorker::stop(){
+	if( !this->isRunning() ){
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( this->mutex );
+
+		this->stopping = true;
+	}
+
+	this->work.notify_one();
+	this->thread.join();
+}
+
+/// Waits until all pushed jobs are finished
+void SqlWorker::wait(){
+	if( !this->isRunning() ){
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock( this->mutex );
+
+	this->idle.wait( lock, [this]{ return this->jobs.empty() && !this->busy; } );
+}
+
+/**
+ * Pushes a job to the worker.
+ * If the worker is not running, the job is executed right away without a connection.
+ * @param job: Job to run on the worker thread
+ * @param callback: Called on the main thread by process() after the job has finished
+ */
+void SqlWorker::push( t_job job, t_callback callback ){
+	if( !this->isRunning() ){
+		job( nullptr );
+
+		if( callback ){
+			std::lock_guard<std::mutex> lock( this->mutex );
+
+			this->finished.push_back( std::move( callback ) );
+		}
+
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( this->mutex );
+
+		this->jobs.push_back( { std::move( job ), std::move( callback ) } );
+	}
+
+	this->work.notify_one();
+}
+
+/// Returns the number of jobs that are not finished yet
+size_t SqlWorker::pending(){
+	std::lock_guard<std::mutex> lock( this->mutex );
+
+	return this->jobs.size() + ( this->busy ? 1 : 0 );
+}
+
+/// Shows the errors of the worker and runs the callbacks of finished jobs
+void SqlWorker::process(){
+	std::deque<t_callback> callbacks;
+	std::vector<std::string> messages;
+
+	{
+		std::lock_guard<std::mutex> lock( this->mutex );
+
+		callbacks.swap( this->finished );
+		messages.swap( this->errors );
+	}
+
+	for( const std::string& message : messages ){
+		ShowError( "%s: %s\n", this->name.c_str(), message.c_str() );
+	}
+
+	for( t_callback& callback : callbacks ){
+		callback();
+	}
+}
+
+/// Stores an error to be shown by the main thread
+void SqlWorker::error( const std::string& message ){
+	std::lock_guard<std::mutex> lock( this->mutex );
+
+	this->errors.push_back( message );
+}
+
+/**
+ * Executes a query without a result.
+ * @param handle: Handle passed to the job
+ * @param query: Query to execute
+ * @return true on success
+ */
+bool SqlWorker::query( MYSQL* handle, const std::string& query ){
+	if( handle == nullptr ){
+		this->error( "no connection to the database, query dropped: " + query.substr( 0, 100 ) );
+		return false;
+	}
+
+	if( mysql_real_query( handle, query.c_str(), static_cast<unsigned long>( query.length() ) ) != 0 ){
+		this->error( std::string( "query failed: " ) + mysql_error( handle ) + " - " + query.substr( 0, 100 ) );
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,93 @@
+// Copyright (c) rAthena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef SQLWORKER_HPP
+#define SQLWORKER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common/cbasetypes.hpp>
+#include <common/sql.hpp>
+
+/**
+ * Database connection of a background thread.
+ * The Sql handles of common/sql.hpp are bound to the main thread, so background threads
+ * use the MySQL API directly. Errors are passed to the given handler, because they have
+ * to be shown by the main thread.
+ */
+class SqlThreadConnection{
+public:
+	typedef std::function<void( const std::string& message )> t_error;
+
+private:
+	std::string host, user, password, database, codepage;
+	uint16 port = 0;
+	MYSQL* handle = nullptr;
+
+public:
+	~SqlThreadConnection();
+
+	void setup( const std::string& host, uint16 port, const std::string& user, const std::string& password, const std::string& database, const std::string& codepage );
+	MYSQL* connect( const t_error& error );
+	void close();
+};
+
+/**
+ * Runs database jobs on a background thread with its own connection.
+ * Jobs are executed one after another in the order they were pushed.
+ * The Sql handles, the memory manager and the console output are not thread safe,
+ * so jobs may only use the MySQL handle and std types. Callbacks of finished jobs
+ * and errors are handled on the main thread by process().
+ */
+class SqlWorker{
+public:
+	/// Runs on the worker thread, the handle is nullptr if there is no connection
+	typedef std::function<void( MYSQL* handle )> t_job;
+	/// Runs on the main thread after the job has finished
+	typedef std::function<void()> t_callback;
+
+private:
+	struct s_job{
+		t_job job;
+		t_callback callback;
+	};
+
+	std::string name;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable work; ///< Signaled when a job was pushed or the worker should stop
+	std::condition_variable idle; ///< Signaled when the worker has finished all jobs
+	std::deque<s_job> jobs;
+	std::deque<t_callback> finished;
+	std::vector<std::string> errors;
+	bool stopping = false;
+	bool busy = false;
+
+	SqlThreadConnection connection; ///< Only used by the worker thread
+
+	void run();
+
+public:
+	SqlWorker( const char* name );
+	~SqlWorker();
+
+	bool isRunning();
+	void start( const std::string& host, uint16 port, const std::string& user, const std::string& password, const std::string& database, const std::string& codepage );
+	void stop();
+	void wait();
+	void push( t_job job, t_callback callback = nullptr );
+	size_t pending();
+	void process();
+
+	// Worker thread only
+	void error( const std::string& message );
+	bool query( MYSQL* handle, const std::string& query );
+};
+
+#endif /* SQLWORKER_HPP */
@@ -24,6 +24,7 @@
 #include "path.hpp"
 #include "pc.hpp"
 #include "pc_groups.hpp"
+#include "searchstore.hpp"
 
 static uint32 vending_nextid = 0; ///Vending_id counter
 static DBMap *vending_db; ///DB holder the vender : charid -> map_session_data
@@ -69,6 +70,7 @@ void vending_closevending(map_session_data* sd)
 		sd->vender_id = 0;
 		clif_closevendingboard( *sd, AREA_WOS, nullptr );
 		idb_remove(vending_db, sd->status.char_id);
+		searchstore_index_remove( *sd, SEARCHTYPE_VENDING );
 	}
 }
 
@@ -266,6 +268,7 @@ void vending_purchasereq(map_session_data* sd, int32 aid, int32 uid, const uint8
 	}
 
 	vsd->vend_num = cursor;
+	searchstore_index_update( *vsd, SEARCHTYPE_VENDING );
 
 	//Always save BOTH: customer (buyer) and vender
 	if( save_settings&CHARSAVE_VENDING ) {
@@ -413,6 +416,7 @@ int8 vending_openvending( map_session_data& sd, const char* message, const uint8
 	clif_showvendingboard( sd );
 
 	idb_put(vending_db, sd.status.char_id, &sd);
+	searchstore_index_update( sd, SEARCHTYPE_VENDING );
 
 	return 0;
 }
@@ -440,74 +444,56 @@ bool vending_search( const map_session_data* sd, t_itemid nameid )
 }
 
 /**
- * Searches for all items in a vending, that match given ids, price and possible cards.
+ * Checks a vending entry found by the search index for the cards of a search and adds it to the results.
  * @param sd : The vender session to search into
+ * @param slot : index of the entry in sd->vending
  * @param s : parameter of the search (see s_search_store_search)
  * @return Whether or not the search should be continued.
  */
-bool vending_searchall( const map_session_data* sd, const struct s_search_store_search* s )
+bool vending_searchentry( const map_session_data* sd, uint16 slot, const struct s_search_store_search* s )
 {
-	int32 i, c, slot;
-	uint32 idx, cidx;
-	const item* it;
+	int32 c, slots;
+	uint32 cidx;
+	const item* it = &sd->cart.u.items_cart[sd->vending[slot].index];
 
-	if( !sd->state.vending ) // not vending
-		return true;
-
-	for( idx = 0; idx < s->item_count; idx++ ) {
-		ARR_FIND( 0, sd->vend_num, i, sd->cart.u.items_cart[sd->vending[i].index].nameid == s->itemlist[idx].itemId );
-		if( i == sd->vend_num ) { // not found
-			continue;
-		}
-		it = &sd->cart.u.items_cart[sd->vending[i].index];
-
-		if( s->min_price && s->min_price > sd->vending[i].value ) { // too low price
-			continue;
+	if( s->card_count ) { // check cards
+		if( itemdb_isspecial(it->card[0]) ) { // something, that is not a carded
+			return true;
 		}
+		slots = itemdb_slots(it->nameid);
 
-		if( s->max_price && s->max_price < sd->vending[i].value ) { // too high price
-			continue;
-		}
-
-		if( s->card_count ) { // check cards
-			if( itemdb_isspecial(it->card[0]) ) { // something, that is not a carded
-				continue;
-			}
-			slot = itemdb_slots(it->nameid);
-
-			for( c = 0; c < slot && it->card[c]; c ++ ) {
-				ARR_FIND( 0, s->card_count, cidx, s->cardlist[cidx].itemId == it->card[c] );
-				if( cidx != s->card_count ) { // found
-					break;
-				}
-			}
-
-			if( c == slot || !it->card[c] ) { // no card match
-				continue;
+		for( c = 0; c < slots && it->card[c]; c ++ ) {
+			ARR_FIND( 0, s->card_count, cidx, s->cardlist[cidx].itemId == it->card[c] );
+			if( cidx != s->card_count ) { // found
+				break;
 			}
 		}
 
-		// Check if the result set is full
-		if( s->search_sd->searchstore.items.size() >= (uint32)battle_config.searchstore_maxresults ){
-			return false;
+		if( c == slots || !it->card[c] ) { // no card match
+			return true;
 		}
+	}
 
-		std::shared_ptr<s_search_store_info_item> ssitem = std::make_shared<s_search_store_info_item>();
+	// Check if the result set is full
+	if( s->search_sd->searchstore.items.size() >= (uint32)battle_config.searchstore_maxresults ){
+		return false;
+	}
 
-		ssitem->store_id = sd->vender_id;
-		ssitem->account_id = sd->status.account_id;
-		safestrncpy( ssitem->store_name, sd->message, sizeof( ssitem->store_name ) );
-		ssitem->nameid = it->nameid;
-		ssitem->amount = sd->vending[i].amount;
-		ssitem->price = sd->vending[i].value;
-		for( int32 j = 0; j < MAX_SLOTS; j++ ){
-			ssitem->card[j] = it->card[j];
-		}
-		ssitem->refine = it->refine;
-		ssitem->enchantgrade = it->enchantgrade;
+	std::shared_ptr<s_search_store_info_item> ssitem = std::make_shared<s_search_store_info_item>();
 
-		s->search_sd->searchstore.items.push_back( ssitem );
+	ssitem->store_id = sd->vender_id;
+	ssitem->account_id = sd->status.account_id;
+	safestrncpy( ssitem->store_name, sd->message, sizeof( ssitem->store_name ) );
+	ssitem->nameid = it->nameid;
+	ssitem->amount = sd->vending[slot].amount;
+	ssitem->price = sd->vending[slot].value;
+	for( int32 j = 0; j < MAX_SLOTS; j++ ){
+		ssitem->card[j] = it->card[j];
 	}
+	ssitem->refine = it->refine;
+	ssitem->enchantgrade = it->enchantgrade;
+
+	s->search_sd->searchstore.items.push_back( ssitem );
 
 	return true;
 }
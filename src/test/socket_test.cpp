@@ -0,0 +1,127 @@
+// Copyright (c) rAthena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Sends write fifos that are interleaved with shared packets through a local connection
+// and checks that the peer receives the exact byte stream.
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef WIN32
+	#include <arpa/inet.h>
+	#include <netinet/in.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#endif
+
+#include <common/cbasetypes.hpp>
+#include <common/cli.hpp>
+#include <common/malloc.hpp>
+#include <common/showmsg.hpp>
+#include <common/socket.hpp>
+#include <common/timer.hpp>
+
+// Each server provides these for the console
+void display_helpscreen( bool exit ){
+}
+
+int32 parse_console( const char* buf ){
+	return 0;
+}
+
+/**
+ * Queues the given number of shared packets, each after some bytes of the write fifo,
+ * and some more bytes of the write fifo at the end.
+ * @return true if the peer received everything in order
+ */
+static bool test_interleaved( int32 fd, int32 peer, int32 packets ){
+	std::vector<uint8> expected;
+
+	for( int32 i = 0; i < packets; i++ ){
+		WFIFOHEAD( fd, 4 );
+		WFIFOL( fd, 0 ) = 0x11110000 + i;
+		expected.insert( expected.end(), WFIFOP( fd, 0 ), WFIFOP( fd, 4 ) );
+		WFIFOSET( fd, 4 );
+
+		uint8 shared[6] = { 0x22, 0x22, (uint8)i, (uint8)( i >> 8 ), 0x33, 0x33 };
+
+		WFIFOSHARE( fd, socket_shared_packet( shared, sizeof( shared ) ) );
+		expected.insert( expected.end(), shared, shared + sizeof( shared ) );
+	}
+
+	WFIFOHEAD( fd, 4 );
+	WFIFOL( fd, 0 ) = 0x44444444;
+	expected.insert( expected.end(), WFIFOP( fd, 0 ), WFIFOP( fd, 4 ) );
+	WFIFOSET( fd, 4 );
+
+	std::vector<uint8> received;
+
+	// Every send takes a limited number of buffers, the rest stays queued for the next one
+	for( int32 tries = 0; tries < 1000 && received.size() < expected.size(); tries++ ){
+		flush_fifo( fd );
+
+		uint8 buf[4096];
+		ssize_t len = recv( peer, (char*)buf, sizeof( buf ), 0 );
+
+		if( len > 0 ){
+			received.insert( received.end(), buf, buf + len );
+		}
+	}
+
+	if( received != expected ){
+		ShowError( "socket_test: %d interleaved shared packets, received %" PRIuPTR " of %" PRIuPTR " bytes or in the wrong order.\n", packets, received.size(), expected.size() );
+		return false;
+	}
+
+	if( session[fd]->wdata_size != 0 || session[fd]->wshared_size != 0 ){
+		ShowError( "socket_test: %d interleaved shared packets, data left in the write fifo.\n", packets );
+		return false;
+	}
+
+	return true;
+}
+
+int32 main( int32 argc, char* argv[] ){
+	malloc_init();
+	timer_init();
+	socket_init();
+
+	// Local listener that is not managed by the socket layer
+	int32 listener = (int32)socket( AF_INET, SOCK_STREAM, 0 );
+	struct sockaddr_in addr = {};
+	socklen_t addr_len = sizeof( addr );
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	addr.sin_port = 0;
+
+	if( bind( listener, (struct sockaddr*)&addr, sizeof( addr ) ) != 0 || listen( listener, 1 ) != 0 || getsockname( listener, (struct sockaddr*)&addr, &addr_len ) != 0 ){
+		ShowError( "socket_test: Failed to create the listener.\n" );
+		return EXIT_FAILURE;
+	}
+
+	int32 fd = make_connection( INADDR_LOOPBACK, ntohs( addr.sin_port ), true, 5 );
+	int32 peer = (int32)accept( listener, nullptr, nullptr );
+
+	if( fd <= 0 || peer < 0 ){
+		ShowError( "socket_test: Failed to connect.\n" );
+		return EXIT_FAILURE;
+	}
+
+	set_nonblocking( peer, 1 );
+
+	bool success = true;
+
+	// More shared packets than buffers of a single send
+	for( int32 packets : { 1, 2, 30, 31, 32, 33, 40, 64, 100 } ){
+		success = test_interleaved( fd, peer, packets ) && success;
+	}
+
+	do_close( fd );
+	socket_final();
+	timer_final();
+	malloc_final();
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}